@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2019 Versity Software, Inc.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+
+#include "super.h"
+#include "format.h"
+#include "key.h"
+#include "seg.h"
+#include "item.h"
+#include "lock.h"
+#include "bench.h"
+
+/*
+ * Microbenchmarks of the hot search paths, built only when
+ * SCOUTFS_BENCH is set so that CI can catch regressions without full
+ * cluster runs.  Writing "<name> <iterations>" to the per-mount debugfs
+ * bench file runs a benchmark against the mounted volume and reading it
+ * shows the last result as ns per operation.
+ *
+ * The benchmarks only exercise read paths over synthetic state that is
+ * torn down afterwards.  Item benchmarks populate clean cached items in
+ * an unused key zone under a fabricated lock and invalidate the range
+ * when they're done, so nothing is dirtied or written.  The segment
+ * benchmark builds a private segment under a segno that the manifest
+ * will never reference and drops its ref when it's done, though it does
+ * consume one segment seq and the segment sits in the cache until the
+ * shrinker gets to it.  Item creation isn't benchmarked because created
+ * items are dirty and would be committed to the live volume.
+ */
+
+/* an unused key zone, greater than all real zones and less than ones */
+#define BENCH_ZONE	254
+
+/* a segno the manifest will never reference */
+#define BENCH_SEGNO	U64_MAX
+
+#define BENCH_MAX_ITER	(1 << 20)
+
+struct bench_info {
+	struct super_block *sb;
+	struct dentry *dentry;
+	struct mutex mutex;
+	char results[128];
+	size_t results_len;
+};
+
+static void bench_key(struct scoutfs_key *key, u64 first)
+{
+	scoutfs_key_set_zeros(key);
+	key->sk_zone = BENCH_ZONE;
+	key->_sk_first = cpu_to_le64(first);
+}
+
+/*
+ * The checksum of results is folded into the output so that the
+ * measured calls can't be optimized away.
+ */
+static int bench_key_compare(struct super_block *sb, u32 nr, u64 *ns_per_op,
+			     u64 *cksum)
+{
+	struct scoutfs_key *keys;
+	ktime_t stamp;
+	u64 total;
+	u32 i;
+
+	keys = vmalloc((size_t)nr * sizeof(struct scoutfs_key));
+	if (!keys)
+		return -ENOMEM;
+
+	prandom_bytes(keys, (size_t)nr * sizeof(struct scoutfs_key));
+
+	stamp = ktime_get();
+	for (i = 0; i < nr; i++)
+		*cksum += scoutfs_key_compare(&keys[i], &keys[nr - 1 - i]);
+	total = ktime_to_ns(ktime_sub(ktime_get(), stamp));
+
+	vfree(keys);
+
+	*ns_per_op = total / nr;
+	return 0;
+}
+
+static int bench_seg_find_off(struct super_block *sb, u32 nr, u64 *ns_per_op,
+			      u64 *cksum)
+{
+	__le32 *links[SCOUTFS_MAX_SKIP_LINKS];
+	struct scoutfs_segment *seg = NULL;
+	struct scoutfs_key key;
+	struct kvec val;
+	ktime_t stamp;
+	u64 vbuf = 0;
+	u64 total;
+	u32 items = 0;
+	u32 i;
+	int ret;
+
+	ret = scoutfs_seg_alloc(sb, BENCH_SEGNO, &seg);
+	if (ret)
+		goto out;
+
+	val.iov_base = &vbuf;
+	val.iov_len = sizeof(vbuf);
+
+	/* leave gaps so searches also miss between items */
+	for (i = 0; i < nr; i++) {
+		bench_key(&key, (u64)i * 2 + 1);
+		if (!scoutfs_seg_append_item(sb, seg, &key, &val, 0, links))
+			break;
+		items++;
+	}
+	if (items == 0) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	stamp = ktime_get();
+	for (i = 0; i < nr; i++) {
+		bench_key(&key, prandom_u32() % (items * 2 + 1));
+		*cksum += scoutfs_seg_find_off(seg, &key);
+	}
+	total = ktime_to_ns(ktime_sub(ktime_get(), stamp));
+
+	*ns_per_op = total / nr;
+	ret = 0;
+out:
+	scoutfs_seg_put(seg);
+	return ret;
+}
+
+/*
+ * Benchmark item cache searches over clean synthetic items.  The items
+ * are inserted as a batch under a cached range like a segment read
+ * would and a fabricated granted lock covers the range, so lookups
+ * never fall back to reading the manifest.
+ */
+static int bench_items(struct super_block *sb, bool next, u32 nr,
+		       u64 *ns_per_op, u64 *cksum)
+{
+	struct scoutfs_lock *lock;
+	struct scoutfs_key start_key;
+	struct scoutfs_key end_key;
+	struct scoutfs_key key;
+	struct kvec val;
+	LIST_HEAD(list);
+	ktime_t stamp;
+	u64 vbuf = 0;
+	u64 total;
+	u32 i;
+	int ret;
+
+	lock = kzalloc(sizeof(struct scoutfs_lock), GFP_KERNEL);
+	if (!lock)
+		return -ENOMEM;
+
+	bench_key(&start_key, 0);
+	bench_key(&end_key, U64_MAX);
+
+	lock->granted_mode = DLM_LOCK_PR;
+	lock->start = start_key;
+	lock->end = end_key;
+
+	val.iov_base = &vbuf;
+	val.iov_len = sizeof(vbuf);
+
+	for (i = 0; i < nr; i++) {
+		bench_key(&key, i);
+		ret = scoutfs_item_add_batch(sb, &list, &key, &val);
+		if (ret)
+			goto out;
+	}
+
+	ret = scoutfs_item_insert_batch(sb, &list, &start_key, &end_key);
+	if (ret)
+		goto out;
+
+	stamp = ktime_get();
+	if (next) {
+		key = start_key;
+		for (i = 0; i < nr; i++) {
+			ret = scoutfs_item_next(sb, &key, &end_key, NULL,
+						lock);
+			if (ret == -ENOENT) {
+				key = start_key;
+				continue;
+			}
+			if (ret < 0)
+				break;
+			*cksum += le64_to_cpu(key._sk_first);
+			scoutfs_key_inc(&key);
+			ret = 0;
+		}
+	} else {
+		for (i = 0; i < nr; i++) {
+			bench_key(&key, prandom_u32() % nr);
+			ret = scoutfs_item_lookup(sb, &key, NULL, lock);
+			if (ret < 0)
+				break;
+			*cksum += ret;
+			ret = 0;
+		}
+	}
+	total = ktime_to_ns(ktime_sub(ktime_get(), stamp));
+
+	if (ret == 0)
+		*ns_per_op = total / nr;
+out:
+	scoutfs_item_free_batch(sb, &list);
+	scoutfs_item_invalidate(sb, &start_key, &end_key);
+	kfree(lock);
+	return ret;
+}
+
+static ssize_t bench_write(struct file *file, const char __user *ubuf,
+			   size_t count, loff_t *ppos)
+{
+	struct bench_info *binfo = file_inode(file)->i_private;
+	struct super_block *sb = binfo->sb;
+	u64 ns_per_op = 0;
+	u64 cksum = 0;
+	char buf[48];
+	char name[24];
+	u32 nr;
+	int ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	if (sscanf(buf, "%23s %u", name, &nr) != 2 ||
+	    nr == 0 || nr > BENCH_MAX_ITER)
+		return -EINVAL;
+
+	mutex_lock(&binfo->mutex);
+
+	if (strcmp(name, "key_compare") == 0)
+		ret = bench_key_compare(sb, nr, &ns_per_op, &cksum);
+	else if (strcmp(name, "seg_find_off") == 0)
+		ret = bench_seg_find_off(sb, nr, &ns_per_op, &cksum);
+	else if (strcmp(name, "item_lookup") == 0)
+		ret = bench_items(sb, false, nr, &ns_per_op, &cksum);
+	else if (strcmp(name, "item_next") == 0)
+		ret = bench_items(sb, true, nr, &ns_per_op, &cksum);
+	else
+		ret = -EINVAL;
+
+	if (ret == 0)
+		binfo->results_len = snprintf(binfo->results,
+					      sizeof(binfo->results),
+					      "%s %u ns/op %llu cksum %llx\n",
+					      name, nr, ns_per_op, cksum);
+
+	mutex_unlock(&binfo->mutex);
+
+	return ret ?: count;
+}
+
+static ssize_t bench_read(struct file *file, char __user *ubuf, size_t count,
+			  loff_t *ppos)
+{
+	struct bench_info *binfo = file_inode(file)->i_private;
+	ssize_t ret;
+
+	mutex_lock(&binfo->mutex);
+	ret = simple_read_from_buffer(ubuf, count, ppos, binfo->results,
+				      binfo->results_len);
+	mutex_unlock(&binfo->mutex);
+
+	return ret;
+}
+
+static const struct file_operations bench_fops = {
+	.read =		bench_read,
+	.write =	bench_write,
+};
+
+int scoutfs_bench_setup(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct bench_info *binfo;
+
+	binfo = kzalloc(sizeof(struct bench_info), GFP_KERNEL);
+	if (!binfo)
+		return -ENOMEM;
+
+	binfo->sb = sb;
+	mutex_init(&binfo->mutex);
+
+	binfo->dentry = debugfs_create_file("bench", 0600, sbi->debug_root,
+					    binfo, &bench_fops);
+	if (!binfo->dentry) {
+		kfree(binfo);
+		return -ENOMEM;
+	}
+
+	sbi->bench_info = binfo;
+	return 0;
+}
+
+void scoutfs_bench_destroy(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct bench_info *binfo = sbi->bench_info;
+
+	if (binfo) {
+		debugfs_remove(binfo->dentry);
+		kfree(binfo);
+		sbi->bench_info = NULL;
+	}
+}
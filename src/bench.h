@@ -0,0 +1,23 @@
+#ifndef _SCOUTFS_BENCH_H_
+#define _SCOUTFS_BENCH_H_
+
+#include "super.h"
+
+/*
+ * Hot path microbenchmarks are only built when SCOUTFS_BENCH is set on
+ * the make command line so production modules don't carry them.
+ */
+#ifdef SCOUTFS_BENCH
+int scoutfs_bench_setup(struct super_block *sb);
+void scoutfs_bench_destroy(struct super_block *sb);
+#else
+static inline int scoutfs_bench_setup(struct super_block *sb)
+{
+	return 0;
+}
+static inline void scoutfs_bench_destroy(struct super_block *sb)
+{
+}
+#endif
+
+#endif
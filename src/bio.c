@@ -102,7 +102,8 @@ void scoutfs_bio_submit(struct super_block *sb, int rw, struct page **pages,
 		page = pages[i];
 
 		if (!bio) {
-			bio = bio_alloc(GFP_NOFS, nr_pages - i);
+			bio = bio_alloc(GFP_NOFS, min_t(int, nr_pages - i,
+							BIO_MAX_PAGES));
 			if (!bio)
 				bio = bio_alloc(GFP_NOFS, 1);
 			if (!bio) {
@@ -18,6 +18,7 @@
 #include <linux/crc32c.h>
 #include <linux/sort.h>
 #include <linux/blkdev.h>
+#include <linux/hash.h>
 
 #include "super.h"
 #include "format.h"
@@ -110,6 +111,16 @@
  *  - validate structures on read?
  */
 
+/*
+ * A small direct mapped cache of buffer head references hashed by
+ * blkno.  Holding the references pins hot blocks, the upper levels that
+ * every walk crosses, and lets walks skip the block layer lookup for
+ * them.  Stale detection evicts entries just like it invalidates the
+ * underlying buffers.
+ */
+#define BTREE_CACHE_SHIFT 6
+#define BTREE_CACHE_NR (1 << BTREE_CACHE_SHIFT)
+
 /*
  * There's one physical ring that stores the blocks for all btrees.  We
  * track the state of the ring and all its dirty blocks in this one
@@ -118,6 +129,9 @@
 struct btree_info {
 	struct mutex mutex;
 
+	spinlock_t cache_lock;
+	struct buffer_head *cache_bhs[BTREE_CACHE_NR];
+
 	unsigned long cur_dirtied;
 	unsigned long old_dirtied;
 	struct buffer_head *first_dirty_bh;
@@ -591,6 +605,57 @@ static void put_btree_block(void *ptr)
 		put_bh(virt_to_bh(ptr));
 }
 
+/* return a referenced cached buffer for the blkno, or null on a miss */
+static struct buffer_head *btree_cache_lookup(struct btree_info *bti,
+					      u64 blkno)
+{
+	int i = hash_64(blkno, BTREE_CACHE_SHIFT);
+	struct buffer_head *bh;
+
+	spin_lock(&bti->cache_lock);
+	bh = bti->cache_bhs[i];
+	if (bh && bh->b_blocknr == blkno)
+		get_bh(bh);
+	else
+		bh = NULL;
+	spin_unlock(&bti->cache_lock);
+
+	return bh;
+}
+
+/* hold a reference in the cache, displacing whatever hashed there */
+static void btree_cache_store(struct btree_info *bti, struct buffer_head *bh)
+{
+	int i = hash_64((u64)bh->b_blocknr, BTREE_CACHE_SHIFT);
+	struct buffer_head *old;
+
+	get_bh(bh);
+	spin_lock(&bti->cache_lock);
+	old = bti->cache_bhs[i];
+	bti->cache_bhs[i] = bh;
+	spin_unlock(&bti->cache_lock);
+
+	if (old)
+		put_bh(old);
+}
+
+/* drop a block that failed validation so retries go back to the device */
+static void btree_cache_erase(struct btree_info *bti, u64 blkno)
+{
+	int i = hash_64(blkno, BTREE_CACHE_SHIFT);
+	struct buffer_head *bh = NULL;
+
+	spin_lock(&bti->cache_lock);
+	if (bti->cache_bhs[i] && bti->cache_bhs[i]->b_blocknr == blkno) {
+		bh = bti->cache_bhs[i];
+		bti->cache_bhs[i] = NULL;
+	}
+	spin_unlock(&bti->cache_lock);
+
+	if (bh)
+		put_bh(bh);
+}
+
 enum {
         BH_ScoutfsChecked = BH_PrivateStart,
         BH_ScoutfsValidCrc,
@@ -665,12 +730,19 @@ static int get_ref_block(struct super_block *sb, int flags,
 	/* always get the current block, either to return or cow from */
 	if (ref && ref->blkno) {
 retry:
-		bh = sb_bread(sb, le64_to_cpu(ref->blkno));
-		if (!bh) {
-			trace_scoutfs_btree_read_error(sb, ref);
-			scoutfs_inc_counter(sb, btree_read_error);
-			ret = -EIO;
-			goto out;
+		bh = btree_cache_lookup(bti, le64_to_cpu(ref->blkno));
+		if (bh) {
+			scoutfs_inc_counter(sb, btree_cache_hit);
+		} else {
+			bh = sb_bread(sb, le64_to_cpu(ref->blkno));
+			if (!bh) {
+				trace_scoutfs_btree_read_error(sb, ref);
+				scoutfs_inc_counter(sb, btree_read_error);
+				ret = -EIO;
+				goto out;
+			}
+			scoutfs_inc_counter(sb, btree_cache_miss);
+			btree_cache_store(bti, bh);
 		}
 		bt = (void *)bh->b_data;
 
@@ -679,6 +751,8 @@ retry:
 
 			scoutfs_inc_counter(sb, btree_stale_read);
 
+			btree_cache_erase(bti, le64_to_cpu(ref->blkno));
+
 			lock_buffer(bh);
 			clear_buffer_uptodate(bh);
 			clear_buffer_scoutfs_valid_crc(bh);
@@ -726,6 +800,9 @@ retry:
 	set_buffer_scoutfs_checked(bh);
 	set_buffer_scoutfs_valid_crc(bh);
 
+	/* walks will be right back for the cow or fresh block */
+	btree_cache_store(bti, bh);
+
 	/*
 	 * Track our contiguous dirty blocks by holding a ref and putting
 	 * them in a list.  We don't want them marked dirty or else they
@@ -1410,6 +1487,163 @@ int scoutfs_btree_delete(struct super_block *sb, struct scoutfs_btree_root *root
 	return ret;
 }
 
+static int cmp_op_keys(void *priv, const void *a_ptr, const void *b_ptr)
+{
+	const struct scoutfs_btree_op *a = a_ptr;
+	const struct scoutfs_btree_op *b = b_ptr;
+
+	return cmp_keys(a->key, a->key_len, b->key, b->key_len);
+}
+
+static void swap_ops(void *priv, void *a_ptr, void *b_ptr, int size)
+{
+	struct scoutfs_btree_op *a = a_ptr;
+	struct scoutfs_btree_op *b = b_ptr;
+
+	swap(*a, *b);
+}
+
+/*
+ * Apply a batch of insertions and deletions with as few descents from
+ * the root as we can get away with.
+ *
+ * We sort the ops by key in place and apply them in order.  After
+ * applying an op we try to apply the next one to the leaf block we
+ * still hold.  That's safe when the next key provably falls inside the
+ * leaf and applying it can't need the splitting or merging that only
+ * happens during descent: an insertion has to fit in the leaf's
+ * reclaimable free space and a deletion can't take the leaf below the
+ * minimum used bytes that descent maintains.  Otherwise we drop the
+ * leaf and walk again from the root, just like the single item calls
+ * would.
+ *
+ * Compaction commits motivate this.  The server applies all of a
+ * compaction's manifest entry updates while holding the commit rwsem
+ * and the manifest lock, stalling every other client rpc.  Sorted
+ * entries land in a handful of neighbouring leaves so batching them
+ * collapses most of the descents, and with them the hold time.
+ *
+ * Each op's ret records its outcome: 0 once it's applied, -EEXIST or
+ * -ENOENT when the tree disagrees with an insertion or deletion, and
+ * -EAGAIN if we stopped before reaching it.  We stop at the first
+ * failure and return its error, leaving earlier applied ops in place.
+ * The caller unwinds the ops whose ret is 0, remembering that the sort
+ * reordered the array they see.
+ */
+int scoutfs_btree_apply_batch(struct super_block *sb,
+			      struct scoutfs_btree_root *root,
+			      struct scoutfs_btree_op *ops, unsigned nr)
+{
+	struct scoutfs_btree_block *bt = NULL;
+	struct scoutfs_btree_op *op;
+	unsigned int min_used;
+	unsigned int ins_free;
+	unsigned int i;
+	bool reuse;
+	int walked = 0;
+	int flags;
+	int pos = 0;
+	int cmp = 0;
+	int ret = 0;
+
+	if (scoutfs_option_bool(sb, Opt_btree_force_tiny_blocks))
+		min_used = min_used_bytes(SCOUTFS_BTREE_TINY_BLOCK_SIZE);
+	else
+		min_used = min_used_bytes(SCOUTFS_BLOCK_SIZE);
+
+	for (i = 0; i < nr; i++) {
+		op = &ops[i];
+		if (!op->del &&
+		    invalid_item(op->key, op->key_len, op->val_len))
+			return -EINVAL;
+		op->ret = -EAGAIN;
+	}
+
+	sort_priv(NULL, ops, nr, sizeof(ops[0]), cmp_op_keys, swap_ops);
+
+	for (i = 0; i < nr; i++) {
+		op = &ops[i];
+		flags = BTW_DIRTY | (op->del ? BTW_DELETE : BTW_INSERT);
+
+		/*
+		 * See if the op can be applied to the held leaf.  A key
+		 * that sorts after all the leaf's items might belong in
+		 * the next leaf and descent would have split or merged
+		 * for ops the checks refuse.
+		 */
+		reuse = false;
+		if (bt && walked == flags) {
+			if (scoutfs_option_bool(sb,
+						Opt_btree_force_tiny_blocks))
+				ins_free = SCOUTFS_BLOCK_SIZE -
+					   SCOUTFS_BTREE_TINY_BLOCK_SIZE;
+			else
+				ins_free = all_len_bytes(op->key_len,
+							 op->val_len);
+
+			pos = find_pos(bt, op->key, op->key_len, &cmp);
+			if (pos < le16_to_cpu(bt->nr_items) &&
+			    (op->del ||
+			     cmp == 0 || reclaimable_free(bt) >= ins_free) &&
+			    (!op->del ||
+			     cmp != 0 ||
+			     used_total(bt) - all_item_bytes(pos_item(bt, pos))
+			     >= min_used)) {
+				reuse = true;
+				scoutfs_inc_counter(sb, btree_batch_leaf_hit);
+			}
+		}
+		if (!reuse) {
+			put_btree_block(bt);
+			ret = btree_walk(sb, root, flags, op->key, op->key_len,
+					 op->del ? 0 : op->val_len, &bt,
+					 NULL, NULL);
+			if (ret < 0) {
+				bt = NULL;
+				op->ret = ret;
+				break;
+			}
+			walked = flags;
+			pos = find_pos(bt, op->key, op->key_len, &cmp);
+		}
+
+		if (op->del) {
+			if (cmp == 0) {
+				delete_item(bt, pos);
+				op->ret = 0;
+
+				/* delete the final block in the tree */
+				if (bt->nr_items == 0) {
+					root->height = 0;
+					root->ref.blkno = 0;
+					root->ref.seq = 0;
+					put_btree_block(bt);
+					bt = NULL;
+				}
+			} else {
+				op->ret = -ENOENT;
+			}
+		} else {
+			if (cmp != 0) {
+				create_item(bt, pos, op->key, op->key_len,
+					    op->val, op->val_len);
+				op->ret = 0;
+			} else {
+				op->ret = -EEXIST;
+			}
+		}
+
+		if (op->ret < 0) {
+			ret = op->ret;
+			break;
+		}
+	}
+
+	put_btree_block(bt);
+
+	return ret;
+}
+
 /*
  * Iterate from a key value to the next item in the direction of
  * iteration.  Callers set flags to tell which way to iterate and
@@ -1706,6 +1940,7 @@ int scoutfs_btree_setup(struct super_block *sb)
 		return -ENOMEM;
 
 	mutex_init(&bti->mutex);
+	spin_lock_init(&bti->cache_lock);
 
 	sbi->btree_info = bti;
 
@@ -1717,7 +1952,16 @@ int scoutfs_btree_setup(struct super_block *sb)
 void scoutfs_btree_destroy(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct btree_info *bti = sbi->btree_info;
+	int i;
+
+	if (bti) {
+		for (i = 0; i < BTREE_CACHE_NR; i++) {
+			if (bti->cache_bhs[i])
+				put_bh(bti->cache_bhs[i]);
+		}
+	}
 
-	kfree(sbi->btree_info);
+	kfree(bti);
 	sbi->btree_info = NULL;
 }
@@ -13,6 +13,21 @@ struct scoutfs_btree_item_ref {
 #define SCOUTFS_BTREE_ITEM_REF(name) \
 	struct scoutfs_btree_item_ref name = {NULL,}
 
+/*
+ * One pending insertion or deletion in a batch.  The batch is sorted by
+ * key in place as it's applied and each op's ret records its outcome.
+ * Deletion ignores the value, callers can use it to remember what to
+ * re-insert if they unwind a partial batch.
+ */
+struct scoutfs_btree_op {
+	void *key;
+	unsigned key_len;
+	void *val;
+	unsigned val_len;
+	bool del;
+	int ret;
+};
+
 int scoutfs_btree_lookup(struct super_block *sb, struct scoutfs_btree_root *root,
 			 void *key, unsigned key_len,
 			 struct scoutfs_btree_item_ref *iref);
@@ -24,6 +39,9 @@ int scoutfs_btree_update(struct super_block *sb, struct scoutfs_btree_root *root
 			 void *val, unsigned val_len);
 int scoutfs_btree_delete(struct super_block *sb, struct scoutfs_btree_root *root,
 			 void *key, unsigned key_len);
+int scoutfs_btree_apply_batch(struct super_block *sb,
+			      struct scoutfs_btree_root *root,
+			      struct scoutfs_btree_op *ops, unsigned nr);
 int scoutfs_btree_next(struct super_block *sb, struct scoutfs_btree_root *root,
 		       void *key, unsigned key_len,
 		       struct scoutfs_btree_item_ref *iref);
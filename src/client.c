@@ -13,6 +13,7 @@
 #include <linux/kernel.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
+#include <linux/random.h>
 #include <asm/ioctls.h>
 #include <linux/net.h>
 #include <linux/inet.h>
@@ -55,15 +56,54 @@ struct client_info {
 	atomic_t shutting_down;
 
 	struct workqueue_struct *workq;
+	struct workqueue_struct *compact_workq;
 	struct delayed_work connect_dwork;
+	struct work_struct root_warm_work;
 
 	/* connection timeouts are tracked across attempts */
 	unsigned long conn_retry_ms;
+
+	/* locally cached manifest root, invalidated as locks are granted */
+	spinlock_t manifest_root_lock;
+	bool manifest_root_valid;
+	u64 manifest_root_gen;
+	struct scoutfs_btree_root manifest_root;
+
+	/* a pool of granted segnos feeds commits without round trips */
+	spinlock_t segno_lock;
+	u64 segnos[SCOUTFS_NET_SEGNOS_MAX_NR];
+	unsigned int nr_segnos;
+	unsigned int segno_target;
+	bool segno_refill_pending;
+
+	/* cached statfs fields served while younger than the age bound */
+	spinlock_t statfs_lock;
+	struct scoutfs_net_statfs statfs_cache;
+	unsigned long statfs_sample_j;
+	bool statfs_valid;
+	bool statfs_refreshing;
+
+	/* a granted run feeds the directory it was granted for */
+	spinlock_t ino_lock;
+	u64 ino_dir;
+	u64 ino;
+	u64 ino_nr;
+	u64 ino_grant;
 };
 
+/* each server trip doubles the next inode grant up to this many */
+#define CLIENT_INO_GRANT_MAX_NR	(128 * 1024)
+
+/*
+ * Retries restart from the connection's measured round trip time, when
+ * we have one, so the base timeout tracks the network we're actually on
+ * rather than a constant that's too short for slow fabrics and too long
+ * for fast ones.
+ */
 static void reset_connect_timeout(struct client_info *client)
 {
-	client->conn_retry_ms = CONN_RETRY_MIN_MS;
+	client->conn_retry_ms = clamp(scoutfs_net_conn_rtt_ms(client->conn),
+				      CONN_RETRY_MIN_MS, CONN_RETRY_MAX_MS);
 }
 
 static void grow_connect_timeout(struct client_info *client)
@@ -73,32 +113,85 @@ static void grow_connect_timeout(struct client_info *client)
 }
 
 /*
- * Ask for a new run of allocated inode numbers.  The server can return
- * fewer than @count.  It will success with nr == 0 if we've run out.
+ * Spread retries over the second half of the backoff window so that all
+ * the nodes that lost the server at the same moment don't hammer its
+ * replacement in lock step.
+ */
+static unsigned long jittered_retry_ms(struct client_info *client)
+{
+	unsigned long ms = client->conn_retry_ms;
+
+	return ms / 2 + prandom_u32() % (ms / 2 + 1);
+}
+
+/*
+ * Give the caller a new run of allocated inode numbers for creation in
+ * the given directory.  The caller can get fewer than @count.
+ *
+ * The server grants runs from per-directory regions so a directory's
+ * inodes cluster in key space no matter which nodes create in it.  We
+ * cache the remainder of the last grant for its directory, with the
+ * server refilling in geometrically growing batches, so the hot
+ * directory of a create storm stops paying a round trip per directory
+ * pool.  A grant for another directory replaces the cached remainder.
+ * Inode numbers are never reclaimed; whatever remains is lost at
+ * unmount just like the per-directory pools that draw from it.
  */
-int scoutfs_client_alloc_inodes(struct super_block *sb, u64 count,
-				u64 *ino, u64 *nr)
+int scoutfs_client_alloc_inodes(struct super_block *sb, u64 dir_ino,
+				u64 count, u64 *ino, u64 *nr)
 {
 	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+	struct scoutfs_net_inode_alloc_args args;
 	struct scoutfs_net_inode_alloc ial;
-	__le64 lecount = cpu_to_le64(count);
+	u64 gino;
+	u64 gnr;
+	u64 want;
 	int ret;
 
+	spin_lock(&client->ino_lock);
+	if (client->ino_nr > 0 && client->ino_dir == dir_ino) {
+		*ino = client->ino;
+		*nr = min(count, client->ino_nr);
+		client->ino += *nr;
+		client->ino_nr -= *nr;
+		spin_unlock(&client->ino_lock);
+		scoutfs_inc_counter(sb, ino_grant_hit);
+		return 0;
+	}
+	want = min_t(u64, max(client->ino_grant * 2, count),
+		     CLIENT_INO_GRANT_MAX_NR);
+	spin_unlock(&client->ino_lock);
+
+	args.count = cpu_to_le64(want);
+	args.dir_ino = cpu_to_le64(dir_ino);
 	ret = scoutfs_net_sync_request(sb, client->conn,
 				       SCOUTFS_NET_CMD_ALLOC_INODES,
-				       &lecount, sizeof(lecount),
+				       &args, sizeof(args),
 				       &ial, sizeof(ial));
-	if (ret == 0) {
-		*ino = le64_to_cpu(ial.ino);
-		*nr = le64_to_cpu(ial.nr);
-
-		if (*nr == 0)
-			ret = -ENOSPC;
-		else if (*ino + *nr < *ino)
-			ret = -EINVAL;
+	if (ret < 0)
+		return ret;
+
+	gino = le64_to_cpu(ial.ino);
+	gnr = le64_to_cpu(ial.nr);
+	if (gnr == 0)
+		return -ENOSPC;
+	if (gino + gnr < gino)
+		return -EINVAL;
+
+	*ino = gino;
+	*nr = min(count, gnr);
+
+	spin_lock(&client->ino_lock);
+	client->ino_grant = want;
+	/* a rare racing refill can land first, strand the loser's rest */
+	if (client->ino_nr == 0 && gnr > *nr) {
+		client->ino_dir = dir_ino;
+		client->ino = gino + *nr;
+		client->ino_nr = gnr - *nr;
 	}
+	spin_unlock(&client->ino_lock);
 
-	return ret;
+	return 0;
 }
 
 /*
@@ -130,6 +223,12 @@ int scoutfs_client_alloc_extent(struct super_block *sb, u64 blocks, u64 *start,
 	return ret;
 }
 
+/*
+ * Free a list of extents back to the server.  The request takes
+ * ownership of the caller's allocated list and frees it, the lists can
+ * carry thousands of extents and handing them off avoids copying them
+ * into the message.
+ */
 int scoutfs_client_free_extents(struct super_block *sb,
 				struct scoutfs_net_extent_list *nexl)
 {
@@ -138,32 +237,153 @@ int scoutfs_client_free_extents(struct super_block *sb,
 
 	bytes = SCOUTFS_NET_EXTENT_LIST_BYTES(le64_to_cpu(nexl->nr));
 
-	return scoutfs_net_sync_request(sb, client->conn,
-					SCOUTFS_NET_CMD_FREE_EXTENTS,
-					nexl, bytes, NULL, 0);
+	return scoutfs_net_sync_request_own(sb, client->conn,
+					    SCOUTFS_NET_CMD_FREE_EXTENTS,
+					    nexl, bytes, NULL, 0);
 }
 
-int scoutfs_client_alloc_segno(struct super_block *sb, u64 *segno)
+/*
+ * A segno grant arrived from the server, add it to the pool.  A refill
+ * response that raced with unmount leaves its segnos to be forgotten
+ * along with the connection.
+ */
+static int client_segnos_response(struct super_block *sb,
+				  struct scoutfs_net_connection *conn,
+				  void *resp, unsigned int resp_len, int error,
+				  void *data)
 {
 	struct client_info *client = SCOUTFS_SB(sb)->client_info;
-	__le64 lesegno;
+	struct scoutfs_net_segnos *ns = resp;
+	u64 nr = 0;
+	u64 i;
+
+	if (error == 0 && resp_len >= sizeof(struct scoutfs_net_segnos))
+		nr = le64_to_cpu(ns->nr);
+	if (nr > SCOUTFS_NET_SEGNOS_MAX_NR ||
+	    resp_len != SCOUTFS_NET_SEGNOS_BYTES(nr))
+		nr = 0;
+
+	spin_lock(&client->segno_lock);
+	client->segno_refill_pending = false;
+	for (i = 0; i < nr && client->nr_segnos < ARRAY_SIZE(client->segnos);
+	     i++)
+		client->segnos[client->nr_segnos++] =
+			le64_to_cpu(ns->segnos[i]);
+	spin_unlock(&client->segno_lock);
+
+	return 0;
+}
+
+/*
+ * Keep one refill request in flight while the pool is below its target
+ * so that commits find a granted segno waiting for them instead of
+ * paying the round trip.
+ */
+static void client_refill_segnos(struct super_block *sb)
+{
+	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+	__le64 lecount;
+	u64 want = 0;
 	int ret;
 
-	ret = scoutfs_net_sync_request(sb, client->conn,
-				       SCOUTFS_NET_CMD_ALLOC_SEGNO,
-				       NULL, 0, &lesegno, sizeof(lesegno));
+	spin_lock(&client->segno_lock);
+	if (!client->segno_refill_pending &&
+	    client->nr_segnos < client->segno_target) {
+		client->segno_refill_pending = true;
+		want = client->segno_target - client->nr_segnos;
+	}
+	spin_unlock(&client->segno_lock);
+
+	if (want == 0)
+		return;
+
+	lecount = cpu_to_le64(want);
+	ret = scoutfs_net_submit_request(sb, client->conn,
+					 SCOUTFS_NET_CMD_ALLOC_SEGNOS,
+					 &lecount, sizeof(lecount),
+					 client_segnos_response, NULL, NULL);
+	if (ret < 0) {
+		spin_lock(&client->segno_lock);
+		client->segno_refill_pending = false;
+		spin_unlock(&client->segno_lock);
+	}
+}
+
+/*
+ * Submit a segno allocation request without waiting for the response so
+ * that the caller can overlap the round trip with other work.  The
+ * caller must wait before the async struct leaves scope.
+ *
+ * The pool of granted segnos satisfies the request immediately when it
+ * can.  Misses double the pool target so that a sustained stream of
+ * commits quickly reaches a depth where refills complete before the
+ * pool drains, while a mostly idle mount never holds more than a
+ * granted segment or two.
+ */
+void scoutfs_client_submit_alloc_segno(struct super_block *sb,
+				       struct scoutfs_client_async_segno *aseg)
+{
+	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+
+	spin_lock(&client->segno_lock);
+	if (client->nr_segnos > 0) {
+		aseg->lesegno =
+			cpu_to_le64(client->segnos[--client->nr_segnos]);
+		aseg->from_pool = true;
+	} else {
+		aseg->from_pool = false;
+		client->segno_target = min_t(unsigned int,
+					client->segno_target ?
+						client->segno_target * 2 : 1,
+					SCOUTFS_NET_SEGNOS_MAX_NR);
+	}
+	spin_unlock(&client->segno_lock);
+
+	if (aseg->from_pool) {
+		scoutfs_inc_counter(sb, segno_pool_hit);
+	} else {
+		scoutfs_inc_counter(sb, segno_pool_miss);
+		scoutfs_net_submit_async_request(sb, client->conn,
+						 SCOUTFS_NET_CMD_ALLOC_SEGNO,
+						 NULL, 0, &aseg->lesegno,
+						 sizeof(aseg->lesegno),
+						 &aseg->areq);
+	}
+
+	client_refill_segnos(sb);
+}
+
+int scoutfs_client_alloc_segno_wait(struct super_block *sb,
+				    struct scoutfs_client_async_segno *aseg,
+				    u64 *segno)
+{
+	int ret;
+
+	if (aseg->from_pool)
+		ret = 0;
+	else
+		ret = scoutfs_net_async_request_wait(sb, &aseg->areq);
 	if (ret == 0) {
-		if (lesegno == 0)
+		if (aseg->lesegno == 0)
 			ret = -ENOSPC;
 		else
-			*segno = le64_to_cpu(lesegno);
+			*segno = le64_to_cpu(aseg->lesegno);
 	}
 
 	return ret;
 }
 
-int scoutfs_client_record_segment(struct super_block *sb,
-				  struct scoutfs_segment *seg, u8 level)
+int scoutfs_client_alloc_segno(struct super_block *sb, u64 *segno)
+{
+	struct scoutfs_client_async_segno aseg;
+
+	scoutfs_client_submit_alloc_segno(sb, &aseg);
+	return scoutfs_client_alloc_segno_wait(sb, &aseg, segno);
+}
+
+void scoutfs_client_submit_record_segment(struct super_block *sb,
+					  struct scoutfs_segment *seg, u8 level,
+					  struct scoutfs_net_async_request *areq)
 {
 	struct client_info *client = SCOUTFS_SB(sb)->client_info;
 	struct scoutfs_net_manifest_entry net_ment;
@@ -172,28 +392,69 @@ int scoutfs_client_record_segment(struct super_block *sb,
 	scoutfs_seg_init_ment(&ment, level, seg);
 	scoutfs_init_ment_to_net(&net_ment, &ment);
 
-	return scoutfs_net_sync_request(sb, client->conn,
-					SCOUTFS_NET_CMD_RECORD_SEGMENT,
-					&net_ment, sizeof(net_ment), NULL, 0);
+	scoutfs_net_submit_async_request(sb, client->conn,
+					 SCOUTFS_NET_CMD_RECORD_SEGMENT,
+					 &net_ment, sizeof(net_ment), NULL, 0,
+					 areq);
 }
 
-int scoutfs_client_advance_seq(struct super_block *sb, u64 *seq)
+int scoutfs_client_record_segment_wait(struct super_block *sb,
+				       struct scoutfs_net_async_request *areq)
+{
+	int ret;
+
+	ret = scoutfs_net_async_request_wait(sb, areq);
+
+	/* our cached root can't see the segment we just recorded */
+	if (ret == 0)
+		scoutfs_client_invalidate_manifest_root(sb);
+
+	return ret;
+}
+
+int scoutfs_client_record_segment(struct super_block *sb,
+				  struct scoutfs_segment *seg, u8 level)
+{
+	struct scoutfs_net_async_request areq;
+
+	scoutfs_client_submit_record_segment(sb, seg, level, &areq);
+	return scoutfs_client_record_segment_wait(sb, &areq);
+}
+
+void scoutfs_client_submit_advance_seq(struct super_block *sb, u64 seq,
+				       struct scoutfs_client_async_seq *aseq)
 {
 	struct client_info *client = SCOUTFS_SB(sb)->client_info;
-	__le64 before = cpu_to_le64p(seq);
-	__le64 after;
+	__le64 before = cpu_to_le64(seq);
+
+	scoutfs_net_submit_async_request(sb, client->conn,
+					 SCOUTFS_NET_CMD_ADVANCE_SEQ,
+					 &before, sizeof(before),
+					 &aseq->after, sizeof(aseq->after),
+					 &aseq->areq);
+}
+
+int scoutfs_client_advance_seq_wait(struct super_block *sb,
+				    struct scoutfs_client_async_seq *aseq,
+				    u64 *seq)
+{
 	int ret;
 
-	ret = scoutfs_net_sync_request(sb, client->conn,
-				       SCOUTFS_NET_CMD_ADVANCE_SEQ,
-				       &before, sizeof(before),
-				       &after, sizeof(after));
+	ret = scoutfs_net_async_request_wait(sb, &aseq->areq);
 	if (ret == 0)
-		*seq = le64_to_cpu(after);
+		*seq = le64_to_cpu(aseq->after);
 
 	return ret;
 }
 
+int scoutfs_client_advance_seq(struct super_block *sb, u64 *seq)
+{
+	struct scoutfs_client_async_seq aseq;
+
+	scoutfs_client_submit_advance_seq(sb, *seq, &aseq);
+	return scoutfs_client_advance_seq_wait(sb, &aseq, seq);
+}
+
 int scoutfs_client_get_last_seq(struct super_block *sb, u64 *seq)
 {
 	struct client_info *client = SCOUTFS_SB(sb)->client_info;
@@ -209,26 +470,175 @@ int scoutfs_client_get_last_seq(struct super_block *sb, u64 *seq)
 	return ret;
 }
 
+/*
+ * Give the caller the manifest root to read from, avoiding the round
+ * trip to the server when we have a valid cached copy.
+ *
+ * The cache can only satisfy reads that are allowed to see slightly
+ * stale roots.  Item visibility between nodes is fenced by cluster
+ * locks, so we invalidate the cache every time a lock grant lets us
+ * read keys that we couldn't before, and when we record a segment of
+ * our own.  Readers that see persistently stale blocks through a
+ * cached root invalidate it and retry against the server.
+ *
+ * We sample the invalidation generation before sending the request and
+ * only cache the response if no invalidation arrived while it was in
+ * flight, so a cached root is always at least as new as the last
+ * invalidating event.
+ */
 int scoutfs_client_get_manifest_root(struct super_block *sb,
 				     struct scoutfs_btree_root *root)
 {
 	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+	u64 gen;
+	int ret;
+
+	spin_lock(&client->manifest_root_lock);
+	if (client->manifest_root_valid) {
+		*root = client->manifest_root;
+		spin_unlock(&client->manifest_root_lock);
+		scoutfs_inc_counter(sb, manifest_root_cache_hit);
+		return 0;
+	}
+	gen = client->manifest_root_gen;
+	spin_unlock(&client->manifest_root_lock);
+
+	ret = scoutfs_net_sync_request(sb, client->conn,
+				       SCOUTFS_NET_CMD_GET_MANIFEST_ROOT,
+				       NULL, 0, root,
+				       sizeof(struct scoutfs_btree_root));
+	if (ret == 0) {
+		spin_lock(&client->manifest_root_lock);
+		if (gen == client->manifest_root_gen) {
+			client->manifest_root = *root;
+			client->manifest_root_valid = true;
+		}
+		spin_unlock(&client->manifest_root_lock);
+	}
+
+	return ret;
+}
+
+/*
+ * Forget the cached manifest root so that the next read asks the
+ * server.  This can be called from lock asts in atomic context.
+ */
+void scoutfs_client_invalidate_manifest_root(struct super_block *sb)
+{
+	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+
+	if (client == NULL)
+		return;
 
-	return scoutfs_net_sync_request(sb, client->conn,
-					SCOUTFS_NET_CMD_GET_MANIFEST_ROOT,
-					NULL, 0, root,
-					sizeof(struct scoutfs_btree_root));
+	scoutfs_inc_counter(sb, manifest_root_invalidate);
+
+	spin_lock(&client->manifest_root_lock);
+	client->manifest_root_valid = false;
+	client->manifest_root_gen++;
+	spin_unlock(&client->manifest_root_lock);
 }
 
+/*
+ * A background statfs refresh came back, update the cache with the
+ * fresher fields.  Errors just leave the current cached copy in place,
+ * another refresh will be sent once it ages past the bound again.
+ */
+static int client_statfs_response(struct super_block *sb,
+				  struct scoutfs_net_connection *conn,
+				  void *resp, unsigned int resp_len, int error,
+				  void *data)
+{
+	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+
+	spin_lock(&client->statfs_lock);
+	if (error == 0 && resp_len == sizeof(struct scoutfs_net_statfs)) {
+		memcpy(&client->statfs_cache, resp, resp_len);
+		client->statfs_sample_j = jiffies;
+		client->statfs_valid = true;
+	}
+	client->statfs_refreshing = false;
+	spin_unlock(&client->statfs_lock);
+
+	return 0;
+}
+
+/*
+ * Give the caller the statfs fields from the server.  Results are
+ * served from a cache so that constant statfs monitoring across all the
+ * nodes doesn't turn into a stream of round trips to the server.  The
+ * statfs_age_ms mount option bounds how old a served result can be;
+ * once a cached copy ages past the bound it's still served immediately
+ * while a single background request refreshes the cache.  Only the
+ * first call after mount waits for the server.
+ */
 int scoutfs_client_statfs(struct super_block *sb,
 			  struct scoutfs_net_statfs *nstatfs)
 {
-	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct client_info *client = sbi->client_info;
+	unsigned int age_ms = sbi->opts.statfs_age_ms;
+	bool refresh = false;
+	bool cached = false;
+	int ret;
+
+	if (age_ms) {
+		spin_lock(&client->statfs_lock);
+		if (client->statfs_valid) {
+			memcpy(nstatfs, &client->statfs_cache,
+			       sizeof(*nstatfs));
+			cached = true;
+			if (time_after(jiffies, client->statfs_sample_j +
+					        msecs_to_jiffies(age_ms)) &&
+			    !client->statfs_refreshing) {
+				client->statfs_refreshing = true;
+				refresh = true;
+			}
+		}
+		spin_unlock(&client->statfs_lock);
+	}
+
+	if (refresh &&
+	    scoutfs_net_submit_request(sb, client->conn,
+				       SCOUTFS_NET_CMD_STATFS, NULL, 0,
+				       client_statfs_response, NULL, NULL)) {
+		spin_lock(&client->statfs_lock);
+		client->statfs_refreshing = false;
+		spin_unlock(&client->statfs_lock);
+	}
+
+	if (cached) {
+		scoutfs_inc_counter(sb, client_statfs_cached);
+		return 0;
+	}
+
+	ret = scoutfs_net_sync_request(sb, client->conn,
+				       SCOUTFS_NET_CMD_STATFS, NULL, 0,
+				       nstatfs,
+				       sizeof(struct scoutfs_net_statfs));
+	if (ret == 0 && age_ms) {
+		spin_lock(&client->statfs_lock);
+		memcpy(&client->statfs_cache, nstatfs, sizeof(*nstatfs));
+		client->statfs_sample_j = jiffies;
+		client->statfs_valid = true;
+		spin_unlock(&client->statfs_lock);
+	}
+
+	return ret;
+}
+
+/*
+ * Warm the manifest root cache in the background once the greeting has
+ * assigned our node_id so that the first metadata reads after mount
+ * don't pay another round trip to the server.  Errors are harmless,
+ * the first reader just asks the server itself.
+ */
+static void client_root_warm_worker(struct work_struct *work)
+{
+	struct client_info *client = container_of(work, struct client_info,
+						  root_warm_work);
+	struct scoutfs_btree_root root;
 
-	return scoutfs_net_sync_request(sb, client->conn,
-					SCOUTFS_NET_CMD_STATFS, NULL, 0,
-					nstatfs,
-					sizeof(struct scoutfs_net_statfs));
+	scoutfs_client_get_manifest_root(client->sb, &root);
 }
 
 /*
@@ -289,6 +699,7 @@ static int client_greeting(struct super_block *sb,
 
 	if (sbi->node_id == 0) {
 		sbi->node_id = le64_to_cpu(gr->node_id);
+		queue_work(client->workq, &client->root_warm_work);
 		complete(&client->node_id_comp);
 	}
 
@@ -352,16 +763,25 @@ static void scoutfs_client_connect_worker(struct work_struct *work)
 out:
 	if (ret && !atomic_read(&client->shutting_down)) {
 		queue_delayed_work(client->workq, &client->connect_dwork,
-				   msecs_to_jiffies(client->conn_retry_ms));
+				   msecs_to_jiffies(jittered_retry_ms(client)));
 		grow_connect_timeout(client);
 	}
 }
 
+/* a compaction request queued for processing by the compaction workers */
+struct client_compact_work {
+	struct work_struct work;
+	struct super_block *sb;
+	struct scoutfs_net_connection *conn;
+	u8 cmd;
+	u64 id;
+	struct scoutfs_net_compact_request req;
+};
+
 /*
  * Perform a compaction in the client as requested by the server.  The
  * server has protected the input segments and allocated the output
- * segnos for us.  This executes in work queued by the client's net
- * connection.  It only reads and write segments.  The server will
+ * segnos for us.  It only reads and write segments.  The server will
  * update the manifest and allocators while processing the response.  An
  * error response includes the compaction id so that the server can
  * clean it up.
@@ -372,42 +792,72 @@ out:
  * output.  Our response can be lost if the socket is shutdown while
  * it's in flight, the server deals with this.
  */
-static int client_compact(struct super_block *sb,
-			  struct scoutfs_net_connection *conn,
-			  u8 cmd, u64 id, void *arg, u16 arg_len)
+static void client_compact_worker(struct work_struct *work)
 {
-	struct scoutfs_net_compact_response *resp = NULL;
-	struct scoutfs_net_compact_request *req;
+	struct client_compact_work *cw = container_of(work,
+						struct client_compact_work,
+						work);
+	struct super_block *sb = cw->sb;
+	struct scoutfs_net_compact_response *resp;
 	int ret;
 
-	if (arg_len != sizeof(struct scoutfs_net_compact_request)) {
-		ret = -EINVAL;
-		goto out;
-	}
-	req = arg;
-
-	trace_scoutfs_client_compact_start(sb, le64_to_cpu(req->id),
-					   req->last_level, req->flags);
+	trace_scoutfs_client_compact_start(sb, le64_to_cpu(cw->req.id),
+					   cw->req.last_level, cw->req.flags);
 
 	resp = kzalloc(sizeof(struct scoutfs_net_compact_response), GFP_NOFS);
 	if (!resp) {
 		ret = -ENOMEM;
 	} else {
-		resp->id = req->id;
-		ret = scoutfs_compact(sb, req, resp);
+		resp->id = cw->req.id;
+		ret = scoutfs_compact(sb, &cw->req, resp);
 	}
 
-	trace_scoutfs_client_compact_stop(sb, le64_to_cpu(req->id), ret);
+	trace_scoutfs_client_compact_stop(sb, le64_to_cpu(cw->req.id), ret);
 
+	/* lost responses are resolved by the server, not us */
 	if (ret < 0)
-		ret = scoutfs_net_response(sb, conn, cmd, id, ret,
-					   &req->id, sizeof(req->id));
+		scoutfs_net_response(sb, cw->conn, cw->cmd, cw->id, ret,
+				     &cw->req.id, sizeof(cw->req.id));
 	else
-		ret = scoutfs_net_response(sb, conn, cmd, id, 0,
-					   resp, sizeof(*resp));
+		scoutfs_net_response(sb, cw->conn, cw->cmd, cw->id, 0,
+				     resp, sizeof(*resp));
 	kfree(resp);
-out:
-	return ret;
+	kfree(cw);
+}
+
+/*
+ * Queue an incoming compaction request for the compaction workers so
+ * that the server can keep multiple compactions in flight per client
+ * without tying up net request processing for the duration of the
+ * segment io.  The unbound workqueue spreads the queued compactions
+ * across idle cpus.
+ */
+static int client_compact(struct super_block *sb,
+			  struct scoutfs_net_connection *conn,
+			  u8 cmd, u64 id, void *arg, u16 arg_len)
+{
+	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+	struct scoutfs_net_compact_request *req;
+	struct client_compact_work *cw;
+
+	if (arg_len != sizeof(struct scoutfs_net_compact_request))
+		return -EINVAL;
+	req = arg;
+
+	cw = kzalloc(sizeof(struct client_compact_work), GFP_NOFS);
+	if (!cw)
+		return scoutfs_net_response(sb, conn, cmd, id, -ENOMEM,
+					    &req->id, sizeof(req->id));
+
+	INIT_WORK(&cw->work, client_compact_worker);
+	cw->sb = sb;
+	cw->conn = conn;
+	cw->cmd = cmd;
+	cw->id = id;
+	cw->req = *req;
+
+	queue_work(client->compact_workq, &cw->work);
+	return 0;
 }
 
 static scoutfs_net_request_t client_req_funcs[] = {
@@ -459,8 +909,13 @@ int scoutfs_client_setup(struct super_block *sb)
 	client->sb = sb;
 	init_completion(&client->node_id_comp);
 	atomic_set(&client->shutting_down, 0);
+	spin_lock_init(&client->manifest_root_lock);
+	spin_lock_init(&client->segno_lock);
+	spin_lock_init(&client->statfs_lock);
+	spin_lock_init(&client->ino_lock);
 	INIT_DELAYED_WORK(&client->connect_dwork,
 			  scoutfs_client_connect_worker);
+	INIT_WORK(&client->root_warm_work, client_root_warm_worker);
 
 	client->conn = scoutfs_net_alloc_conn(sb, NULL, client_notify_down, 0,
 					      client_req_funcs, "client");
@@ -475,6 +930,13 @@ int scoutfs_client_setup(struct super_block *sb)
 		goto out;
 	}
 
+	client->compact_workq = alloc_workqueue("scoutfs_client_compact",
+						WQ_UNBOUND, 0);
+	if (!client->compact_workq) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	reset_connect_timeout(client);
 	/* delay initial connect to give a local server some time to setup */
 	queue_delayed_work(client->workq, &client->connect_dwork,
@@ -487,6 +949,43 @@ out:
 	return ret;
 }
 
+/*
+ * Free any segnos still pooled at unmount so that a clean unmount
+ * doesn't strand granted segments.  This is best effort, the server
+ * forgets grants it can't reclaim when the connection goes down.
+ */
+static void client_return_segnos(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct client_info *client = sbi->client_info;
+	struct scoutfs_net_extent_list *nexl;
+	u64 segnos[SCOUTFS_NET_SEGNOS_MAX_NR];
+	unsigned int nr = 0;
+	u64 i;
+
+	spin_lock(&client->segno_lock);
+	while (client->nr_segnos > 0)
+		segnos[nr++] = client->segnos[--client->nr_segnos];
+	client->segno_target = 0;
+	spin_unlock(&client->segno_lock);
+
+	if (nr == 0)
+		return;
+
+	nexl = kmalloc(SCOUTFS_NET_EXTENT_LIST_BYTES(nr), GFP_NOFS);
+	if (!nexl)
+		return;
+
+	nexl->nr = cpu_to_le64(nr);
+	for (i = 0; i < nr; i++) {
+		nexl->extents[i].start =
+			cpu_to_le64(segnos[i] << sbi->segment_block_shift);
+		nexl->extents[i].len = cpu_to_le64(sbi->segment_blocks);
+	}
+
+	scoutfs_client_free_extents(sb, nexl);
+}
+
 /*
  * There must be no more callers to the client request functions by the
  * time we get here.
@@ -498,11 +997,22 @@ void scoutfs_client_destroy(struct super_block *sb)
 	struct scoutfs_net_connection *conn;
 
 	if (client) {
+		client_return_segnos(sb);
+
 		/* stop notify_down from queueing connect work */
 		atomic_set(&client->shutting_down, 1);
 
-		/* make sure worker isn't using the conn */
+		/* make sure workers aren't using the conn */
 		cancel_delayed_work_sync(&client->connect_dwork);
+		cancel_work_sync(&client->root_warm_work);
+
+		/* stop request processing that queues compactions */
+		if (client->conn)
+			scoutfs_net_shutdown(sb, client->conn);
+
+		/* wait for queued compactions which use the conn */
+		if (client->compact_workq)
+			destroy_workqueue(client->compact_workq);
 
 		/* make racing conn use explode */
 		conn = client->conn;
@@ -1,20 +1,51 @@
 #ifndef _SCOUTFS_CLIENT_H_
 #define _SCOUTFS_CLIENT_H_
 
-int scoutfs_client_alloc_inodes(struct super_block *sb, u64 count,
-				u64 *ino, u64 *nr);
+#include "net.h"
+
+/* async requests whose responses need decoding carry their raw reply */
+struct scoutfs_client_async_segno {
+	struct scoutfs_net_async_request areq;
+	__le64 lesegno;
+	/* satisfied from the granted segno pool without a request */
+	bool from_pool;
+};
+
+struct scoutfs_client_async_seq {
+	struct scoutfs_net_async_request areq;
+	__le64 after;
+};
+
+int scoutfs_client_alloc_inodes(struct super_block *sb, u64 dir_ino,
+				u64 count, u64 *ino, u64 *nr);
 int scoutfs_client_alloc_extent(struct super_block *sb, u64 blocks, u64 *start,
 				u64 *len);
 int scoutfs_client_free_extents(struct super_block *sb,
 				struct scoutfs_net_extent_list *nexl);
+void scoutfs_client_submit_alloc_segno(struct super_block *sb,
+				       struct scoutfs_client_async_segno *aseg);
+int scoutfs_client_alloc_segno_wait(struct super_block *sb,
+				    struct scoutfs_client_async_segno *aseg,
+				    u64 *segno);
 int scoutfs_client_alloc_segno(struct super_block *sb, u64 *segno);
+void scoutfs_client_submit_record_segment(struct super_block *sb,
+					  struct scoutfs_segment *seg, u8 level,
+					  struct scoutfs_net_async_request *areq);
+int scoutfs_client_record_segment_wait(struct super_block *sb,
+				       struct scoutfs_net_async_request *areq);
 int scoutfs_client_record_segment(struct super_block *sb,
 				  struct scoutfs_segment *seg, u8 level);
 u64 *scoutfs_client_bulk_alloc(struct super_block *sb);
+void scoutfs_client_submit_advance_seq(struct super_block *sb, u64 seq,
+				       struct scoutfs_client_async_seq *aseq);
+int scoutfs_client_advance_seq_wait(struct super_block *sb,
+				    struct scoutfs_client_async_seq *aseq,
+				    u64 *seq);
 int scoutfs_client_advance_seq(struct super_block *sb, u64 *seq);
 int scoutfs_client_get_last_seq(struct super_block *sb, u64 *seq);
 int scoutfs_client_get_manifest_root(struct super_block *sb,
 				     struct scoutfs_btree_root *root);
+void scoutfs_client_invalidate_manifest_root(struct super_block *sb);
 int scoutfs_client_statfs(struct super_block *sb,
 			  struct scoutfs_net_statfs *nstatfs);
 
@@ -14,6 +14,7 @@
 #include <linux/fs.h>
 #include <linux/slab.h>
 #include <linux/sort.h>
+#include <linux/delay.h>
 
 #include "super.h"
 #include "format.h"
@@ -23,6 +24,7 @@
 #include "compact.h"
 #include "manifest.h"
 #include "counters.h"
+#include "recorder.h"
 #include "server.h"
 #include "scoutfs_trace.h"
 
@@ -41,8 +43,32 @@
  * from the two input segments are copied into new output segments in
  * sorted order.  Space is reclaimed as duplicate or deletion items are
  * removed and fewer segments are written than were read.
+ *
+ * Compaction io lands on the same device that's serving foreground
+ * reads so requests are admitted through a token bucket before they're
+ * allowed to touch segments.  Each request is charged a token for every
+ * segment it will read or write and the bucket refills at a fixed rate,
+ * spreading a storm of requests out over time instead of letting them
+ * saturate the device.  The refill rate backs off while foreground
+ * segment reads are waiting longer than usual.
  */
 
+struct compact_info {
+	struct super_block *sb;
+	spinlock_t lock;
+	unsigned long last_fill;
+	u64 tokens;
+};
+
+/* steady state compaction bandwidth in segments of io per second */
+#define COMPACT_RATE_SEGS	32
+/* an idle bucket can accumulate a burst of this many segments */
+#define COMPACT_BURST_SEGS	64
+/* read waits over this cut the refill rate while reads recover */
+#define COMPACT_SLOW_READ_NS	(20 * NSEC_PER_MSEC)
+/* tokens are thousandths of segments so short refill ticks aren't lost */
+#define COMPACT_TOKENS(segs)	((u64)(segs) * 1000)
+
 struct compact_seg {
 	struct list_head entry;
 
@@ -53,9 +79,19 @@ struct compact_seg {
 	struct scoutfs_key last;
 	struct scoutfs_segment *seg;
 	int off;
+	bool read;
 	bool part_of_move;
+
+	/* the decoded item at off, cached across produced items */
+	struct scoutfs_key item_key;
+	struct kvec item_val;
+	u8 item_flags;
+	bool item_cached;
 };
 
+/* input segment reads kept in flight ahead of the merge cursor */
+#define COMPACT_READAHEAD_NR 2
+
 struct compact_cursor {
 	struct list_head csegs;
 
@@ -70,6 +106,7 @@ struct compact_cursor {
 	struct compact_seg *lower;
 
 	bool sticky;
+	bool split_tail;
 	struct compact_seg *last_lower;
 
 	__le32 *links[SCOUTFS_MAX_SKIP_LINKS];
@@ -110,35 +147,75 @@ static void free_cseg_list(struct super_block *sb, struct list_head *list)
 	}
 }
 
-static int read_segment(struct super_block *sb, struct compact_seg *cseg)
+static struct compact_seg *next_spos(struct compact_cursor *curs,
+				     struct compact_seg *cseg)
+{
+	if (cseg->entry.next == &curs->csegs)
+		return NULL;
+
+	return list_next_entry(cseg, entry);
+}
+
+/* submit a read for a segment without waiting for its completion */
+static int submit_segment(struct super_block *sb, struct compact_seg *cseg)
 {
 	struct scoutfs_segment *seg;
-	int ret;
 
-	if (cseg == NULL || cseg->seg)
+	if (cseg->seg)
 		return 0;
 
-	seg = scoutfs_seg_submit_read(sb, cseg->segno);
-	if (IS_ERR(seg)) {
-		ret = PTR_ERR(seg);
-	} else {
-		cseg->seg = seg;
-		scoutfs_inc_counter(sb, compact_segment_read);
-		ret = scoutfs_seg_wait(sb, cseg->seg, cseg->segno, cseg->seq);
-	}
+	seg = scoutfs_seg_submit_read(sb, cseg->segno, true);
+	if (IS_ERR(seg))
+		return PTR_ERR(seg);
 
-	/* XXX verify read segment metadata */
+	cseg->seg = seg;
+	scoutfs_inc_counter(sb, compact_segment_read);
+	return 0;
+}
 
-	return ret;
+/*
+ * Keep reads for the next input segments in flight while the merge
+ * works through the current segment so that the device isn't idle
+ * between segments.  This is best effort, the waiting reader retries
+ * submission and sees errors.
+ */
+static void readahead_segments(struct super_block *sb,
+			       struct compact_cursor *curs,
+			       struct compact_seg *cseg)
+{
+	int i;
+
+	for (i = 0; cseg && i < COMPACT_READAHEAD_NR; i++) {
+		if (!cseg->seg) {
+			scoutfs_inc_counter(sb, compact_segment_readahead);
+			if (submit_segment(sb, cseg))
+				break;
+		}
+		cseg = next_spos(curs, cseg);
+	}
 }
 
-static struct compact_seg *next_spos(struct compact_cursor *curs,
-				     struct compact_seg *cseg)
+static int read_segment(struct super_block *sb, struct compact_cursor *curs,
+			struct compact_seg *cseg)
 {
-	if (cseg->entry.next == &curs->csegs)
-		return NULL;
+	int ret;
 
-	return list_next_entry(cseg, entry);
+	if (cseg == NULL || cseg->read)
+		return 0;
+
+	ret = submit_segment(sb, cseg);
+	if (ret)
+		return ret;
+
+	readahead_segments(sb, curs, next_spos(curs, cseg));
+
+	ret = scoutfs_seg_wait(sb, cseg->seg, cseg->segno, cseg->seq);
+	if (ret == 0)
+		cseg->read = true;
+
+	/* XXX verify read segment metadata */
+
+	return ret;
 }
 
 /*
@@ -147,6 +224,12 @@ static struct compact_seg *next_spos(struct compact_cursor *curs,
  * the lowest key or the upper if they're the same.  We advance the
  * cursor past the item that is returned.
  *
+ * The lower segments don't overlap each other and are sorted so only
+ * one lower is merged against the upper at a time.  Each source caches
+ * its decoded item at the cursor position so that producing an item
+ * only re-decodes the sources that advanced past it instead of
+ * re-decoding every source for every produced item.
+ *
  * XXX this will get fancier as we get range deletion items and
  * incremental update items.
  */
@@ -156,30 +239,32 @@ static int next_item(struct super_block *sb, struct compact_cursor *curs,
 {
 	struct compact_seg *upper = curs->upper;
 	struct compact_seg *lower = curs->lower;
-	struct scoutfs_key lower_key;
-	struct kvec lower_val;
-	u8 lower_flags;
 	int cmp;
 	int ret;
 
 retry:
-	if (upper) {
+	if (upper && !upper->item_cached) {
 		ret = scoutfs_seg_get_item(upper->seg, upper->off,
-					   item_key, item_val, item_flags);
+					   &upper->item_key, &upper->item_val,
+					   &upper->item_flags);
 		if (ret < 0)
 			upper = NULL;
+		else
+			upper->item_cached = true;
 	}
 
-	while (lower) {
-		ret = read_segment(sb, lower);
+	while (lower && !lower->item_cached) {
+		ret = read_segment(sb, curs, lower);
 		if (ret)
 			goto out;
 
 		ret = scoutfs_seg_get_item(lower->seg, lower->off,
-					   &lower_key, &lower_val,
-					   &lower_flags);
-		if (ret == 0)
+					   &lower->item_key, &lower->item_val,
+					   &lower->item_flags);
+		if (ret == 0) {
+			lower->item_cached = true;
 			break;
+		}
 		lower = next_spos(curs, lower);
 	}
 
@@ -189,22 +274,38 @@ retry:
 		goto out;
 	}
 
+	/*
+	 * Once the lower segments are exhausted the remaining upper
+	 * items don't need to be merged with anything.  When the
+	 * compaction can split the upper segment we stop producing
+	 * items here and the caller moves the tail down by reference
+	 * instead of rewriting it.
+	 */
+	if (curs->split_tail && upper && !lower) {
+		ret = 0;
+		goto out;
+	}
+
 	/*
 	 * < 0: return upper, advance upper
 	 * == 0: return upper, advance both
 	 * > 0: return lower, advance lower
 	 */
 	if (upper && lower)
-		cmp = scoutfs_key_compare(item_key, &lower_key);
+		cmp = scoutfs_key_compare(&upper->item_key, &lower->item_key);
 	else if (upper)
 		cmp = -1;
 	else
 		cmp = 1;
 
-	if (cmp > 0) {
-		*item_key = lower_key;
-		*item_val = lower_val;
-		*item_flags = lower_flags;
+	if (cmp <= 0) {
+		*item_key = upper->item_key;
+		*item_val = upper->item_val;
+		*item_flags = upper->item_flags;
+	} else {
+		*item_key = lower->item_key;
+		*item_val = lower->item_val;
+		*item_flags = lower->item_flags;
 	}
 
 	/*
@@ -220,10 +321,14 @@ retry:
 		goto out;
 	}
 
-	if (cmp <= 0)
+	if (cmp <= 0) {
 		upper->off = scoutfs_seg_next_off(upper->seg, upper->off);
-	if (cmp >= 0)
+		upper->item_cached = false;
+	}
+	if (cmp >= 0) {
 		lower->off = scoutfs_seg_next_off(lower->seg, lower->off);
+		lower->item_cached = false;
+	}
 
 	/*
 	 * Deletion items make their way down all the levels, replacing
@@ -247,6 +352,66 @@ out:
 	return ret;
 }
 
+/*
+ * Submit all the segment writes that a compaction produced, tracked by
+ * the one completion that the caller waits on.
+ *
+ * The output segnos were granted in sorted order so the written results
+ * are already ascending and physically contiguous segments are merged
+ * into larger IOs by the batched submission.  A segment at a time is
+ * the fallback if we can't gather the array.
+ */
+static int submit_result_writes(struct super_block *sb,
+				struct list_head *results,
+				struct scoutfs_bio_completion *comp)
+{
+	struct scoutfs_segment **segs;
+	struct compact_seg *cseg;
+	unsigned int nr = 0;
+	int ret = 0;
+
+	list_for_each_entry(cseg, results, entry) {
+		if (cseg->seg && !cseg->part_of_move)
+			nr++;
+	}
+	if (nr == 0)
+		return 0;
+
+	segs = kmalloc(nr * sizeof(segs[0]), GFP_NOFS);
+	if (segs) {
+		nr = 0;
+		list_for_each_entry(cseg, results, entry) {
+			if (cseg->seg && !cseg->part_of_move)
+				segs[nr++] = cseg->seg;
+		}
+
+		ret = scoutfs_seg_submit_write_batch(sb, segs, nr, comp);
+		kfree(segs);
+	} else {
+		list_for_each_entry(cseg, results, entry) {
+			if (cseg->seg && !cseg->part_of_move) {
+				ret = scoutfs_seg_submit_write(sb, cseg->seg,
+							       comp);
+				if (ret)
+					break;
+			}
+		}
+	}
+
+	if (ret == 0) {
+		list_for_each_entry(cseg, results, entry) {
+			if (cseg->seg && !cseg->part_of_move) {
+				scoutfs_inc_counter(sb, compact_segment_writes);
+				scoutfs_add_counter(sb,
+					compact_segment_write_bytes,
+					scoutfs_seg_total_bytes(cseg->seg));
+			}
+		}
+	}
+
+	return ret;
+}
+
 static int compact_segments(struct super_block *sb,
 			    struct compact_cursor *curs,
 			    struct scoutfs_bio_completion *comp,
@@ -273,17 +438,37 @@ static int compact_segments(struct super_block *sb,
 		lower = curs->lower;
 
 		/*
-		 * If we're at the start of the upper segment and
-		 * there's no lower segment then we might as well just
-		 * move the segment in the manifest.  We can't do this
-		 * if we're moving to the last level because we might
-		 * need to drop any deletion items.
+		 * If there's no lower segment then the remaining upper
+		 * items don't need to be merged and we can move them in
+		 * the manifest alone.  At the start of the segment the
+		 * whole entry moves down.  If a leading portion was
+		 * already merged we split the segment: the tail moves
+		 * by reference with an entry whose range starts at the
+		 * next remaining item, the already merged items it
+		 * leaves behind are shadowed because the moved entry's
+		 * range no longer covers them.  We can't do either when
+		 * moving to the last level because we might need to
+		 * drop any deletion items.
 		 *
 		 * XXX We should have metadata in the manifest to tell
 		 * us that there's no deletion items in the segment.
 		 */
-		if (upper && upper->off == 0 && !lower && !curs->sticky &&
-		    ((upper->level + 1) < curs->last_level)) {
+		if (upper && !lower && !append_filled && !curs->sticky &&
+		    ((upper->level + 1) < curs->last_level) &&
+		    (upper->off == 0 || curs->split_tail)) {
+
+			if (upper->off != 0) {
+				ret = scoutfs_seg_get_item(upper->seg,
+							   upper->off,
+							   &item_key,
+							   &item_val, &flags);
+				if (ret < 0)
+					break;
+				scoutfs_inc_counter(sb, compact_segment_split);
+			} else {
+				item_key = upper->first;
+				scoutfs_inc_counter(sb, compact_segment_moved);
+			}
 
 			/*
 			 * XXX blah!  these csegs are getting
@@ -291,7 +476,7 @@ static int compact_segments(struct super_block *sb,
 			 * entry iterator that reading and compacting
 			 * can use.
 			 */
-			cseg = alloc_cseg(sb, &upper->first, &upper->last);
+			cseg = alloc_cseg(sb, &item_key, &upper->last);
 			if (!cseg) {
 				ret = -ENOMEM;
 				break;
@@ -310,13 +495,11 @@ static int compact_segments(struct super_block *sb,
 			cseg->part_of_move = true;
 
 			curs->upper = NULL;
-
-			scoutfs_inc_counter(sb, compact_segment_moved);
 			break;
 		}
 
 		/* we're going to need its next key */
-		ret = read_segment(sb, upper);
+		ret = read_segment(sb, curs, upper);
 		if (ret)
 			break;
 
@@ -333,7 +516,7 @@ static int compact_segments(struct super_block *sb,
 		 * its neighbours.
 		 */
 
-		ret = read_segment(sb, lower);
+		ret = read_segment(sb, curs, lower);
 		if (ret)
 			break;
 
@@ -406,17 +589,11 @@ static int compact_segments(struct super_block *sb,
 		}
 		if (ret < 0)
 			break;
-
-		/* start a complete segment write now, we'll wait later */
-		ret = scoutfs_seg_submit_write(sb, seg, comp);
-		if (ret)
-			break;
-
-		scoutfs_inc_counter(sb, compact_segment_writes);
-		scoutfs_add_counter(sb, compact_segment_write_bytes,
-				    scoutfs_seg_total_bytes(seg));
 	}
 
+	if (ret == 0)
+		ret = submit_result_writes(sb, results, comp);
+
 	return ret;
 }
 
@@ -565,6 +742,8 @@ static int prepare_curs(struct super_block *sb, struct compact_cursor *curs,
 	curs->lower_level = req->ents[0].level + 1;
 	curs->last_level = req->last_level;
 	curs->sticky = !!(req->flags & SCOUTFS_NET_COMPACT_FLAG_STICKY);
+	curs->split_tail = !curs->sticky &&
+			   (curs->lower_level < curs->last_level);
 
 	for (i = 0; i < ARRAY_SIZE(req->segnos); i++) {
 		if (req->segnos[i] == 0)
@@ -602,6 +781,72 @@ static int prepare_curs(struct super_block *sb, struct compact_cursor *curs,
 	return ret;
 }
 
+/*
+ * Wait for the token bucket to have capacity for a compaction's io
+ * before admitting it.
+ *
+ * The request is charged a token per input segment read and we assume
+ * that about as many output segments will be written.  While foreground
+ * segment reads are waiting longer than usual the refill rate is cut
+ * back so that compaction stops competing with reads for the device.
+ *
+ * Requests with a level 0 upper segment never wait.  Level 0 segments
+ * all overlap so every read has to search them; when reads are slow a
+ * deep level 0 is usually why, and draining it is how latency recovers.
+ * They still consume whatever tokens are available so that the work
+ * they do delays the merges behind them.
+ */
+static void compact_throttle(struct super_block *sb,
+			     struct scoutfs_net_compact_request *req)
+{
+	struct compact_info *ci = SCOUTFS_SB(sb)->compact_info;
+	unsigned long now;
+	u64 need;
+	u64 rate;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(req->ents); i++) {
+		if (req->ents[i].segno == 0)
+			break;
+	}
+	need = COMPACT_TOKENS(2 * i);
+
+	for (;;) {
+		rate = COMPACT_RATE_SEGS;
+		if (scoutfs_seg_read_wait_ewma(sb) > COMPACT_SLOW_READ_NS)
+			rate = COMPACT_RATE_SEGS / 4;
+
+		spin_lock(&ci->lock);
+
+		now = jiffies;
+		ci->tokens += COMPACT_TOKENS(rate) *
+			      jiffies_to_msecs(now - ci->last_fill) /
+			      MSEC_PER_SEC;
+		ci->tokens = min(ci->tokens,
+				 COMPACT_TOKENS(COMPACT_BURST_SEGS));
+		ci->last_fill = now;
+
+		if (req->ents[0].level == 0) {
+			if (ci->tokens < need)
+				scoutfs_inc_counter(sb, compact_level0_nowait);
+			ci->tokens -= min(ci->tokens, need);
+			spin_unlock(&ci->lock);
+			break;
+		}
+
+		if (ci->tokens >= need) {
+			ci->tokens -= need;
+			spin_unlock(&ci->lock);
+			break;
+		}
+
+		spin_unlock(&ci->lock);
+
+		scoutfs_inc_counter(sb, compact_throttle_wait);
+		msleep(100);
+	}
+}
+
 /*
  * Perform a compaction by translating the incoming request into our
  * working state, iterating over input segments and write output
@@ -627,8 +872,16 @@ int scoutfs_compact(struct super_block *sb,
 	INIT_LIST_HEAD(&curs.csegs);
 	scoutfs_bio_init_comp(&comp);
 
-	ret = verify_request(sb, req) ?:
-	      prepare_curs(sb, &curs, req);
+	scoutfs_rec(sb, SCOUTFS_REC_COMPACT_START, le64_to_cpu(req->id),
+		    req->last_level);
+
+	ret = verify_request(sb, req);
+	if (ret)
+		goto out;
+
+	compact_throttle(sb, req);
+
+	ret = prepare_curs(sb, &curs, req);
 	if (ret)
 		goto out;
 
@@ -651,8 +904,12 @@ int scoutfs_compact(struct super_block *sb,
 	/* fill entries for written output segments */
 	nr = 0;
 	list_for_each_entry(cseg, &results, entry) {
-		/* XXX moved upper segments won't have read the segment :P */
-		if (cseg->seg)
+		/*
+		 * Moved segments might not have read the segment and
+		 * split segments only cover a subrange of their items,
+		 * so both use the cseg keys instead of the segment's.
+		 */
+		if (cseg->seg && !cseg->part_of_move)
 			scoutfs_seg_init_ment(&ment, cseg->level, cseg->seg);
 		else
 			scoutfs_manifest_init_entry(&ment, cseg->level,
@@ -668,6 +925,8 @@ int scoutfs_compact(struct super_block *sb,
 
 	ret = 0;
 out:
+	scoutfs_rec(sb, SCOUTFS_REC_COMPACT_DONE, le64_to_cpu(req->id), ret);
+
 	if (ret == -ESTALE)
 		scoutfs_inc_counter(sb, compact_stale_error);
 
@@ -676,3 +935,30 @@ out:
 
 	return ret;
 }
+
+int scoutfs_compact_setup(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct compact_info *ci;
+
+	ci = kzalloc(sizeof(struct compact_info), GFP_KERNEL);
+	if (!ci)
+		return -ENOMEM;
+
+	ci->sb = sb;
+	spin_lock_init(&ci->lock);
+	ci->last_fill = jiffies;
+	ci->tokens = COMPACT_TOKENS(COMPACT_BURST_SEGS);
+
+	sbi->compact_info = ci;
+
+	return 0;
+}
+
+void scoutfs_compact_destroy(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+
+	kfree(sbi->compact_info);
+	sbi->compact_info = NULL;
+}
@@ -5,4 +5,7 @@ int scoutfs_compact(struct super_block *sb,
 		    struct scoutfs_net_compact_request *req,
 		    struct scoutfs_net_compact_response *resp);
 
+int scoutfs_compact_setup(struct super_block *sb);
+void scoutfs_compact_destroy(struct super_block *sb);
+
 #endif
@@ -1,6 +1,8 @@
 #ifndef _SCOUTFS_COUNT_H_
 #define _SCOUTFS_COUNT_H_
 
+#include <linux/cpumask.h>
+
 /*
  * Our estimate of the space consumed while dirtying items is based on
  * the number of items and the size of their values.
@@ -117,6 +119,27 @@ static inline const struct scoutfs_item_count SIC_MKNOD(unsigned name_len)
 	return cnt;
 }
 
+/*
+ * Bulk creation makes each file's items as mknod would but only
+ * dirties the directory inode once for the whole batch.  name_bytes
+ * is the total length of all the names.
+ */
+static inline const struct scoutfs_item_count SIC_BULK_CREATE(unsigned nr,
+							unsigned name_bytes)
+{
+	struct scoutfs_item_count cnt = {0,};
+	unsigned i;
+
+	__count_dirty_inode(&cnt);
+	for (i = 0; i < nr; i++) {
+		__count_alloc_inode(&cnt);
+		__count_dirents(&cnt, 0);
+	}
+	cnt.vals += 3 * name_bytes;
+
+	return cnt;
+}
+
 /*
  * Dropping the inode deletes all its items.  Potentially enormous numbers
  * of items (data mapping, xattrs) are deleted in their own transactions.
@@ -277,6 +300,20 @@ SIC_TRUNC_EXTENT(struct inode *inode)
 	return cnt;
 }
 
+/*
+ * Draining the per-cpu free extent caches back into the node's items
+ * can, for each possible cpu, delete two neighbouring free extents
+ * and insert one merged, each with indexed copies.
+ */
+static inline const struct scoutfs_item_count SIC_DRAIN_EXTENT_CACHES(void)
+{
+	struct scoutfs_item_count cnt = {0,};
+
+	cnt.items += num_possible_cpus() * ((1 + 2) * 2);
+
+	return cnt;
+}
+
 /*
  * Returning extents to the server can, at most:
  *  - delete MAX_NR extents with indexed copies
@@ -292,6 +329,20 @@ static inline const struct scoutfs_item_count SIC_RETURN_EXTENTS(void)
 	return cnt;
 }
 
+/*
+ * Adding an extent granted by the server to the node's free pool can
+ * delete two neighbouring free extents and insert one merged, each
+ * with indexed copies.
+ */
+static inline const struct scoutfs_item_count SIC_SERVER_EXTENT(void)
+{
+	struct scoutfs_item_count cnt = {0,};
+
+	cnt.items += (1 + 2) * 2;
+
+	return cnt;
+}
+
 /*
  * Fallocating an extent can, at most:
  *  - allocate from the server: delete two free and insert merged
@@ -12,19 +12,28 @@
  * other places by this macro.  Don't forget to update LAST_COUNTER.
  */
 #define EXPAND_EACH_COUNTER					\
+	EXPAND_COUNTER(btree_batch_leaf_hit)			\
+	EXPAND_COUNTER(btree_cache_hit)				\
+	EXPAND_COUNTER(btree_cache_miss)			\
 	EXPAND_COUNTER(btree_read_error)			\
 	EXPAND_COUNTER(btree_stale_read)			\
 	EXPAND_COUNTER(btree_write_error)			\
+	EXPAND_COUNTER(client_statfs_cached)			\
+	EXPAND_COUNTER(compact_candidate_scored)		\
 	EXPAND_COUNTER(compact_invalid_request)			\
+	EXPAND_COUNTER(compact_level0_nowait)			\
 	EXPAND_COUNTER(compact_operations)			\
 	EXPAND_COUNTER(compact_segment_busy)			\
 	EXPAND_COUNTER(compact_segment_moved)			\
 	EXPAND_COUNTER(compact_segment_read)			\
+	EXPAND_COUNTER(compact_segment_readahead)		\
+	EXPAND_COUNTER(compact_segment_split)			\
 	EXPAND_COUNTER(compact_segment_write_bytes)		\
 	EXPAND_COUNTER(compact_segment_writes)			\
 	EXPAND_COUNTER(compact_stale_error)			\
 	EXPAND_COUNTER(compact_sticky_upper)			\
 	EXPAND_COUNTER(compact_sticky_written)			\
+	EXPAND_COUNTER(compact_throttle_wait)			\
 	EXPAND_COUNTER(corrupt_btree_block_level)		\
 	EXPAND_COUNTER(corrupt_btree_no_child_ref)		\
 	EXPAND_COUNTER(corrupt_data_extent_trunc_cleanup)	\
@@ -40,8 +49,15 @@
 	EXPAND_COUNTER(corrupt_symlink_inode_size)		\
 	EXPAND_COUNTER(corrupt_symlink_missing_item)		\
 	EXPAND_COUNTER(corrupt_symlink_not_null_term)		\
+	EXPAND_COUNTER(data_delalloc_block)			\
 	EXPAND_COUNTER(data_end_writeback_page)			\
+	EXPAND_COUNTER(data_extent_cache_hit)			\
 	EXPAND_COUNTER(data_invalidatepage)			\
+	EXPAND_COUNTER(data_pcpu_extent_drain)			\
+	EXPAND_COUNTER(data_pcpu_extent_hit)			\
+	EXPAND_COUNTER(data_pcpu_extent_refill)			\
+	EXPAND_COUNTER(data_prefetch_server_extent)		\
+	EXPAND_COUNTER(data_readahead_grow)			\
 	EXPAND_COUNTER(data_readpage)				\
 	EXPAND_COUNTER(data_write_begin)			\
 	EXPAND_COUNTER(data_write_end)				\
@@ -53,6 +69,7 @@
 	EXPAND_COUNTER(dentry_revalidate_rcu)			\
 	EXPAND_COUNTER(dentry_revalidate_root)			\
 	EXPAND_COUNTER(dentry_revalidate_valid)			\
+	EXPAND_COUNTER(dir_backref_cache_hit)			\
 	EXPAND_COUNTER(dir_backref_excessive_retries)		\
 	EXPAND_COUNTER(extent_add)				\
 	EXPAND_COUNTER(extent_delete)				\
@@ -60,15 +77,27 @@
 	EXPAND_COUNTER(extent_next)				\
 	EXPAND_COUNTER(extent_prev)				\
 	EXPAND_COUNTER(extent_remove)				\
+	EXPAND_COUNTER(file_write_dio_shared)			\
+	EXPAND_COUNTER(ino_grant_hit)				\
+	EXPAND_COUNTER(inode_iget_cached)			\
+	EXPAND_COUNTER(inode_index_created)			\
+	EXPAND_COUNTER(inode_index_deleted)			\
+	EXPAND_COUNTER(inode_index_elided)			\
 	EXPAND_COUNTER(item_alloc)				\
 	EXPAND_COUNTER(item_batch_duplicate)			\
 	EXPAND_COUNTER(item_batch_inserted)			\
+	EXPAND_COUNTER(item_cache_warm)				\
 	EXPAND_COUNTER(item_create)				\
 	EXPAND_COUNTER(item_delete)				\
 	EXPAND_COUNTER(item_free)				\
 	EXPAND_COUNTER(item_lookup_hit)				\
 	EXPAND_COUNTER(item_lookup_miss)			\
+	EXPAND_COUNTER(item_lookup_rcu_hit)			\
+	EXPAND_COUNTER(item_lru_demote)				\
+	EXPAND_COUNTER(item_lru_promote)			\
+	EXPAND_COUNTER(item_next_rcu_hit)			\
 	EXPAND_COUNTER(item_range_alloc)			\
+	EXPAND_COUNTER(item_rcu_fallback)			\
 	EXPAND_COUNTER(item_range_free)				\
 	EXPAND_COUNTER(item_range_hit)				\
 	EXPAND_COUNTER(item_range_insert)			\
@@ -78,17 +107,24 @@
 	EXPAND_COUNTER(item_shrink_empty_range)			\
 	EXPAND_COUNTER(item_shrink_next_dirty)			\
 	EXPAND_COUNTER(item_shrink_outside)			\
+	EXPAND_COUNTER(item_shrink_protected)			\
 	EXPAND_COUNTER(item_shrink_range_end)			\
 	EXPAND_COUNTER(item_shrink_small_split)			\
 	EXPAND_COUNTER(item_shrink_split_range)			\
+	EXPAND_COUNTER(item_val_ref)				\
+	EXPAND_COUNTER(item_val_ref_copy)			\
+	EXPAND_COUNTER(lock_ahead)				\
 	EXPAND_COUNTER(lock_alloc)				\
 	EXPAND_COUNTER(lock_ast)				\
 	EXPAND_COUNTER(lock_ast_edeadlk)			\
 	EXPAND_COUNTER(lock_ast_error)				\
 	EXPAND_COUNTER(lock_bast)				\
+	EXPAND_COUNTER(lock_cached_hit)				\
 	EXPAND_COUNTER(lock_dlm_call)				\
 	EXPAND_COUNTER(lock_dlm_call_error)			\
+	EXPAND_COUNTER(lock_downconvert_keep_items)		\
 	EXPAND_COUNTER(lock_free)				\
+	EXPAND_COUNTER(lock_grace_elided)			\
 	EXPAND_COUNTER(lock_grace_enforced)			\
 	EXPAND_COUNTER(lock_grace_expired)			\
 	EXPAND_COUNTER(lock_grace_extended)			\
@@ -97,11 +133,15 @@
 	EXPAND_COUNTER(lock_lock_error)				\
 	EXPAND_COUNTER(lock_nonblock_eagain)			\
 	EXPAND_COUNTER(lock_shrink)				\
+	EXPAND_COUNTER(lock_shrink_deferred)			\
 	EXPAND_COUNTER(lock_write_dirty_item)			\
 	EXPAND_COUNTER(lock_unlock)				\
 	EXPAND_COUNTER(manifest_compact_migrate)		\
 	EXPAND_COUNTER(manifest_hard_stale_error)		\
 	EXPAND_COUNTER(manifest_read_excluded_key)		\
+	EXPAND_COUNTER(manifest_readahead_segment)		\
+	EXPAND_COUNTER(manifest_root_cache_hit)			\
+	EXPAND_COUNTER(manifest_root_invalidate)		\
 	EXPAND_COUNTER(net_dropped_response)			\
 	EXPAND_COUNTER(net_send_bytes)				\
 	EXPAND_COUNTER(net_send_error)				\
@@ -111,18 +151,40 @@
 	EXPAND_COUNTER(net_recv_invalid_message)		\
 	EXPAND_COUNTER(net_recv_messages)			\
 	EXPAND_COUNTER(net_unknown_request)			\
+	EXPAND_COUNTER(orphan_scan_processed)			\
 	EXPAND_COUNTER(seg_alloc)				\
+	EXPAND_COUNTER(seg_bloom_excluded)			\
+	EXPAND_COUNTER(seg_bloom_pass)				\
+	EXPAND_COUNTER(seg_bloom_read)				\
+	EXPAND_COUNTER(seg_bloom_stale)				\
+	EXPAND_COUNTER(seg_cache_hit)				\
+	EXPAND_COUNTER(seg_cache_miss)				\
 	EXPAND_COUNTER(seg_csum_error)				\
+	EXPAND_COUNTER(seg_find_index_build)			\
 	EXPAND_COUNTER(seg_free)				\
 	EXPAND_COUNTER(seg_shrink)				\
 	EXPAND_COUNTER(seg_stale_read)				\
+	EXPAND_COUNTER(seg_write_merged)			\
+	EXPAND_COUNTER(seg_write_trim_blocks)			\
+	EXPAND_COUNTER(segno_pool_hit)				\
+	EXPAND_COUNTER(segno_pool_miss)				\
+	EXPAND_COUNTER(server_alloc_bucket_hit)			\
 	EXPAND_COUNTER(server_alloc_segno)			\
+	EXPAND_COUNTER(server_commit_empty)			\
+	EXPAND_COUNTER(server_commit_waiters)			\
+	EXPAND_COUNTER(server_commit_writes)			\
 	EXPAND_COUNTER(server_extent_alloc)			\
 	EXPAND_COUNTER(server_extent_alloc_error)		\
 	EXPAND_COUNTER(server_free_extent)			\
 	EXPAND_COUNTER(server_free_pending_extent)		\
 	EXPAND_COUNTER(server_free_pending_error)		\
 	EXPAND_COUNTER(server_free_segno)			\
+	EXPAND_COUNTER(server_segno_bitmap_hit)			\
+	EXPAND_COUNTER(server_segno_bitmap_stale)		\
+	EXPAND_COUNTER(symlink_cache_hit)			\
+	EXPAND_COUNTER(trans_budget_grow)			\
+	EXPAND_COUNTER(trans_budget_shrink)			\
+	EXPAND_COUNTER(trans_commit_budget)			\
 	EXPAND_COUNTER(trans_commit_fsync)			\
 	EXPAND_COUNTER(trans_commit_full)			\
 	EXPAND_COUNTER(trans_commit_item_flush)			\
@@ -130,11 +192,14 @@
 	EXPAND_COUNTER(trans_commit_timer)			\
 	EXPAND_COUNTER(trans_level0_seg_write_bytes)		\
 	EXPAND_COUNTER(trans_level0_seg_writes)			\
+	EXPAND_COUNTER(trans_sync_delay_grow)			\
+	EXPAND_COUNTER(trans_sync_delay_shrink)			\
 	EXPAND_COUNTER(trans_write_item)			\
-	EXPAND_COUNTER(trans_write_deletion_item)
+	EXPAND_COUNTER(trans_write_deletion_item)		\
+	EXPAND_COUNTER(xattr_cache_hit)
 
-#define FIRST_COUNTER	btree_read_error
-#define LAST_COUNTER	trans_write_deletion_item
+#define FIRST_COUNTER	btree_batch_leaf_hit
+#define LAST_COUNTER	xattr_cache_hit
 
 #undef EXPAND_COUNTER
 #define EXPAND_COUNTER(which) struct percpu_counter which;
@@ -22,6 +22,8 @@
 #include <linux/falloc.h>
 #include <linux/writeback.h>
 #include <linux/workqueue.h>
+#include <linux/percpu.h>
+#include <linux/pagevec.h>
 
 #include "format.h"
 #include "super.h"
@@ -45,8 +47,10 @@
  * scoutfs uses extent items to track file data block mappings and free
  * blocks.
  *
- * Typically we'll allocate a single block in get_block if a mapping
- * isn't found.
+ * Buffered writes into holes are delayed: write_begin leaves the
+ * buffers unallocated and writeback allocates contiguous extents for
+ * whole dirty ranges as it maps them.  Staging and direct IO writes
+ * still allocate as they map blocks.
  *
  * We special case extending contiguous files.  In that case we'll preallocate
  * an unwritten extent at the end of the file.  The size of the preallocation
@@ -57,7 +61,6 @@
  *  - mmap
  *  - better io error propagation
  *  - forced unmount with dirty data
- *  - direct IO
  *  - need trans around each bulk alloc
  */
 
@@ -71,7 +74,8 @@
  */
 #define MAX_EXTENT_BLOCKS (8ULL * 1024 * 1024 >> SCOUTFS_BLOCK_SHIFT)
 /*
- * We ask for a fixed size from the server today.
+ * The smallest request we'll make of the server when refilling the
+ * node's free pool.
  */
 #define SERVER_ALLOC_BLOCKS (MAX_EXTENT_BLOCKS * 8)
 /*
@@ -79,10 +83,33 @@
  */
 #define NODE_FREE_HIGH_WATER_BLOCKS (SERVER_ALLOC_BLOCKS * 16)
 
+/* per-cpu caches carve this many blocks from the node's free pool */
+#define PCPU_EXTENT_CACHE_BLOCKS MAX_EXTENT_BLOCKS
+
+/*
+ * Delayed buffers are mapped to an impossibly large device block so
+ * that the generic buffer paths treat them as usable without reading
+ * or writing through the bogus mapping before they're allocated.
+ */
+#define DELALLOC_INVALID_BLOCK (~((sector_t)0xffff))
+
+/*
+ * Each cpu caches a free extent carved from the node's free extent
+ * items so that the write path can allocate blocks without serializing
+ * on the alloc_rwsem.  The lock is only contended when another cpu
+ * drains the cache back into the items.
+ */
+struct pcpu_extent_cache {
+	spinlock_t lock;
+	u64 start;
+	u64 len;
+};
+
 struct data_info {
 	struct super_block *sb;
 	struct rw_semaphore alloc_rwsem;
 	atomic64_t node_free_blocks;
+	struct pcpu_extent_cache __percpu *pcpu_caches;
 	struct workqueue_struct *workq;
 	struct work_struct return_work;
 };
@@ -256,6 +283,48 @@ static int data_extent_io(struct super_block *sb, int op,
 	return ret;
 }
 
+/*
+ * Use the inode's cached extent if it still covers the caller's block.
+ * It's only valid while the lock that covered the search that populated
+ * it hasn't been refreshed; a newer grant means other nodes could have
+ * changed the extent items.
+ */
+static bool cached_extent_covers(struct scoutfs_inode_info *si,
+				 struct scoutfs_lock *lock, u64 iblock,
+				 struct scoutfs_extent *ext)
+{
+	bool hit = false;
+
+	spin_lock(&si->extent_cache_lock);
+	if (si->extent_cache_gen == lock->refresh_gen &&
+	    si->cached_extent.len > 0 &&
+	    iblock >= si->cached_extent.start &&
+	    iblock - si->cached_extent.start < si->cached_extent.len) {
+		*ext = si->cached_extent;
+		hit = true;
+	}
+	spin_unlock(&si->extent_cache_lock);
+
+	return hit;
+}
+
+static void cache_extent(struct scoutfs_inode_info *si,
+			 struct scoutfs_lock *lock,
+			 struct scoutfs_extent *ext)
+{
+	spin_lock(&si->extent_cache_lock);
+	si->cached_extent = *ext;
+	si->extent_cache_gen = lock->refresh_gen;
+	spin_unlock(&si->extent_cache_lock);
+}
+
+static void invalidate_cached_extent(struct scoutfs_inode_info *si)
+{
+	spin_lock(&si->extent_cache_lock);
+	si->extent_cache_gen = 0;
+	spin_unlock(&si->extent_cache_lock);
+}
+
 /*
  * Find and remove or mark offline the next extent that intersects with
  * the caller's range.  The caller is responsible for transactions and
@@ -440,10 +509,20 @@ int scoutfs_data_truncate_items(struct super_block *sb, struct inode *inode,
 		ret = 0;
 	}
 
+	/* a racing read can cache an extent while we're removing them */
+	if (inode)
+		invalidate_cached_extent(SCOUTFS_I(inode));
+
 	return ret;
 }
 
-static int get_server_extent(struct super_block *sb)
+/*
+ * Ask the server for more free blocks for the node's pool.  The server
+ * returns its first single extent that covers at most the requested
+ * count, so callers that know they need a lot of space can get it in
+ * one round trip when free space isn't fragmented.
+ */
+static int get_server_extent(struct super_block *sb, u64 blocks)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_extent ext;
@@ -451,8 +530,10 @@ static int get_server_extent(struct super_block *sb)
 	u64 len;
 	int ret;
 
-	ret = scoutfs_client_alloc_extent(sb, SERVER_ALLOC_BLOCKS,
-					  &start, &len);
+	blocks = ALIGN(max_t(u64, blocks, SERVER_ALLOC_BLOCKS),
+		       sbi->segment_blocks);
+
+	ret = scoutfs_client_alloc_extent(sb, blocks, &start, &len);
 	if (ret)
 		goto out;
 
@@ -466,6 +547,48 @@ out:
 	return ret;
 }
 
+/*
+ * Return one cpu's cached extent to the node's free extent items so
+ * that searches of the items can see it.  Returns true if a cached
+ * extent was returned.  The caller holds the alloc_rwsem.
+ */
+static bool drain_one_pcpu_extent_cache(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	DECLARE_DATA_INFO(sb, datinf);
+	struct pcpu_extent_cache *pec;
+	struct scoutfs_extent ext;
+	u64 start = 0;
+	u64 len = 0;
+	int cpu;
+	int ret;
+
+	for_each_possible_cpu(cpu) {
+		pec = per_cpu_ptr(datinf->pcpu_caches, cpu);
+		spin_lock(&pec->lock);
+		if (pec->len) {
+			start = pec->start;
+			len = pec->len;
+			pec->len = 0;
+		}
+		spin_unlock(&pec->lock);
+		if (len)
+			break;
+	}
+	if (len == 0)
+		return false;
+
+	scoutfs_inc_counter(sb, data_pcpu_extent_drain);
+
+	scoutfs_extent_init(&ext, SCOUTFS_FREE_EXTENT_BLKNO_TYPE,
+			    sbi->node_id, start, len, 0, 0);
+	ret = scoutfs_extent_add(sb, data_extent_io, &ext, sbi->node_id_lock);
+	/* XXX cached blocks are leaked if we can't store the item */
+	WARN_ON_ONCE(ret);
+
+	return ret == 0;
+}
+
 /*
  * Find a free extent to satisfy an allocation of at most @len blocks.
  *
@@ -499,7 +622,10 @@ static int find_free_extent(struct super_block *sb, u64 len,
 
 		/* ask the server for more if we think it'll help */
 		if (ret == -ENOENT || ext->len < len) {
-			ret = get_server_extent(sb);
+			/* reclaim cached per-cpu extents before asking */
+			if (drain_one_pcpu_extent_cache(sb))
+				continue;
+			ret = get_server_extent(sb, SERVER_ALLOC_BLOCKS);
 			if (ret == 0)
 				continue;
 		}
@@ -517,6 +643,97 @@ static int find_free_extent(struct super_block *sb, u64 len,
 	return ret;
 }
 
+/*
+ * Carve up to @len blocks for the write path from the calling cpu's
+ * cached extent, refilling the cache from the node's free extent items
+ * when it's empty.  A drained pool falls back to reclaiming other
+ * cpus' caches through find_free_extent.
+ *
+ * Returns the number of carved blocks, which can be less than asked
+ * for, and sets *start to their first blkno.  Returns -errno,
+ * including -ENOSPC, if nothing could be carved.
+ *
+ * The common case takes only the cpu's own uncontended spinlock so
+ * concurrent writers don't serialize on the alloc_rwsem.
+ */
+static s64 pcpu_extent_carve(struct super_block *sb, u64 len, u64 *start)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	DECLARE_DATA_INFO(sb, datinf);
+	struct pcpu_extent_cache *pec;
+	struct scoutfs_extent fr;
+	struct scoutfs_extent rem;
+	u64 taken = 0;
+	int err;
+	int ret;
+
+	pec = get_cpu_ptr(datinf->pcpu_caches);
+	spin_lock(&pec->lock);
+	if (pec->len) {
+		taken = min(len, pec->len);
+		*start = pec->start;
+		pec->start += taken;
+		pec->len -= taken;
+	}
+	spin_unlock(&pec->lock);
+	put_cpu_ptr(datinf->pcpu_caches);
+
+	if (taken) {
+		scoutfs_inc_counter(sb, data_pcpu_extent_hit);
+		return taken;
+	}
+
+	down_write(&datinf->alloc_rwsem);
+	ret = find_free_extent(sb, PCPU_EXTENT_CACHE_BLOCKS, &fr);
+	if (ret == 0)
+		ret = scoutfs_extent_remove(sb, data_extent_io, &fr,
+					    sbi->node_id_lock);
+	up_write(&datinf->alloc_rwsem);
+	if (ret < 0)
+		return ret;
+
+	scoutfs_inc_counter(sb, data_pcpu_extent_refill);
+
+	taken = min(len, fr.len);
+	*start = fr.start;
+	fr.start += taken;
+	fr.len -= taken;
+
+	/* cache the remainder on our cpu, merging if we can */
+	if (fr.len) {
+		pec = get_cpu_ptr(datinf->pcpu_caches);
+		spin_lock(&pec->lock);
+		if (pec->len == 0) {
+			pec->start = fr.start;
+			pec->len = fr.len;
+			fr.len = 0;
+		} else if (fr.start + fr.len == pec->start) {
+			pec->start = fr.start;
+			pec->len += fr.len;
+			fr.len = 0;
+		} else if (pec->start + pec->len == fr.start) {
+			pec->len += fr.len;
+			fr.len = 0;
+		}
+		spin_unlock(&pec->lock);
+		put_cpu_ptr(datinf->pcpu_caches);
+	}
+
+	/* the cache was refilled while we worked, put the remainder back */
+	if (fr.len) {
+		scoutfs_extent_init(&rem, SCOUTFS_FREE_EXTENT_BLKNO_TYPE,
+				    sbi->node_id, fr.start, fr.len, 0, 0);
+		down_write(&datinf->alloc_rwsem);
+		err = scoutfs_extent_add(sb, data_extent_io, &rem,
+					 sbi->node_id_lock);
+		up_write(&datinf->alloc_rwsem);
+		/* XXX the remainder is leaked if we can't store the item */
+		WARN_ON_ONCE(err);
+	}
+
+	return taken;
+}
+
 /*
  * The caller is writing to a logical block that doesn't have an
  * allocated extent.
@@ -547,7 +764,7 @@ static int find_free_extent(struct super_block *sb, u64 len,
  */
 static int alloc_block(struct super_block *sb, struct inode *inode,
 		       struct scoutfs_extent *ext, u64 iblock, u64 len,
-		       struct scoutfs_lock *lock)
+		       u64 want, struct scoutfs_lock *lock)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	DECLARE_DATA_INFO(sb, datinf);
@@ -561,14 +778,17 @@ static int alloc_block(struct super_block *sb, struct inode *inode,
 	bool rem_blk = false;
 	u64 offline;
 	u64 online;
+	u64 start;
+	s64 taken;
 	int ret;
 
-	down_write(&datinf->alloc_rwsem);
-
 	scoutfs_inode_get_onoff(inode, &online, &offline);
 
-	/* strictly contiguous extending writes will try to preallocate */ 
-	if (iblock > 1 && iblock == online)
+	/* writeback of a delayed range allocates the whole range */
+	if (want > 1)
+		len = min3(len, want, MAX_EXTENT_BLOCKS);
+	/* strictly contiguous extending writes will try to preallocate */
+	else if (iblock > 1 && iblock == online)
 		len = min3(len, iblock, MAX_EXTENT_BLOCKS);
 	else
 		len = 1;
@@ -576,21 +796,24 @@ static int alloc_block(struct super_block *sb, struct inode *inode,
 	trace_scoutfs_data_alloc_block(sb, inode, ext, iblock, len,
 				       online, offline);
 
-	ret = find_free_extent(sb, len, &fr);
-	if (ret < 0)
+	/* carve from the cpu's cache, possibly less than we asked for */
+	taken = pcpu_extent_carve(sb, len, &start);
+	if (taken < 0) {
+		ret = taken;
 		goto out;
+	}
+	len = taken;
+
+	/* the carved free blocks, referenced by cleanup */
+	scoutfs_extent_init(&fr, SCOUTFS_FREE_EXTENT_BLKNO_TYPE,
+			    sbi->node_id, start, len, 0, 0);
+	add_fr = true;
 
 	trace_scoutfs_data_alloc_block_next(sb, &fr);
 
 	/* initialize the new mapped block extent, referenced by cleanup */
 	scoutfs_extent_init(&blk, SCOUTFS_FILE_EXTENT_TYPE, ino,
-			    iblock, 1, fr.start, 0);
-
-	/* remove the free extent that we're allocating */
-	ret = scoutfs_extent_remove(sb, data_extent_io, &fr, sbi->node_id_lock);
-	if (ret)
-		goto out;
-	add_fr = true;
+			    iblock, 1, start, 0);
 
 	/* remove an existing offline or unwritten block extent */
 	if (ext->flags) {
@@ -611,7 +834,7 @@ static int alloc_block(struct super_block *sb, struct inode *inode,
 	/* and maybe add the remaining unwritten extent */
 	if (len > 1) {
 		scoutfs_extent_init(&unwr, SCOUTFS_FILE_EXTENT_TYPE, ino,
-				    iblock + 1, len - 1, fr.start + 1,
+				    iblock + 1, len - 1, start + 1,
 				    ext->flags | SEF_UNWRITTEN);
 		ret = scoutfs_extent_add(sb, data_extent_io, &unwr, lock);
 		if (ret)
@@ -630,12 +853,14 @@ out:
 			       data_extent_io, &old, lock,
 			       SC_DATA_EXTENT_ALLOC_CLEANUP,
 			       corrupt_data_extent_alloc_cleanup, &blk);
-	scoutfs_extent_cleanup(ret < 0 && add_fr, scoutfs_extent_add, sb,
-			       data_extent_io, &fr, sbi->node_id_lock,
-			       SC_DATA_EXTENT_ALLOC_CLEANUP,
-			       corrupt_data_extent_alloc_cleanup, &blk);
-
-	up_write(&datinf->alloc_rwsem);
+	if (ret < 0 && add_fr) {
+		down_write(&datinf->alloc_rwsem);
+		scoutfs_extent_cleanup(true, scoutfs_extent_add, sb,
+				       data_extent_io, &fr, sbi->node_id_lock,
+				       SC_DATA_EXTENT_ALLOC_CLEANUP,
+				       corrupt_data_extent_alloc_cleanup, &blk);
+		up_write(&datinf->alloc_rwsem);
+	}
 
 	trace_scoutfs_data_alloc_block_ret(sb, ext, ret);
 	if (ret == 0)
@@ -689,22 +914,21 @@ out:
 	return ret;
 }
 
-static int scoutfs_get_block(struct inode *inode, sector_t iblock,
-			     struct buffer_head *bh, int create)
+static int scoutfs_get_block_common(struct inode *inode, sector_t iblock,
+				    struct buffer_head *bh, int create,
+				    bool delay, u64 want,
+				    struct scoutfs_lock *lock)
 {
 	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
 	struct super_block *sb = inode->i_sb;
-	struct scoutfs_lock *lock = NULL;
+	DECLARE_DATA_INFO(sb, datinf);
 	struct scoutfs_extent ext;
 	u64 next_iblock = 0;
 	u64 offset;
 	u64 len;
 	int ret;
 
-	WARN_ON_ONCE(create && !mutex_is_locked(&inode->i_mutex));
-
 	/* make sure caller holds a cluster lock */
-	lock = scoutfs_per_task_get(&si->pt_data_lock);
 	if (WARN_ON_ONCE(!lock) ||
 	    WARN_ON_ONCE(!create && si->staging)) {
 		ret = -EINVAL;
@@ -714,6 +938,14 @@ static int scoutfs_get_block(struct inode *inode, sector_t iblock,
 	/* look for the extent that overlaps our iblock */
 	scoutfs_extent_init(&ext, SCOUTFS_FILE_EXTENT_TYPE,
 			    scoutfs_ino(inode), iblock, 1, 0, 0);
+
+	/* reads inside the cached extent can skip the item search */
+	if (!create && cached_extent_covers(si, lock, iblock, &ext)) {
+		scoutfs_inc_counter(sb, data_extent_cache_hit);
+		ret = 0;
+		goto found;
+	}
+
 	ret = scoutfs_extent_next(sb, data_extent_io, &ext, lock);
 	if (ret && ret != -ENOENT)
 		goto out;
@@ -729,6 +961,8 @@ static int scoutfs_get_block(struct inode *inode, sector_t iblock,
 	if (ret == -ENOENT || ext.start > iblock)
 		memset(&ext, 0, sizeof(ext));
 
+found:
+
 	if (ext.len)
 		trace_scoutfs_data_get_block_intersection(sb, &ext);
 
@@ -748,6 +982,27 @@ static int scoutfs_get_block(struct inode *inode, sector_t iblock,
 
 	/* allocate an extent from our logical block */
 	if (create && !ext.map) {
+		/*
+		 * Delay allocating plain holes until writeback can map
+		 * whole dirty ranges with contiguous extents.  We only
+		 * delay while the node's free pool covers the write so
+		 * that exhaustion falls back to allocating here, where
+		 * -ENOSPC can still fail the write syscall.  We record
+		 * the covering lock for writeback contexts that don't
+		 * have a per-task lock entry.
+		 */
+		if (delay && !ext.flags && !si->staging &&
+		    atomic64_read(&datinf->node_free_blocks) > 0) {
+			map_bh(bh, inode->i_sb, DELALLOC_INVALID_BLOCK);
+			set_buffer_new(bh);
+			set_buffer_delay(bh);
+			si->delalloc_lock = lock;
+			si->delalloc_blocks++;
+			scoutfs_inc_counter(sb, data_delalloc_block);
+			ret = 0;
+			goto out;
+		}
+
 		/* limit possible alloc to this extent, next, or logical max */
 		if (ext.len > 0)
 			len = ext.len - (iblock - ext.start);
@@ -756,7 +1011,7 @@ static int scoutfs_get_block(struct inode *inode, sector_t iblock,
 		else
 			len = SCOUTFS_BLOCK_MAX - iblock;
 
-		ret = alloc_block(sb, inode, &ext, iblock, len, lock);
+		ret = alloc_block(sb, inode, &ext, iblock, len, want, lock);
 		if (ret == 0)
 			set_buffer_new(bh);
 	} else {
@@ -766,6 +1021,7 @@ static int scoutfs_get_block(struct inode *inode, sector_t iblock,
 out:
 	/* map usable extent, else leave bh unmapped for sparse reads */
 	if (ret == 0 && ext.map && !(ext.flags & SEF_UNWRITTEN)) {
+		cache_extent(si, lock, &ext);
 		offset = iblock - ext.start;
 		map_bh(bh, inode->i_sb, ext.map + offset);
 		bh->b_size = min_t(u64, bh->b_size,
@@ -777,6 +1033,148 @@ out:
 	return ret;
 }
 
+static int scoutfs_get_block(struct inode *inode, sector_t iblock,
+			     struct buffer_head *bh, int create)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+
+	WARN_ON_ONCE(create && !mutex_is_locked(&inode->i_mutex));
+
+	return scoutfs_get_block_common(inode, iblock, bh, create, false, 0,
+					scoutfs_per_task_get(&si->pt_data_lock));
+}
+
+/*
+ * Count the blocks of consecutive dirty pages from the given block so
+ * that writeback of a delayed range can allocate it as a single
+ * extent.  The count is advisory: racing writes or page writeback only
+ * change the length of the allocation, not its correctness.
+ */
+static u64 count_dirty_range_blocks(struct inode *inode, sector_t iblock)
+{
+	struct address_space *mapping = inode->i_mapping;
+	pgoff_t next = iblock >> (PAGE_CACHE_SHIFT - SCOUTFS_BLOCK_SHIFT);
+	pgoff_t index = next;
+	struct pagevec pvec;
+	u64 blocks = 0;
+	bool contig = true;
+	unsigned i;
+	int nr;
+
+	pagevec_init(&pvec, 0);
+	while (contig && blocks < MAX_EXTENT_BLOCKS) {
+		nr = pagevec_lookup_tag(&pvec, mapping, &index,
+					PAGECACHE_TAG_DIRTY, PAGEVEC_SIZE);
+		if (nr == 0)
+			break;
+		for (i = 0; i < nr; i++) {
+			if (pvec.pages[i]->index != next) {
+				contig = false;
+				break;
+			}
+			next++;
+			blocks += SCOUTFS_BLOCKS_PER_PAGE;
+		}
+		pagevec_release(&pvec);
+	}
+
+	return max_t(u64, blocks, 1);
+}
+
+/*
+ * Map blocks for buffered write_begin.  Writes into holes are delayed
+ * so that writeback can allocate contiguous extents for whole dirty
+ * ranges instead of a block at a time as pages are copied in.  The
+ * alloc_mutex serializes the unwritten conversions and fallback
+ * allocations we do here with allocation during writeback.
+ */
+static int scoutfs_get_block_delalloc(struct inode *inode, sector_t iblock,
+				      struct buffer_head *bh, int create)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	int ret;
+
+	WARN_ON_ONCE(create && !mutex_is_locked(&inode->i_mutex));
+
+	mutex_lock(&si->alloc_mutex);
+	ret = scoutfs_get_block_common(inode, iblock, bh, create, true, 0,
+				       scoutfs_per_task_get(&si->pt_data_lock));
+	mutex_unlock(&si->alloc_mutex);
+
+	return ret;
+}
+
+/*
+ * Map blocks for writeback, allocating extents for delayed buffers.
+ *
+ * Writeback can run in contexts without a per-task lock entry, like
+ * the transaction commit's inode walk or the background flusher, so we
+ * fall back to the lock that covered the delayed writes.  It's valid
+ * as long as the delayed pages are dirty because invalidating it first
+ * commits, and the commit writes the pages through it before it's
+ * dropped.  We count the delayed blocks down as we map them and clear
+ * the fallback with the last one so it can't dangle after the lock is
+ * eventually invalidated and freed.
+ *
+ * Each allocating call dirties a bounded number of items so we open a
+ * transaction around each one, as the direct IO path does.  During
+ * commit the hold is a nop for the committing task and the items we
+ * dirty are swept into the very commit that's writing the pages.  The
+ * index locks are already held in that case: the inode item was
+ * updated when the pages were dirtied so the prepared list is empty.
+ */
+static int scoutfs_get_block_writeback(struct inode *inode, sector_t iblock,
+				       struct buffer_head *bh, int create)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_lock *lock;
+	LIST_HEAD(ind_locks);
+	u64 want = 0;
+	u64 ind_seq;
+	int ret;
+
+	lock = scoutfs_per_task_get(&si->pt_data_lock) ?: si->delalloc_lock;
+
+	/* map blocks that already have extents without a transaction */
+	if (!buffer_delay(bh) && !si->staging) {
+		ret = scoutfs_get_block_common(inode, iblock, bh, 0, false, 0,
+					       lock);
+		if (ret < 0 || buffer_mapped(bh) || !create)
+			return ret;
+	}
+
+	if (buffer_delay(bh))
+		want = count_dirty_range_blocks(inode, iblock);
+
+	do {
+		ret = scoutfs_inode_index_start(sb, &ind_seq) ?:
+		      scoutfs_inode_index_prepare(sb, &ind_locks, inode,
+						  true) ?:
+		      scoutfs_inode_index_try_lock_hold(sb, &ind_locks,
+							ind_seq,
+							SIC_WRITE_BEGIN());
+	} while (ret > 0);
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&si->alloc_mutex);
+	ret = scoutfs_dirty_inode_item(inode, lock) ?:
+	      scoutfs_get_block_common(inode, iblock, bh, create, false, want,
+				       lock);
+	/* our caller clears delay once we've mapped the buffer */
+	if (ret == 0 && buffer_delay(bh) && si->delalloc_blocks > 0 &&
+	    --si->delalloc_blocks == 0)
+		si->delalloc_lock = NULL;
+	mutex_unlock(&si->alloc_mutex);
+	if (ret == 0)
+		scoutfs_update_inode_item(inode, lock, &ind_locks);
+
+	scoutfs_release_trans(sb);
+	scoutfs_inode_index_unlock(sb, &ind_locks);
+	return ret;
+}
+
 /*
  * This is almost never used.  We can't block on a cluster lock while
  * holding the page lock because lock invalidation gets the page lock
@@ -812,6 +1210,44 @@ static int scoutfs_readpage(struct file *file, struct page *page)
 	return ret;
 }
 
+/* don't grow a file's readahead window past this many pages */
+#define EXTENT_RA_PAGES_MAX ((8 * 1024 * 1024) / PAGE_SIZE)
+
+/*
+ * Generic readahead sizes its window without knowing the file's extent
+ * layout so cold sequential reads stall at each extent seam: the window
+ * drains before the VM asks for the pages that cross into the next
+ * extent.  Grow the file's readahead window to the on-disk contiguity
+ * of the extent under the first page being read so the VM keeps enough
+ * io in flight to start the next extent before the current one drains.
+ */
+static void grow_extent_readahead(struct file *file, struct inode *inode,
+				  u64 iblock, struct scoutfs_lock *lock)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_extent ext;
+	unsigned long pages;
+	int ret;
+
+	scoutfs_extent_init(&ext, SCOUTFS_FILE_EXTENT_TYPE,
+			    scoutfs_ino(inode), iblock, 1, 0, 0);
+	if (!cached_extent_covers(si, lock, iblock, &ext)) {
+		ret = scoutfs_extent_next(sb, data_extent_io, &ext, lock);
+		if (ret < 0 || ext.start > iblock || !ext.map ||
+		    (ext.flags & (SEF_OFFLINE | SEF_UNWRITTEN)))
+			return;
+		cache_extent(si, lock, &ext);
+	}
+
+	pages = min_t(u64, ext.len - (iblock - ext.start),
+		      EXTENT_RA_PAGES_MAX);
+	if (pages > file->f_ra.ra_pages) {
+		file->f_ra.ra_pages = pages;
+		scoutfs_inc_counter(sb, data_readahead_grow);
+	}
+}
+
 static int scoutfs_readpages(struct file *file, struct address_space *mapping,
 			     struct list_head *pages, unsigned nr_pages)
 {
@@ -825,6 +1261,11 @@ static int scoutfs_readpages(struct file *file, struct address_space *mapping,
 	if (ret)
 		return ret;
 
+	if (nr_pages)
+		grow_extent_readahead(file, inode,
+				      list_entry(pages->prev, struct page,
+						 lru)->index, inode_lock);
+
 	ret = mpage_readpages(mapping, pages, nr_pages, scoutfs_get_block);
 
 	scoutfs_unlock(sb, inode_lock, DLM_LOCK_PR);
@@ -833,13 +1274,127 @@ static int scoutfs_readpages(struct file *file, struct address_space *mapping,
 
 static int scoutfs_writepage(struct page *page, struct writeback_control *wbc)
 {
-	return block_write_full_page(page, scoutfs_get_block, wbc);
+	return block_write_full_page(page, scoutfs_get_block_writeback, wbc);
 }
 
+/*
+ * mpage_writepages can't write delayed buffers: they look mapped so it
+ * would submit them to their fake delalloc block without ever calling
+ * get_block.  Drive our ->writepage instead, whose
+ * block_write_full_page calls get_block for delayed buffers so they're
+ * allocated and mapped before the bio is built.
+ */
 static int scoutfs_writepages(struct address_space *mapping,
 			      struct writeback_control *wbc)
 {
-	return mpage_writepages(mapping, wbc, scoutfs_get_block);
+	return generic_writepages(mapping, wbc);
+}
+
+/*
+ * Map extents for direct IO.  Reads only need the current mapping but
+ * writes allocate extents as they map blocks.  Each allocating call
+ * modifies a bounded number of items so we open a transaction around
+ * each one, like write_begin does for each page of buffered writes.
+ */
+static int scoutfs_get_block_direct(struct inode *inode, sector_t iblock,
+				    struct buffer_head *bh, int create)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_lock *lock;
+	LIST_HEAD(ind_locks);
+	u64 ind_seq;
+	int ret;
+
+	if (!create)
+		return scoutfs_get_block(inode, iblock, bh, 0);
+
+	lock = scoutfs_per_task_get(&si->pt_data_lock);
+	if (WARN_ON_ONCE(!lock))
+		return -EINVAL;
+
+	do {
+		ret = scoutfs_inode_index_start(sb, &ind_seq) ?:
+		      scoutfs_inode_index_prepare(sb, &ind_locks, inode,
+						  true) ?:
+		      scoutfs_inode_index_try_lock_hold(sb, &ind_locks,
+							ind_seq,
+							SIC_WRITE_BEGIN());
+	} while (ret > 0);
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&si->alloc_mutex);
+	ret = scoutfs_dirty_inode_item(inode, lock) ?:
+	      scoutfs_get_block(inode, iblock, bh, 1);
+	mutex_unlock(&si->alloc_mutex);
+	if (ret == 0)
+		scoutfs_update_inode_item(inode, lock, &ind_locks);
+
+	scoutfs_release_trans(sb);
+	scoutfs_inode_index_unlock(sb, &ind_locks);
+	return ret;
+}
+
+/*
+ * Direct IO reads and writes the caller's pages without copying through
+ * the page cache.  The aio paths in file.c hold the cluster lock and
+ * per-task lock entry around the generic paths that call us, so the
+ * get_block calls during submission have the locking they need.  Direct
+ * overwrites drop i_mutex across submission and can run concurrently;
+ * alloc_mutex serializes their extent allocation.  Async requests return
+ * -EIOCBQUEUED once the bios are in flight and complete the iocb from
+ * end_io without blocking the submitter, but the aio paths wait for the
+ * IO to drain before they drop the cluster lock that fences it.
+ */
+static ssize_t scoutfs_direct_IO(int rw, struct kiocb *iocb,
+				 const struct iovec *iov, loff_t offset,
+				 unsigned long nr_segs)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+
+	return blockdev_direct_IO(rw, iocb, inode, iov, offset, nr_segs,
+				  scoutfs_get_block_direct);
+}
+
+/*
+ * Buffered writes update the inode item in write_end but direct writes
+ * bypass write_begin and write_end entirely.  After submitting a direct
+ * write we update the data version and sync the vfs inode, which the
+ * generic direct write path has already updated, into its item.
+ */
+int scoutfs_data_direct_written(struct inode *inode, struct scoutfs_lock *lock)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	struct super_block *sb = inode->i_sb;
+	LIST_HEAD(ind_locks);
+	u64 ind_seq;
+	int ret;
+
+	do {
+		ret = scoutfs_inode_index_start(sb, &ind_seq) ?:
+		      scoutfs_inode_index_prepare(sb, &ind_locks, inode,
+						  true) ?:
+		      scoutfs_inode_index_try_lock_hold(sb, &ind_locks,
+							ind_seq,
+							SIC_WRITE_BEGIN());
+	} while (ret > 0);
+	if (ret < 0)
+		return ret;
+
+	ret = scoutfs_dirty_inode_item(inode, lock);
+	if (ret == 0) {
+		if (!si->staging) {
+			scoutfs_inode_set_data_seq(inode);
+			scoutfs_inode_inc_data_version(inode);
+		}
+		scoutfs_update_inode_item(inode, lock, &ind_locks);
+	}
+
+	scoutfs_release_trans(sb);
+	scoutfs_inode_index_unlock(sb, &ind_locks);
+	return ret;
 }
 
 /* fsdata allocated in write_begin and freed in write_end */
@@ -893,7 +1448,7 @@ static int scoutfs_write_begin(struct file *file,
 	ret = scoutfs_dirty_inode_item(inode, wbd->lock);
 	if (ret == 0)
 		ret = block_write_begin(mapping, pos, len, flags, pagep,
-					scoutfs_get_block);
+					scoutfs_get_block_delalloc);
 	if (ret)
 		scoutfs_release_trans(sb);
 out:
@@ -1033,6 +1588,45 @@ out:
 	return ret;
 }
 
+/*
+ * Fill the node's free pool with enough blocks to satisfy a caller
+ * who's about to allocate a large known size, rather than letting each
+ * allocation fall back to fixed size refill requests as the pool runs
+ * dry.  The server returns its first single extent that covers at most
+ * our shortfall, so when free space is fragmented we get less than we
+ * asked for and keep asking while the requests make progress.
+ *
+ * This is purely an optimization.  We give up on errors and leave it
+ * to the allocation paths to refill the pool and return hard failures.
+ */
+static void prefetch_server_extents(struct super_block *sb, u64 blocks)
+{
+	DECLARE_DATA_INFO(sb, datinf);
+	u64 have;
+	u64 prev;
+	int ret;
+
+	have = atomic64_read(&datinf->node_free_blocks);
+
+	while (have < blocks) {
+		ret = scoutfs_hold_trans(sb, SIC_SERVER_EXTENT());
+		if (ret)
+			break;
+
+		down_write(&datinf->alloc_rwsem);
+		ret = get_server_extent(sb, blocks - have);
+		up_write(&datinf->alloc_rwsem);
+		scoutfs_release_trans(sb);
+
+		prev = have;
+		have = atomic64_read(&datinf->node_free_blocks);
+		if (ret || have <= prev)
+			break;
+
+		scoutfs_inc_counter(sb, data_prefetch_server_extent);
+	}
+}
+
 /*
  * Modify the extents that map the blocks that store the len byte region
  * starting at offset.
@@ -1081,7 +1675,17 @@ long scoutfs_fallocate(struct file *file, int mode, loff_t offset, loff_t len)
 	if (ret)
 		goto out;
 
-	inode_dio_wait(inode);
+	scoutfs_inode_wait_dio_writers(inode);
+
+	/*
+	 * Write any delayed pages in the region so that writeback can't
+	 * allocate their extents under us, i_mutex keeps writes from
+	 * delaying more.
+	 */
+	ret = filemap_write_and_wait_range(inode->i_mapping, offset,
+					   offset + len - 1);
+	if (ret)
+		goto out;
 
 	if (!(mode & FALLOC_FL_KEEP_SIZE) &&
 	    (offset + len > i_size_read(inode))) {
@@ -1093,6 +1697,9 @@ long scoutfs_fallocate(struct file *file, int mode, loff_t offset, loff_t len)
 	iblock = offset >> SCOUTFS_BLOCK_SHIFT;
 	last_block = (offset + len - 1) >> SCOUTFS_BLOCK_SHIFT;
 
+	/* try to get the whole region's blocks in a few round trips */
+	prefetch_server_extents(sb, last_block - iblock + 1);
+
 	while(iblock <= last_block) {
 
 		scoutfs_extent_init(&ext, SCOUTFS_FILE_EXTENT_TYPE,
@@ -1254,6 +1861,7 @@ const struct address_space_operations scoutfs_file_aops = {
 	.writepages		= scoutfs_writepages,
 	.write_begin		= scoutfs_write_begin,
 	.write_end		= scoutfs_write_end,
+	.direct_IO		= scoutfs_direct_IO,
 };
 
 const struct file_operations scoutfs_file_fops = {
@@ -1295,6 +1903,16 @@ static void scoutfs_data_return_server_extents_worker(struct work_struct *work)
 		goto out;
 	}
 
+	/* first return unused cached per-cpu extents to the node's pool */
+	ret = scoutfs_hold_trans(sb, SIC_DRAIN_EXTENT_CACHES());
+	if (ret)
+		goto out;
+	down_write(&datinf->alloc_rwsem);
+	while (drain_one_pcpu_extent_cache(sb))
+		;
+	up_write(&datinf->alloc_rwsem);
+	scoutfs_release_trans(sb);
+
 	ret = scoutfs_hold_trans(sb, SIC_RETURN_EXTENTS());
 	if (ret)
 		goto out;
@@ -1338,7 +1956,9 @@ static void scoutfs_data_return_server_extents_worker(struct work_struct *work)
 	up_write(&datinf->alloc_rwsem);
 
 	if (nr > 0) {
+		/* the request consumes and frees the list */
 		err = scoutfs_client_free_extents(sb, nexl);
+		nexl = NULL;
 		/* XXX leaked extents if free failed */
 		if (ret == 0 && err < 0)
 			ret = err;
@@ -1356,10 +1976,27 @@ out:
 		queue_work(datinf->workq, &datinf->return_work);
 }
 
+/* racy peek at the caches, only used once they've quiesced */
+static bool pcpu_extent_caches_occupied(struct data_info *datinf)
+{
+	struct pcpu_extent_cache *pec;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pec = per_cpu_ptr(datinf->pcpu_caches, cpu);
+		if (pec->len)
+			return true;
+	}
+
+	return false;
+}
+
 int scoutfs_data_setup(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct data_info *datinf;
+	struct pcpu_extent_cache *pec;
+	int cpu;
 
 	datinf = kzalloc(sizeof(struct data_info), GFP_KERNEL);
 	if (!datinf)
@@ -1371,8 +2008,19 @@ int scoutfs_data_setup(struct super_block *sb)
 	INIT_WORK(&datinf->return_work,
 		  scoutfs_data_return_server_extents_worker);
 
+	datinf->pcpu_caches = alloc_percpu(struct pcpu_extent_cache);
+	if (!datinf->pcpu_caches) {
+		kfree(datinf);
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu) {
+		pec = per_cpu_ptr(datinf->pcpu_caches, cpu);
+		spin_lock_init(&pec->lock);
+	}
+
 	datinf->workq = alloc_workqueue("scoutfs_data", WQ_UNBOUND, 1);
 	if (!datinf->workq) {
+		free_percpu(datinf->pcpu_caches);
 		kfree(datinf);
 		return -ENOMEM;
 	}
@@ -1393,6 +2041,24 @@ void scoutfs_data_destroy(struct super_block *sb)
 			datinf->workq = NULL;
 		}
 
+		/*
+		 * Return any cached extents to the node's free items
+		 * so that they aren't leaked across the unmount.  The
+		 * trans machinery is torn down after us so we can
+		 * still commit the drained items.
+		 */
+		if (datinf->pcpu_caches &&
+		    pcpu_extent_caches_occupied(datinf) &&
+		    scoutfs_hold_trans(sb, SIC_DRAIN_EXTENT_CACHES()) == 0) {
+			down_write(&datinf->alloc_rwsem);
+			while (drain_one_pcpu_extent_cache(sb))
+				;
+			up_write(&datinf->alloc_rwsem);
+			scoutfs_release_trans(sb);
+			scoutfs_trans_sync(sb, 1);
+		}
+		free_percpu(datinf->pcpu_caches);
+
 		sbi->data_info = NULL;
 		kfree(datinf);
 	}
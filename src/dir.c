@@ -13,10 +13,11 @@
 #include <linux/kernel.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
-#include <linux/crc32c.h>
 #include <linux/uio.h>
 #include <linux/xattr.h>
 #include <linux/namei.h>
+#include <linux/hash.h>
+#include <asm/unaligned.h>
 
 #include "format.h"
 #include "file.h"
@@ -62,6 +63,8 @@
  * populated by lookup.
  */
 
+static void backref_cache_invalidate(struct super_block *sb, u64 ino);
+
 static unsigned int mode_to_type(umode_t mode)
 {
 #define S_SHIFT 12
@@ -213,12 +216,61 @@ static struct scoutfs_dirent *alloc_dirent(unsigned int name_len)
 	return kmalloc(dirent_bytes(name_len), GFP_NOFS);
 }
 
-static u64 dirent_name_hash(const char *name, unsigned int name_len)
+#define SIPROUND(v0, v1, v2, v3)					\
+do {									\
+	v0 += v1; v1 = rol64(v1, 13); v1 ^= v0; v0 = rol64(v0, 32);	\
+	v2 += v3; v3 = rol64(v3, 16); v3 ^= v2;				\
+	v0 += v3; v3 = rol64(v3, 21); v3 ^= v0;				\
+	v2 += v1; v1 = rol64(v1, 17); v1 ^= v2; v2 = rol64(v2, 32);	\
+} while (0)
+
+/*
+ * Hash entry names with SipHash-1-3 keyed by the volume uuid.  Dirent
+ * items for a name are keyed by its hash so collisions turn one item
+ * lookup into a chain of item comparisons.  Full 64bit mixing keeps
+ * chains vanishingly rare even in directories with hundreds of
+ * millions of entries, and a round of SipHash over a short name is
+ * cheaper than the pair of crc32c calls it replaces.  The uuid key is
+ * stable across nodes and mounts, which the persistent item keys
+ * require, while giving each volume its own hash distribution.
+ */
+static u64 dirent_name_hash(struct super_block *sb, const char *name,
+			    unsigned int name_len)
 {
-       unsigned int half = (name_len + 1) / 2;
+	struct scoutfs_super_block *super = &SCOUTFS_SB(sb)->super;
+	u64 k0 = get_unaligned_le64(&super->uuid[0]);
+	u64 k1 = get_unaligned_le64(&super->uuid[8]);
+	u64 v0 = k0 ^ 0x736f6d6570736575ULL;
+	u64 v1 = k1 ^ 0x646f72616e646f6dULL;
+	u64 v2 = k0 ^ 0x6c7967656e657261ULL;
+	u64 v3 = k1 ^ 0x7465646279746573ULL;
+	u64 m = (u64)name_len << 56;
+	unsigned int left = name_len;
+	u64 w;
+	int i;
+
+	while (left >= sizeof(w)) {
+		w = get_unaligned_le64(name);
+		v3 ^= w;
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= w;
+		name += sizeof(w);
+		left -= sizeof(w);
+	}
+
+	for (i = 0; i < left; i++)
+		m |= (u64)(u8)name[i] << (i * 8);
 
-       return crc32c(~0, name, half) |
-              ((u64)crc32c(~0, name + name_len - half, half) << 32);
+	v3 ^= m;
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= m;
+
+	v2 ^= 0xff;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+
+	return v0 ^ v1 ^ v2 ^ v3;
 }
 
 static u64 dirent_names_equal(const char *a_name, unsigned int a_len,
@@ -341,7 +393,7 @@ static int scoutfs_d_revalidate(struct dentry *dentry, unsigned int flags)
 
 	ret = lookup_dirent(sb, scoutfs_ino(dir),
 			    dentry->d_name.name, dentry->d_name.len,
-			    dirent_name_hash(dentry->d_name.name,
+			    dirent_name_hash(sb, dentry->d_name.name,
 					     dentry->d_name.len),
 			    &dent, lock);
 	if (ret == -ENOENT) {
@@ -398,7 +450,7 @@ static struct dentry *scoutfs_lookup(struct inode *dir, struct dentry *dentry,
 	u64 hash;
 	int ret;
 
-	hash = dirent_name_hash(dentry->d_name.name, dentry->d_name.len);
+	hash = dirent_name_hash(sb, dentry->d_name.name, dentry->d_name.len);
 
 	if (dentry->d_name.len > SCOUTFS_NAME_LEN) {
 		ret = -ENAMETOOLONG;
@@ -462,34 +514,74 @@ static int dir_emit_dots(struct file *file, void *dirent, filldir_t filldir)
  * readdir simply iterates over the dirent items for the dir inode and
  * uses their offset as the readdir position.
  *
+ * Calling the item cache once per entry dominates listing very large
+ * directories so we copy batches of dirent items into a buffer with
+ * one item cache traversal and emit the entries from there.
+ *
  * It will need to be careful not to read past the region of the dirent
  * hash offset keys that it has access to.
  */
+/* warm the inode items of this many leading entries per readdir call */
+#define READDIR_WARM_NR 32
+
+/*
+ * Ask the background warming work to pull the inode items of entries
+ * we just returned into the item cache.  Bursts that stat each entry
+ * right after listing it, like nfs readdirplus, then find the covering
+ * locks granted and the items cached instead of paying serialized lock
+ * and segment round trips per entry.  It's purely a hint so errors are
+ * ignored.
+ */
+static void readdir_warm_inode_items(struct super_block *sb, void *buf,
+				     u64 *inos, unsigned int nr)
+{
+	struct scoutfs_key *keys = buf;
+	unsigned int i;
+
+	BUILD_BUG_ON(2 * READDIR_WARM_NR * sizeof(struct scoutfs_key) >
+		     PAGE_SIZE);
+
+	for (i = 0; i < nr; i++) {
+		keys[2 * i] = (struct scoutfs_key) {
+			.sk_zone = SCOUTFS_FS_ZONE,
+			.ski_ino = cpu_to_le64(inos[i]),
+			.sk_type = SCOUTFS_INODE_TYPE,
+		};
+		keys[2 * i + 1] = keys[2 * i];
+	}
+
+	scoutfs_lock_warm_ranges(sb, keys, 2 * nr);
+}
+
 static int scoutfs_readdir(struct file *file, void *dirent, filldir_t filldir)
 {
 	struct inode *inode = file_inode(file);
 	struct super_block *sb = inode->i_sb;
+	struct scoutfs_item_batch_entry *ent;
 	struct scoutfs_dirent *dent;
 	struct scoutfs_key key;
 	struct scoutfs_key last_key;
-	struct scoutfs_lock *dir_lock;
-	struct kvec val;
+	struct scoutfs_lock *dir_lock = NULL;
+	u64 warm_inos[READDIR_WARM_NR];
+	unsigned int warm_nr = 0;
+	void *buf;
 	int name_len;
 	u64 pos;
+	int nr;
+	int i;
 	int ret;
 
 	if (!dir_emit_dots(file, dirent, filldir))
 		return 0;
 
-	dent = alloc_dirent(SCOUTFS_NAME_LEN);
-	if (!dent) {
+	buf = kmalloc(PAGE_SIZE, GFP_NOFS);
+	if (!buf) {
 		ret = -ENOMEM;
 		goto out;
 	}
 
 	init_dirent_key(&last_key, SCOUTFS_READDIR_TYPE, scoutfs_ino(inode),
 			SCOUTFS_DIRENT_LAST_POS, 0);
-	kvec_init(&val, dent, dirent_bytes(SCOUTFS_NAME_LEN));
 
 	ret = scoutfs_lock_inode(sb, DLM_LOCK_PR, 0, inode, &dir_lock);
 	if (ret)
@@ -499,39 +591,53 @@ static int scoutfs_readdir(struct file *file, void *dirent, filldir_t filldir)
 		init_dirent_key(&key, SCOUTFS_READDIR_TYPE, scoutfs_ino(inode),
 				file->f_pos, 0);
 
-		ret = scoutfs_item_next(sb, &key, &last_key, &val, dir_lock);
-		if (ret < 0) {
-			if (ret == -ENOENT)
-				ret = 0;
+		nr = scoutfs_item_next_batch(sb, &key, &last_key, buf,
+					     PAGE_SIZE, dir_lock);
+		if (nr < 0) {
+			ret = nr == -ENOENT ? 0 : nr;
 			break;
 		}
 
-		name_len = ret - sizeof(struct scoutfs_dirent);
-		if (name_len < 1 || name_len > SCOUTFS_NAME_LEN) {
-			scoutfs_corruption(sb, SC_DIRENT_READDIR_NAME_LEN,
+		for (i = 0, ent = buf; i < nr;
+		     i++, ent = scoutfs_item_batch_entry_next(ent)) {
+			dent = (void *)ent->val;
+
+			name_len = ent->val_len - sizeof(struct scoutfs_dirent);
+			if (name_len < 1 || name_len > SCOUTFS_NAME_LEN) {
+				scoutfs_corruption(sb,
+					   SC_DIRENT_READDIR_NAME_LEN,
 					   corrupt_dirent_readdir_name_len,
 					   "dir_ino %llu pos %llu key "SK_FMT" len %d",
 					   scoutfs_ino(inode), file->f_pos,
-					   SK_ARG(&key), name_len);
-			ret = -EIO;
-			goto out;
-		}
+					   SK_ARG(&ent->key), name_len);
+				ret = -EIO;
+				goto out;
+			}
 
-		pos = le64_to_cpu(key.skd_major);
+			pos = le64_to_cpu(ent->key.skd_major);
 
-		if (filldir(dirent, dent->name, name_len, pos,
-			    le64_to_cpu(dent->ino), dentry_type(dent->type))) {
-			ret = 0;
-			break;
-		}
+			if (filldir(dirent, dent->name, name_len, pos,
+				    le64_to_cpu(dent->ino),
+				    dentry_type(dent->type))) {
+				ret = 0;
+				goto out;
+			}
 
-		file->f_pos = pos + 1;
+			if (warm_nr < READDIR_WARM_NR)
+				warm_inos[warm_nr++] = le64_to_cpu(dent->ino);
+
+			file->f_pos = pos + 1;
+		}
 	}
 
 out:
 	scoutfs_unlock(sb, dir_lock, DLM_LOCK_PR);
 
-	kfree(dent);
+	/* the entry batches have been emitted so we can reuse the buffer */
+	if (ret == 0 && warm_nr)
+		readdir_warm_inode_items(sb, buf, warm_inos, warm_nr);
+
+	kfree(buf);
 	return ret;
 }
 
@@ -591,6 +697,8 @@ out:
 			scoutfs_item_delete_dirty(sb, &ent_key);
 		if (del_rdir)
 			scoutfs_item_delete_dirty(sb, &rdir_key);
+	} else {
+		backref_cache_invalidate(sb, ino);
 	}
 
 	kfree(dent);
@@ -629,6 +737,7 @@ static int del_entry_items(struct super_block *sb, u64 dir_ino, u64 hash,
 	} else {
 		scoutfs_item_free_batch(sb, &dir_saved);
 		scoutfs_item_free_batch(sb, &inode_saved);
+		backref_cache_invalidate(sb, ino);
 	}
 
 	return ret;
@@ -636,12 +745,11 @@ static int del_entry_items(struct super_block *sb, u64 dir_ino, u64 hash,
 
 /*
  * Inode creation needs to hold dir and inode locks which can be greater
- * or less than each other.  It seems easiest to keep the dual locking
- * here like it is for all the other dual locking of established inodes.
- * Except we don't have the inode struct yet when we're getting locks,
- * so we roll our own comparion between the two instead of pushing
- * complexity down the locking paths that acquire existing inodes in
- * order.
+ * or less than each other.  We don't have the inode struct yet when
+ * we're getting locks so we lock the pair of inode numbers, which
+ * issues both lock requests at once and gathers the grants in sorted
+ * order.  The dir inode is refreshed once its lock is granted, as
+ * scoutfs_lock_inode() would have done.
  */
 static struct inode *lock_hold_create(struct inode *dir, struct dentry *dentry,
 				      umode_t mode, dev_t rdev,
@@ -664,17 +772,9 @@ static struct inode *lock_hold_create(struct inode *dir, struct dentry *dentry,
 	if (ret)
 		return ERR_PTR(ret);
 
-	if (ino < scoutfs_ino(dir)) {
-		ret = scoutfs_lock_ino(sb, DLM_LOCK_EX, 0, ino, inode_lock) ?:
-		      scoutfs_lock_inode(sb, DLM_LOCK_EX,
-				         SCOUTFS_LKF_REFRESH_INODE, dir,
-					 dir_lock);
-	} else {
-		ret = scoutfs_lock_inode(sb, DLM_LOCK_EX,
-				         SCOUTFS_LKF_REFRESH_INODE, dir,
-					 dir_lock) ?:
-		      scoutfs_lock_ino(sb, DLM_LOCK_EX, 0, ino, inode_lock);
-	}
+	ret = scoutfs_lock_ino_pair(sb, DLM_LOCK_EX, 0, ino, inode_lock,
+				    scoutfs_ino(dir), dir_lock) ?:
+	      scoutfs_inode_refresh(dir, *dir_lock, SCOUTFS_LKF_REFRESH_INODE);
 	if (ret)
 		goto out_unlock;
 
@@ -727,7 +827,7 @@ static int scoutfs_mknod(struct inode *dir, struct dentry *dentry, umode_t mode,
 	if (dentry->d_name.len > SCOUTFS_NAME_LEN)
 		return -ENAMETOOLONG;
 
-	hash = dirent_name_hash(dentry->d_name.name, dentry->d_name.len);
+	hash = dirent_name_hash(sb, dentry->d_name.name, dentry->d_name.len);
 	inode = lock_hold_create(dir, dentry, mode, rdev,
 				 SIC_MKNOD(dentry->d_name.len),
 				 &dir_lock, &inode_lock, &ind_locks);
@@ -784,6 +884,143 @@ static int scoutfs_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
 	return scoutfs_mknod(dir, dentry, mode | S_IFDIR, 0);
 }
 
+/*
+ * Create a batch of regular files in one directory for the bulk
+ * create ioctl.  The caller has validated the names and holds the
+ * directory's i_mutex.  Batching amortizes the per-file creation
+ * cost: one pair of cluster locks, one transaction hold sized for the
+ * whole batch, and one contiguous run of inode numbers cover every
+ * file.  Name at index i is at names[i * SCOUTFS_NAME_LEN].
+ *
+ * The files are created without dentries, later lookups find them as
+ * they find files created on other nodes.  The number of files
+ * created is returned and can be short of nr because the inode number
+ * run stops at a lock group boundary.  The whole batch fails before
+ * any items change if a name already exists.
+ */
+int scoutfs_dir_bulk_create(struct inode *dir, umode_t mode,
+			    const char *names, const unsigned *name_lens,
+			    unsigned nr, u64 *inos)
+{
+	struct super_block *sb = dir->i_sb;
+	struct scoutfs_lock *dir_lock = NULL;
+	struct scoutfs_lock *inode_lock = NULL;
+	struct scoutfs_dirent dent;
+	struct inode *inode;
+	LIST_HEAD(ind_locks);
+	struct timespec now;
+	const char *name;
+	unsigned name_bytes = 0;
+	unsigned created = 0;
+	unsigned i;
+	unsigned j;
+	u64 ind_seq;
+	u64 hash;
+	u64 ino;
+	u64 pos;
+	int ret;
+
+	ret = scoutfs_alloc_ino_run(dir, &ino, &nr);
+	if (ret)
+		return ret;
+
+	ret = scoutfs_lock_ino_pair(sb, DLM_LOCK_EX, 0, ino, &inode_lock,
+				    scoutfs_ino(dir), &dir_lock) ?:
+	      scoutfs_inode_refresh(dir, dir_lock, SCOUTFS_LKF_REFRESH_INODE);
+	if (ret)
+		goto out_unlock;
+
+	/* fail the whole batch before creating anything */
+	for (i = 0; i < nr; i++) {
+		name = &names[i * SCOUTFS_NAME_LEN];
+
+		for (j = 0; j < i; j++) {
+			if (dirent_names_equal(name, name_lens[i],
+					       &names[j * SCOUTFS_NAME_LEN],
+					       name_lens[j])) {
+				ret = -EEXIST;
+				goto out_unlock;
+			}
+		}
+
+		hash = dirent_name_hash(sb, name, name_lens[i]);
+		ret = lookup_dirent(sb, scoutfs_ino(dir), name, name_lens[i],
+				    hash, &dent, dir_lock);
+		if (ret != -ENOENT) {
+			if (ret == 0)
+				ret = -EEXIST;
+			goto out_unlock;
+		}
+
+		name_bytes += name_lens[i];
+	}
+
+retry:
+	ret = scoutfs_inode_index_start(sb, &ind_seq) ?:
+	      scoutfs_inode_index_prepare(sb, &ind_locks, dir, true);
+	for (i = 0; ret == 0 && i < nr; i++)
+		ret = scoutfs_inode_index_prepare_ino(sb, &ind_locks,
+						      ino + i, mode);
+	ret = ret ?:
+	      scoutfs_inode_index_try_lock_hold(sb, &ind_locks, ind_seq,
+					SIC_BULK_CREATE(nr, name_bytes));
+	if (ret > 0)
+		goto retry;
+	if (ret < 0)
+		goto out_unlock;
+
+	ret = scoutfs_dirty_inode_item(dir, dir_lock);
+
+	now = CURRENT_TIME;
+
+	for (i = 0; ret == 0 && i < nr; i++) {
+		name = &names[i * SCOUTFS_NAME_LEN];
+		hash = dirent_name_hash(sb, name, name_lens[i]);
+
+		inode = scoutfs_new_inode(sb, dir, mode, 0, ino + i,
+					  inode_lock);
+		if (IS_ERR(inode)) {
+			ret = PTR_ERR(inode);
+			break;
+		}
+
+		pos = SCOUTFS_I(dir)->next_readdir_pos++;
+		ret = add_entry_items(sb, scoutfs_ino(dir), hash, pos, name,
+				      name_lens[i], ino + i, mode, dir_lock,
+				      inode_lock);
+		if (ret) {
+			/* XXX as in mknod, the inode item is leaked */
+			iput(inode);
+			break;
+		}
+
+		i_size_write(dir, i_size_read(dir) + name_lens[i]);
+		inode->i_mtime = inode->i_atime = inode->i_ctime = now;
+
+		scoutfs_update_inode_item(inode, inode_lock, &ind_locks);
+		insert_inode_hash(inode);
+		iput(inode);
+
+		inos[i] = ino + i;
+		created++;
+	}
+
+	if (created) {
+		dir->i_mtime = dir->i_ctime = now;
+		scoutfs_update_inode_item(dir, dir_lock, &ind_locks);
+	}
+
+	scoutfs_release_trans(sb);
+out_unlock:
+	scoutfs_inode_index_unlock(sb, &ind_locks);
+	scoutfs_unlock(sb, dir_lock, DLM_LOCK_EX);
+	scoutfs_unlock(sb, inode_lock, DLM_LOCK_EX);
+
+	if (created)
+		ret = created;
+	return ret;
+}
+
 static int scoutfs_link(struct dentry *old_dentry,
 			struct inode *dir, struct dentry *dentry)
 {
@@ -798,7 +1035,7 @@ static int scoutfs_link(struct dentry *old_dentry,
 	u64 pos;
 	int ret;
 
-	hash = dirent_name_hash(dentry->d_name.name, dentry->d_name.len);
+	hash = dirent_name_hash(sb, dentry->d_name.name, dentry->d_name.len);
 
 	if (dentry->d_name.len > SCOUTFS_NAME_LEN)
 		return -ENAMETOOLONG;
@@ -976,7 +1213,6 @@ static void init_symlink_key(struct scoutfs_key *key, u64 ino, u8 nr)
  */
 enum {
 	SYM_CREATE = 0,
-	SYM_LOOKUP,
 	SYM_DELETE,
 };
 static int symlink_item_ops(struct super_block *sb, int op, u64 ino,
@@ -1003,8 +1239,6 @@ static int symlink_item_ops(struct super_block *sb, int op, u64 ino,
 
 		if (op == SYM_CREATE)
 			ret = scoutfs_item_create(sb, &key, &val, lock);
-		else if (op == SYM_LOOKUP)
-			ret = scoutfs_item_lookup_exact(sb, &key, &val, lock);
 		else if (op == SYM_DELETE)
 			ret = scoutfs_item_delete(sb, &key, lock);
 		if (ret)
@@ -1018,22 +1252,114 @@ static int symlink_item_ops(struct super_block *sb, int op, u64 ino,
 }
 
 /*
- * Full a buffer with the null terminated symlink, point nd at it, and
- * return it so put_link can free it once the vfs is done.
+ * Assemble a multi-item symlink target into the caller's buffer with
+ * batched item copies instead of a locked item search per part.  The
+ * batch buffer has room for every part so cached targets are copied
+ * out in a single item call.
+ *
+ * Returns -ENOENT if the first part is missing and -EIO if the items
+ * don't cover the inode's size.
+ */
+static int read_symlink_items(struct super_block *sb, u64 ino,
+			      struct scoutfs_lock *lock, char *target,
+			      size_t size)
+{
+	struct scoutfs_item_batch_entry *ent;
+	struct scoutfs_key key;
+	struct scoutfs_key last;
+	unsigned int batch_bytes;
+	unsigned int nr;
+	size_t total = 0;
+	unsigned int i = 0;
+	void *buf;
+	int n;
+	int j;
+	int ret;
+
+	nr = DIV_ROUND_UP(size, SCOUTFS_MAX_VAL_SIZE);
+	init_symlink_key(&last, ino, nr - 1);
+
+	batch_bytes = size + (nr * scoutfs_item_batch_entry_bytes(0));
+	buf = kmalloc(batch_bytes, GFP_NOFS);
+	if (!buf)
+		return -ENOMEM;
+
+	while (i < nr) {
+		init_symlink_key(&key, ino, i);
+		ret = scoutfs_item_next_batch(sb, &key, &last, buf,
+					      batch_bytes, lock);
+		if (ret < 0) {
+			/* a missing later part is corruption */
+			if (ret == -ENOENT && i > 0)
+				ret = -EIO;
+			goto out;
+		}
+
+		n = ret;
+		ent = buf;
+		for (j = 0; j < n; j++) {
+			init_symlink_key(&key, ino, i);
+			if (scoutfs_key_compare(&ent->key, &key) != 0 ||
+			    ent->val_len > size - total) {
+				ret = -EIO;
+				goto out;
+			}
+
+			memcpy(target + total, ent->val, ent->val_len);
+			total += ent->val_len;
+			i++;
+			ent = scoutfs_item_batch_entry_next(ent);
+		}
+	}
+
+	ret = total == size ? 0 : -EIO;
+out:
+	kfree(buf);
+	return ret;
+}
+
+/* follow_link's cookie, freed by put_link once the vfs is done */
+struct symlink_cookie {
+	struct scoutfs_item_ref ref;
+	char *buf;
+};
+
+/*
+ * Point nd at the null terminated symlink target and return a cookie
+ * that put_link frees once the vfs is done.
  *
- * We chose to pay the runtime cost of per-call allocation and copy
- * overhead instead of wiring up symlinks to the page cache, storing
- * each small link in a full page, and later having to reclaim them.
+ * Targets are immutable once the symlink is created so the first read
+ * caches them in the inode and repeated traversals just dereference
+ * the cached copy without locking or item reads.
+ *
+ * When reading, links that fit in a single item reference the item
+ * cache's stable value allocation directly instead of being copied
+ * out.  Longer links that span multiple items are assembled into an
+ * allocated buffer with a batched item copy.
  */
 static void *scoutfs_follow_link(struct dentry *dentry, struct nameidata *nd)
 {
 	struct inode *inode = dentry->d_inode;
 	struct super_block *sb = inode->i_sb;
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
 	struct scoutfs_lock *inode_lock = NULL;
+	struct symlink_cookie *ck = NULL;
+	struct scoutfs_key key;
+	char *cached;
 	char *path = NULL;
 	loff_t size;
 	int ret;
 
+	/* the cached target is stable until the inode is destroyed */
+	spin_lock(&si->symlink_cache_lock);
+	if (si->cached_symlink) {
+		nd_set_link(nd, si->cached_symlink);
+		spin_unlock(&si->symlink_cache_lock);
+		scoutfs_inc_counter(sb, symlink_cache_hit);
+		return NULL;
+	}
+	spin_unlock(&si->symlink_cache_lock);
+
 	ret = scoutfs_lock_inode(sb, DLM_LOCK_PR, SCOUTFS_LKF_REFRESH_INODE,
 				 inode, &inode_lock);
 	if (ret)
@@ -1056,14 +1382,31 @@ static void *scoutfs_follow_link(struct dentry *dentry, struct nameidata *nd)
 		goto out;
 	}
 
-	path = kmalloc(size, GFP_NOFS);
-	if (!path) {
+	ck = kzalloc(sizeof(struct symlink_cookie), GFP_NOFS);
+	if (!ck) {
 		ret = -ENOMEM;
 		goto out;
 	}
 
-	ret = symlink_item_ops(sb, SYM_LOOKUP, scoutfs_ino(inode), inode_lock,
-			       path, size);
+	if (size <= SCOUTFS_MAX_VAL_SIZE) {
+		init_symlink_key(&key, scoutfs_ino(inode), 0);
+		ret = scoutfs_item_lookup_ref(sb, &key, &ck->ref, inode_lock);
+		if (ret >= 0 && ret != size)
+			ret = -EIO;
+		else if (ret > 0)
+			ret = 0;
+		path = ck->ref.val.iov_base;
+	} else {
+		ck->buf = kmalloc(size, GFP_NOFS);
+		if (!ck->buf) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		ret = read_symlink_items(sb, scoutfs_ino(inode), inode_lock,
+					 ck->buf, size);
+		path = ck->buf;
+	}
 
 	if (ret == -ENOENT) {
 		scoutfs_corruption(sb, SC_SYMLINK_MISSING_ITEM,
@@ -1082,20 +1425,41 @@ static void *scoutfs_follow_link(struct dentry *dentry, struct nameidata *nd)
 
 out:
 	if (ret < 0) {
-		kfree(path);
-		path = ERR_PTR(ret);
+		if (ck) {
+			scoutfs_item_put_ref(&ck->ref);
+			kfree(ck->buf);
+			kfree(ck);
+		}
+		ck = ERR_PTR(ret);
 	} else {
+		/* cache a copy of the target for future traversals */
+		cached = kmalloc(size, GFP_NOFS);
+		if (cached) {
+			memcpy(cached, path, size);
+			spin_lock(&si->symlink_cache_lock);
+			if (!si->cached_symlink) {
+				si->cached_symlink = cached;
+				cached = NULL;
+			}
+			spin_unlock(&si->symlink_cache_lock);
+			kfree(cached);
+		}
 		nd_set_link(nd, path);
 	}
 	scoutfs_unlock(sb, inode_lock, DLM_LOCK_PR);
-	return path;
+	return ck;
 }
 
 static void scoutfs_put_link(struct dentry *dentry, struct nameidata *nd,
 			     void *cookie)
 {
-	if (!IS_ERR_OR_NULL(cookie))
-		kfree(cookie);
+	struct symlink_cookie *ck = cookie;
+
+	if (!IS_ERR_OR_NULL(ck)) {
+		scoutfs_item_put_ref(&ck->ref);
+		kfree(ck->buf);
+		kfree(ck);
+	}
 }
 
 const struct inode_operations scoutfs_symlink_iops = {
@@ -1127,7 +1491,7 @@ static int scoutfs_symlink(struct inode *dir, struct dentry *dentry,
 	u64 pos;
 	int ret;
 
-	hash = dirent_name_hash(dentry->d_name.name, dentry->d_name.len);
+	hash = dirent_name_hash(sb, dentry->d_name.name, dentry->d_name.len);
 
 	/* path_max includes null as does our value for nd_set_link */
 	if (dentry->d_name.len > SCOUTFS_NAME_LEN ||
@@ -1202,6 +1566,243 @@ int scoutfs_symlink_drop(struct super_block *sb, u64 ino,
 	return ret;
 }
 
+/*
+ * Path resolution walks link backref items from an inode up through its
+ * parent directories with an item lookup and a lock acquisition per
+ * component.  Consumers resolve paths for enormous batches of inodes
+ * that share deep common directory prefixes so we cache each
+ * directory's first backref as it's resolved.  A cached entry is only
+ * used while the lock that covered its backref item still covers it,
+ * which catches other nodes modifying the directory's entries, and
+ * local entry creation and deletion invalidates the inode's cached
+ * backref directly.
+ */
+
+#define BACKREF_CACHE_HT_BITS	9
+#define BACKREF_CACHE_HT_NR	(1 << BACKREF_CACHE_HT_BITS)
+#define BACKREF_CACHE_MAX_NR	4096
+
+struct backref_cache_entry {
+	struct hlist_node hnode;
+	struct list_head lru_head;
+	struct scoutfs_lock_coverage cov;
+	u64 ino;
+	u64 dir_ino;
+	u64 dir_pos;
+	u16 name_len;
+	struct scoutfs_dirent dent;
+	/* the full name is allocated and stored in dent.name[0] */
+};
+
+struct dir_info {
+	spinlock_t lock;
+	struct hlist_head ht[BACKREF_CACHE_HT_NR];
+	struct list_head lru;
+	unsigned int nr;
+};
+
+#define DECLARE_DIR_INFO(sb, name) \
+	struct dir_info *name = SCOUTFS_SB(sb)->dir_info
+
+static struct backref_cache_entry *backref_cache_search(struct dir_info *di,
+							u64 ino)
+{
+	struct backref_cache_entry *ent;
+	struct hlist_head *head = &di->ht[hash_64(ino, BACKREF_CACHE_HT_BITS)];
+
+	hlist_for_each_entry(ent, head, hnode) {
+		if (ent->ino == ino)
+			return ent;
+	}
+
+	return NULL;
+}
+
+static void backref_cache_erase(struct dir_info *di,
+				struct backref_cache_entry *ent)
+{
+	assert_spin_locked(&di->lock);
+
+	hlist_del(&ent->hnode);
+	list_del(&ent->lru_head);
+	di->nr--;
+}
+
+static void backref_cache_free(struct super_block *sb,
+			       struct backref_cache_entry *ent)
+{
+	scoutfs_lock_del_coverage(sb, &ent->cov);
+	kfree(ent);
+}
+
+/*
+ * Cache a copy of an inode's first backref that was just read under the
+ * still held lock.  The coverage tie to the lock is what lets lookups
+ * trust the entry later without acquiring the lock again.  This is only
+ * an optimization so allocation failure just means we don't cache.
+ */
+static void backref_cache_insert(struct super_block *sb,
+				 struct scoutfs_lock *lock, u64 ino,
+				 struct scoutfs_link_backref_entry *lent)
+{
+	DECLARE_DIR_INFO(sb, di);
+	struct backref_cache_entry *evict = NULL;
+	struct backref_cache_entry *old;
+	struct backref_cache_entry *ent;
+
+	ent = kmalloc(offsetof(struct backref_cache_entry,
+			       dent.name[lent->name_len]), GFP_NOFS);
+	if (!ent)
+		return;
+
+	ent->ino = ino;
+	ent->dir_ino = lent->dir_ino;
+	ent->dir_pos = lent->dir_pos;
+	ent->name_len = lent->name_len;
+	memcpy(&ent->dent, &lent->dent, dirent_bytes(lent->name_len));
+	scoutfs_lock_init_coverage(&ent->cov);
+	scoutfs_lock_add_coverage(sb, lock, &ent->cov);
+
+	spin_lock(&di->lock);
+
+	old = backref_cache_search(di, ino);
+	if (old)
+		backref_cache_erase(di, old);
+
+	hlist_add_head(&ent->hnode,
+		       &di->ht[hash_64(ino, BACKREF_CACHE_HT_BITS)]);
+	list_add(&ent->lru_head, &di->lru);
+	di->nr++;
+
+	if (di->nr > BACKREF_CACHE_MAX_NR) {
+		evict = list_last_entry(&di->lru, struct backref_cache_entry,
+					lru_head);
+		backref_cache_erase(di, evict);
+	}
+
+	spin_unlock(&di->lock);
+
+	if (old)
+		backref_cache_free(sb, old);
+	if (evict)
+		backref_cache_free(sb, evict);
+}
+
+/*
+ * Add the cached first backref for the inode to the head of the
+ * caller's list, as though it'd been read from the item.  Returns
+ * -ENOENT if there's no trustworthy cached entry and the caller falls
+ * back to reading the item.  Entries whose lock coverage was lost are
+ * dropped as we find them.
+ */
+static int backref_cache_add_entry(struct super_block *sb, u64 ino,
+				   struct list_head *list)
+{
+	DECLARE_DIR_INFO(sb, di);
+	struct scoutfs_link_backref_entry *lent;
+	struct backref_cache_entry *stale = NULL;
+	struct backref_cache_entry *ent;
+	int ret = -ENOENT;
+
+	lent = kmalloc(offsetof(struct scoutfs_link_backref_entry,
+				dent.name[SCOUTFS_NAME_LEN]), GFP_KERNEL);
+	if (!lent)
+		return -ENOMEM;
+	INIT_LIST_HEAD(&lent->head);
+
+	spin_lock(&di->lock);
+
+	ent = backref_cache_search(di, ino);
+	if (ent) {
+		if (scoutfs_lock_is_covered(sb, &ent->cov)) {
+			lent->dir_ino = ent->dir_ino;
+			lent->dir_pos = ent->dir_pos;
+			lent->name_len = ent->name_len;
+			memcpy(&lent->dent, &ent->dent,
+			       dirent_bytes(ent->name_len));
+			list_move(&ent->lru_head, &di->lru);
+			ret = 0;
+		} else {
+			backref_cache_erase(di, ent);
+			stale = ent;
+		}
+	}
+
+	spin_unlock(&di->lock);
+
+	if (stale)
+		backref_cache_free(sb, stale);
+
+	if (ret == 0) {
+		list_add(&lent->head, list);
+		scoutfs_inc_counter(sb, dir_backref_cache_hit);
+	} else {
+		kfree(lent);
+	}
+
+	return ret;
+}
+
+/*
+ * Local creation or deletion of an entry to the inode changes its
+ * backref items under locks we already hold, which coverage won't
+ * catch, so the paths that modify entry items drop the cached backref.
+ */
+static void backref_cache_invalidate(struct super_block *sb, u64 ino)
+{
+	DECLARE_DIR_INFO(sb, di);
+	struct backref_cache_entry *ent;
+
+	spin_lock(&di->lock);
+	ent = backref_cache_search(di, ino);
+	if (ent)
+		backref_cache_erase(di, ent);
+	spin_unlock(&di->lock);
+
+	if (ent)
+		backref_cache_free(sb, ent);
+}
+
+int scoutfs_dir_setup(struct super_block *sb)
+{
+	struct dir_info *di;
+	int i;
+
+	di = kzalloc(sizeof(struct dir_info), GFP_KERNEL);
+	if (!di)
+		return -ENOMEM;
+
+	spin_lock_init(&di->lock);
+	INIT_LIST_HEAD(&di->lru);
+	for (i = 0; i < BACKREF_CACHE_HT_NR; i++)
+		INIT_HLIST_HEAD(&di->ht[i]);
+
+	SCOUTFS_SB(sb)->dir_info = di;
+
+	return 0;
+}
+
+void scoutfs_dir_destroy(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct dir_info *di = sbi->dir_info;
+	struct backref_cache_entry *ent;
+
+	if (!di)
+		return;
+
+	while (!list_empty(&di->lru)) {
+		ent = list_first_entry(&di->lru, struct backref_cache_entry,
+				       lru_head);
+		hlist_del(&ent->hnode);
+		list_del(&ent->lru_head);
+		backref_cache_free(sb, ent);
+	}
+
+	kfree(di);
+	sbi->dir_info = NULL;
+}
+
 /*
  * Find the next link backref key for the given ino starting from the
  * given dir inode and final entry position.  If we find a backref item
@@ -1244,8 +1845,6 @@ int scoutfs_dir_add_next_linkref(struct super_block *sb, u64 ino,
 		goto out;
 
 	ret = scoutfs_item_next(sb, &key, &last_key, &val, lock);
-	scoutfs_unlock(sb, lock, DLM_LOCK_PR);
-	lock = NULL;
 	if (ret < 0)
 		goto out;
 
@@ -1263,8 +1862,14 @@ int scoutfs_dir_add_next_linkref(struct super_block *sb, u64 ino,
 	ent->dir_ino = le64_to_cpu(key.skd_major);
 	ent->dir_pos = le64_to_cpu(key.skd_minor);
 	ent->name_len = len;
+
+	/* cache an inode's first backref while we still hold its lock */
+	if (dir_ino == 0 && dir_pos == 0)
+		backref_cache_insert(sb, lock, ino, ent);
+
 	ret = 0;
 out:
+	scoutfs_unlock(sb, lock, DLM_LOCK_PR);
 	trace_scoutfs_dir_add_next_linkref(sb, ino, dir_ino, dir_pos, ret,
 					   ent ? ent->dir_ino : 0,
 					   ent ? ent->dir_pos : 0,
@@ -1355,7 +1960,10 @@ retry:
 	par_ino = first_backref_dir_ino(list);
 	while (par_ino != SCOUTFS_ROOT_INO) {
 
-		ret = scoutfs_dir_add_next_linkref(sb, par_ino, 0, 0, list);
+		ret = backref_cache_add_entry(sb, par_ino, list);
+		if (ret == -ENOENT)
+			ret = scoutfs_dir_add_next_linkref(sb, par_ino, 0, 0,
+							   list);
 		if (ret < 0) {
 			if (ret == -ENOENT) {
 				/* restart if there was no parent component */
@@ -1514,9 +2122,9 @@ static int scoutfs_rename(struct inode *old_dir, struct dentry *old_dentry,
 
 	trace_scoutfs_rename(sb, old_dir, old_dentry, new_dir, new_dentry);
 
-	old_hash = dirent_name_hash(old_dentry->d_name.name,
+	old_hash = dirent_name_hash(sb, old_dentry->d_name.name,
 				    old_dentry->d_name.len);
-	new_hash = dirent_name_hash(new_dentry->d_name.name,
+	new_hash = dirent_name_hash(sb, new_dentry->d_name.name,
 				    new_dentry->d_name.len);
 
 	if (new_dentry->d_name.len > SCOUTFS_NAME_LEN)
@@ -29,6 +29,13 @@ int scoutfs_dir_add_next_linkref(struct super_block *sb, u64 ino,
 int scoutfs_symlink_drop(struct super_block *sb, u64 ino,
 			 struct scoutfs_lock *lock, u64 i_size);
 
+int scoutfs_dir_bulk_create(struct inode *dir, umode_t mode,
+			    const char *names, const unsigned *name_lens,
+			    unsigned nr, u64 *inos);
+
+int scoutfs_dir_setup(struct super_block *sb);
+void scoutfs_dir_destroy(struct super_block *sb);
+
 int scoutfs_dir_init(void);
 void scoutfs_dir_exit(void);
 
@@ -28,8 +28,13 @@
 #include "file.h"
 #include "inode.h"
 #include "per_task.h"
+#include "counters.h"
 
-/* TODO: Direct I/O, AIO */
+/*
+ * The generic read path calls the direct_IO aop in data.c for O_DIRECT
+ * requests; we just wrap it in the cluster lock and per-task lock entry
+ * that get_block needs.
+ */
 ssize_t scoutfs_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 			      unsigned long nr_segs, loff_t pos)
 {
@@ -46,6 +51,13 @@ ssize_t scoutfs_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 	if (ret == 0) {
 		scoutfs_per_task_add(&si->pt_data_lock, &pt_ent, inode_lock);
 		ret = generic_file_aio_read(iocb, iov, nr_segs, pos);
+		/*
+		 * Async O_DIRECT reads can return with bios in flight.
+		 * The lock fences our data IO from other nodes so we
+		 * have to wait for completion before dropping it.
+		 */
+		if (file->f_flags & O_DIRECT)
+			inode_dio_wait(inode);
 		scoutfs_per_task_del(&si->pt_data_lock, &pt_ent);
 		scoutfs_unlock(sb, inode_lock, DLM_LOCK_PR);
 	}
@@ -53,6 +65,35 @@ ssize_t scoutfs_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 	return ret;
 }
 
+/*
+ * A block aligned direct write that lands entirely inside i_size
+ * doesn't change the inode fields that i_mutex protects and doesn't
+ * work through the page cache, so it doesn't need i_mutex held across
+ * submission.  Unaligned writes are excluded because the generic path
+ * falls back to buffered writes for them.
+ */
+static bool dio_write_overwrites(struct file *file, struct inode *inode,
+				 const struct iovec *iov,
+				 unsigned long nr_segs, loff_t pos)
+{
+	unsigned long mask = SCOUTFS_BLOCK_MASK;
+	size_t count = iov_length(iov, nr_segs);
+	unsigned long i;
+
+	if (((file->f_flags & (O_DIRECT | O_APPEND)) != O_DIRECT) ||
+	    inode->i_mapping->nrpages != 0 ||
+	    pos + count > i_size_read(inode) ||
+	    ((pos | count) & mask))
+		return false;
+
+	for (i = 0; i < nr_segs; i++) {
+		if (((unsigned long)iov[i].iov_base | iov[i].iov_len) & mask)
+			return false;
+	}
+
+	return true;
+}
+
 ssize_t scoutfs_file_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			       unsigned long nr_segs, loff_t pos)
 {
@@ -62,6 +103,9 @@ ssize_t scoutfs_file_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	struct super_block *sb = inode->i_sb;
 	struct scoutfs_lock *inode_lock = NULL;
 	SCOUTFS_DECLARE_PER_TASK_ENTRY(pt_ent);
+	bool shared = false;
+	size_t ocount = 0;
+	size_t count;
 	int ret;
 
 	if (iocb->ki_left == 0) /* Does this even happen? */
@@ -81,11 +125,72 @@ ssize_t scoutfs_file_aio_write(struct kiocb *iocb, const struct iovec *iov,
 
 	/* XXX: remove SUID bit */
 
-	ret = __generic_file_aio_write(iocb, iov, nr_segs, &iocb->ki_pos);
+	/*
+	 * Direct overwrites can run concurrently on this node, like
+	 * reads.  All the writing tasks share the granted EX lock,
+	 * extent allocation during block mapping is serialized by
+	 * alloc_mutex, and paths that check the data version or free
+	 * extents drain us with scoutfs_inode_wait_dio_writers().  We
+	 * only drop i_mutex once the generic checks that reference
+	 * inode fields are done.
+	 */
+	if (dio_write_overwrites(file, inode, iov, nr_segs, pos)) {
+		ret = generic_segment_checks(iov, &nr_segs, &ocount,
+					     VERIFY_READ);
+		if (ret)
+			goto out;
+		count = ocount;
+		ret = generic_write_checks(file, &pos, &count,
+					   S_ISBLK(inode->i_mode));
+		if (ret)
+			goto out;
+
+		if (count && pos + count <= i_size_read(inode)) {
+			ret = file_remove_suid(file);
+			if (ret == 0)
+				ret = file_update_time(file);
+			if (ret)
+				goto out;
+
+			down_read(&si->dio_rwsem);
+			shared = true;
+			mutex_unlock(&inode->i_mutex);
+			scoutfs_inc_counter(sb, file_write_dio_shared);
+		}
+	}
+
+	if (shared)
+		ret = generic_file_direct_write(iocb, iov, &nr_segs, pos,
+						&iocb->ki_pos, count, ocount);
+	else
+		ret = __generic_file_aio_write(iocb, iov, nr_segs,
+					       &iocb->ki_pos);
+
+	/*
+	 * Direct writes bypass write_begin and write_end so we update
+	 * the data version and inode item after the write.  Async
+	 * requests can return with bios still in flight, but the EX
+	 * lock fences our data IO from other nodes and the updated
+	 * item has to describe completed data, so we wait for
+	 * completion before updating and before the unlock below.
+	 * Async requests that would extend i_size are forced sync by
+	 * the generic path so the vfs inode is always current here.
+	 */
+	if ((ret > 0 || ret == -EIOCBQUEUED) && (file->f_flags & O_DIRECT)) {
+		ssize_t err;
+
+		inode_dio_wait(inode);
+		err = scoutfs_data_direct_written(inode, inode_lock);
+		if (err < 0)
+			ret = err;
+	}
 out:
 	scoutfs_per_task_del(&si->pt_data_lock, &pt_ent);
 	scoutfs_unlock(sb, inode_lock, DLM_LOCK_EX);
-	mutex_unlock(&inode->i_mutex);
+	if (shared)
+		up_read(&si->dio_rwsem);
+	else
+		mutex_unlock(&inode->i_mutex);
 
 	if (ret > 0 || ret == -EIOCBQUEUED) {
 		ssize_t err;
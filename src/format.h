@@ -18,16 +18,15 @@
 #define SCOUTFS_BLOCK_MAX (U64_MAX >> SCOUTFS_BLOCK_SHIFT)
 
 /*
- * FS data is stored in segments, for now they're fixed size. They'll
- * be dynamic.
+ * FS data is stored in segments.  The segment size is chosen per
+ * volume at mkfs time and carried in the super block, mounts read it
+ * and derive their segment geometry from it at runtime.  The bounds
+ * keep the first crc chunk large enough to cover the segment block
+ * header and keep page pointer arrays reasonably sized.
  */
-#define SCOUTFS_SEGMENT_SHIFT 20
-#define SCOUTFS_SEGMENT_SIZE (1 << SCOUTFS_SEGMENT_SHIFT)
-#define SCOUTFS_SEGMENT_MASK (SCOUTFS_SEGMENT_SIZE - 1)
-#define SCOUTFS_SEGMENT_PAGES (SCOUTFS_SEGMENT_SIZE / PAGE_SIZE)
-#define SCOUTFS_SEGMENT_BLOCKS (SCOUTFS_SEGMENT_SIZE / SCOUTFS_BLOCK_SIZE)
-#define SCOUTFS_SEGMENT_BLOCK_SHIFT \
-		(SCOUTFS_SEGMENT_SHIFT - SCOUTFS_BLOCK_SHIFT)
+#define SCOUTFS_SEGMENT_SHIFT_MIN 17
+#define SCOUTFS_SEGMENT_SHIFT_DEFAULT 20
+#define SCOUTFS_SEGMENT_SHIFT_MAX 24
 
 #define SCOUTFS_PAGES_PER_BLOCK (SCOUTFS_BLOCK_SIZE / PAGE_SIZE)
 #define SCOUTFS_BLOCK_PAGE_ORDER (SCOUTFS_BLOCK_SHIFT - PAGE_SHIFT)
@@ -252,17 +251,50 @@ struct scoutfs_extent_btree_key {
  */
 #define SCOUTFS_MAX_SKIP_LINKS 32
 
+/*
+ * Each segment's block header contains a bloom filter which is set for
+ * every item key in the segment, including deletion items.  The filter
+ * is sized so that the segment block header fits in the first few
+ * blocks of the segment.  Readers can test the filter with a small
+ * header read instead of reading the entire segment.  Typical segment
+ * item counts and seven bits per key give a false positive rate well
+ * under a percent.
+ */
+/*
+ * Segment contents are checksummed in chunks so that verification can
+ * be spread across CPUs.  The number of chunks is fixed and the chunk
+ * size scales with the volume's segment size so that the segment block
+ * header layout doesn't depend on the segment size.  The first chunk's
+ * crc skips the segment block header which is covered by the header
+ * crc.
+ */
+#define SCOUTFS_SEG_NR_CHUNKS_SHIFT 3
+#define SCOUTFS_SEG_NR_CHUNKS (1 << SCOUTFS_SEG_NR_CHUNKS_SHIFT)
+
+#define SCOUTFS_SEG_BLOOM_BLOCKS 4
+#define SCOUTFS_SEG_BLOOM_LONGS 2016
+#define SCOUTFS_SEG_BLOOM_BITS (SCOUTFS_SEG_BLOOM_LONGS * 64)
+#define SCOUTFS_SEG_BLOOM_NRS 7
+
 /*
  * Items are packed into segments and linked together in a skip list.
- * Each item's header, links, key, and value are stored contiguously.
- * They're not allowed to cross a block boundary.
+ * Each item's header, links, key suffix, and value are stored
+ * contiguously.  They're not allowed to cross a block boundary.
+ *
+ * Item keys are prefix compressed against the full key stored by the
+ * first item in their block.  key_pfx is the number of leading key
+ * bytes that are shared with the block's first key, only the remaining
+ * suffix bytes are stored.  The first item in each block stores its
+ * whole key with a key_pfx of 0 so that any item can be decoded with
+ * only its block's contents.
  */
 struct scoutfs_segment_item {
-	struct scoutfs_key key;
 	__le16 val_len;
 	__u8 flags;
 	__u8 nr_links;
+	__u8 key_pfx;
 	__le32 skip_links[0];
+	/* __u8 key_bytes[sizeof(struct scoutfs_key) - key_pfx] */
 	/* __u8 val_bytes[val_len] */
 } __packed;
 
@@ -272,8 +304,9 @@ struct scoutfs_segment_item {
  * Each large segment starts with a segment block that describes the
  * rest of the blocks that make up the segment.
  *
- * The crc covers the initial total_bytes of the segment but starts
- * after the padding.
+ * The crc covers the rest of the header starting after the padding.
+ * The chunk crcs each cover their chunk of the remaining total_bytes of
+ * the segment.
  */
 struct scoutfs_segment_block {
 	__le32 crc;
@@ -284,6 +317,9 @@ struct scoutfs_segment_block {
 	__le32 total_bytes;
 	__le32 nr_items;
 	__le32 skip_links[SCOUTFS_MAX_SKIP_LINKS];
+	__le32 chunk_crcs[SCOUTFS_SEG_NR_CHUNKS];
+	__le32 _bloom_pad;
+	__le64 bloom[SCOUTFS_SEG_BLOOM_LONGS];
 	/* packed items */
 } __packed;
 
@@ -365,6 +401,7 @@ struct scoutfs_super_block {
 	__le64 next_seq;
 	__le64 total_blocks;
 	__le64 free_blocks;
+	__le64 segment_shift;
 	__le64 alloc_cursor;
 	struct scoutfs_btree_ring bring;
 	__le64 next_seg_seq;
@@ -544,6 +581,7 @@ enum {
 	SCOUTFS_NET_CMD_ALLOC_EXTENT,
 	SCOUTFS_NET_CMD_FREE_EXTENTS,
 	SCOUTFS_NET_CMD_ALLOC_SEGNO,
+	SCOUTFS_NET_CMD_ALLOC_SEGNOS,
 	SCOUTFS_NET_CMD_RECORD_SEGMENT,
 	SCOUTFS_NET_CMD_ADVANCE_SEQ,
 	SCOUTFS_NET_CMD_GET_LAST_SEQ,
@@ -576,6 +614,16 @@ enum {
 /* arbitrarily chosen to be safely less than mss and allow 1k with header */
 #define SCOUTFS_NET_MAX_DATA_LEN 1100
 
+/*
+ * dir_ino gives the directory that the inodes will be created in so
+ * that the server can grant numbers from that directory's region and
+ * cluster its inodes in key space across nodes.
+ */
+struct scoutfs_net_inode_alloc_args {
+	__le64 count;
+	__le64 dir_ino;
+} __packed;
+
 /*
  * When there's no more free inodes this will be sent with ino = ~0 and
  * nr = 0.
@@ -625,6 +673,21 @@ struct scoutfs_net_extent_list {
 /* arbitrarily makes a nice ~1k extent list payload */
 #define SCOUTFS_NET_EXTENT_LIST_MAX_NR	64
 
+/*
+ * A batch of segnos granted to a node.  The server can return fewer
+ * segnos than were asked for, nr == 0 when it's out of space.
+ */
+struct scoutfs_net_segnos {
+	__le64 nr;
+	__le64 segnos[0];
+} __packed;
+
+#define SCOUTFS_NET_SEGNOS_BYTES(nr) \
+	offsetof(struct scoutfs_net_segnos, segnos[nr])
+
+/* bounds the segments a node can hold idle in its pool */
+#define SCOUTFS_NET_SEGNOS_MAX_NR	16
+
 /* one upper segment and fanout lower segments */
 #define SCOUTFS_COMPACTION_MAX_INPUT        (1 + SCOUTFS_MANIFEST_FANOUT)
 /* sticky can split the input and item alignment padding can add a lower */
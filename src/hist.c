@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2017 Versity Software, Inc.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+
+#include "super.h"
+#include "sysfs.h"
+#include "hist.h"
+
+/*
+ * Maintain percpu log2 bucketed latency histograms next to the
+ * counters.  Recording ticks the bucket for the most significant bit
+ * of a nanosecond duration.  Reading a histogram file sums the percpu
+ * buckets and prints a line with each hit bucket's floor in
+ * nanoseconds and its count, so tail latencies can be read straight
+ * off production mounts.
+ */
+
+#undef EXPAND_HIST
+#define EXPAND_HIST(which) { .name = __stringify(which), .mode = 0444 },
+static struct attribute scoutfs_hist_attrs[] = {
+	EXPAND_EACH_HIST
+};
+
+/* zero BSS and + 1 makes this null terminated */
+#define NR_ATTRS ARRAY_SIZE(scoutfs_hist_attrs)
+static struct attribute *scoutfs_hist_attr_ptrs[NR_ATTRS + 1];
+
+void scoutfs_hist_record(struct scoutfs_hist *hist, u64 ns)
+{
+	int bucket = ns ? fls64(ns) - 1 : 0;
+
+	preempt_disable();
+	this_cpu_ptr(hist->buckets)[bucket]++;
+	preempt_enable();
+}
+
+static ssize_t scoutfs_hist_attr_show(struct kobject *kobj,
+				      struct attribute *attr, char *buf)
+{
+	struct scoutfs_hists *hists;
+	struct scoutfs_hist *hist;
+	ssize_t ret = 0;
+	size_t index;
+	u64 total;
+	int cpu;
+	int i;
+
+	/* use the index in the _attrs array to discover the hist pointer */
+	hists = container_of(kobj, struct scoutfs_hists, kobj);
+	index = attr - scoutfs_hist_attrs;
+	hist = &hists->FIRST_HIST + index;
+
+	for (i = 0; i < SCOUTFS_HIST_NR_BUCKETS; i++) {
+		total = 0;
+		for_each_possible_cpu(cpu)
+			total += per_cpu_ptr(hist->buckets, cpu)[i];
+		if (total)
+			ret += snprintf(buf + ret, PAGE_SIZE - ret,
+					"%llu %llu\n",
+					i ? 1ULL << i : 0, total);
+	}
+
+	return ret;
+}
+
+static void scoutfs_hists_kobj_release(struct kobject *kobj)
+{
+	struct scoutfs_hists *hists;
+
+	hists = container_of(kobj, struct scoutfs_hists, kobj);
+
+	complete(&hists->comp);
+}
+
+static const struct sysfs_ops scoutfs_hist_attr_ops = {
+	.show   = scoutfs_hist_attr_show,
+};
+
+static struct kobj_type scoutfs_hists_ktype = {
+	.default_attrs  = scoutfs_hist_attr_ptrs,
+	.sysfs_ops      = &scoutfs_hist_attr_ops,
+	.release        = scoutfs_hists_kobj_release,
+};
+
+int scoutfs_setup_hists(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct scoutfs_hists *hists;
+	struct scoutfs_hist *hist;
+	int ret = 0;
+
+	hists = kzalloc(sizeof(struct scoutfs_hists), GFP_KERNEL);
+	if (!hists)
+		return -ENOMEM;
+	sbi->hists = hists;
+
+	scoutfs_foreach_hist(sb, hist) {
+		hist->buckets = __alloc_percpu(SCOUTFS_HIST_NR_BUCKETS *
+					       sizeof(u64), __alignof__(u64));
+		if (!hist->buckets) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	init_completion(&hists->comp);
+	ret = kobject_init_and_add(&hists->kobj, &scoutfs_hists_ktype,
+				   scoutfs_sysfs_sb_dir(sb), "hists");
+out:
+	if (ret) {
+		/* free_percpu is fine with buckets that weren't allocated */
+		scoutfs_foreach_hist(sb, hist)
+			free_percpu(hist->buckets);
+		kfree(hists);
+		sbi->hists = NULL;
+	}
+
+	return ret;
+}
+
+void scoutfs_destroy_hists(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct scoutfs_hists *hists = sbi->hists;
+	struct scoutfs_hist *hist;
+
+	/* this only destroys fully initialized hists */
+	if (!hists)
+		return;
+
+	kobject_del(&hists->kobj);
+	kobject_put(&hists->kobj);
+	wait_for_completion(&hists->comp);
+
+	scoutfs_foreach_hist(sb, hist)
+		free_percpu(hist->buckets);
+
+	kfree(hists);
+	sbi->hists = NULL;
+}
+
+void __init scoutfs_init_hists(void)
+{
+	int i;
+
+	/* not ARRAY_SIZE because that would clobber null term */
+	for (i = 0; i < NR_ATTRS; i++)
+		scoutfs_hist_attr_ptrs[i] = &scoutfs_hist_attrs[i];
+}
@@ -0,0 +1,61 @@
+#ifndef _SCOUTFS_HIST_H_
+#define _SCOUTFS_HIST_H_
+
+#include <linux/kobject.h>
+#include <linux/completion.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+
+#include "super.h"
+
+/*
+ * Lightweight percpu latency histograms alongside the counters.  Each
+ * recorded duration in nanoseconds adds a tick to the bucket for its
+ * most significant bit.  We only have to define each histogram here and
+ * it'll be enumerated in other places by this macro.  Don't forget to
+ * update LAST_HIST.
+ */
+#define EXPAND_EACH_HIST				\
+	EXPAND_HIST(lock_inode_grant)			\
+	EXPAND_HIST(net_sync_request)			\
+	EXPAND_HIST(seg_read_wait)			\
+	EXPAND_HIST(trans_commit)			\
+	EXPAND_HIST(trans_hold)
+
+#define FIRST_HIST	lock_inode_grant
+#define LAST_HIST	trans_hold
+
+#define SCOUTFS_HIST_NR_BUCKETS	64
+
+struct scoutfs_hist {
+	u64 __percpu *buckets;
+};
+
+#undef EXPAND_HIST
+#define EXPAND_HIST(which) struct scoutfs_hist which;
+
+struct scoutfs_hists {
+	/* $sysfs/fs/scoutfs/$id/hists/ */
+	struct kobject kobj;
+	struct completion comp;
+
+	EXPAND_EACH_HIST
+};
+
+#define scoutfs_foreach_hist(sb, hist)				\
+	for (hist = &SCOUTFS_SB(sb)->hists->FIRST_HIST;		\
+	     hist <= &SCOUTFS_SB(sb)->hists->LAST_HIST;		\
+	     hist++)
+
+void scoutfs_hist_record(struct scoutfs_hist *hist, u64 ns);
+
+/* record the ns that have passed since the ktime stamp */
+#define scoutfs_hist_record_since(sb, which, stamp)			\
+	scoutfs_hist_record(&SCOUTFS_SB(sb)->hists->which,		\
+			    ktime_to_ns(ktime_sub(ktime_get(), stamp)))
+
+void __init scoutfs_init_hists(void);
+int scoutfs_setup_hists(struct super_block *sb);
+void scoutfs_destroy_hists(struct super_block *sb);
+
+#endif
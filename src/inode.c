@@ -19,6 +19,7 @@
 #include <linux/pagemap.h>
 #include <linux/sched.h>
 #include <linux/list_sort.h>
+#include <linux/workqueue.h>
 
 #include "format.h"
 #include "super.h"
@@ -34,6 +35,7 @@
 #include "item.h"
 #include "client.h"
 #include "cmp.h"
+#include "counters.h"
 
 /*
  * XXX
@@ -47,9 +49,21 @@
  *  - describe data locking size problems
  */
 
+struct orphan_scan_work {
+	struct work_struct work;
+	struct super_block *sb;
+	u64 first_ino;
+	u64 last_ino;
+};
+
+#define ORPHAN_SCAN_NR_WORKERS 4
+
 struct inode_sb_info {
 	spinlock_t writeback_lock;
 	struct rb_root writeback_inodes;
+
+	struct workqueue_struct *orphan_workq;
+	struct orphan_scan_work orphan_works[ORPHAN_SCAN_NR_WORKERS];
 };
 
 #define DECLARE_INODE_SB_INFO(sb, name) \
@@ -71,8 +85,19 @@ static void scoutfs_inode_ctor(void *obj)
 	ci->staging = false;
 	scoutfs_per_task_init(&ci->pt_data_lock);
 	init_rwsem(&ci->xattr_rwsem);
+	init_rwsem(&ci->dio_rwsem);
+	mutex_init(&ci->alloc_mutex);
+	ci->delalloc_lock = NULL;
+	ci->delalloc_blocks = 0;
 	RB_CLEAR_NODE(&ci->writeback_node);
 	spin_lock_init(&ci->ino_alloc.lock);
+	spin_lock_init(&ci->extent_cache_lock);
+	spin_lock_init(&ci->xattr_cache_lock);
+	memset(ci->xattr_cache, 0, sizeof(ci->xattr_cache));
+	ci->xattr_cache_next = 0;
+	ci->xattr_cache_gen = 0;
+	spin_lock_init(&ci->symlink_cache_lock);
+	ci->cached_symlink = NULL;
 
 	inode_init_once(&ci->inode);
 }
@@ -85,6 +110,10 @@ struct inode *scoutfs_alloc_inode(struct super_block *sb)
 	if (!ci)
 		return NULL;
 
+	ci->delalloc_lock = NULL;
+	ci->delalloc_blocks = 0;
+	ci->extent_cache_gen = 0;
+
 	return &ci->inode;
 }
 
@@ -133,6 +162,11 @@ static void remove_writeback_inode(struct inode_sb_info *inf,
 void scoutfs_destroy_inode(struct inode *inode)
 {
 	DECLARE_INODE_SB_INFO(inode->i_sb, inf);
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+
+	scoutfs_xattr_invalidate_cache(si);
+	kfree(si->cached_symlink);
+	si->cached_symlink = NULL;
 
 	spin_lock(&inf->writeback_lock);
 	remove_writeback_inode(inf, SCOUTFS_I(inode));
@@ -394,6 +428,21 @@ int scoutfs_complete_truncate(struct inode *inode, struct scoutfs_lock *lock)
 	return ret ? ret : err;
 }
 
+/*
+ * Wait for direct writers that dropped i_mutex to finish.  The caller
+ * holds i_mutex so no new ones can enter.  Draining the rwsem waits for
+ * submitters to finish updating the inode and inode_dio_wait waits for
+ * their bios to complete.
+ */
+void scoutfs_inode_wait_dio_writers(struct inode *inode)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+
+	down_write(&si->dio_rwsem);
+	up_write(&si->dio_rwsem);
+	inode_dio_wait(inode);
+}
+
 int scoutfs_setattr(struct dentry *dentry, struct iattr *attr)
 {
 	struct inode *inode = dentry->d_inode;
@@ -419,6 +468,8 @@ int scoutfs_setattr(struct dentry *dentry, struct iattr *attr)
 		i_size_read(inode);
 
 	if (S_ISREG(inode->i_mode) && attr->ia_valid & ATTR_SIZE) {
+		scoutfs_inode_wait_dio_writers(inode);
+
 		/*
 		 * Complete any truncates that may have failed while
 		 * in progress
@@ -459,18 +510,19 @@ out:
 /*
  * Set a given seq to the current trans seq if it differs.  The caller
  * holds locks and a transaction which prevents the transaction from
- * committing and refreshing the seq.
+ * committing and refreshing the seq; the sample helper orders our read
+ * against the commit that admitted our hold.
  */
 static void set_trans_seq(struct inode *inode, u64 *seq)
 {
 	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
 	struct super_block *sb = inode->i_sb;
-	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	u64 trans_seq = scoutfs_trans_sample_seq(sb);
 
-	if (*seq != sbi->trans_seq) {
+	if (*seq != trans_seq) {
 		preempt_disable();
 		write_seqcount_begin(&si->seqcount);
-		*seq = sbi->trans_seq;
+		*seq = trans_seq;
 		write_seqcount_end(&si->seqcount);
 		preempt_enable();
 	}
@@ -612,6 +664,20 @@ struct inode *scoutfs_iget(struct super_block *sb, u64 ino)
 	struct inode *inode;
 	int ret;
 
+	/*
+	 * Inodes that are already in the inode cache don't need the
+	 * lock.  It's only used to read the item for new inodes;
+	 * callers refresh cached inodes under their own locks.  This
+	 * keeps hot lookups of a cached working set, like nfs
+	 * filehandle resolution, from paying a lock round trip per
+	 * call.
+	 */
+	inode = scoutfs_ilookup(sb, ino);
+	if (inode) {
+		scoutfs_inc_counter(sb, inode_iget_cached);
+		return inode;
+	}
+
 	ret = scoutfs_lock_ino(sb, DLM_LOCK_PR, 0, ino, &lock);
 	if (ret)
 		return ERR_PTR(ret);
@@ -818,6 +884,15 @@ void scoutfs_inode_init_index_key(struct scoutfs_key *key, u8 type, u64 major,
  * The inode info reflects the current inode index items.  Create or delete
  * index items to bring the index in line with the caller's item.  The list
  * should contain locks that cover any item modifications that are made.
+ *
+ * Comparing against the cached index values coalesces repeated updates
+ * of an inode within a transaction.  The seqs are only advanced to the
+ * current transaction's seq once so later updates in the same
+ * transaction find the index items already in place and are elided
+ * entirely, skipping both the item calls and the index lock
+ * preparation.  The dirty index items that we do create sit in the item
+ * cache until the transaction commits and writes them out in sorted
+ * key order along with the rest of the dirty items.
  */
 static int update_index_items(struct super_block *sb,
 			      struct scoutfs_inode_info *si, u64 ino, u8 type,
@@ -831,8 +906,10 @@ static int update_index_items(struct super_block *sb,
 	int ret;
 	int err;
 
-	if (!will_ins_index(si, type, major, minor))
+	if (!will_ins_index(si, type, major, minor)) {
+		scoutfs_inc_counter(sb, inode_index_elided);
 		return 0;
+	}
 
 	trace_scoutfs_create_index_item(sb, type, major, minor, ino);
 
@@ -840,6 +917,8 @@ static int update_index_items(struct super_block *sb,
 
 	ins_lock = find_index_lock(lock_list, type, major, minor, ino);
 	ret = scoutfs_item_create_force(sb, &ins, NULL, ins_lock);
+	if (ret == 0)
+		scoutfs_inc_counter(sb, inode_index_created);
 	if (ret || !will_del_index(si, type, major, minor))
 		return ret;
 
@@ -855,6 +934,8 @@ static int update_index_items(struct super_block *sb,
 	if (ret) {
 		err = scoutfs_item_delete(sb, &ins, ins_lock);
 		BUG_ON(err);
+	} else {
+		scoutfs_inc_counter(sb, inode_index_deleted);
 	}
 
 	return ret;
@@ -1134,7 +1215,6 @@ int scoutfs_inode_index_try_lock_hold(struct super_block *sb,
 				      struct list_head *list, u64 seq,
 				      const struct scoutfs_item_count cnt)
 {
-	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct index_lock *ind_lock;
 	int ret = 0;
 
@@ -1149,7 +1229,7 @@ int scoutfs_inode_index_try_lock_hold(struct super_block *sb,
 	}
 
 	ret = scoutfs_hold_trans(sb, cnt);
-	if (ret == 0 && seq != sbi->trans_seq) {
+	if (ret == 0 && seq != scoutfs_trans_sample_seq(sb)) {
 		scoutfs_release_trans(sb);
 		ret = 1;
 	}
@@ -1279,7 +1359,7 @@ int scoutfs_alloc_ino(struct inode *parent, u64 *ino_ret)
 
 	if (ia->nr == 0) {
 		spin_unlock(&ia->lock);
-		ret = scoutfs_client_alloc_inodes(sb,
+		ret = scoutfs_client_alloc_inodes(sb, scoutfs_ino(parent),
 					SCOUTFS_LOCK_INODE_GROUP_NR * 10,
 					&ino, &nr);
 		if (ret < 0)
@@ -1301,6 +1381,55 @@ out:
 	return ret;
 }
 
+/*
+ * Return a run of contiguous allocated and unused inode numbers for
+ * batched creation.  The run comes from the parent's pool like single
+ * allocations do and is capped so that it never crosses an inode lock
+ * group boundary, letting one lock cover every inode in the run.  The
+ * run can be shorter than asked for, callers come back for more.
+ */
+int scoutfs_alloc_ino_run(struct inode *parent, u64 *ino_ret,
+			  unsigned *nr_ret)
+{
+	struct scoutfs_inode_allocator *ia = &SCOUTFS_I(parent)->ino_alloc;
+	struct super_block *sb = parent->i_sb;
+	u64 group_left;
+	u64 ino;
+	u64 nr;
+	int ret;
+
+	spin_lock(&ia->lock);
+
+	if (ia->nr == 0) {
+		spin_unlock(&ia->lock);
+		ret = scoutfs_client_alloc_inodes(sb, scoutfs_ino(parent),
+					SCOUTFS_LOCK_INODE_GROUP_NR * 10,
+					&ino, &nr);
+		if (ret < 0)
+			goto out;
+		spin_lock(&ia->lock);
+		if (ia->nr == 0) {
+			ia->ino = ino;
+			ia->nr = nr;
+		}
+	}
+
+	group_left = SCOUTFS_LOCK_INODE_GROUP_NR -
+		     (ia->ino & SCOUTFS_LOCK_INODE_GROUP_MASK);
+	nr = min3((u64)*nr_ret, ia->nr, group_left);
+
+	*ino_ret = ia->ino;
+	*nr_ret = nr;
+	ia->ino += nr;
+	ia->nr -= nr;
+
+	spin_unlock(&ia->lock);
+	ret = 0;
+out:
+	trace_scoutfs_alloc_ino(sb, ret, *ino_ret, ia->ino, ia->nr);
+	return ret;
+}
+
 /*
  * Allocate and initialize a new inode.  The caller is responsible for
  * creating links to it and updating it.  @dir can be null.
@@ -1508,16 +1637,13 @@ int scoutfs_drop_inode(struct inode *inode)
 }
 
 /*
- * Find orphan items and process each one.
- *
- * Runtime of this will be bounded by the number of orphans, which could
- * theoretically be very large. If that becomes a problem we might want to push
- * this work off to a thread.
+ * Find orphan items in the given inode range and process each one.
  *
  * This only scans orphans for this node.  This will need to be covered by
  * the rest of node zone cleanup.
  */
-int scoutfs_scan_orphans(struct super_block *sb)
+static int scoutfs_scan_orphans(struct super_block *sb, u64 first_ino,
+				u64 last_ino)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_lock *lock = sbi->node_id_lock;
@@ -1528,10 +1654,10 @@ int scoutfs_scan_orphans(struct super_block *sb)
 
 	trace_scoutfs_scan_orphans(sb);
 
-	init_orphan_key(&key, sbi->node_id, 0);
-	init_orphan_key(&last, sbi->node_id, ~0ULL);
+	init_orphan_key(&key, sbi->node_id, first_ino);
+	init_orphan_key(&last, sbi->node_id, last_ino);
 
-	while (1) {
+	while (!sbi->shutdown) {
 		ret = scoutfs_item_next(sb, &key, &last, NULL, lock);
 		if (ret == -ENOENT) /* No more orphan items */
 			break;
@@ -1539,10 +1665,12 @@ int scoutfs_scan_orphans(struct super_block *sb)
 			goto out;
 
 		ret = delete_inode_items(sb, le64_to_cpu(key.sko_ino));
+		if (ret == 0)
+			scoutfs_inc_counter(sb, orphan_scan_processed);
 		if (ret && ret != -ENOENT && !err)
 			err = ret;
 
-		if (le64_to_cpu(key.sko_ino) == U64_MAX) {
+		if (le64_to_cpu(key.sko_ino) == last_ino) {
 			ret = -ENOENT;
 			break;
 		}
@@ -1554,6 +1682,63 @@ out:
 	return err ? err : ret;
 }
 
+/*
+ * Each worker processes the orphans in its own disjoint subrange of the
+ * node's inode space.  Deleting an orphan's items is far more work than
+ * finding its orphan item so spreading the subranges across workers
+ * overlaps the lock acquisition and item deletion of independent
+ * inodes.  Per-inode deletion already batches its item removal into
+ * transactions as it goes.
+ *
+ * Orphan cleanup is best effort, as it was when it ran synchronously.
+ * Errors leave orphan items in place for the next scan to retry.
+ */
+static void scoutfs_orphan_scan_worker(struct work_struct *work)
+{
+	struct orphan_scan_work *osw = container_of(work,
+					struct orphan_scan_work, work);
+	struct super_block *sb = osw->sb;
+	int ret;
+
+	ret = scoutfs_scan_orphans(sb, osw->first_ino, osw->last_ino);
+	if (ret < 0 && ret != -ESHUTDOWN)
+		scoutfs_warn(sb, "orphan scan of inos %llu..%llu saw error %d",
+			     osw->first_ino, osw->last_ino, ret);
+}
+
+/*
+ * Kick off background orphan processing once the mount is ready for
+ * item and lock traffic.  Mount doesn't wait for the scan; a node that
+ * crashed with millions of open unlinked files is responsive
+ * immediately while the workers clean up behind it.
+ */
+void scoutfs_inode_start_orphan_scan(struct super_block *sb)
+{
+	DECLARE_INODE_SB_INFO(sb, inf);
+	int i;
+
+	for (i = 0; i < ORPHAN_SCAN_NR_WORKERS; i++)
+		queue_work(inf->orphan_workq, &inf->orphan_works[i].work);
+}
+
+/*
+ * Stop background orphan processing.  This is called early in unmount,
+ * while the node id lock and transactions that the workers use are
+ * still alive.  The workers notice shutdown between orphans so this
+ * waits for at most one inode's deletion.
+ */
+void scoutfs_inode_stop_orphan_scan(struct super_block *sb)
+{
+	DECLARE_INODE_SB_INFO(sb, inf);
+	int i;
+
+	if (!inf || !inf->orphan_workq)
+		return;
+
+	for (i = 0; i < ORPHAN_SCAN_NR_WORKERS; i++)
+		cancel_work_sync(&inf->orphan_works[i].work);
+}
+
 int scoutfs_orphan_inode(struct inode *inode)
 {
 	struct super_block *sb = inode->i_sb;
@@ -1587,13 +1772,45 @@ void scoutfs_inode_queue_writeback(struct inode *inode)
 	spin_unlock(&inf->writeback_lock);
 }
 
+/* find the tracked inode with the least ino that's still >= ino */
+static struct scoutfs_inode_info *next_writeback_inode(
+					struct inode_sb_info *inf, u64 ino)
+{
+	struct rb_node *node = inf->writeback_inodes.rb_node;
+	struct scoutfs_inode_info *found = NULL;
+	struct scoutfs_inode_info *si;
+
+	while (node) {
+		si = container_of(node, struct scoutfs_inode_info,
+				  writeback_node);
+
+		if (ino <= si->ino) {
+			found = si;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	return found;
+}
+
+#define INODE_WALK_BATCH_NR 16
+
 /*
  * Walk our dirty inodes in ino order and either start dirty page
  * writeback or wait for writeback to complete.
  *
+ * Inodes are grabbed in batches under the lock and processed outside it
+ * so that commits with enormous numbers of dirty inodes don't pay a
+ * lock round trip per inode, and inodes whose mappings don't have any
+ * pages tagged for the pass are skipped without calling into the
+ * filemap methods at all.
+ *
  * This is called by transaction commiting so other writers are
  * excluded.  We're still very careful to iterate over the tree while it
- * and the inodes could be changing.
+ * and the inodes could be changing, resuming each batch from the next
+ * tracked ino past the last batch.
  *
  * Because writes are excluded we know that there's no remaining dirty
  * pages once waiting returns successfully.
@@ -1603,66 +1820,76 @@ void scoutfs_inode_queue_writeback(struct inode *inode)
 int scoutfs_inode_walk_writeback(struct super_block *sb, bool write)
 {
 	DECLARE_INODE_SB_INFO(sb, inf);
+	struct inode *batch[INODE_WALK_BATCH_NR];
 	struct scoutfs_inode_info *si;
-	struct rb_node *node;
 	struct inode *inode;
-	struct inode *defer_iput = NULL;
-	int ret;
+	unsigned int nr;
+	unsigned int i;
+	u64 next_ino = 0;
+	int ret = 0;
 
-	spin_lock(&inf->writeback_lock);
+	for (;;) {
+		nr = 0;
+		spin_lock(&inf->writeback_lock);
 
-	node = rb_first(&inf->writeback_inodes);
-	while (node) {
-		si = container_of(node, struct scoutfs_inode_info,
-				  writeback_node);
-		node = rb_next(node);
-		inode = igrab(&si->inode);
-		if (!inode)
-			continue;
+		si = next_writeback_inode(inf, next_ino);
+		while (si && nr < ARRAY_SIZE(batch)) {
+			inode = igrab(&si->inode);
+			if (inode) {
+				batch[nr++] = inode;
+				next_ino = si->ino + 1;
+			}
+			si = rb_entry_safe(rb_next(&si->writeback_node),
+					   struct scoutfs_inode_info,
+					   writeback_node);
+		}
 
 		spin_unlock(&inf->writeback_lock);
 
-		if (defer_iput) {
-			iput(defer_iput);
-			defer_iput = NULL;
-		}
+		if (nr == 0)
+			break;
 
-		if (write)
-			ret = filemap_fdatawrite(inode->i_mapping);
-		else
-			ret = filemap_fdatawait(inode->i_mapping);
-		trace_scoutfs_inode_walk_writeback(sb, scoutfs_ino(inode),
-						   write, ret);
-		if (ret) {
-			iput(inode);
-			goto out;
+		for (i = 0; i < nr && ret == 0; i++) {
+			inode = batch[i];
+
+			if (write &&
+			    mapping_tagged(inode->i_mapping,
+					   PAGECACHE_TAG_DIRTY))
+				ret = filemap_fdatawrite(inode->i_mapping);
+			else if (!write &&
+				 mapping_tagged(inode->i_mapping,
+						PAGECACHE_TAG_WRITEBACK))
+				ret = filemap_fdatawait(inode->i_mapping);
+			trace_scoutfs_inode_walk_writeback(sb,
+					scoutfs_ino(inode), write, ret);
 		}
 
-		spin_lock(&inf->writeback_lock);
-
-		if (WARN_ON_ONCE(RB_EMPTY_NODE(&si->writeback_node)))
-			node = rb_first(&inf->writeback_inodes);
-		else
-			node = rb_next(&si->writeback_node);
+		if (!write && ret == 0) {
+			spin_lock(&inf->writeback_lock);
+			for (i = 0; i < nr; i++)
+				remove_writeback_inode(inf,
+						SCOUTFS_I(batch[i]));
+			spin_unlock(&inf->writeback_lock);
+		}
 
-		if (!write)
-			remove_writeback_inode(inf, si);
+		/* iput can call destroy which takes the lock */
+		for (i = 0; i < nr; i++)
+			iput(batch[i]);
 
-		/* avoid iput->destroy lock deadlock */
-		defer_iput = inode;
+		if (ret)
+			break;
 	}
 
-	spin_unlock(&inf->writeback_lock);
-out:
-	if (defer_iput)
-		iput(defer_iput);
 	return ret;
 }
 
 int scoutfs_inode_setup(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct orphan_scan_work *osw;
 	struct inode_sb_info *inf;
+	u64 span;
+	int i;
 
 	inf = kzalloc(sizeof(struct inode_sb_info), GFP_KERNEL);
 	if (!inf)
@@ -1671,6 +1898,25 @@ int scoutfs_inode_setup(struct super_block *sb)
 	spin_lock_init(&inf->writeback_lock);
 	inf->writeback_inodes = RB_ROOT;
 
+	inf->orphan_workq = alloc_workqueue("scoutfs_orphan",
+					    WQ_NON_REENTRANT | WQ_UNBOUND,
+					    ORPHAN_SCAN_NR_WORKERS);
+	if (!inf->orphan_workq) {
+		kfree(inf);
+		return -ENOMEM;
+	}
+
+	/* workers split the node's inode space into disjoint subranges */
+	span = U64_MAX / ORPHAN_SCAN_NR_WORKERS;
+	for (i = 0; i < ORPHAN_SCAN_NR_WORKERS; i++) {
+		osw = &inf->orphan_works[i];
+		osw->sb = sb;
+		osw->first_ino = i == 0 ? 0 : i * span + 1;
+		osw->last_ino = i == ORPHAN_SCAN_NR_WORKERS - 1 ?
+				U64_MAX : (i + 1) * span;
+		INIT_WORK(&osw->work, scoutfs_orphan_scan_worker);
+	}
+
 	sbi->inode_sb_info = inf;
 
 	return 0;
@@ -1680,6 +1926,8 @@ void scoutfs_inode_destroy(struct super_block *sb)
 {
 	struct inode_sb_info *inf = SCOUTFS_SB(sb)->inode_sb_info;
 
+	if (inf && inf->orphan_workq)
+		destroy_workqueue(inf->orphan_workq);
 	kfree(inf);
 }
 
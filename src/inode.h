@@ -6,9 +6,13 @@
 #include "per_task.h"
 #include "count.h"
 #include "format.h"
+#include "extents.h"
 
 struct scoutfs_lock;
 
+/* a few small recently read xattrs are cached per inode */
+#define SCOUTFS_XATTR_CACHE_NR 4
+
 struct scoutfs_inode_allocator {
 	spinlock_t lock;
 	u64 ino;
@@ -50,6 +54,62 @@ struct scoutfs_inode_info {
 	struct scoutfs_per_task pt_data_lock;
 	struct rw_semaphore xattr_rwsem;
 	struct rb_node writeback_node;
+
+	/*
+	 * Held for reading by direct writers that drop i_mutex so that
+	 * paths which check the data version or free extents can drain
+	 * them with scoutfs_inode_wait_dio_writers().
+	 */
+	struct rw_semaphore dio_rwsem;
+
+	/* serializes extent allocation between writers and writeback */
+	struct mutex alloc_mutex;
+	/*
+	 * The lock that covered delayed allocation of dirty pages, used
+	 * by writeback contexts that don't have a per-task lock entry.
+	 * It's valid as long as delayed pages are dirty: the lock can't
+	 * be invalidated without first committing, and committing
+	 * writes the delayed pages through it.  Writeback counts the
+	 * delayed blocks down as it maps them and clears the pointer
+	 * with the last one, and lock invalidation clears it after
+	 * truncating the pages, so it never dangles once the lock can
+	 * be freed.  Both fields are under alloc_mutex.
+	 */
+	struct scoutfs_lock *delalloc_lock;
+	unsigned long delalloc_blocks;
+
+	/*
+	 * A copy of the file extent that most recently mapped a block,
+	 * letting repeated io inside one extent skip the item search.
+	 * It's only valid while the cluster lock whose refresh_gen is
+	 * recorded here is still granted; a refreshed lock means other
+	 * nodes could have changed the extent items.  Local extent
+	 * modifications invalidate it by zeroing the gen.
+	 */
+	spinlock_t extent_cache_lock;
+	struct scoutfs_extent cached_extent;
+	u64 extent_cache_gen;
+
+	/*
+	 * Copies of recently read xattrs serve repeated getxattr calls
+	 * without item searches.  Like the cached extent, entries are
+	 * only valid while the cluster lock whose refresh_gen is
+	 * recorded here is still granted.  Local xattr modification
+	 * invalidates them by freeing the entries and zeroing the gen.
+	 */
+	spinlock_t xattr_cache_lock;
+	struct scoutfs_xattr *xattr_cache[SCOUTFS_XATTR_CACHE_NR];
+	unsigned int xattr_cache_next;
+	u64 xattr_cache_gen;
+
+	/*
+	 * Symlink targets are immutable once created, so after the
+	 * first read the null terminated target is cached until the
+	 * inode is destroyed and traversals don't touch items.
+	 */
+	spinlock_t symlink_cache_lock;
+	char *cached_symlink;
+
 	struct inode inode;
 };
 
@@ -93,6 +153,8 @@ void scoutfs_update_inode_item(struct inode *inode, struct scoutfs_lock *lock,
 			       struct list_head *ind_locks);
 
 int scoutfs_alloc_ino(struct inode *parent, u64 *ino);
+int scoutfs_alloc_ino_run(struct inode *parent, u64 *ino_ret,
+			  unsigned *nr_ret);
 struct inode *scoutfs_new_inode(struct super_block *sb, struct inode *dir,
 				umode_t mode, dev_t rdev, u64 ino,
 				struct scoutfs_lock *lock);
@@ -106,6 +168,7 @@ u64 scoutfs_inode_data_seq(struct inode *inode);
 u64 scoutfs_inode_data_version(struct inode *inode);
 void scoutfs_inode_get_onoff(struct inode *inode, s64 *on, s64 *off);
 int scoutfs_complete_truncate(struct inode *inode, struct scoutfs_lock *lock);
+void scoutfs_inode_wait_dio_writers(struct inode *inode);
 
 int scoutfs_inode_refresh(struct inode *inode, struct scoutfs_lock *lock,
 			  int flags);
@@ -113,7 +176,8 @@ int scoutfs_getattr(struct vfsmount *mnt, struct dentry *dentry,
 		    struct kstat *stat);
 int scoutfs_setattr(struct dentry *dentry, struct iattr *attr);
 
-int scoutfs_scan_orphans(struct super_block *sb);
+void scoutfs_inode_start_orphan_scan(struct super_block *sb);
+void scoutfs_inode_stop_orphan_scan(struct super_block *sb);
 
 void scoutfs_inode_queue_writeback(struct inode *inode);
 int scoutfs_inode_walk_writeback(struct super_block *sb, bool write);
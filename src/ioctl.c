@@ -20,6 +20,7 @@
 #include <linux/mm.h>
 #include <linux/sched.h>
 #include <linux/aio.h>
+#include <linux/security.h>
 
 #include "format.h"
 #include "key.h"
@@ -28,6 +29,7 @@
 #include "super.h"
 #include "inode.h"
 #include "item.h"
+#include "kvec.h"
 #include "data.h"
 #include "client.h"
 #include "lock.h"
@@ -48,20 +50,31 @@
  * the lower level.  DLM locks don't block tasks in a node, they match
  * and the tasks fall back to local locking.  In this case the spin
  * locks around the item cache.
+ *
+ * Iteration streams whole batches of index items out of the cache per
+ * traversal instead of searching the item rbtree once per entry, and
+ * user entries are copied out a page at a time.  Populating the cache
+ * from segments already issues readahead of the segments that cover
+ * the upcoming key range, so a large user buffer keeps the device busy
+ * for the whole walk.
  */
 static long scoutfs_ioc_walk_inodes(struct file *file, unsigned long arg)
 {
 	struct super_block *sb = file_inode(file)->i_sb;
 	struct scoutfs_ioctl_walk_inodes __user *uwalk = (void __user *)arg;
 	struct scoutfs_ioctl_walk_inodes walk;
-	struct scoutfs_ioctl_walk_inodes_entry ent;
+	struct scoutfs_ioctl_walk_inodes_entry *ents = NULL;
+	struct scoutfs_item_batch_entry *bent;
 	struct scoutfs_key next_key;
 	struct scoutfs_key last_key;
 	struct scoutfs_key key;
 	struct scoutfs_lock *lock;
+	void *buf = NULL;
 	u64 last_seq;
 	int ret = 0;
+	u32 cnt;
 	u32 nr = 0;
+	u32 i;
 	u8 type;
 
 	if (copy_from_user(&walk, uwalk, sizeof(walk)))
@@ -99,6 +112,17 @@ static long scoutfs_ioc_walk_inodes(struct file *file, unsigned long arg)
 	/* cap nr to the max the ioctl can return to a compat task */
 	walk.nr_entries = min_t(u64, walk.nr_entries, INT_MAX);
 
+	buf = (void *)__get_free_page(GFP_NOFS);
+	ents = (void *)__get_free_page(GFP_NOFS);
+	if (!buf || !ents) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* each item entry is larger than the user entry it becomes */
+	BUILD_BUG_ON(scoutfs_item_batch_entry_bytes(0) <
+		     sizeof(struct scoutfs_ioctl_walk_inodes_entry));
+
 	ret = scoutfs_lock_inode_index(sb, DLM_LOCK_PR, type, walk.first.major,
 				       walk.first.ino, &lock);
 	if (ret < 0)
@@ -106,7 +130,8 @@ static long scoutfs_ioc_walk_inodes(struct file *file, unsigned long arg)
 
 	for (nr = 0; nr < walk.nr_entries; ) {
 
-		ret = scoutfs_item_next(sb, &key, &last_key, NULL, lock);
+		ret = scoutfs_item_next_batch(sb, &key, &last_key, buf,
+					      PAGE_SIZE, lock);
 		if (ret < 0 && ret != -ENOENT)
 			break;
 
@@ -154,18 +179,25 @@ static long scoutfs_ioc_walk_inodes(struct file *file, unsigned long arg)
 			continue;
 		}
 
-		ent.major = le64_to_cpu(key.skii_major);
-		ent.minor = 0;
-		ent.ino = le64_to_cpu(key.skii_ino);
+		cnt = min_t(u32, ret, walk.nr_entries - nr);
 
-		if (copy_to_user((void __user *)walk.entries_ptr, &ent,
-				 sizeof(ent))) {
+		bent = buf;
+		for (i = 0; i < cnt; i++) {
+			ents[i].major = le64_to_cpu(bent->key.skii_major);
+			ents[i].minor = 0;
+			ents[i].ino = le64_to_cpu(bent->key.skii_ino);
+			key = bent->key;
+			bent = scoutfs_item_batch_entry_next(bent);
+		}
+
+		if (copy_to_user((void __user *)walk.entries_ptr, ents,
+				 cnt * sizeof(ents[0]))) {
 			ret = -EFAULT;
 			break;
 		}
 
-		nr++;
-		walk.entries_ptr += sizeof(ent);
+		nr += cnt;
+		walk.entries_ptr += cnt * sizeof(ents[0]);
 
 		scoutfs_key_inc(&key);
 	}
@@ -173,6 +205,9 @@ static long scoutfs_ioc_walk_inodes(struct file *file, unsigned long arg)
 	scoutfs_unlock(sb, lock, DLM_LOCK_PR);
 
 out:
+	free_page((unsigned long)buf);
+	free_page((unsigned long)ents);
+
 	if (nr > 0)
 		ret = nr;
 
@@ -269,12 +304,15 @@ out:
  * XXX permissions?
  * XXX a lot of this could be generic file write prep
  */
-static long scoutfs_ioc_release(struct file *file, unsigned long arg)
+/*
+ * Release the given block range of a locked regular file, leaving
+ * offline mappings behind.  If the file's online blocks drop to 0 we
+ * also truncate any blocks beyond i_size.
+ */
+static int release_inode_range(struct super_block *sb, struct inode *inode,
+			       u64 block, u64 count, u64 data_version,
+			       struct scoutfs_lock *lock)
 {
-	struct inode *inode = file_inode(file);
-	struct super_block *sb = inode->i_sb;
-	struct scoutfs_ioctl_release args;
-	struct scoutfs_lock *lock = NULL;
 	loff_t start;
 	loff_t end_inc;
 	u64 online;
@@ -282,6 +320,47 @@ static long scoutfs_ioc_release(struct file *file, unsigned long arg)
 	u64 isize;
 	int ret;
 
+	if (!S_ISREG(inode->i_mode))
+		return -EINVAL;
+
+	/* drain direct writers before the data version check */
+	scoutfs_inode_wait_dio_writers(inode);
+
+	if (scoutfs_inode_data_version(inode) != data_version)
+		return -ESTALE;
+
+	/* drop all clean and dirty cached blocks in the range */
+	start = block << SCOUTFS_BLOCK_SHIFT;
+	end_inc = ((block + count) << SCOUTFS_BLOCK_SHIFT) - 1;
+	truncate_inode_pages_range(&inode->i_data, start, end_inc);
+
+	ret = scoutfs_data_truncate_items(sb, inode, scoutfs_ino(inode),
+					  block, block + count - 1, true,
+					  lock);
+	if (ret == 0) {
+		scoutfs_inode_get_onoff(inode, &online, &offline);
+		isize = i_size_read(inode);
+		if (online == 0 && isize) {
+			start = (isize + SCOUTFS_BLOCK_SIZE - 1)
+					>> SCOUTFS_BLOCK_SHIFT;
+			ret = scoutfs_data_truncate_items(sb, inode,
+							  scoutfs_ino(inode),
+							  start, U64_MAX,
+							  false, lock);
+		}
+	}
+
+	return ret;
+}
+
+static long scoutfs_ioc_release(struct file *file, unsigned long arg)
+{
+	struct inode *inode = file_inode(file);
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_ioctl_release args;
+	struct scoutfs_lock *lock = NULL;
+	int ret;
+
 	if (copy_from_user(&args, (void __user *)arg, sizeof(args)))
 		return -EFAULT;
 
@@ -304,51 +383,113 @@ static long scoutfs_ioc_release(struct file *file, unsigned long arg)
 	if (ret)
 		goto out;
 
-	if (!S_ISREG(inode->i_mode)) {
-		ret = -EINVAL;
-		goto out;
-	}
-
 	if (!(file->f_mode & FMODE_WRITE)) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	if (scoutfs_inode_data_version(inode) != args.data_version) {
-		ret = -ESTALE;
-		goto out;
-	}
+	ret = release_inode_range(sb, inode, args.block, args.count,
+				  args.data_version, lock);
 
-	inode_dio_wait(inode);
+out:
+	scoutfs_unlock(sb, lock, DLM_LOCK_EX);
+	mutex_unlock(&inode->i_mutex);
+	mnt_drop_write_file(file);
 
-	/* drop all clean and dirty cached blocks in the range */
-	start = args.block << SCOUTFS_BLOCK_SHIFT;
-	end_inc = ((args.block + args.count) << SCOUTFS_BLOCK_SHIFT) - 1;
-	truncate_inode_pages_range(&inode->i_data, start, end_inc);
+	trace_scoutfs_ioc_release_ret(sb, ret);
+	return ret;
+}
 
-	ret = scoutfs_data_truncate_items(sb, inode, scoutfs_ino(inode),
-					  args.block,
-					  args.block + args.count - 1, true,
-					  lock);
-	if (ret == 0) {
-		scoutfs_inode_get_onoff(inode, &online, &offline);
-		isize = i_size_read(inode);
-		if (online == 0 && isize) {
-			start = (isize + SCOUTFS_BLOCK_SIZE - 1)
-					>> SCOUTFS_BLOCK_SHIFT;
-			ret = scoutfs_data_truncate_items(sb, inode,
-							  scoutfs_ino(inode),
-							  start, U64_MAX,
-							  false, lock);
+/*
+ * Release file data for a batch of inodes.  See the struct definition
+ * for the full semantics.
+ *
+ * Each entry is processed like a single file release.  The lock that
+ * covers a group of inodes stays granted between entries so sorted
+ * arrays only pay a lock round trip per group, and the extent item
+ * truncation batches deletions into transactions as it goes.  We stop
+ * at the first failed entry and return how many were processed so the
+ * caller can resume.
+ */
+static long scoutfs_ioc_batch_release(struct file *file, unsigned long arg)
+{
+	struct super_block *sb = file_inode(file)->i_sb;
+	struct scoutfs_ioctl_batch_release_entry entry;
+	struct scoutfs_ioctl_batch_release args;
+	struct scoutfs_ioctl_batch_release_entry __user *uent;
+	struct scoutfs_lock *lock;
+	struct inode *inode;
+	long done = 0;
+	u64 nr;
+	u64 i;
+	int ret = 0;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&args, (void __user *)arg, sizeof(args)))
+		return -EFAULT;
+
+	uent = (void __user *)(unsigned long)args.entries_ptr;
+	nr = min_t(u64, args.nr, INT_MAX);
+
+	ret = mnt_want_write_file(file);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < nr; i++) {
+		if (copy_from_user(&entry, &uent[i], sizeof(entry))) {
+			ret = -EFAULT;
+			break;
 		}
+
+		if ((entry.block + entry.count) < entry.block) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (entry.count == 0) {
+			done++;
+			continue;
+		}
+
+		inode = scoutfs_iget(sb, entry.ino);
+		if (IS_ERR(inode)) {
+			ret = PTR_ERR(inode);
+			/* released files can be racing unlink, skip */
+			if (ret == -ENOENT) {
+				ret = 0;
+				done++;
+				continue;
+			}
+			break;
+		}
+
+		mutex_lock(&inode->i_mutex);
+
+		lock = NULL;
+		ret = scoutfs_lock_inode(sb, DLM_LOCK_EX,
+					 SCOUTFS_LKF_REFRESH_INODE, inode,
+					 &lock);
+		if (ret == 0)
+			ret = release_inode_range(sb, inode, entry.block,
+						  entry.count,
+						  entry.data_version, lock);
+
+		scoutfs_unlock(sb, lock, DLM_LOCK_EX);
+		mutex_unlock(&inode->i_mutex);
+		iput(inode);
+
+		if (ret < 0)
+			break;
+		done++;
 	}
 
-out:
-	scoutfs_unlock(sb, lock, DLM_LOCK_EX);
-	mutex_unlock(&inode->i_mutex);
 	mnt_drop_write_file(file);
 
-	trace_scoutfs_ioc_release_ret(sb, ret);
+	if (done > 0)
+		ret = done;
+
 	return ret;
 }
 
@@ -442,6 +583,9 @@ static long scoutfs_ioc_stage(struct file *file, unsigned long arg)
 		goto out;
 	}
 
+	/* drain direct writers before the data version check */
+	scoutfs_inode_wait_dio_writers(inode);
+
 	if (scoutfs_inode_data_version(inode) != args.data_version) {
 		ret = -ESTALE;
 		goto out;
@@ -540,6 +684,338 @@ static long scoutfs_ioc_item_cache_keys(struct file *file, unsigned long arg)
 	return ret ?: total;
 }
 
+/*
+ * Kick off background acquisition of the locks that cover the given
+ * inodes so that a scan pipeline stating them doesn't pay a serialized
+ * lock round trip per inode.  See the struct definition for semantics.
+ */
+static long scoutfs_ioc_lock_ahead(struct file *file, unsigned long arg)
+{
+	struct super_block *sb = file_inode(file)->i_sb;
+	struct scoutfs_ioctl_lock_ahead args;
+	unsigned int nr;
+	u64 *inos;
+	int ret;
+
+	if (copy_from_user(&args, (void __user *)arg, sizeof(args)))
+		return -EFAULT;
+
+	if (args.nr == 0)
+		return 0;
+
+	nr = min_t(u64, args.nr, SCOUTFS_IOC_LOCK_AHEAD_MAX_NR);
+
+	inos = kmalloc(nr * sizeof(inos[0]), GFP_NOFS);
+	if (!inos)
+		return -ENOMEM;
+
+	if (copy_from_user(inos, (void __user *)(unsigned long)args.inos_ptr,
+			   nr * sizeof(inos[0]))) {
+		ret = -EFAULT;
+	} else {
+		ret = scoutfs_lock_inos_ahead(sb, inos, nr);
+		if (ret == 0)
+			ret = nr;
+	}
+
+	kfree(inos);
+	return ret;
+}
+
+/*
+ * Fill stat entries for a batch of inodes straight from their inode
+ * items.  See the struct definition for the full semantics.
+ *
+ * We don't refresh or even look up vfs inodes.  The caller wants raw
+ * item contents for enormous batches of inodes, most of which will
+ * never be visited again, and the cluster lock alone makes the items
+ * we read consistent.
+ *
+ * The inode numbers tend to arrive sorted from index walks so we hold
+ * the lock that covers a group of inodes across all the consecutive
+ * numbers it covers instead of acquiring it per inode.
+ */
+static long scoutfs_ioc_bulk_stat(struct file *file, unsigned long arg)
+{
+	struct super_block *sb = file_inode(file)->i_sb;
+	struct scoutfs_ioctl_bulk_stat_entry entry;
+	struct scoutfs_ioctl_bulk_stat args;
+	struct scoutfs_lock *lock = NULL;
+	struct scoutfs_inode sinode;
+	struct scoutfs_key key;
+	u64 __user *uinos;
+	void __user *uent;
+	struct kvec val;
+	u64 group = U64_MAX;
+	u64 nr;
+	u64 ino;
+	u64 i;
+	long filled = 0;
+	int ret = 0;
+
+	if (!capable(CAP_DAC_READ_SEARCH))
+		return -EPERM;
+
+	if (copy_from_user(&args, (void __user *)arg, sizeof(args)))
+		return -EFAULT;
+
+	uinos = (void __user *)(unsigned long)args.inos_ptr;
+	uent = (void __user *)(unsigned long)args.entries_ptr;
+	nr = min_t(u64, args.nr, INT_MAX);
+
+	for (i = 0; i < nr; i++) {
+		if (get_user(ino, &uinos[i])) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (!lock || (ino & ~(u64)SCOUTFS_LOCK_INODE_GROUP_MASK) !=
+			     group) {
+			if (lock)
+				scoutfs_unlock(sb, lock, DLM_LOCK_PR);
+			lock = NULL;
+			ret = scoutfs_lock_ino(sb, DLM_LOCK_PR, 0, ino, &lock);
+			if (ret < 0)
+				break;
+			group = ino & ~(u64)SCOUTFS_LOCK_INODE_GROUP_MASK;
+		}
+
+		key = (struct scoutfs_key) {
+			.sk_zone = SCOUTFS_FS_ZONE,
+			.ski_ino = cpu_to_le64(ino),
+			.sk_type = SCOUTFS_INODE_TYPE,
+		};
+		kvec_init(&val, &sinode, sizeof(sinode));
+
+		ret = scoutfs_item_lookup_exact(sb, &key, &val, lock);
+		if (ret < 0) {
+			/* freed between the index walk and us, skip it */
+			if (ret == -ENOENT) {
+				ret = 0;
+				continue;
+			}
+			break;
+		}
+
+		entry.ino = ino;
+		entry.size = le64_to_cpu(sinode.size);
+		entry.meta_seq = le64_to_cpu(sinode.meta_seq);
+		entry.data_seq = le64_to_cpu(sinode.data_seq);
+		entry.data_version = le64_to_cpu(sinode.data_version);
+		entry.online_blocks = le64_to_cpu(sinode.online_blocks);
+		entry.offline_blocks = le64_to_cpu(sinode.offline_blocks);
+		entry.atime_sec = le64_to_cpu(sinode.atime.sec);
+		entry.ctime_sec = le64_to_cpu(sinode.ctime.sec);
+		entry.mtime_sec = le64_to_cpu(sinode.mtime.sec);
+		entry.atime_nsec = le32_to_cpu(sinode.atime.nsec);
+		entry.ctime_nsec = le32_to_cpu(sinode.ctime.nsec);
+		entry.mtime_nsec = le32_to_cpu(sinode.mtime.nsec);
+		entry.nlink = le32_to_cpu(sinode.nlink);
+		entry.uid = le32_to_cpu(sinode.uid);
+		entry.gid = le32_to_cpu(sinode.gid);
+		entry.mode = le32_to_cpu(sinode.mode);
+		entry.rdev = le32_to_cpu(sinode.rdev);
+
+		if (copy_to_user(uent, &entry, sizeof(entry))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		uent += sizeof(entry);
+		filled++;
+	}
+
+	if (lock)
+		scoutfs_unlock(sb, lock, DLM_LOCK_PR);
+
+	if (filled > 0)
+		ret = filled;
+
+	return ret;
+}
+
+/*
+ * Hand recorded key ranges to a background worker that populates the
+ * item cache under their covering locks.  See the struct definition
+ * for the full semantics.
+ */
+static long scoutfs_ioc_item_cache_warm(struct file *file, unsigned long arg)
+{
+	struct super_block *sb = file_inode(file)->i_sb;
+	struct scoutfs_ioctl_item_cache_warm args;
+	struct scoutfs_key *keys;
+	unsigned int nr;
+	int ret;
+
+	if (copy_from_user(&args, (void __user *)arg, sizeof(args)))
+		return -EFAULT;
+
+	if (args.nr & 1)
+		return -EINVAL;
+	if (args.nr == 0)
+		return 0;
+
+	nr = min_t(u64, args.nr, SCOUTFS_IOC_ITEM_CACHE_WARM_MAX_NR);
+
+	keys = kmalloc(nr * sizeof(keys[0]), GFP_NOFS);
+	if (!keys)
+		return -ENOMEM;
+
+	if (copy_from_user(keys, (void __user *)(unsigned long)args.keys_ptr,
+			   nr * sizeof(keys[0]))) {
+		ret = -EFAULT;
+	} else {
+		ret = scoutfs_lock_warm_ranges(sb, keys, nr);
+		if (ret == 0)
+			ret = nr;
+	}
+
+	kfree(keys);
+	return ret;
+}
+
+/*
+ * Copy in and validate the batch of names and hand them to the dir
+ * code which creates the files under one pair of locks and one
+ * transaction.  We drop any stale negative dentries for the created
+ * names so that hashed lookups don't mask the new entries.  See the
+ * struct definition for the full semantics.
+ */
+static long scoutfs_ioc_bulk_create(struct file *file, unsigned long arg)
+{
+	struct inode *dir = file_inode(file);
+	struct scoutfs_ioctl_bulk_create_entry __user *uent;
+	struct scoutfs_ioctl_bulk_create_entry ent;
+	struct scoutfs_ioctl_bulk_create args;
+	struct dentry *dentry;
+	struct qstr q;
+	unsigned *name_lens = NULL;
+	char *names = NULL;
+	const char *name;
+	u64 *inos = NULL;
+	unsigned nr;
+	unsigned i;
+	long ret;
+
+	if (copy_from_user(&args, (void __user *)arg, sizeof(args)))
+		return -EFAULT;
+
+	if (!S_ISDIR(dir->i_mode))
+		return -ENOTDIR;
+	if (args.mode & ~07777U)
+		return -EINVAL;
+	if (args.nr == 0)
+		return 0;
+
+	if (IS_IMMUTABLE(dir))
+		return -EPERM;
+
+	/* creating entries needs the same dir permission as creat(2) */
+	ret = inode_permission(dir, MAY_WRITE | MAY_EXEC);
+	if (ret)
+		return ret;
+
+	nr = min_t(u64, args.nr, SCOUTFS_IOC_BULK_CREATE_MAX_NR);
+	uent = (void __user *)(unsigned long)args.entries_ptr;
+
+	names = kmalloc(nr * SCOUTFS_NAME_LEN, GFP_NOFS);
+	name_lens = kmalloc(nr * sizeof(name_lens[0]), GFP_NOFS);
+	inos = kmalloc(nr * sizeof(inos[0]), GFP_NOFS);
+	if (!names || !name_lens || !inos) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (copy_from_user(&ent, &uent[i], sizeof(ent))) {
+			ret = -EFAULT;
+			goto out;
+		}
+
+		if (ent.name_len < 1 || ent.name_len > SCOUTFS_NAME_LEN) {
+			ret = ent.name_len ? -ENAMETOOLONG : -EINVAL;
+			goto out;
+		}
+
+		name = &names[i * SCOUTFS_NAME_LEN];
+		if (copy_from_user(&names[i * SCOUTFS_NAME_LEN],
+				   (void __user *)(unsigned long)ent.name_ptr,
+				   ent.name_len)) {
+			ret = -EFAULT;
+			goto out;
+		}
+
+		if (memchr(name, '/', ent.name_len) ||
+		    memchr(name, '\0', ent.name_len) ||
+		    (name[0] == '.' && (ent.name_len == 1 ||
+					(ent.name_len == 2 &&
+					 name[1] == '.')))) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		name_lens[i] = ent.name_len;
+	}
+
+	ret = mnt_want_write_file(file);
+	if (ret)
+		goto out;
+
+	mutex_lock(&dir->i_mutex);
+
+	/*
+	 * creat(2) would give the LSM a create hook for each name.  We
+	 * don't have dentries for the names yet so we build transient
+	 * negative dentries for the hook to judge, before any of the
+	 * batch is created.
+	 */
+	for (i = 0; i < nr; i++) {
+		q.name = &names[i * SCOUTFS_NAME_LEN];
+		q.len = name_lens[i];
+		q.hash = full_name_hash(q.name, q.len);
+		dentry = d_alloc(file->f_path.dentry, &q);
+		if (!dentry) {
+			ret = -ENOMEM;
+			goto unlock;
+		}
+		ret = security_inode_create(dir, dentry, S_IFREG | args.mode);
+		dput(dentry);
+		if (ret)
+			goto unlock;
+	}
+
+	ret = scoutfs_dir_bulk_create(dir, S_IFREG | args.mode, names,
+				      name_lens, nr, inos);
+
+	for (i = 0; i < ret; i++) {
+		q.name = &names[i * SCOUTFS_NAME_LEN];
+		q.len = name_lens[i];
+		q.hash = full_name_hash(q.name, q.len);
+		dentry = d_lookup(file->f_path.dentry, &q);
+		if (dentry) {
+			if (!dentry->d_inode)
+				d_drop(dentry);
+			dput(dentry);
+		}
+	}
+
+unlock:
+	mutex_unlock(&dir->i_mutex);
+	mnt_drop_write_file(file);
+
+	for (i = 0; i < ret; i++) {
+		if (put_user(inos[i], &uent[i].ino)) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+out:
+	kfree(inos);
+	kfree(name_lens);
+	kfree(names);
+	return ret;
+}
+
 long scoutfs_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	switch (cmd) {
@@ -555,6 +1031,16 @@ long scoutfs_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		return scoutfs_ioc_stat_more(file, arg);
 	case SCOUTFS_IOC_ITEM_CACHE_KEYS:
 		return scoutfs_ioc_item_cache_keys(file, arg);
+	case SCOUTFS_IOC_LOCK_AHEAD:
+		return scoutfs_ioc_lock_ahead(file, arg);
+	case SCOUTFS_IOC_BULK_STAT:
+		return scoutfs_ioc_bulk_stat(file, arg);
+	case SCOUTFS_IOC_BATCH_RELEASE:
+		return scoutfs_ioc_batch_release(file, arg);
+	case SCOUTFS_IOC_ITEM_CACHE_WARM:
+		return scoutfs_ioc_item_cache_warm(file, arg);
+	case SCOUTFS_IOC_BULK_CREATE:
+		return scoutfs_ioc_bulk_create(file, arg);
 	}
 
 	return -ENOTTY;
@@ -229,4 +229,203 @@ enum {
 #define SCOUTFS_IOC_ITEM_CACHE_KEYS _IOW(SCOUTFS_IOCTL_MAGIC, 8, \
 					 struct scoutfs_ioctl_item_cache_keys)
 
+/*
+ * Asynchronously warm the cluster locks that cover the given inodes.
+ *
+ * @inos_ptr: Pointer to an array of __u64 inode numbers, typically the
+ * inodes that a scan is about to visit in the order they'll be visited.
+ * @nr: The number of inode numbers in the array.
+ *
+ * The locks are requested in the background in array order.  By the
+ * time the caller stats an inode from the batch its lock is likely to
+ * already be granted, turning a serialized lock round trip per inode
+ * into pipelined work.  This is only a hint: it doesn't guarantee that
+ * any lock is held and grants can be lost to contention at any time.
+ *
+ * At most _LOCK_AHEAD_MAX_NR inode numbers are copied from the array.
+ * The number copied is returned and callers advance through larger
+ * batches as their scan proceeds.
+ */
+struct scoutfs_ioctl_lock_ahead {
+	__u64 inos_ptr;
+	__u64 nr;
+} __packed;
+
+#define SCOUTFS_IOC_LOCK_AHEAD_MAX_NR 4096
+
+#define SCOUTFS_IOC_LOCK_AHEAD _IOW(SCOUTFS_IOCTL_MAGIC, 9, \
+				    struct scoutfs_ioctl_lock_ahead)
+
+/* filled from the inode item, not the vfs inode */
+struct scoutfs_ioctl_bulk_stat_entry {
+	__u64 ino;
+	__u64 size;
+	__u64 meta_seq;
+	__u64 data_seq;
+	__u64 data_version;
+	__u64 online_blocks;
+	__u64 offline_blocks;
+	__u64 atime_sec;
+	__u64 ctime_sec;
+	__u64 mtime_sec;
+	__u32 atime_nsec;
+	__u32 ctime_nsec;
+	__u32 mtime_nsec;
+	__u32 nlink;
+	__u32 uid;
+	__u32 gid;
+	__u32 mode;
+	__u32 rdev;
+} __packed;
+
+/*
+ * Fill stat entries for a batch of inodes straight from their inode
+ * items, without instantiating vfs inodes.
+ *
+ * @inos_ptr: Pointer to an array of __u64 inode numbers, typically the
+ * inodes returned by walking an index.
+ * @entries_ptr: Pointer to an array of bulk_stat entries with room for
+ * a result for every inode number.
+ * @nr: The number of inode numbers in the array.
+ *
+ * An entry is only filled for the inode numbers whose items are found,
+ * each entry records its inode number.  Inodes can be freed between an
+ * index walk and this call so callers match entries to inodes by the
+ * recorded numbers, not by array position.  The number of entries
+ * filled is returned.
+ *
+ * The lock that covers a group of inode numbers is acquired once and
+ * used for all the neighbouring numbers it covers, so sorted arrays
+ * stat many inodes per lock acquisition.
+ *
+ * This doesn't check that the caller has permission to reach the inodes
+ * through paths.  It requires CAP_DAC_READ_SEARCH which bypasses
+ * permissions checking.
+ */
+struct scoutfs_ioctl_bulk_stat {
+	__u64 inos_ptr;
+	__u64 entries_ptr;
+	__u64 nr;
+} __packed;
+
+#define SCOUTFS_IOC_BULK_STAT _IOW(SCOUTFS_IOCTL_MAGIC, 10, \
+				   struct scoutfs_ioctl_bulk_stat)
+
+/* the fields have the same meaning as the single file release above */
+struct scoutfs_ioctl_batch_release_entry {
+	__u64 ino;
+	__u64 block;
+	__u64 count;
+	__u64 data_version;
+} __packed;
+
+/*
+ * Release file data for a batch of inodes in one call.
+ *
+ * @entries_ptr: Pointer to an array of batch_release entries.
+ * @nr: The number of entries in the array.
+ *
+ * Entries are processed in order with the same semantics as releasing
+ * each file individually.  Inodes that no longer exist are skipped.
+ * Sorted arrays release many files per cluster lock because the lock
+ * covering a group of inodes stays granted between entries.
+ *
+ * Processing stops at the first entry that fails.  The number of
+ * entries processed is returned, or the error if the first entry
+ * failed, so callers resume from or examine the entry at the returned
+ * index.
+ *
+ * This releases inodes that the caller doesn't have open for writing
+ * so it requires CAP_SYS_ADMIN.
+ */
+struct scoutfs_ioctl_batch_release {
+	__u64 entries_ptr;
+	__u64 nr;
+} __packed;
+
+#define SCOUTFS_IOC_BATCH_RELEASE _IOW(SCOUTFS_IOCTL_MAGIC, 11, \
+					struct scoutfs_ioctl_batch_release)
+
+/*
+ * Asynchronously populate the item cache for the given key ranges.
+ *
+ * @keys_ptr: Pointer to an array of struct scoutfs_key.  Each pair of
+ * keys gives the inclusive start and end of a range, the layout that
+ * SCOUTFS_IOC_ITEM_CACHE_KEYS returns when dumping cached ranges.
+ * @nr: The number of keys in the array, which must be a multiple of
+ * two.
+ *
+ * A background worker acquires the cluster lock covering each range
+ * and reads the range's items from segments into the item cache with
+ * batched segment readahead.  Dumping the cached ranges before
+ * unmount and feeding them back after mount gets a freshly mounted
+ * node to a warm cache without waiting for foreground misses to fault
+ * it in.
+ *
+ * This is only a hint: locks can be lost to contention and the warmed
+ * cache can be shrunk at any time.  At most _MAX_NR keys are copied
+ * from the array.  The number copied is returned and callers advance
+ * through larger dumps in batches.
+ */
+struct scoutfs_ioctl_item_cache_warm {
+	__u64 keys_ptr;
+	__u64 nr;
+} __packed;
+
+#define SCOUTFS_IOC_ITEM_CACHE_WARM_MAX_NR 1024
+
+#define SCOUTFS_IOC_ITEM_CACHE_WARM _IOW(SCOUTFS_IOCTL_MAGIC, 12, \
+					 struct scoutfs_ioctl_item_cache_warm)
+
+/* each created file's inode number is stored in ino on return */
+struct scoutfs_ioctl_bulk_create_entry {
+	__u64 name_ptr;
+	__u64 ino;
+	__u16 name_len;
+	__u8 _pad[6];
+} __packed;
+
+/*
+ * Create a batch of regular files in the directory the ioctl is called
+ * on, amortizing the per-file creation cost for restore-style ingest:
+ * one pair of cluster locks, one transaction hold, and one run of
+ * inode numbers cover the whole batch.
+ *
+ * @entries_ptr: Pointer to an array of bulk_create entries, each
+ * naming one file to create.  The names can't contain slashes and
+ * can't be "." or "..".
+ * @nr: The number of entries in the array.
+ * @mode: The permission bits for the created files, S_IFREG is
+ * implied.
+ *
+ * Entries are processed in order and the number of files created is
+ * returned, with each created entry's ino field recording its inode
+ * number.  A short return isn't an error: at most _MAX_NR entries are
+ * processed per call and a batch ends early when its run of inode
+ * numbers reaches a lock group boundary.  Callers continue from the
+ * first uncreated entry.
+ *
+ * The whole batch fails with -EEXIST before creating anything if any
+ * name already exists, including duplicates within the batch.  If an
+ * entry fails after files have been created then the count of created
+ * files is returned and retrying reports the error for the failed
+ * entry first.
+ *
+ * The files are created with the caller's creds like creat() would,
+ * but without instantiating dentries; later lookups find them just as
+ * they find files created on other nodes.  Writing to the directory
+ * requires the usual write permission on it.
+ */
+struct scoutfs_ioctl_bulk_create {
+	__u64 entries_ptr;
+	__u64 nr;
+	__u32 mode;
+	__u8 _pad[4];
+} __packed;
+
+#define SCOUTFS_IOC_BULK_CREATE_MAX_NR 64
+
+#define SCOUTFS_IOC_BULK_CREATE _IOW(SCOUTFS_IOCTL_MAGIC, 13, \
+				     struct scoutfs_ioctl_bulk_create)
+
 #endif
@@ -14,7 +14,11 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
-#include <linux/rbtree_augmented.h>
+#include <linux/hash.h>
+#include <linux/rbtree.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/delay.h>
 
 #include "super.h"
 #include "format.h"
@@ -35,6 +39,25 @@
  * negative lookups cache hits for items that don't exist without having
  * to constantly perform expensive segment searches.
  *
+ * The cache is sharded to reduce lock contention between unrelated
+ * operations.  Item keys are hashed to shards at the granularity of the
+ * key ranges that are covered by cluster locks.  All the keys covered
+ * by a given lock hash to the same shard so all the operations inside a
+ * lock work with a single shard's trees under its lock while operations
+ * under other locks can proceed on other shards concurrently.
+ *
+ * Dirty items are additionally indexed by a single rbtree across all
+ * the shards so that writing dirty items into a sorted segment doesn't
+ * have to merge sorted walks of all the shards.
+ *
+ * Read-mostly callers first try a lockless walk of the shard's trees.
+ * Writers modify the trees and item values under the shard lock inside
+ * a seqcount write section and free items and values after an rcu grace
+ * period.  Lockless readers can always safely load pointers during
+ * their walk and retry against the seqcount to throw away results of
+ * racing walks, falling back to the locked path when they race or when
+ * resolving the call needs to populate or modify the cache.
+ *
  * Deletions of persistent items are recorded with items in the rbtree
  * which record the key of the deletion.  They're removed once they're
  * written to a level0 segment.  While they're present in the cache we
@@ -49,54 +72,208 @@ static bool invalid_key_val(struct scoutfs_key *key, struct kvec *val)
 	return WARN_ON_ONCE(val && (val->iov_len > SCOUTFS_MAX_VAL_SIZE));
 }
 
-struct item_cache {
-	struct super_block *sb;
+/*
+ * We can hold all the shard locks at once while sweeping dirty items so
+ * the shard count is limited by the max lockdep subclass nesting.
+ */
+#define ITEM_SHARD_NR 8
 
+/*
+ * Clean items sit on one of two lru lists.  Items enter on probation
+ * and are only promoted to the protected list when they're referenced
+ * again, so a single streaming scan can't flush the working set.  The
+ * shrinker empties probation before it touches protected items.
+ * lru_nr counts the items on both lists.
+ */
+struct item_shard {
 	spinlock_t lock;
+	seqcount_t seqcount;
 	struct rb_root items;
 	struct rb_root ranges;
 
+	struct list_head probation_list;
+	struct list_head protected_list;
+	unsigned long lru_nr;
+	unsigned long protected_nr;
+};
+
+struct item_cache {
+	struct super_block *sb;
+
+	struct item_shard shards[ITEM_SHARD_NR];
+
+	/* the dirty item index spans the shards under its own lock */
+	spinlock_t dirty_lock;
+	struct rb_root dirty_items;
 	long nr_dirty_items;
 	long dirty_val_bytes;
 
 	struct shrinker shrinker;
-	struct list_head lru_list;
-	unsigned long lru_nr;
 };
 
 /*
- * The dirty bits track if the given item is dirty and if its child
- * subtrees contain any dirty items.
+ * Hash a key to its shard.  The hash input must be constant across all
+ * the keys that can be covered by a single cluster lock so that every
+ * locked operation works in one shard.  We mirror the group masking
+ * that lock.c uses to build lock ranges for each zone and fold in the
+ * zone itself for the remaining zones whose locks cover the fixed
+ * ranges of a single name.
+ */
+static struct item_shard *item_shard(struct item_cache *cac,
+				     struct scoutfs_key *key)
+{
+	u64 group;
+
+	switch (key->sk_zone) {
+	case SCOUTFS_FS_ZONE:
+		group = le64_to_cpu(key->ski_ino) &
+			~(u64)SCOUTFS_LOCK_INODE_GROUP_MASK;
+		break;
+	case SCOUTFS_INODE_INDEX_ZONE:
+		group = (le64_to_cpu(key->skii_major) &
+			 ~SCOUTFS_LOCK_SEQ_GROUP_MASK) ^
+			((u64)key->sk_type << 56);
+		break;
+	case SCOUTFS_NODE_ZONE:
+		group = le64_to_cpu(key->_sk_first);
+		break;
+	default:
+		group = 0;
+		break;
+	}
+
+	return &cac->shards[hash_64(group ^ key->sk_zone, ilog2(ITEM_SHARD_NR))];
+}
+
+/*
+ * The dirty bit is set while the item is linked in the cache-wide dirty
+ * item rbtree with its dirty_node.
  *
- * The entry list_head typically stores clean items on an lru for shrinking.
- * It's also briefly used to track items in a batch after they're
+ * The entry list_head typically stores clean items on one of a shard's
+ * lru lists for shrinking, with the lru_protected bit recording which
+ * list.  It's also briefly used to track items in a batch after they're
  * allocated but before they're inserted for the first time.
  *
  * The persistent bit indicates that the item's key is present in
  * segments.   If we delete persistent items we have to write a deletion
  * item to delete to remove the existing item.  We can free deleted items
  * that aren't persistent without writing them.
+ *
+ * Small values are stored inline in the item allocation and val points
+ * at inline_val.  Larger values get their own allocation.  The inline
+ * capacity covers the most common items, including inodes and typical
+ * dirents, so bulk ingest doesn't pay for a second allocation per item.
  */
+#define ITEM_INLINE_VAL_LEN 128
+
 struct cached_item {
 	struct rb_node node;
+	struct rb_node dirty_node;
 	struct list_head entry;
+	struct rcu_head rcu;
 
-	long dirty;
-	unsigned deletion:1,
-		 persistent:1;
+	unsigned dirty:1,
+		 deletion:1,
+		 persistent:1,
+		 lru_protected:1;
 
 	struct scoutfs_key key;
 	void *val;
 	unsigned int val_len;
+	u8 inline_val[ITEM_INLINE_VAL_LEN];
 };
 
+/*
+ * Ranges in a shard's tree are kept disjoint: insertion merges any
+ * overlapping ranges into one and removal trims or splits them.  That
+ * means a stabbing query for the range covering a key is a plain
+ * O(log n) rbtree descent and the tree doesn't need interval
+ * augmentation to bound overlap searches.
+ */
 struct cached_range {
 	struct rb_node node;
+	struct rcu_head rcu;
 
 	struct scoutfs_key start;
 	struct scoutfs_key end;
 };
 
+/*
+ * Items and cached ranges share one slab cache because the shrinker
+ * re-uses freed item memory to store split ranges, so both object types
+ * have to be freed back to the same cache.  Item allocations dominate
+ * by orders of magnitude so the padding in range allocations is noise.
+ */
+static struct kmem_cache *cached_obj_cache;
+
+/*
+ * Item values are allocated with a hidden header so that a value that
+ * was replaced or deleted, and whose pointer lockless readers might
+ * still be copying from, can be freed after a grace period.
+ *
+ * The allocations are refcounted so that value references handed out to
+ * callers can outlive the item.  Out of line values are never modified
+ * in place -- updates swap in a new allocation -- so a held ref always
+ * sees a stable snapshot of the value.  The final put still defers the
+ * free past a grace period for the lockless readers.
+ */
+struct item_val {
+	struct rcu_head rcu;
+	atomic_t refs;
+	u8 data[0];
+};
+
+static void *val_ptr_alloc(unsigned int len)
+{
+	struct item_val *iv;
+
+	iv = kmalloc(offsetof(struct item_val, data[len]), GFP_NOFS);
+	if (!iv)
+		return NULL;
+
+	atomic_set(&iv->refs, 1);
+	return iv->data;
+}
+
+static struct item_val *val_ptr_iv(void *ptr)
+{
+	return (struct item_val *)((char *)ptr -
+				   offsetof(struct item_val, data));
+}
+
+/* only safe under the shard lock which excludes the last put */
+static void val_ptr_get(void *ptr)
+{
+	atomic_inc(&val_ptr_iv(ptr)->refs);
+}
+
+static void val_ptr_free_rcu(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct item_val, rcu));
+}
+
+static void val_ptr_put(void *ptr)
+{
+	if (ptr && atomic_dec_and_test(&val_ptr_iv(ptr)->refs))
+		call_rcu(&val_ptr_iv(ptr)->rcu, val_ptr_free_rcu);
+}
+
+/*
+ * Modifications of a shard's trees and item values are made under the
+ * shard lock inside a seqcount write section so that lockless readers
+ * can detect that they raced with a writer and retry or fall back to
+ * the locked path.
+ */
+static void shard_mod_begin(struct item_shard *shard)
+{
+	write_seqcount_begin(&shard->seqcount);
+}
+
+static void shard_mod_end(struct item_shard *shard)
+{
+	write_seqcount_end(&shard->seqcount);
+}
+
 #define trace_range(which, sb, rng) \
 	trace_scoutfs_item_range_##which(sb, (rng), &(rng)->start, &(rng)->end)
 
@@ -105,21 +282,47 @@ static u8 item_flags(struct cached_item *item)
 	return item->deletion ? SCOUTFS_ITEM_FLAG_DELETION : 0;
 }
 
+static void free_item_rcu(struct rcu_head *rcu)
+{
+	struct cached_item *item = container_of(rcu, struct cached_item, rcu);
+
+	if (item->val && item->val != item->inline_val)
+		kfree(val_ptr_iv(item->val));
+	kmem_cache_free(cached_obj_cache, item);
+}
+
+/*
+ * Items are freed after a grace period because lockless readers can
+ * still be walking through their node and copying their value.
+ */
 static void free_item(struct super_block *sb, struct cached_item *item)
 {
 	if (!IS_ERR_OR_NULL(item)) {
 		scoutfs_inc_counter(sb, item_free);
 		WARN_ON_ONCE(!list_empty(&item->entry));
 		WARN_ON_ONCE(!RB_EMPTY_NODE(&item->node));
-		kfree(item->val);
-		kfree(item);
+		WARN_ON_ONCE(!RB_EMPTY_NODE(&item->dirty_node));
+		call_rcu(&item->rcu, free_item_rcu);
 	}
 }
 
 /*
- * The value vec may be null if the item has no value.  Values are
- * allocated separately so that we can free them when deleting or swap
- * them in place when updating items.
+ * Free an item's value allocation if it has one that isn't stored
+ * inline, leaving the item with no value.
+ */
+static void free_item_val(struct cached_item *item)
+{
+	if (item->val && item->val != item->inline_val)
+		val_ptr_put(item->val);
+	item->val = NULL;
+	item->val_len = 0;
+}
+
+/*
+ * The value vec may be null if the item has no value.  Small values are
+ * stored inline in the item, larger values are allocated separately so
+ * that we can free them when deleting or swap them in place when
+ * updating items.
  */
 static struct cached_item *alloc_item(struct super_block *sb,
 				      struct scoutfs_key *key,
@@ -127,20 +330,25 @@ static struct cached_item *alloc_item(struct super_block *sb,
 {
 	struct cached_item *item;
 
-	item = kzalloc(sizeof(struct cached_item), GFP_NOFS);
+	item = kmem_cache_zalloc(cached_obj_cache, GFP_NOFS);
 	if (!item)
 		goto out;
 
 	item->key = *key;
 	RB_CLEAR_NODE(&item->node);
+	RB_CLEAR_NODE(&item->dirty_node);
 	INIT_LIST_HEAD(&item->entry);
 
 	if (val) {
-		item->val = kmalloc(val->iov_len, GFP_NOFS);
-		if (!item->val) {
-			free_item(sb, item);
-			item = NULL;
-			goto out;
+		if (val->iov_len <= ITEM_INLINE_VAL_LEN) {
+			item->val = item->inline_val;
+		} else {
+			item->val = val_ptr_alloc(val->iov_len);
+			if (!item->val) {
+				free_item(sb, item);
+				item = NULL;
+				goto out;
+			}
 		}
 		item->val_len = val->iov_len;
 		memcpy(item->val, val->iov_base, val->iov_len);
@@ -251,110 +459,33 @@ static struct cached_item *prev_item(struct rb_root *root,
 	return walk_items(root, key, &prev, &next) ?: prev;
 }
 
-/*
- * We store the dirty bits in a single value so that the simple
- * augmented rbtree implementation gets a single scalar value to compare
- * and store.
- */
-#define ITEM_DIRTY 0x1
-#define LEFT_DIRTY 0x2
-#define RIGHT_DIRTY 0x4
-
 static bool item_is_dirty(struct cached_item *item)
 {
-	return (item->dirty & ITEM_DIRTY) != 0;
+	return item->dirty != 0;
 }
 
-/*
- * Return the given dirty bit if the item with the given node is dirty
- * or has dirty children.
- */
-static long node_dirty_bit(struct rb_node *node, long dirty)
+/* the caller holds the dirty_lock, keys are unique across the shards */
+static void insert_dirty_item(struct item_cache *cac, struct cached_item *ins)
 {
+	struct rb_node **node = &cac->dirty_items.rb_node;
+	struct rb_node *parent = NULL;
 	struct cached_item *item;
 
-	if (node) {
-		item = container_of(node, struct cached_item, node);
-		if (item->dirty)
-			return dirty;
-	}
-
-	return 0;
-}
-
-static long compute_item_dirty(struct cached_item *item)
-{
-	return (item->dirty & ITEM_DIRTY) |
-	       node_dirty_bit(item->node.rb_left, LEFT_DIRTY) |
-	       node_dirty_bit(item->node.rb_right, RIGHT_DIRTY);
-}
-
-static void scoutfs_item_rb_propagate(struct rb_node *node,
-				      struct rb_node *stop)
-{
-	struct cached_item *item;
-	long dirty;
-
-	while (node != stop) {
-		item = container_of(node, struct cached_item, node);
-		dirty = compute_item_dirty(item);
-
-		if (item->dirty == dirty)
-			break;
+	while (*node) {
+		parent = *node;
+		item = container_of(*node, struct cached_item, dirty_node);
 
-		item->dirty = dirty;
-		node = rb_parent(&item->node);
+		if (scoutfs_key_compare(&ins->key, &item->key) < 0)
+			node = &(*node)->rb_left;
+		else
+			node = &(*node)->rb_right;
 	}
-}
-
-static void scoutfs_item_rb_copy(struct rb_node *old, struct rb_node *new)
-{
-	struct cached_item *n = container_of(new, struct cached_item, node);
-
-	n->dirty = compute_item_dirty(n);
-}
-
-/* calculate the new parent last as it depends on the old parent */
-static void scoutfs_item_rb_rotate(struct rb_node *old, struct rb_node *new)
-{
-	struct cached_item *o = container_of(old, struct cached_item, node);
-	struct cached_item *n = container_of(new, struct cached_item, node);
-
-	o->dirty = compute_item_dirty(o);
-	n->dirty = compute_item_dirty(n);
-}
-
-/*
- * The generic RB_DECLARE_CALLBACKS() helpers are built for augmented
- * values that are simple commutative function of the left and right
- * children's augmented values.  During rotation the new parent just
- * gets the old parent's augmented value and then the old parent's value
- * is calculated.
- *
- * Our dirty bits don't work that way.  They are not just an or of the
- * child's bits, the bits depend on the left and right children
- * specifically.  During rotation both parents need to be specifically
- * recalculated.  (They could be masked and asigned based on the
- * direction of the rotation but that's annoying, let's just
- * recalculate.)
- */
-static const struct rb_augment_callbacks scoutfs_item_rb_cb  = {
-	.propagate = scoutfs_item_rb_propagate,
-	.copy = scoutfs_item_rb_copy,
-	.rotate = scoutfs_item_rb_rotate,
-};
 
-/*
- * The caller has changed an item's dirty bit.  Its child dirty bits are
- * still consistent.  But its parent's bits might need to be updated.
- * Its bits are consistent so we don't propagate from the node itself
- * because it would immediately terminate.
- */
-static void update_dirty_parents(struct cached_item *item)
-{
-	scoutfs_item_rb_propagate(rb_parent(&item->node), NULL);
+	rb_link_node(&ins->dirty_node, parent, node);
+	rb_insert_color(&ins->dirty_node, &cac->dirty_items);
 }
 
+/* the caller holds the dirty_lock */
 static void update_dirty_item_counts(struct super_block *sb, signed items,
 				     signed vals)
 {
@@ -368,7 +499,7 @@ static void update_dirty_item_counts(struct super_block *sb, signed items,
 }
 
 static void mark_item_dirty(struct super_block *sb, struct item_cache *cac,
-			    struct cached_item *item)
+			    struct item_shard *shard, struct cached_item *item)
 {
 	if (WARN_ON_ONCE(RB_EMPTY_NODE(&item->node)))
 		return;
@@ -376,15 +507,22 @@ static void mark_item_dirty(struct super_block *sb, struct item_cache *cac,
 	if (item_is_dirty(item))
 		return;
 
-	item->dirty |= ITEM_DIRTY;
+	item->dirty = 1;
 	list_del_init(&item->entry);
-	cac->lru_nr--;
+	shard->lru_nr--;
+	if (item->lru_protected) {
+		item->lru_protected = 0;
+		shard->protected_nr--;
+	}
 
+	spin_lock(&cac->dirty_lock);
+	insert_dirty_item(cac, item);
 	update_dirty_item_counts(sb, 1, item->val_len);
-	update_dirty_parents(item);
+	spin_unlock(&cac->dirty_lock);
 }
 
 static void clear_item_dirty(struct super_block *sb, struct item_cache *cac,
+			     struct item_shard *shard,
 			     struct cached_item *item)
 {
 	if (WARN_ON_ONCE(RB_EMPTY_NODE(&item->node)))
@@ -393,46 +531,78 @@ static void clear_item_dirty(struct super_block *sb, struct item_cache *cac,
 	if (!item_is_dirty(item))
 		return;
 
-	item->dirty &= ~ITEM_DIRTY;
-	list_add_tail(&item->entry, &cac->lru_list);
-	cac->lru_nr++;
+	item->dirty = 0;
+	list_add_tail(&item->entry, &shard->probation_list);
+	shard->lru_nr++;
 
+	spin_lock(&cac->dirty_lock);
+	rb_erase(&item->dirty_node, &cac->dirty_items);
+	RB_CLEAR_NODE(&item->dirty_node);
 	update_dirty_item_counts(sb, -1, -item->val_len);
 
 	WARN_ON_ONCE(cac->nr_dirty_items < 0 || cac->dirty_val_bytes < 0);
-
-	update_dirty_parents(item);
+	spin_unlock(&cac->dirty_lock);
 }
 
-static void item_referenced(struct item_cache *cac, struct cached_item *item)
+/*
+ * A locked reader used the item.  First references promote items from
+ * probation to the protected list so the shrinker's probation scan
+ * passes over the working set.  When the protected list grows past half
+ * of the shard's clean items we age its coldest item back to probation
+ * so a once-hot set can't pin the whole cache.
+ */
+static void item_referenced(struct super_block *sb, struct item_shard *shard,
+			    struct cached_item *item)
 {
-	if (!item->dirty)
-		list_move_tail(&item->entry, &cac->lru_list);
+	struct cached_item *cold;
+
+	if (item->dirty)
+		return;
+
+	if (!item->lru_protected) {
+		item->lru_protected = 1;
+		shard->protected_nr++;
+		scoutfs_inc_counter(sb, item_lru_promote);
+	}
+	list_move_tail(&item->entry, &shard->protected_list);
+
+	if (shard->protected_nr > shard->lru_nr - shard->protected_nr) {
+		cold = list_first_entry(&shard->protected_list,
+					struct cached_item, entry);
+		cold->lru_protected = 0;
+		shard->protected_nr--;
+		list_move_tail(&cold->entry, &shard->probation_list);
+		scoutfs_inc_counter(sb, item_lru_demote);
+	}
 }
 
 /* remove the item from its tracking data structures */
 static void unlink_item(struct super_block *sb, struct item_cache *cac,
-		        struct cached_item *item)
+			struct item_shard *shard, struct cached_item *item)
 {
-	clear_item_dirty(sb, cac, item);
-	rb_erase_augmented(&item->node, &cac->items, &scoutfs_item_rb_cb);
+	clear_item_dirty(sb, cac, shard, item);
+	rb_erase(&item->node, &shard->items);
 	RB_CLEAR_NODE(&item->node);
 	if (!list_empty(&item->entry)) {
 		list_del_init(&item->entry);
-		cac->lru_nr--;
+		shard->lru_nr--;
+		if (item->lru_protected) {
+			item->lru_protected = 0;
+			shard->protected_nr--;
+		}
 	}
 }
 
 /*
  * Safely erase an item from the tree.  Make sure to remove its dirty
- * accounting, use the augmented erase, and free it.
+ * accounting and free it.
  */
 static void erase_item(struct super_block *sb, struct item_cache *cac,
-		       struct cached_item *item)
+		       struct item_shard *shard, struct cached_item *item)
 {
 	trace_scoutfs_erase_item(sb, item);
 
-	unlink_item(sb, cac, item);
+	unlink_item(sb, cac, shard, item);
 	free_item(sb, item);
 }
 
@@ -446,22 +616,20 @@ static void erase_item(struct super_block *sb, struct item_cache *cac,
  * deletion item so we can free the value.
  */
 static void delete_item(struct super_block *sb, struct item_cache *cac,
-			struct cached_item *item)
+			struct item_shard *shard, struct cached_item *item)
 {
 	if (!item->persistent) {
-		erase_item(sb, cac, item);
+		erase_item(sb, cac, shard, item);
 		return;
 	}
 
 	/* uses val_len to update item accounting */
-	clear_item_dirty(sb, cac, item);
+	clear_item_dirty(sb, cac, shard, item);
 
-	kfree(item->val);
-	item->val = NULL;
-	item->val_len = 0;
+	free_item_val(item);
 
 	item->deletion = 1;
-	mark_item_dirty(sb, cac, item);
+	mark_item_dirty(sb, cac, shard, item);
 	scoutfs_inc_counter(sb, item_delete);
 }
 
@@ -484,10 +652,10 @@ static void delete_item(struct super_block *sb, struct item_cache *cac,
  * locking consistency).
  */
 static int insert_item(struct super_block *sb, struct item_cache *cac,
-		       struct cached_item *ins, bool logical_overwrite,
-		       bool cache_populate)
+		       struct item_shard *shard, struct cached_item *ins,
+		       bool logical_overwrite, bool cache_populate)
 {
-	struct rb_root *root = &cac->items;
+	struct rb_root *root = &shard->items;
 	struct cached_item *item;
 	struct rb_node *parent;
 	struct rb_node **node;
@@ -502,20 +670,15 @@ restart:
 
 		cmp = scoutfs_key_compare(&ins->key, &item->key);
 		if (cmp < 0) {
-			if (ins->dirty)
-				item->dirty |= LEFT_DIRTY;
 			node = &(*node)->rb_left;
 		} else if (cmp > 0) {
-			if (ins->dirty)
-				item->dirty |= RIGHT_DIRTY;
 			node = &(*node)->rb_right;
 		} else {
 			if (cache_populate ||
 			    (!item->deletion && !logical_overwrite))
 				return -EEXIST;
 
-			/* sadly there's no augmented replace */
-			erase_item(sb, cac, item);
+			erase_item(sb, cac, shard, item);
 			if (item->persistent)
 				ins->persistent = 1;
 			goto restart;
@@ -525,11 +688,11 @@ restart:
 	trace_scoutfs_item_insertion(sb, &ins->key);
 
 	rb_link_node(&ins->node, parent, node);
-	rb_insert_augmented(&ins->node, root, &scoutfs_item_rb_cb);
+	rb_insert_color(&ins->node, root);
 
 	BUG_ON(item_is_dirty(ins));
-	list_add_tail(&ins->entry, &cac->lru_list);
-	cac->lru_nr++;
+	list_add_tail(&ins->entry, &shard->probation_list);
+	shard->lru_nr++;
 
 	return 0;
 }
@@ -590,22 +753,20 @@ static struct cached_range *walk_ranges(struct rb_root *root,
 }
 
 /*
- * Return true if the given key is covered by a cached range.  start and
- * end are set to the existing cached range.
+ * Return true if the given key is covered by a cached range in the
+ * shard.  start and end are set to the existing cached range.
  *
  * Return false if the key is not covered by a range.  start and end are
  * set to zero.  (Nothing uses these today, this is to avoid tracing
  * uninitialized keys in this case.)
  */
-static bool check_range(struct super_block *sb, struct rb_root *root,
+static bool check_range(struct super_block *sb, struct item_shard *shard,
 			struct scoutfs_key *key, struct scoutfs_key *start,
 			struct scoutfs_key *end)
 {
-	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
-	struct item_cache *cac = sbi->item_cache;
 	struct cached_range *rng;
 
-	rng = walk_ranges(&cac->ranges, key, NULL, NULL);
+	rng = walk_ranges(&shard->ranges, key, NULL, NULL);
 	if (rng) {
 		scoutfs_inc_counter(sb, item_range_hit);
 		if (start)
@@ -624,12 +785,18 @@ static bool check_range(struct super_block *sb, struct rb_root *root,
 	return false;
 }
 
+static void free_range_rcu(struct rcu_head *rcu)
+{
+	kmem_cache_free(cached_obj_cache,
+			 container_of(rcu, struct cached_range, rcu));
+}
+
 static void free_range(struct super_block *sb, struct cached_range *rng)
 {
 	if (!IS_ERR_OR_NULL(rng)) {
 		scoutfs_inc_counter(sb, item_range_free);
 		trace_range(free, sb, rng);
-		kfree(rng);
+		call_rcu(&rng->rcu, free_range_rcu);
 	}
 }
 
@@ -799,6 +966,242 @@ static bool lock_coverage(struct scoutfs_lock *lock,
 					   &lock->start, &lock->end) == 0;
 }
 
+/*
+ * The lockless walks descend through child pointers that concurrent
+ * rebalancing can modify.  The seqcount retry throws away anything a
+ * racing walk produced, we just have to make sure that a confused walk
+ * terminates.  Nodes are only freed after a grace period so child
+ * pointer loads always hit valid memory.
+ */
+#define ITEM_RCU_WALK_MAX 64
+
+/*
+ * Lockless search for the item with the given key.  Returns the exact
+ * item, null, or -EAGAIN if the walk didn't terminate in time.
+ */
+static struct cached_item *rcu_walk_item(struct item_shard *shard,
+					 struct scoutfs_key *key)
+{
+	struct rb_node *node = ACCESS_ONCE(shard->items.rb_node);
+	struct cached_item *item;
+	int cmp;
+	int i;
+
+	for (i = 0; node; i++) {
+		if (i == ITEM_RCU_WALK_MAX)
+			return ERR_PTR(-EAGAIN);
+
+		item = container_of(node, struct cached_item, node);
+
+		cmp = scoutfs_key_compare(key, &item->key);
+		if (cmp < 0)
+			node = ACCESS_ONCE(node->rb_left);
+		else if (cmp > 0)
+			node = ACCESS_ONCE(node->rb_right);
+		else
+			return item;
+	}
+
+	return NULL;
+}
+
+/*
+ * Lockless search for the item at or after the given key, only using
+ * the descent itself so that we never have to chase parent pointers.
+ */
+static struct cached_item *rcu_walk_next_item(struct item_shard *shard,
+					      struct scoutfs_key *key)
+{
+	struct rb_node *node = ACCESS_ONCE(shard->items.rb_node);
+	struct cached_item *next = NULL;
+	struct cached_item *item;
+	int cmp;
+	int i;
+
+	for (i = 0; node; i++) {
+		if (i == ITEM_RCU_WALK_MAX)
+			return ERR_PTR(-EAGAIN);
+
+		item = container_of(node, struct cached_item, node);
+
+		cmp = scoutfs_key_compare(key, &item->key);
+		if (cmp < 0) {
+			next = item;
+			node = ACCESS_ONCE(node->rb_left);
+		} else if (cmp > 0) {
+			node = ACCESS_ONCE(node->rb_right);
+		} else {
+			return item;
+		}
+	}
+
+	return next;
+}
+
+/* Lockless search for the cached range covering the given key. */
+static struct cached_range *rcu_walk_ranges(struct item_shard *shard,
+					    struct scoutfs_key *key)
+{
+	struct rb_node *node = ACCESS_ONCE(shard->ranges.rb_node);
+	struct cached_range *rng;
+	int cmp;
+	int i;
+
+	for (i = 0; node; i++) {
+		if (i == ITEM_RCU_WALK_MAX)
+			return ERR_PTR(-EAGAIN);
+
+		rng = container_of(node, struct cached_range, node);
+
+		cmp = scoutfs_key_compare_ranges(key, key,
+						 &rng->start, &rng->end);
+		if (cmp < 0)
+			node = ACCESS_ONCE(node->rb_left);
+		else if (cmp > 0)
+			node = ACCESS_ONCE(node->rb_right);
+		else
+			return rng;
+	}
+
+	return NULL;
+}
+
+/*
+ * Copy an item's value for a lockless reader.  Writers update the
+ * value pointer and length non-atomically under their seqcount write
+ * section and can transiently null the pointer, so we snapshot both
+ * and only copy once the seqcount shows they were stable since the
+ * read section began: a consistent pair never describes more bytes
+ * than its allocation holds.  The rcu grace periods on value and item
+ * frees keep the snapshotted memory alive for the copy; a writer that
+ * modifies an inline value under us can only tear the copied bytes,
+ * which the caller's final seqcount retry throws away.
+ */
+static int copy_item_val_rcu(struct item_shard *shard, unsigned int seq,
+			     struct kvec *val, struct cached_item *item)
+{
+	unsigned int len = ACCESS_ONCE(item->val_len);
+	void *ptr = ACCESS_ONCE(item->val);
+	int ret;
+
+	if (!val)
+		return 0;
+
+	if (ptr == NULL || read_seqcount_retry(&shard->seqcount, seq))
+		return -EAGAIN;
+
+	ret = min_t(size_t, len, val->iov_len);
+	memcpy(val->iov_base, ptr, ret);
+	return ret;
+}
+
+/*
+ * Try to resolve a lookup without taking the shard lock.  We can return
+ * a positive hit from an item or a cached negative -ENOENT when a range
+ * covers the key without an item.  -EAGAIN falls back to the locked
+ * path: the cache has to be populated, or we raced with a writer.
+ *
+ * Lockless hits don't nudge items in the lru.  Shrinking order is
+ * approximate to begin with and it beats dirtying shared cache lines on
+ * every read.
+ */
+static int item_lookup_rcu(struct super_block *sb, struct item_shard *shard,
+			   struct scoutfs_key *key, struct kvec *val)
+{
+	struct cached_range *rng;
+	struct cached_item *item;
+	unsigned int seq;
+	int ret;
+
+	rcu_read_lock();
+	seq = read_seqcount_begin(&shard->seqcount);
+
+	item = rcu_walk_item(shard, key);
+	if (IS_ERR(item)) {
+		ret = -EAGAIN;
+	} else if (item && !item->deletion) {
+		ret = copy_item_val_rcu(shard, seq, val, item);
+	} else {
+		rng = rcu_walk_ranges(shard, key);
+		if (IS_ERR_OR_NULL(rng))
+			ret = -EAGAIN;
+		else
+			ret = -ENOENT;
+	}
+
+	if (ret != -EAGAIN && read_seqcount_retry(&shard->seqcount, seq))
+		ret = -EAGAIN;
+	rcu_read_unlock();
+
+	if (ret == -EAGAIN)
+		scoutfs_inc_counter(sb, item_rcu_fallback);
+	else
+		scoutfs_inc_counter(sb, item_lookup_rcu_hit);
+
+	return ret;
+}
+
+/*
+ * Try to resolve a _next call without taking the shard lock.  We only
+ * handle the case where the next item falls inside the cached range
+ * covering the search key, which the descent can find without chasing
+ * parent pointers.  Iterating into following ranges or over deletion
+ * items falls back to the locked path.
+ */
+static int item_next_rcu(struct super_block *sb, struct item_shard *shard,
+			 struct scoutfs_key *key, struct scoutfs_key *last,
+			 struct kvec *val)
+{
+	struct scoutfs_key range_end;
+	struct scoutfs_key found;
+	struct cached_range *rng;
+	struct cached_item *item;
+	unsigned int seq;
+	int ret;
+
+	rcu_read_lock();
+	seq = read_seqcount_begin(&shard->seqcount);
+
+	rng = rcu_walk_ranges(shard, key);
+	if (IS_ERR_OR_NULL(rng)) {
+		ret = -EAGAIN;
+		goto check;
+	}
+	range_end = rng->end;
+
+	item = rcu_walk_next_item(shard, key);
+	if (IS_ERR(item) || (item && item->deletion)) {
+		ret = -EAGAIN;
+		goto check;
+	}
+
+	if (item && scoutfs_key_compare(&item->key, last) <= 0 &&
+	    scoutfs_key_compare(&item->key, &range_end) <= 0) {
+		found = item->key;
+		ret = copy_item_val_rcu(shard, seq, val, item);
+	} else if (scoutfs_key_compare(&range_end, last) >= 0) {
+		/* the cached range covers the search, no next item */
+		ret = -ENOENT;
+	} else {
+		ret = -EAGAIN;
+	}
+
+check:
+	if (ret != -EAGAIN && read_seqcount_retry(&shard->seqcount, seq))
+		ret = -EAGAIN;
+	rcu_read_unlock();
+
+	if (ret == -EAGAIN) {
+		scoutfs_inc_counter(sb, item_rcu_fallback);
+	} else {
+		if (ret >= 0)
+			*key = found;
+		scoutfs_inc_counter(sb, item_next_rcu_hit);
+	}
+
+	return ret;
+}
+
 /*
  * Find an item with the given key and copy its value into the caller's
  * value vector.  The amount of bytes copied is returned which can be 0
@@ -812,6 +1215,7 @@ int scoutfs_item_lookup(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
@@ -821,28 +1225,33 @@ int scoutfs_item_lookup(struct super_block *sb, struct scoutfs_key *key,
 
 	trace_scoutfs_item_lookup(sb, key);
 
+	ret = item_lookup_rcu(sb, shard, key, val);
+	if (ret != -EAGAIN)
+		goto out;
+
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		item = find_item(sb, &cac->items, key);
+		item = find_item(sb, &shard->items, key);
 		if (item) {
-			item_referenced(cac, item);
+			item_referenced(sb, shard, item);
 			if (val)
 				ret = copy_item_val(val, item);
 			else
 				ret = 0;
-		} else if (check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENOENT;
 		} else {
 			ret = -ENODATA;
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 
+out:
 	trace_scoutfs_item_lookup_ret(sb, ret);
 	return ret;
 }
@@ -875,6 +1284,87 @@ int scoutfs_item_lookup_exact(struct super_block *sb,
 	return ret;
 }
 
+/*
+ * Give the caller a reference to an item's value without copying it.
+ * Values that aren't stored inline are refcounted allocations that are
+ * never modified in place -- updates swap in a new allocation -- so the
+ * caller's vec points at a stable snapshot of the value until they put
+ * the ref, even after they drop their lock.  Small inline values are
+ * copied into a private allocation so callers see one interface.
+ *
+ * The ref is acquired under the shard lock so that it can't race with
+ * an update dropping the last ref on the value.
+ *
+ * Returns the value length on success.  The caller must put the ref
+ * when they're done with the value.
+ */
+int scoutfs_item_lookup_ref(struct super_block *sb, struct scoutfs_key *key,
+			    struct scoutfs_item_ref *ref,
+			    struct scoutfs_lock *lock)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
+	struct cached_item *item;
+	unsigned long flags;
+	void *copy;
+	int ret;
+
+	if (WARN_ON_ONCE(!lock_coverage(lock, key, DLM_LOCK_PR)))
+		return -EINVAL;
+
+	ref->refd = NULL;
+	kvec_init(&ref->val, NULL, 0);
+
+	/* inline values are copied under the lock into our allocation */
+	copy = val_ptr_alloc(ITEM_INLINE_VAL_LEN);
+	if (!copy)
+		return -ENOMEM;
+
+	do {
+		spin_lock_irqsave(&shard->lock, flags);
+
+		item = find_item(sb, &shard->items, key);
+		if (item) {
+			item_referenced(sb, shard, item);
+			if (item->val && item->val != item->inline_val) {
+				val_ptr_get(item->val);
+				ref->refd = item->val;
+				scoutfs_inc_counter(sb, item_val_ref);
+			} else {
+				if (item->val_len)
+					memcpy(copy, item->val, item->val_len);
+				ref->refd = copy;
+				copy = NULL;
+				scoutfs_inc_counter(sb, item_val_ref_copy);
+			}
+			kvec_init(&ref->val, ref->refd, item->val_len);
+			ret = item->val_len;
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
+			ret = -ENOENT;
+		} else {
+			ret = -ENODATA;
+		}
+
+		spin_unlock_irqrestore(&shard->lock, flags);
+
+	} while (ret == -ENODATA &&
+		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
+						    &lock->end, true)) == 0);
+
+	val_ptr_put(copy);
+	return ret;
+}
+
+void scoutfs_item_put_ref(struct scoutfs_item_ref *ref)
+{
+	if (ref->refd) {
+		val_ptr_put(ref->refd);
+		ref->refd = NULL;
+		kvec_init(&ref->val, NULL, 0);
+	}
+}
+
 /*
  * Return the next linked node in the tree that isn't a deletion item
  * and which is still within the last allowed key value.
@@ -959,6 +1449,7 @@ int scoutfs_item_next(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct scoutfs_key pos;
 	struct scoutfs_key range_end;
 	struct cached_item *item;
@@ -981,13 +1472,17 @@ int scoutfs_item_next(struct super_block *sb, struct scoutfs_key *key,
 		goto out;
 	}
 
+	ret = item_next_rcu(sb, shard, key, last, val);
+	if (ret != -EAGAIN)
+		goto out;
+
 	pos = *key;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
 
 	for(;;) {
 		/* see if we have cache coverage of our iterator pos */
-		cached = check_range(sb, &cac->ranges, &pos, NULL, &range_end);
+		cached = check_range(sb, shard, &pos, NULL, &range_end);
 
 		trace_scoutfs_item_next_range_check(sb, !!cached, key,
 						    &pos, last, &lock->end,
@@ -995,49 +1490,178 @@ int scoutfs_item_next(struct super_block *sb, struct scoutfs_key *key,
 
 		if (!cached) {
 			/* populate missing cached range starting at pos */
-			spin_unlock_irqrestore(&cac->lock, flags);
+			spin_unlock_irqrestore(&shard->lock, flags);
+
+			ret = scoutfs_manifest_read_items(sb, &pos,
+							  &lock->start,
+							  &lock->end,
+							  false);
+
+			spin_lock_irqsave(&shard->lock, flags);
+			if (ret)
+				break;
+			else
+				continue;
+		}
+
+		/* see if there's an item in the cached range from pos */
+		item = item_for_next(&shard->items, &pos, &range_end, last);
+		if (!item) {
+			if (scoutfs_key_compare(&range_end, last) < 0) {
+				/* keep searching after empty cached range */
+				pos = range_end;
+				scoutfs_key_inc(&pos);
+				continue;
+			}
+
+			/* no item and cache covers last, done */
+			ret = -ENOENT;
+			break;
+		}
+
+		/* we have a next item inside the cached range, done */
+		*key = item->key;
+		if (val) {
+			item_referenced(sb, shard, item);
+			ret = copy_item_val(val, item);
+		} else {
+			ret = 0;
+		}
+		break;
+	}
+
+	spin_unlock_irqrestore(&shard->lock, flags);
+out:
+
+	trace_scoutfs_item_next_ret(sb, ret);
+	return ret;
+}
+
+/*
+ * Copy a batch of items into the caller's buffer, starting with the
+ * given key and returning items up to the last key at most.  Each item
+ * is packed into a scoutfs_item_batch_entry record with its value
+ * bytes following the entry.
+ *
+ * Where _next locks and searches the item rbtree once per item, this
+ * copies as many items as fit in the buffer per traversal.  Iterating
+ * over lots of small items, like listing a large directory, calls this
+ * once per buffer instead of once per item.
+ *
+ * The number of copied entries is returned.  Like _next, -ENOENT is
+ * returned when there are no items between the given and last keys
+ * inside the range covered by the lock.  Copying stops short when the
+ * next item's entry doesn't fit in the remaining buffer bytes and the
+ * caller continues from after the last copied key.  -ENOBUFS is
+ * returned if the first item's entry doesn't fit in the buffer at all.
+ */
+int scoutfs_item_next_batch(struct super_block *sb, struct scoutfs_key *key,
+			    struct scoutfs_key *last, void *buf,
+			    unsigned int bytes, struct scoutfs_lock *lock)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
+	struct scoutfs_item_batch_entry *ent = buf;
+	struct scoutfs_key range_end;
+	struct scoutfs_key pos;
+	struct scoutfs_key *bound;
+	struct cached_item *item;
+	unsigned int ent_bytes;
+	unsigned int used = 0;
+	unsigned long flags;
+	bool cached;
+	int nr = 0;
+	int ret;
+
+	/* use the end key as the last key if it's closer to reduce compares */
+	if (scoutfs_key_compare(&lock->end, last) < 0)
+		last = &lock->end;
+
+	/* convenience to avoid searching if caller iterates past their last */
+	if (scoutfs_key_compare(key, last) > 0) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	if (WARN_ON_ONCE(!lock_coverage(lock, key, DLM_LOCK_PR))) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	pos = *key;
+
+	spin_lock_irqsave(&shard->lock, flags);
+
+	for(;;) {
+		/* see if we have cache coverage of our iterator pos */
+		cached = check_range(sb, shard, &pos, NULL, &range_end);
+
+		if (!cached) {
+			/* return a partial batch instead of reading */
+			if (nr) {
+				ret = nr;
+				break;
+			}
+
+			/* populate missing cached range starting at pos */
+			spin_unlock_irqrestore(&shard->lock, flags);
 
 			ret = scoutfs_manifest_read_items(sb, &pos,
 							  &lock->start,
-							  &lock->end);
+							  &lock->end,
+							  false);
 
-			spin_lock_irqsave(&cac->lock, flags);
+			spin_lock_irqsave(&shard->lock, flags);
 			if (ret)
 				break;
 			else
 				continue;
 		}
 
-		/* see if there's an item in the cached range from pos */
-		item = item_for_next(&cac->items, &pos, &range_end, last);
-		if (!item) {
-			if (scoutfs_key_compare(&range_end, last) < 0) {
-				/* keep searching after empty cached range */
-				pos = range_end;
-				scoutfs_key_inc(&pos);
-				continue;
-			}
+		/* limit by the lesser of the two */
+		bound = scoutfs_key_compare(&range_end, last) < 0 ?
+			&range_end : last;
 
-			/* no item and cache covers last, done */
-			ret = -ENOENT;
+		/* copy the cached range's items that fit in the buffer */
+		item = item_for_next(&shard->items, &pos, &range_end, last);
+		while (item) {
+			ent_bytes = scoutfs_item_batch_entry_bytes(
+								item->val_len);
+			if (used + ent_bytes > bytes)
+				break;
+
+			item_referenced(sb, shard, item);
+			ent->key = item->key;
+			ent->val_len = item->val_len;
+			memcpy(ent->val, item->val, item->val_len);
+			ent = scoutfs_item_batch_entry_next(ent);
+			used += ent_bytes;
+			nr++;
+
+			item = next_item_node(&shard->items, item, bound);
+		}
+
+		/* an item didn't fit, return what we have */
+		if (item) {
+			ret = nr ?: -ENOBUFS;
 			break;
 		}
 
-		/* we have a next item inside the cached range, done */
-		*key = item->key;
-		if (val) {
-			item_referenced(cac, item);
-			ret = copy_item_val(val, item);
-		} else {
-			ret = 0;
+		if (scoutfs_key_compare(&range_end, last) < 0) {
+			/* keep copying after the end of the cached range */
+			pos = range_end;
+			scoutfs_key_inc(&pos);
+			continue;
 		}
+
+		/* cache covers last, done */
+		ret = nr ?: -ENOENT;
 		break;
 	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
 out:
-
-	trace_scoutfs_item_next_ret(sb, ret);
 	return ret;
 }
 
@@ -1125,6 +1749,7 @@ int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct scoutfs_key range_start;
 	struct scoutfs_key pos;
 	struct cached_item *item;
@@ -1149,12 +1774,11 @@ int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 
 	pos = *key;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
 
 	for(;;) {
 		/* see if we have cache coverage of our iterator pos */
-		cached = check_range(sb, &cac->ranges, &pos,
-				     &range_start, NULL);
+		cached = check_range(sb, shard, &pos, &range_start, NULL);
 
 		trace_scoutfs_item_prev_range_check(sb, !!cached, key,
 						    &pos, first, &lock->start,
@@ -1162,13 +1786,14 @@ int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 
 		if (!cached) {
 			/* populate missing cached range starting at pos */
-			spin_unlock_irqrestore(&cac->lock, flags);
+			spin_unlock_irqrestore(&shard->lock, flags);
 
 			ret = scoutfs_manifest_read_items(sb, &pos,
 							  &lock->start,
-							  &lock->end);
+							  &lock->end,
+							  false);
 
-			spin_lock_irqsave(&cac->lock, flags);
+			spin_lock_irqsave(&shard->lock, flags);
 			if (ret)
 				break;
 			else
@@ -1176,7 +1801,7 @@ int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 		}
 
 		/* see if there's an item in the cached range from pos */
-		item = item_for_prev(&cac->items, &pos, &range_start, first);
+		item = item_for_prev(&shard->items, &pos, &range_start, first);
 		if (!item) {
 			if (scoutfs_key_compare(&range_start, first) > 0) {
 				/* keep searching before empty cached range */
@@ -1193,7 +1818,7 @@ int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 		/* we have a prev item inside the cached range, done */
 		*key = item->key;
 		if (val) {
-			item_referenced(cac, item);
+			item_referenced(sb, shard, item);
 			ret = copy_item_val(val, item);
 		} else {
 			ret = 0;
@@ -1201,7 +1826,7 @@ int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 		break;
 	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
 out:
 
 	trace_scoutfs_item_prev_ret(sb, ret);
@@ -1217,6 +1842,7 @@ int scoutfs_item_create(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
@@ -1234,23 +1860,25 @@ int scoutfs_item_create(struct super_block *sb, struct scoutfs_key *key,
 	}
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		if (!check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		if (!check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENODATA;
 		} else {
-			ret = insert_item(sb, cac, item, false, false);
+			shard_mod_begin(shard);
+			ret = insert_item(sb, cac, shard, item, false, false);
 			if (!ret) {
 				scoutfs_inc_counter(sb, item_create);
-				mark_item_dirty(sb, cac, item);
+				mark_item_dirty(sb, cac, shard, item);
 			}
+			shard_mod_end(shard);
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 
 	if (ret)
 		free_item(sb, item);
@@ -1275,6 +1903,7 @@ int scoutfs_item_create_force(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
@@ -1291,9 +1920,10 @@ int scoutfs_item_create_force(struct super_block *sb,
 
 	item->persistent = 1;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
+	shard_mod_begin(shard);
 
-	ret = insert_item(sb, cac, item, true, false);
+	ret = insert_item(sb, cac, shard, item, true, false);
 	if (ret) {
 		printk(KERN_EMERG "Scoutfs: corrupted item cache found while"
 		       " creating item "SK_FMT" on fs %llu\n", SK_ARG(key),
@@ -1301,9 +1931,10 @@ int scoutfs_item_create_force(struct super_block *sb,
 		BUG_ON(ret);
 	}
 	scoutfs_inc_counter(sb, item_create);
-	mark_item_dirty(sb, cac, item);
+	mark_item_dirty(sb, cac, shard, item);
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	shard_mod_end(shard);
+	spin_unlock_irqrestore(&shard->lock, flags);
 
 	if (ret)
 		free_item(sb, item);
@@ -1346,7 +1977,9 @@ int scoutfs_item_add_batch(struct super_block *sb, struct list_head *list,
  * the floor.
  *
  * The batch atomically adds the items and updates the cached range to
- * include the callers range that covers the items.
+ * include the callers range that covers the items.  The range comes
+ * from a lock's coverage so its keys, and all the batched items, hash
+ * to a single shard.
  *
  * It's safe to re-add items to the batch list after they aren't
  * inserted because _safe iteration will always be past the head entry
@@ -1358,6 +1991,7 @@ int scoutfs_item_insert_batch(struct super_block *sb, struct list_head *list,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, start);
 	struct cached_range *rng;
 	struct cached_item *item;
 	struct cached_item *tmp;
@@ -1366,11 +2000,12 @@ int scoutfs_item_insert_batch(struct super_block *sb, struct list_head *list,
 
 	trace_scoutfs_item_insert_batch(sb, start, end);
 
-	if (WARN_ON_ONCE(scoutfs_key_compare(start, end) > 0))
+	if (WARN_ON_ONCE(scoutfs_key_compare(start, end) > 0) ||
+	    WARN_ON_ONCE(item_shard(cac, end) != shard))
 		return -EINVAL;
 
 	scoutfs_inc_counter(sb, item_range_alloc);
-	rng = kzalloc(sizeof(struct cached_range), GFP_NOFS);
+	rng = kmem_cache_zalloc(cached_obj_cache, GFP_NOFS);
 	if (!rng) {
 		free_range(sb, rng);
 		ret = -ENOMEM;
@@ -1380,14 +2015,15 @@ int scoutfs_item_insert_batch(struct super_block *sb, struct list_head *list,
 	rng->start = *start;
 	rng->end = *end;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
+	shard_mod_begin(shard);
 
-	insert_range(sb, &cac->ranges, rng);
+	insert_range(sb, &shard->ranges, rng);
 
 	list_for_each_entry_safe(item, tmp, list, entry) {
 		list_del_init(&item->entry);
 		item->persistent = 1;
-		if (insert_item(sb, cac, item, false, true)) {
+		if (insert_item(sb, cac, shard, item, false, true)) {
 			scoutfs_inc_counter(sb, item_batch_duplicate);
 			list_add(&item->entry, list);
 		} else {
@@ -1395,7 +2031,8 @@ int scoutfs_item_insert_batch(struct super_block *sb, struct list_head *list,
 		}
 	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	shard_mod_end(shard);
+	spin_unlock_irqrestore(&shard->lock, flags);
 
 	ret = 0;
 out:
@@ -1424,6 +2061,7 @@ int scoutfs_item_dirty(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
@@ -1432,23 +2070,23 @@ int scoutfs_item_dirty(struct super_block *sb, struct scoutfs_key *key,
 		return -EINVAL;
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		item = find_item(sb, &cac->items, key);
+		item = find_item(sb, &shard->items, key);
 		if (item) {
-			mark_item_dirty(sb, cac, item);
+			mark_item_dirty(sb, cac, shard, item);
 			ret = 0;
-		} else if (check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENOENT;
 		} else {
 			ret = -ENODATA;
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 
 	trace_scoutfs_item_dirty_ret(sb, ret);
 	return ret;
@@ -1465,6 +2103,7 @@ int scoutfs_item_update(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	void *up_val = NULL;
@@ -1476,8 +2115,9 @@ int scoutfs_item_update(struct super_block *sb, struct scoutfs_key *key,
 	if (WARN_ON_ONCE(!lock_coverage(lock, key, DLM_LOCK_EX)))
 		return -EINVAL;
 
-	if (val) {
-		up_val = kmalloc(val->iov_len, GFP_NOFS);
+	/* values that fit inline are copied under the lock instead */
+	if (val && val->iov_len > ITEM_INLINE_VAL_LEN) {
+		up_val = val_ptr_alloc(val->iov_len);
 		if (!up_val) {
 			ret = -ENOMEM;
 			goto out;
@@ -1486,28 +2126,40 @@ int scoutfs_item_update(struct super_block *sb, struct scoutfs_key *key,
 	}
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		item = find_item(sb, &cac->items, key);
+		item = find_item(sb, &shard->items, key);
 		if (item) {
-			clear_item_dirty(sb, cac, item);
-			swap(up_val, item->val);
-			item->val_len = val ? val->iov_len : 0;
-			mark_item_dirty(sb, cac, item);
+			shard_mod_begin(shard);
+			clear_item_dirty(sb, cac, shard, item);
+			if (val && val->iov_len <= ITEM_INLINE_VAL_LEN) {
+				free_item_val(item);
+				memcpy(item->inline_val, val->iov_base,
+				       val->iov_len);
+				item->val = item->inline_val;
+				item->val_len = val->iov_len;
+			} else {
+				if (item->val == item->inline_val)
+					item->val = NULL;
+				swap(up_val, item->val);
+				item->val_len = val ? val->iov_len : 0;
+			}
+			mark_item_dirty(sb, cac, shard, item);
+			shard_mod_end(shard);
 			ret = 0;
-		} else if (check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENOENT;
 		} else {
 			ret = -ENODATA;
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 out:
-	kfree(up_val);
+	val_ptr_put(up_val);
 
 	trace_scoutfs_item_update_ret(sb, ret);
 	return ret;
@@ -1530,6 +2182,7 @@ int scoutfs_item_delete(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
@@ -1540,23 +2193,25 @@ int scoutfs_item_delete(struct super_block *sb, struct scoutfs_key *key,
 	}
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		item = find_item(sb, &cac->items, key);
+		item = find_item(sb, &shard->items, key);
 		if (item) {
-			delete_item(sb, cac, item);
+			shard_mod_begin(shard);
+			delete_item(sb, cac, shard, item);
+			shard_mod_end(shard);
 			ret = 0;
-		} else if (check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENOENT;
 		} else {
 			ret = -ENODATA;
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 
 out:
 	trace_scoutfs_item_delete(sb, key, ret);
@@ -1577,6 +2232,7 @@ int scoutfs_item_delete_force(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
@@ -1590,8 +2246,9 @@ int scoutfs_item_delete_force(struct super_block *sb,
 
 	item->persistent = 1;
 
-	spin_lock_irqsave(&cac->lock, flags);
-	ret = insert_item(sb, cac, item, true, false);
+	spin_lock_irqsave(&shard->lock, flags);
+	shard_mod_begin(shard);
+	ret = insert_item(sb, cac, shard, item, true, false);
 	if (ret) {
 		printk(KERN_EMERG "Scoutfs: corrupted item cache found while"
 		       " deleting item "SK_FMT" on fs %llu\n", SK_ARG(key),
@@ -1599,10 +2256,11 @@ int scoutfs_item_delete_force(struct super_block *sb,
 		BUG_ON(ret);
 	}
 	scoutfs_inc_counter(sb, item_create);
-	mark_item_dirty(sb, cac, item);
+	mark_item_dirty(sb, cac, shard, item);
 
-	delete_item(sb, cac, item);
-	spin_unlock_irqrestore(&cac->lock, flags);
+	delete_item(sb, cac, shard, item);
+	shard_mod_end(shard);
+	spin_unlock_irqrestore(&shard->lock, flags);
 
 	return ret;
 }
@@ -1624,6 +2282,7 @@ int scoutfs_item_delete_save(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct cached_item *item;
 	struct cached_item *del;
 	unsigned long flags;
@@ -1642,33 +2301,35 @@ int scoutfs_item_delete_save(struct super_block *sb,
 	}
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		item = find_item(sb, &cac->items, key);
+		item = find_item(sb, &shard->items, key);
 		if (item) {
+			shard_mod_begin(shard);
 			was_dirty = item_is_dirty(item);
-			unlink_item(sb, cac, item);
+			unlink_item(sb, cac, shard, item);
 			list_add_tail(&item->entry, list);
 			if (was_dirty)
-				item->dirty |= ITEM_DIRTY;
+				item->dirty = 1;
 
 			del->persistent = item->persistent;
-			ret = insert_item(sb, cac, del, false, false);
+			ret = insert_item(sb, cac, shard, del, false, false);
 			BUG_ON(ret);
-			delete_item(sb, cac, del);
+			delete_item(sb, cac, shard, del);
+			shard_mod_end(shard);
 			del = NULL;
 			ret = 0;
-		} else if (check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENOENT;
 		} else {
 			ret = -ENODATA;
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 
 	free_item(sb, del);
 out:
@@ -1682,13 +2343,15 @@ out:
  * Restored items completely overwrite any existing cached items.
  *
  * The caller must have held locks covering the save and restore so that
- * the cached ranges still exist.
+ * the cached ranges still exist.  The lock's coverage also means that
+ * all the items hash to the lock's shard.
  */
 int scoutfs_item_restore(struct super_block *sb, struct list_head *list,
 			 struct scoutfs_lock *lock)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, &lock->start);
 	struct cached_item *existing;
 	struct cached_item *item;
 	struct cached_item *tmp;
@@ -1700,35 +2363,37 @@ int scoutfs_item_restore(struct super_block *sb, struct list_head *list,
 	if (list_empty(list))
 		return 0;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
 
 	/* make sure all the items are locked and cached */
 	list_for_each_entry(item, list, entry) {
 		mode = item_is_dirty(item) ? DLM_LOCK_EX : DLM_LOCK_PR;
 		if (WARN_ON_ONCE(!lock_coverage(lock, &item->key, mode)) ||
-		    WARN_ON_ONCE(!check_range(sb, &cac->ranges, &item->key,
+		    WARN_ON_ONCE(!check_range(sb, shard, &item->key,
 				 NULL, NULL))) {
 			ret = -EINVAL;
 			goto out;
 		}
 	}
 
+	shard_mod_begin(shard);
 	list_for_each_entry_safe(item, tmp, list, entry) {
 		was_dirty = item_is_dirty(item);
-		item->dirty &= ~ITEM_DIRTY;
+		item->dirty = 0;
 		list_del_init(&item->entry);
 
-		existing = find_item(sb, &cac->items, &item->key);
+		existing = find_item(sb, &shard->items, &item->key);
 		if (existing)
-			erase_item(sb, cac, existing);
-		insert_item(sb, cac, item, false, false);
+			erase_item(sb, cac, shard, existing);
+		insert_item(sb, cac, shard, item, false, false);
 		if (was_dirty)
-			mark_item_dirty(sb, cac, item);
+			mark_item_dirty(sb, cac, shard, item);
 	}
+	shard_mod_end(shard);
 
 	ret = 0;
 out:
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
 
 	return ret;
 }
@@ -1743,16 +2408,20 @@ void scoutfs_item_delete_dirty(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
 
-	item = find_item(sb, &cac->items, key);
-	if (item)
-		delete_item(sb, cac, item);
+	item = find_item(sb, &shard->items, key);
+	if (item) {
+		shard_mod_begin(shard);
+		delete_item(sb, cac, shard, item);
+		shard_mod_end(shard);
+	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
 }
 
 /*
@@ -1761,103 +2430,118 @@ void scoutfs_item_delete_dirty(struct super_block *sb,
  * item was dirty and had a large enough value.  If the updated value is
  * smaller then it will sit in the larger item allocation until the
  * value is eventually freed along with the item.
+ *
+ * An out of line value that callers hold refs on is never modified in
+ * place, a new allocation is swapped in so that the refs keep seeing
+ * their stable snapshot.
  */
 void scoutfs_item_update_dirty(struct super_block *sb,
 			       struct scoutfs_key *key, struct kvec *val)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	unsigned int new_len = val ? val->iov_len : 0;
+	void *up_val = NULL;
 	signed delta;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	/*
+	 * If the existing value is out of line with refs held then we
+	 * have to swap in this new allocation, modifying the old one in
+	 * place would corrupt the stable snapshot the ref holders were
+	 * promised.  We can't fail so we keep trying; small GFP_NOFS
+	 * allocations all but never fail.
+	 */
+	if (new_len > ITEM_INLINE_VAL_LEN) {
+		while (!(up_val = val_ptr_alloc(new_len)))
+			msleep(20);
+		memcpy(up_val, val->iov_base, new_len);
+	}
+
+	spin_lock_irqsave(&shard->lock, flags);
 
-	item = find_item(sb, &cac->items, key);
+	item = find_item(sb, &shard->items, key);
 
 	BUG_ON(!item || !item_is_dirty(item) || new_len > item->val_len);
 
+	shard_mod_begin(shard);
 	delta = new_len - item->val_len;
-	if (val)
-		memcpy(item->val, val->iov_base, new_len);
+	if (val) {
+		bool shared = item->val != item->inline_val &&
+			      atomic_read(&val_ptr_iv(item->val)->refs) > 1;
+
+		if (shared && new_len <= ITEM_INLINE_VAL_LEN) {
+			memcpy(item->inline_val, val->iov_base, new_len);
+			swap(up_val, item->val);
+			item->val = item->inline_val;
+		} else if (shared) {
+			swap(up_val, item->val);
+		} else {
+			memcpy(item->val, val->iov_base, new_len);
+		}
+	}
 	item->val_len = new_len;
+	shard_mod_end(shard);
+
+	spin_lock(&cac->dirty_lock);
 	update_dirty_item_counts(sb, 0, delta);
+	spin_unlock(&cac->dirty_lock);
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
+
+	val_ptr_put(up_val);
 }
 
-/*
- * Return the first dirty node in the subtree starting at the given node.
- */
-static struct cached_item *first_dirty(struct rb_node *node)
+static struct cached_item *first_dirty_item(struct rb_root *root)
 {
-	struct cached_item *ret = NULL;
-	struct cached_item *item;
-
-	while (node) {
-		item = container_of(node, struct cached_item, node);
+	struct rb_node *node;
 
-		if (item->dirty & LEFT_DIRTY) {
-			node = item->node.rb_left;
-		} else if (item_is_dirty(item)) {
-			ret = item;
-			break;
-		} else if (item->dirty & RIGHT_DIRTY) {
-			node = item->node.rb_right;
-		} else {
-			break;
-		}
-	}
+	if ((node = rb_first(root)))
+		return container_of(node, struct cached_item, dirty_node);
 
-	return ret;
+	return NULL;
 }
 
-/*
- * Find the next dirty item after a given item.  First we see if we have
- * a dirty item in our right subtree.  If not we ascend through parents
- * skipping those that are less than us.  If we find a parent that's
- * greater than us then we see if it's dirty, if not we start the search
- * all over again by checking its right subtree then ascending.
- */
-static struct cached_item *next_dirty(struct cached_item *item)
+static struct cached_item *next_dirty_item(struct cached_item *item)
 {
-	struct rb_node *parent;
 	struct rb_node *node;
 
-	while (item) {
-		if (item->dirty & RIGHT_DIRTY)
-			return first_dirty(item->node.rb_right);
-
-		/* find next greatest parent */
-		node = &item->node;
-		while ((parent = rb_parent(node)) && parent->rb_right == node)
-			node = parent;
-		if (!parent)
-			break;
-
-		/* done if our next greatest parent itself is dirty */
-		item = container_of(parent, struct cached_item, node);
-		if (item_is_dirty(item))
-			return item;
-
-		/* continue to check right subtree */
-	}
+	if (item && (node = rb_next(&item->dirty_node)))
+		return container_of(node, struct cached_item, dirty_node);
 
 	return NULL;
 }
 
-static bool dirty_item_within(struct rb_root *root,
+/*
+ * Return true if there's a dirty item at or after the given key and at
+ * or before the end key.  The caller holds the dirty_lock.
+ */
+static bool dirty_item_within(struct item_cache *cac,
 			      struct scoutfs_key *from,
 			      struct scoutfs_key *end)
 {
+	struct rb_node *node = cac->dirty_items.rb_node;
+	struct cached_item *found = NULL;
 	struct cached_item *item;
+	int cmp;
+
+	while (node) {
+		item = container_of(node, struct cached_item, dirty_node);
 
-	item = next_item(root, from);
-	if (item && !item_is_dirty(item))
-		item = next_dirty(item);
+		cmp = scoutfs_key_compare(from, &item->key);
+		if (cmp <= 0) {
+			found = item;
+			if (cmp == 0)
+				break;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
 
-	return item && scoutfs_key_compare(&item->key, end) <= 0;
+	return found && scoutfs_key_compare(&found->key, end) <= 0;
 }
 
 bool scoutfs_item_has_dirty(struct super_block *sb)
@@ -1867,9 +2551,9 @@ bool scoutfs_item_has_dirty(struct super_block *sb)
 	unsigned long flags;
 	bool has;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&cac->dirty_lock, flags);
 	has = cac->nr_dirty_items != 0;
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&cac->dirty_lock, flags);
 
 	return has;
 }
@@ -1881,6 +2565,9 @@ bool scoutfs_item_has_dirty(struct super_block *sb)
  *
  * If the start of the query range doesn't overlap a cached range then
  * we see if the next cached range starts before the end of the query range.
+ *
+ * The query ranges come from lock coverage so the shard of the start
+ * key is the shard that can contain cached ranges for the query.
  */
 bool scoutfs_item_range_cached(struct super_block *sb,
 			       struct scoutfs_key *start,
@@ -1888,25 +2575,26 @@ bool scoutfs_item_range_cached(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, start);
 	struct cached_range *next;
 	struct cached_range *rng;
 	unsigned long flags;
 	bool cached = false;
 
-	spin_lock_irqsave(&cac->lock, flags);
-
 	if (dirty) {
-		if (dirty_item_within(&cac->items, start, end))
+		spin_lock_irqsave(&cac->dirty_lock, flags);
+		if (dirty_item_within(cac, start, end))
 			cached = true;
+		spin_unlock_irqrestore(&cac->dirty_lock, flags);
 	} else {
-		rng = walk_ranges(&cac->ranges, start, NULL, &next);
+		spin_lock_irqsave(&shard->lock, flags);
+		rng = walk_ranges(&shard->ranges, start, NULL, &next);
 		if (rng ||
 		    (next && scoutfs_key_compare(&next->start, end) <= 0))
 			cached = true;
+		spin_unlock_irqrestore(&shard->lock, flags);
 	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
-
 	return cached;
 }
 
@@ -1922,20 +2610,51 @@ bool scoutfs_item_dirty_fits_single(struct super_block *sb, u32 nr_items,
 	unsigned long flags;
 	bool fits;
 
-	spin_lock_irqsave(&cac->lock, flags);
-	fits = scoutfs_seg_fits_single(nr_items + cac->nr_dirty_items,
+	spin_lock_irqsave(&cac->dirty_lock, flags);
+	fits = scoutfs_seg_fits_single(sb, nr_items + cac->nr_dirty_items,
 				       val_bytes + cac->dirty_val_bytes);
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&cac->dirty_lock, flags);
 
 	return fits;
 }
 
+/*
+ * Lock or unlock every shard.  Lockdep nesting limits the shard count.
+ * With every shard lock held nothing can modify the items or the dirty
+ * item tree so the dirty tree can be walked without the dirty_lock,
+ * though helpers that maintain it still take it.
+ */
+static void lock_all_shards(struct item_cache *cac, unsigned long *flags)
+{
+	int i;
+
+	local_irq_save(*flags);
+	for (i = 0; i < ITEM_SHARD_NR; i++)
+		spin_lock_nested(&cac->shards[i].lock, i);
+}
+
+static void unlock_all_shards(struct item_cache *cac, unsigned long *flags)
+{
+	int i;
+
+	for (i = ITEM_SHARD_NR - 1; i >= 0; i--)
+		spin_unlock(&cac->shards[i].lock);
+	local_irq_restore(*flags);
+}
+
 /*
  * Fill the given segment with sorted dirty items.
  *
  * The caller is responsible for the consistency of the dirty items once
  * they're in its seg.  We can consider them clean once we store them.
  *
+ * The dirty tree has to stay sorted for range queries so the segment is
+ * filled with an in-order walk, but clearing the dirty items doesn't
+ * have to go through the tree one erase at a time.  A second postorder
+ * walk visits each node once without rebalancing and the accounting is
+ * reset in one step, instead of paying for a rebalance and a dirty_lock
+ * acquisition per item for transactions with huge dirty item counts.
+ *
  * XXX this first/append pattern will go away once we can write a stream
  * of items to a segment without needing to know the item count to
  * find the starting key and value offsets.
@@ -1945,15 +2664,16 @@ int scoutfs_item_dirty_seg(struct super_block *sb, struct scoutfs_segment *seg)
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
 	__le32 *links[SCOUTFS_MAX_SKIP_LINKS];
-	struct cached_item *item = NULL;
-	struct cached_item *del;
+	struct item_shard *shard;
+	struct cached_item *item;
+	struct cached_item *pos;
 	unsigned long flags;
 	struct kvec val;
 	bool appended;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	lock_all_shards(cac, &flags);
 
-	item = first_dirty(cac->items.rb_node);
+	item = first_dirty_item(&cac->dirty_items);
 	while (item) {
 		kvec_init(&val, item->val, item->val_len);
 		appended = scoutfs_seg_append_item(sb, seg, &item->key, &val,
@@ -1969,17 +2689,34 @@ int scoutfs_item_dirty_seg(struct super_block *sb, struct scoutfs_segment *seg)
 		/* non-persistent should have been freed (safe to write) */
 		WARN_ON_ONCE(item->deletion && !item->persistent);
 
-		clear_item_dirty(sb, cac, item);
-		item->persistent = 1;
+		item = next_dirty_item(item);
+	}
 
-		del = item;
-		item = next_dirty(item);
+	/* then tear the dirty tree down all at once */
+	rbtree_postorder_for_each_entry_safe(item, pos, &cac->dirty_items,
+					     dirty_node) {
+		RB_CLEAR_NODE(&item->dirty_node);
+		item->dirty = 0;
+		item->persistent = 1;
 
-		if (del->deletion)
-			erase_item(sb, cac, del);
+		shard = item_shard(cac, &item->key);
+		if (item->deletion) {
+			shard_mod_begin(shard);
+			erase_item(sb, cac, shard, item);
+			shard_mod_end(shard);
+		} else {
+			list_add_tail(&item->entry, &shard->probation_list);
+			shard->lru_nr++;
+		}
 	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_lock(&cac->dirty_lock);
+	cac->dirty_items = RB_ROOT;
+	update_dirty_item_counts(sb, -cac->nr_dirty_items,
+				 -cac->dirty_val_bytes);
+	spin_unlock(&cac->dirty_lock);
+
+	unlock_all_shards(cac, &flags);
 
 	return 0;
 }
@@ -2004,14 +2741,14 @@ int scoutfs_item_writeback(struct super_block *sb,
 
 	/* XXX think about racing with trans write */
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&cac->dirty_lock, flags);
 
-	if (cac->nr_dirty_items && dirty_item_within(&cac->items, start, end)) {
+	if (cac->nr_dirty_items && dirty_item_within(cac, start, end)) {
 		sync = true;
 		count = cac->nr_dirty_items;
 	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&cac->dirty_lock, flags);
 
 	if (sync) {
 		scoutfs_inc_counter(sb, trans_commit_item_flush);
@@ -2021,10 +2758,21 @@ int scoutfs_item_writeback(struct super_block *sb,
 	return ret ?: count;
 }
 
+/* the most items an invalidation erases per shard lock acquisition */
+#define ITEM_INVALIDATE_BATCH 64
+
 /*
  * The caller wants us to drop any items within the range on the floor.
  * They should have ensured that items in this range won't be dirty.
  *
+ * The range comes from a lock's coverage so it falls within a single
+ * shard.  A wide lock can cover an enormous number of cached items so
+ * we erase them in bounded batches, dropping the shard lock between
+ * batches so that we don't stall other lock holders for the entire
+ * walk.  The cached range is only removed with the final batch so a
+ * racing reader either sees the range fully cached or not cached at
+ * all, never a partially erased range that looks authoritative.
+ *
  * Returns errors or the count of the items invalidated.
  */
 int scoutfs_item_invalidate(struct super_block *sb,
@@ -2033,20 +2781,24 @@ int scoutfs_item_invalidate(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = item_shard(cac, start);
+	struct scoutfs_key pos = *start;
 	struct cached_range *rng;
 	struct cached_item *next;
 	struct cached_item *item;
 	struct rb_node *node;
 	unsigned long flags;
 	int count = 0;
+	bool more;
 	int ret;
+	int nr;
 
 	trace_scoutfs_item_invalidate_range(sb, start, end);
 
 	/* XXX think about racing with trans write */
 
 	scoutfs_inc_counter(sb, item_range_alloc);
-	rng = kzalloc(sizeof(struct cached_range), GFP_NOFS);
+	rng = kmem_cache_zalloc(cached_obj_cache, GFP_NOFS);
 	if (!rng) {
 		free_range(sb, rng);
 		ret = -ENOMEM;
@@ -2056,27 +2808,39 @@ int scoutfs_item_invalidate(struct super_block *sb,
 	rng->start = *start;
 	rng->end = *end;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	do {
+		spin_lock_irqsave(&shard->lock, flags);
+		shard_mod_begin(shard);
+
+		nr = 0;
+		for (item = next_item(&shard->items, &pos);
+		     item && scoutfs_key_compare(&item->key, end) <= 0 &&
+		     nr < ITEM_INVALIDATE_BATCH;
+		     item = next) {
+
+			/* XXX seems like this should be a helper? */
+			node = rb_next(&item->node);
+			if (node)
+				next = container_of(node, struct cached_item,
+						    node);
+			else
+				next = NULL;
 
-	for (item = next_item(&cac->items, start);
-	     item && scoutfs_key_compare(&item->key, end) <= 0;
-	     item = next) {
+			WARN_ON_ONCE(item_is_dirty(item));
+			erase_item(sb, cac, shard, item);
+			count++;
+			nr++;
+		}
 
-		/* XXX seems like this should be a helper? */
-		node = rb_next(&item->node);
-		if (node)
-			next = container_of(node, struct cached_item, node);
+		more = item && scoutfs_key_compare(&item->key, end) <= 0;
+		if (more)
+			pos = item->key;
 		else
-			next = NULL;
-
-		WARN_ON_ONCE(item_is_dirty(item));
-		erase_item(sb, cac, item);
-		count++;
-	}
-
-	remove_range(sb, &cac->ranges, rng);
+			remove_range(sb, &shard->ranges, rng);
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+		shard_mod_end(shard);
+		spin_unlock_irqrestore(&shard->lock, flags);
+	} while (more);
 
 	ret = 0;
 out:
@@ -2182,18 +2946,19 @@ static struct cached_item *shrink_boundary(struct super_block *sb,
 }
 
 /*
- * The caller found an item in the lru and the range it falls within.
- * This frees items around the item.  After finding the boundaries we
- * have to either update the ranges if items remain or free the item.
+ * The caller found an item in a shard's lru and the range it falls
+ * within.  This frees items around the item.  After finding the
+ * boundaries we have to either update the ranges if items remain or
+ * free the item.
  *
  * We're in the context of a shrinker so we can't allocate.  If we
  * remove items from the middle of a range we use the memory from some
  * removed items to store the new split range.
  */
-static int shrink_around(struct super_block *sb, struct cached_range *rng,
+static int shrink_around(struct super_block *sb, struct item_cache *cac,
+			 struct item_shard *shard, struct cached_range *rng,
 			 struct cached_item *item)
 {
-	struct item_cache *cac = SCOUTFS_SB(sb)->item_cache;
 	struct scoutfs_key rng_end;
 	struct scoutfs_key key;
 	struct cached_range *new_rng;
@@ -2247,9 +3012,9 @@ static int shrink_around(struct super_block *sb, struct cached_range *rng,
 		item = last;
 		last = rb_prev_item(last);
 
-		unlink_item(sb, cac, item);
+		unlink_item(sb, cac, shard, item);
 		key = item->key;
-		kfree(item->val);
+		free_item_val(item);
 		nr++;
 
 		new_rng = (void *)item;
@@ -2259,14 +3024,14 @@ static int shrink_around(struct super_block *sb, struct cached_range *rng,
 		new_rng->end = rng_end;
 		new_rng->start = key;
 		scoutfs_key_inc(&new_rng->start);
-		insert_range(sb, &cac->ranges, new_rng);
+		insert_range(sb, &shard->ranges, new_rng);
 
 		scoutfs_inc_counter(sb, item_shrink_split_range);
 	}
 
 	/* totally emptied the range */
 	if (!prev && !next) {
-		rb_erase(&rng->node, &cac->ranges);
+		rb_erase(&rng->node, &shard->ranges);
 		free_range(sb, rng);
 	}
 
@@ -2276,15 +3041,79 @@ static int shrink_around(struct super_block *sb, struct cached_range *rng,
 	     item = next) {
 		trace_scoutfs_item_shrink(sb, &item->key);
 		scoutfs_inc_counter(sb, item_shrink);
-		erase_item(sb, cac, item);
+		erase_item(sb, cac, shard, item);
 		nr++;
 	}
 
 	return nr;
 }
 
+static unsigned long lru_total(struct item_cache *cac)
+{
+	unsigned long total = 0;
+	int i;
+
+	for (i = 0; i < ITEM_SHARD_NR; i++)
+		total += cac->shards[i].lru_nr;
+
+	return total;
+}
+
+/*
+ * Scan one of a shard's lru lists from its cold end, freeing items
+ * until we've scanned enough or everything left on the list has been
+ * visited and couldn't be shrunk.  Returns the number of items still to
+ * scan.  The caller holds the shard lock.
+ */
+static unsigned long shrink_shard_list(struct super_block *sb,
+				       struct item_cache *cac,
+				       struct item_shard *shard,
+				       struct list_head *list,
+				       unsigned long nr)
+{
+	struct cached_item *first_moved = NULL;
+	struct cached_item *item;
+	struct cached_range *rng;
+	int ret;
+
+	while (nr && (item = list_first_entry_or_null(list,
+						      struct cached_item,
+						      entry))) {
+
+		/* can't have dirty items on the lru */
+		BUG_ON(item_is_dirty(item));
+
+		/* if we're not in a range just shrink the item */
+		rng = walk_ranges(&shard->ranges, &item->key, NULL, NULL);
+		if (!rng) {
+			scoutfs_inc_counter(sb, item_shrink_outside);
+			shard_mod_begin(shard);
+			erase_item(sb, cac, shard, item);
+			shard_mod_end(shard);
+			nr--;
+			continue;
+		}
+
+		shard_mod_begin(shard);
+		ret = shrink_around(sb, cac, shard, rng, item);
+		shard_mod_end(shard);
+		if (ret == 0) {
+			if (first_moved && first_moved == item)
+				break;
+			else if (!first_moved)
+				first_moved = item;
+			list_move_tail(&item->entry, list);
+			continue;
+		}
+
+		nr -= min_t(unsigned long, nr, ret);
+	}
+
+	return nr;
+}
+
 /*
- * Shrink the item cache. 
+ * Shrink the item cache.
  *
  * Unfortunately this is complicated by the rbtree of ranges that track
  * the validity of the cache.  If we free items we have to make sure
@@ -2295,67 +3124,114 @@ static int shrink_around(struct super_block *sb, struct cached_range *rng,
  *
  * We can also hit items in the lru which aren't covered by ranges, we
  * free those immediately.
+ *
+ * Each shard has its own lrus so we visit the shards in turn until
+ * we've scanned enough items.  Probationary items that were never
+ * re-referenced are evicted before the protected working set.
  */
 static int item_lru_shrink(struct shrinker *shrink, struct shrink_control *sc)
 {
 	struct item_cache *cac = container_of(shrink, struct item_cache,
 					      shrinker);
 	struct super_block *sb = cac->sb;
+	struct item_shard *shard;
 	struct cached_range *rng;
-	struct cached_item *item;
-	struct cached_item *first_moved = NULL;
+	unsigned long before;
 	unsigned long flags;
 	unsigned long nr;
 	int ret;
+	int i;
 
 	nr = sc->nr_to_scan;
 	if (nr == 0)
 		goto out;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	for (i = 0; i < ITEM_SHARD_NR && nr; i++) {
+		shard = &cac->shards[i];
 
-	while (nr &&
-	       (item = list_first_entry_or_null(&cac->lru_list,
-						struct cached_item, entry))) {
+		spin_lock_irqsave(&shard->lock, flags);
 
-		/* can't have dirty items on the lru */
-		BUG_ON(item_is_dirty(item));
+		nr = shrink_shard_list(sb, cac, shard, &shard->probation_list,
+				       nr);
+		if (nr) {
+			before = nr;
+			nr = shrink_shard_list(sb, cac, shard,
+					       &shard->protected_list, nr);
+			scoutfs_add_counter(sb, item_shrink_protected,
+					    before - nr);
+		}
 
-		/* if we're not in a range just shrink the item */
-		rng = walk_ranges(&cac->ranges, &item->key, NULL, NULL);
-		if (!rng) {
-			scoutfs_inc_counter(sb, item_shrink_outside);
-			erase_item(sb, cac, item);
-			nr--;
-			continue;
+		/* always try to free empty ranges */
+		while (RB_EMPTY_ROOT(&shard->items) &&
+		       (rng = rb_first_rng(&shard->ranges))) {
+			scoutfs_inc_counter(sb, item_shrink_empty_range);
+			shard_mod_begin(shard);
+			rb_erase(&rng->node, &shard->ranges);
+			free_range(sb, rng);
+			shard_mod_end(shard);
 		}
 
-		ret = shrink_around(sb, rng, item);
-		if (ret == 0) {
-			if (first_moved && first_moved == item)
+		spin_unlock_irqrestore(&shard->lock, flags);
+	}
+
+out:
+	ret = min_t(unsigned long, lru_total(cac), INT_MAX);
+	trace_scoutfs_item_shrink_exit(sb, sc->nr_to_scan, ret);
+	return ret;
+}
+
+/*
+ * Populate the item cache with the items in the given range under the
+ * caller's held lock.  This walks the same missing-range read path
+ * that foreground lookups fault in one hole at a time, just driven
+ * across the whole range.  The manifest read batches segment
+ * readahead so warming a large range streams segments instead of
+ * faulting them in one miss at a time.
+ */
+int scoutfs_item_warm_range(struct super_block *sb, struct scoutfs_key *start,
+			    struct scoutfs_key *end, struct scoutfs_lock *lock)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct item_cache *cac = sbi->item_cache;
+	struct scoutfs_key range_end;
+	struct scoutfs_key last;
+	struct scoutfs_key pos;
+	struct item_shard *shard;
+	unsigned long flags;
+	bool cached;
+	int ret = 0;
+
+	/* clamp the range to the lock's coverage */
+	pos = *start;
+	if (scoutfs_key_compare(&pos, &lock->start) < 0)
+		pos = lock->start;
+	last = *end;
+	if (scoutfs_key_compare(&lock->end, &last) < 0)
+		last = lock->end;
+
+	while (scoutfs_key_compare(&pos, &last) <= 0) {
+		shard = item_shard(cac, &pos);
+
+		spin_lock_irqsave(&shard->lock, flags);
+		cached = check_range(sb, shard, &pos, NULL, &range_end);
+		spin_unlock_irqrestore(&shard->lock, flags);
+
+		if (!cached) {
+			ret = scoutfs_manifest_read_items(sb, &pos,
+							  &lock->start,
+							  &lock->end, false);
+			if (ret)
 				break;
-			else if (!first_moved)
-				first_moved = item;
-			list_move_tail(&item->entry, &cac->lru_list);
 			continue;
 		}
 
-		nr -= min_t(unsigned long, nr, ret);
-	}
-
-	/* always try to free empty ranges */
-	while (RB_EMPTY_ROOT(&cac->items) &&
-	       (rng = rb_first_rng(&cac->ranges))) {
-		scoutfs_inc_counter(sb, item_shrink_empty_range);
-		rb_erase(&rng->node, &cac->ranges);
-		free_range(sb, rng);
+		pos = range_end;
+		scoutfs_key_inc(&pos);
+		/* stop if the cached range ended the key space */
+		if (scoutfs_key_compare(&pos, &range_end) < 0)
+			break;
 	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
-
-out:
-	ret = min_t(unsigned long, cac->lru_nr, INT_MAX);
-	trace_scoutfs_item_shrink_exit(sb, sc->nr_to_scan, ret);
 	return ret;
 }
 
@@ -2363,6 +3239,11 @@ out:
  * Copy the keys of the sorted cached ranges starting with the search
  * key into the caller's key array.  The number of copied range keys is
  * returned which will always be a multiple of two.
+ *
+ * Ranges in different shards cover disjoint regions of the key space so
+ * we merge across the shards by repeatedly finding the least next range
+ * among all of them.  This is only used by debugging ioctls so we don't
+ * mind the cost of the repeated searches.
  */
 int scoutfs_item_copy_range_keys(struct super_block *sb,
 				 struct scoutfs_key *key,
@@ -2370,40 +3251,48 @@ int scoutfs_item_copy_range_keys(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
-	struct rb_node *node = cac->ranges.rb_node;
-	struct cached_range *next = NULL;
+	struct scoutfs_key best_start;
+	struct scoutfs_key best_end;
+	struct scoutfs_key pos = *key;
+	struct item_shard *shard;
+	struct cached_range *next;
 	struct cached_range *rng;
 	unsigned long flags;
+	bool found;
 	int ret = 0;
-	int cmp;
-
-	spin_lock_irqsave(&cac->lock, flags);
-
-	while (node) {
-		rng = container_of(node, struct cached_range, node);
+	int i;
 
-		cmp = scoutfs_key_compare_ranges(key, key,
-						 &rng->start, &rng->end);
-		if (cmp < 0) {
-			next = rng;
-			node = node->rb_left;
-		} else if (cmp > 0) {
-			node = node->rb_right;
-		} else {
-			next = rng;
-			break;
+	while (ret + 2 <= nr) {
+		found = false;
+
+		for (i = 0; i < ITEM_SHARD_NR; i++) {
+			shard = &cac->shards[i];
+
+			spin_lock_irqsave(&shard->lock, flags);
+			rng = walk_ranges(&shard->ranges, &pos, NULL, &next);
+			rng = rng ?: next;
+			if (rng &&
+			    (!found || scoutfs_key_compare(&rng->start,
+							   &best_start) < 0)) {
+				best_start = rng->start;
+				best_end = rng->end;
+				found = true;
+			}
+			spin_unlock_irqrestore(&shard->lock, flags);
 		}
-	}
 
-	for (rng = next; rng; rng = rb_next_rng(rng)) {
-		if (ret + 2 > nr)
+		if (!found)
 			break;
 
-		keys[ret++] = rng->start;
-		keys[ret++] = rng->end;
-	}
+		keys[ret++] = best_start;
+		keys[ret++] = best_end;
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+		pos = best_end;
+		scoutfs_key_inc(&pos);
+		/* stop if the last range ended the key space */
+		if (scoutfs_key_compare(&pos, &best_end) < 0)
+			break;
+	}
 
 	return ret;
 }
@@ -2411,32 +3300,56 @@ int scoutfs_item_copy_range_keys(struct super_block *sb,
 /*
  * Copy keys for the sorted cached items starting with the search key
  * into the caller's key array.  The number of copied keys is returned.
+ *
+ * Like _copy_range_keys this merges across the shards one key at a time
+ * for debugging.
  */
 int scoutfs_item_copy_keys(struct super_block *sb, struct scoutfs_key *key,
 			   struct scoutfs_key *keys, unsigned nr)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
-	struct cached_item *item = NULL;
+	struct scoutfs_key pos = *key;
+	struct scoutfs_key best;
+	struct scoutfs_key ones;
+	struct item_shard *shard;
+	struct cached_item *item;
 	unsigned long flags;
+	bool found;
 	int ret = 0;
+	int i;
+
+	scoutfs_key_set_ones(&ones);
 
-	spin_lock_irqsave(&cac->lock, flags);
+	while (ret < nr) {
+		found = false;
 
-	for (item = next_item(&cac->items, key); item;
-	     item = rb_next_item(item)) {
+		for (i = 0; i < ITEM_SHARD_NR; i++) {
+			shard = &cac->shards[i];
+
+			spin_lock_irqsave(&shard->lock, flags);
+			item = item_for_next(&shard->items, &pos, NULL, &ones);
+			if (item &&
+			    (!found ||
+			     scoutfs_key_compare(&item->key, &best) < 0)) {
+				best = item->key;
+				found = true;
+			}
+			spin_unlock_irqrestore(&shard->lock, flags);
+		}
 
-		if (ret == nr)
+		if (!found)
 			break;
 
-		if (item->deletion)
-			continue;
+		keys[ret++] = best;
 
-		keys[ret++] = item->key;
+		pos = best;
+		scoutfs_key_inc(&pos);
+		/* stop if the last item ended the key space */
+		if (scoutfs_key_compare(&pos, &best) < 0)
+			break;
 	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
-
 	return ret;
 }
 
@@ -2444,6 +3357,8 @@ int scoutfs_item_setup(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac;
+	struct item_shard *shard;
+	int i;
 
 	cac = kzalloc(sizeof(struct item_cache), GFP_KERNEL);
 	if (!cac)
@@ -2451,20 +3366,28 @@ int scoutfs_item_setup(struct super_block *sb)
 	sbi->item_cache = cac;
 
 	cac->sb = sb;
-	spin_lock_init(&cac->lock);
-	cac->items = RB_ROOT;
-	cac->ranges = RB_ROOT;
+	for (i = 0; i < ITEM_SHARD_NR; i++) {
+		shard = &cac->shards[i];
+		spin_lock_init(&shard->lock);
+		seqcount_init(&shard->seqcount);
+		shard->items = RB_ROOT;
+		shard->ranges = RB_ROOT;
+		INIT_LIST_HEAD(&shard->probation_list);
+		INIT_LIST_HEAD(&shard->protected_list);
+	}
+	spin_lock_init(&cac->dirty_lock);
+	cac->dirty_items = RB_ROOT;
 	cac->shrinker.shrink = item_lru_shrink;
 	cac->shrinker.seeks = DEFAULT_SEEKS;
 	register_shrinker(&cac->shrinker);
-	INIT_LIST_HEAD(&cac->lru_list);
 
 	return 0;
 }
 
 /*
  * There's no more users of the items and ranges at this point.  We can
- * destroy them without locking and ignoring augmentation.
+ * destroy them without locking.  The dirty item tree indexes the same
+ * items as the shards so it doesn't free anything itself.
  */
 void scoutfs_item_destroy(struct super_block *sb)
 {
@@ -2474,23 +3397,54 @@ void scoutfs_item_destroy(struct super_block *sb)
 	struct cached_item *pos_item;
 	struct cached_range *rng;
 	struct cached_range *pos_rng;
+	struct item_shard *shard;
+	int i;
 
 	if (cac) {
 		if (cac->shrinker.shrink == item_lru_shrink)
 			unregister_shrinker(&cac->shrinker);
 
-		rbtree_postorder_for_each_entry_safe(item, pos_item,
-						     &cac->items, node) {
-			RB_CLEAR_NODE(&item->node);
-			INIT_LIST_HEAD(&item->entry);
-			free_item(sb, item);
-		}
+		for (i = 0; i < ITEM_SHARD_NR; i++) {
+			shard = &cac->shards[i];
 
-		rbtree_postorder_for_each_entry_safe(rng, pos_rng,
-						     &cac->ranges, node) {
-			free_range(sb, rng);
+			rbtree_postorder_for_each_entry_safe(item, pos_item,
+							     &shard->items,
+							     node) {
+				RB_CLEAR_NODE(&item->node);
+				RB_CLEAR_NODE(&item->dirty_node);
+				INIT_LIST_HEAD(&item->entry);
+				free_item(sb, item);
+			}
+
+			rbtree_postorder_for_each_entry_safe(rng, pos_rng,
+							     &shard->ranges,
+							     node) {
+				free_range(sb, rng);
+			}
 		}
 
+		/* wait for rcu frees before the callbacks can go away */
+		rcu_barrier();
+
 		kfree(cac);
 	}
 }
+
+void scoutfs_item_exit(void)
+{
+	if (cached_obj_cache) {
+		kmem_cache_destroy(cached_obj_cache);
+		cached_obj_cache = NULL;
+	}
+}
+
+int scoutfs_item_init(void)
+{
+	cached_obj_cache = kmem_cache_create("scoutfs_cached_item",
+					     sizeof(struct cached_item), 0,
+					     SLAB_RECLAIM_ACCOUNT, NULL);
+	if (!cached_obj_cache)
+		return -ENOMEM;
+
+	return 0;
+}
@@ -3,17 +3,56 @@
 
 #include <linux/uio.h>
 
+#include "format.h"
+
 struct scoutfs_segment;
-struct scoutfs_key;
+
+/*
+ * Batched item copies pack each item into one of these entries in the
+ * caller's buffer, with the value bytes immediately following.
+ */
+struct scoutfs_item_batch_entry {
+	struct scoutfs_key key;
+	__u16 val_len;
+	__u8 val[0];
+} __packed;
+
+static inline unsigned int scoutfs_item_batch_entry_bytes(unsigned int val_len)
+{
+	return offsetof(struct scoutfs_item_batch_entry, val[val_len]);
+}
+
+static inline struct scoutfs_item_batch_entry *
+scoutfs_item_batch_entry_next(struct scoutfs_item_batch_entry *ent)
+{
+	return (void *)&ent->val[ent->val_len];
+}
+
+/*
+ * A caller's reference to a stable snapshot of an item's value.  The
+ * val vec points into refcounted memory that stays valid until the ref
+ * is put, without copying large values.
+ */
+struct scoutfs_item_ref {
+	struct kvec val;
+	void *refd;
+};
 
 int scoutfs_item_lookup(struct super_block *sb, struct scoutfs_key *key,
 			struct kvec *val, struct scoutfs_lock *lock);
 int scoutfs_item_lookup_exact(struct super_block *sb,
 			      struct scoutfs_key *key, struct kvec *val,
 			      struct scoutfs_lock *lock);
+int scoutfs_item_lookup_ref(struct super_block *sb, struct scoutfs_key *key,
+			    struct scoutfs_item_ref *ref,
+			    struct scoutfs_lock *lock);
+void scoutfs_item_put_ref(struct scoutfs_item_ref *ref);
 int scoutfs_item_next(struct super_block *sb, struct scoutfs_key *key,
 		      struct scoutfs_key *last, struct kvec *val,
 		      struct scoutfs_lock *lock);
+int scoutfs_item_next_batch(struct super_block *sb, struct scoutfs_key *key,
+			    struct scoutfs_key *last, void *buf,
+			    unsigned int bytes, struct scoutfs_lock *lock);
 int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 		      struct scoutfs_key *first, struct kvec *val,
 		      struct scoutfs_lock *lock);
@@ -63,6 +102,8 @@ int scoutfs_item_invalidate(struct super_block *sb,
 			    struct scoutfs_key *start,
 			    struct scoutfs_key *end);
 
+int scoutfs_item_warm_range(struct super_block *sb, struct scoutfs_key *start,
+			    struct scoutfs_key *end, struct scoutfs_lock *lock);
 int scoutfs_item_copy_range_keys(struct super_block *sb,
 				 struct scoutfs_key *key,
 				 struct scoutfs_key *keys, unsigned nr);
@@ -72,4 +113,7 @@ int scoutfs_item_copy_keys(struct super_block *sb, struct scoutfs_key *key,
 int scoutfs_item_setup(struct super_block *sb);
 void scoutfs_item_destroy(struct super_block *sb);
 
+int scoutfs_item_init(void);
+void scoutfs_item_exit(void);
+
 #endif
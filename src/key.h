@@ -81,22 +81,49 @@ static inline void scoutfs_key_set_ones(struct scoutfs_key *key)
 	key->_sk_fourth = U8_MAX;
 }
 
+/*
+ * Pack a key's fields into four 64bit words whose unsigned comparison
+ * order matches the field comparison order, as though the fields were
+ * concatenated into one big endian value.
+ */
+static inline void scoutfs_key_words(struct scoutfs_key *key, u64 *w)
+{
+	u64 first = le64_to_cpu(key->_sk_first);
+	u64 second = le64_to_cpu(key->_sk_second);
+	u64 third = le64_to_cpu(key->_sk_third);
+
+	w[0] = ((u64)key->sk_zone << 56) | (first >> 8);
+	w[1] = (first << 56) | ((u64)key->sk_type << 48) | (second >> 16);
+	w[2] = (second << 48) | (third >> 16);
+	w[3] = (third << 48) | ((u64)key->_sk_fourth << 40);
+}
+
 /*
  * Return a -1/0/1 comparison of keys.
  *
- * It turns out that these ternary chains are consistently cheaper than
- * other alternatives across keys that first differ in any of the
- * values.  Say maybe 20% faster than memcmp.
+ * Comparing the packed canonical words resolves in at most four word
+ * tests instead of a chain of six dependent field branches, and the
+ * packing is just shifts and ors with no branches at all.  Neighbouring
+ * keys under load share their leading fields, an inode's items agree on
+ * the first word and a directory's entries on most of the second, so
+ * the typical compare is decided by the first or second word.
  */
 static inline int scoutfs_key_compare(struct scoutfs_key *a,
 				      struct scoutfs_key *b)
 {
-	return scoutfs_cmp(a->sk_zone, b->sk_zone) ?:
-	  scoutfs_cmp(le64_to_cpu(a->_sk_first), le64_to_cpu(b->_sk_first)) ?:
-	  scoutfs_cmp(a->sk_type, b->sk_type) ?:
-	  scoutfs_cmp(le64_to_cpu(a->_sk_second), le64_to_cpu(b->_sk_second)) ?:
-	  scoutfs_cmp(le64_to_cpu(a->_sk_third), le64_to_cpu(b->_sk_third)) ?:
-	  scoutfs_cmp(a->_sk_fourth, b->_sk_fourth);
+	u64 aw[4];
+	u64 bw[4];
+	int i;
+
+	scoutfs_key_words(a, aw);
+	scoutfs_key_words(b, bw);
+
+	for (i = 0; i < 4; i++) {
+		if (aw[i] != bw[i])
+			return aw[i] < bw[i] ? -1 : 1;
+	}
+
+	return 0;
 }
 
 /*
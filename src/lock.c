@@ -28,9 +28,12 @@
 #include "inode.h"
 #include "trans.h"
 #include "counters.h"
+#include "hist.h"
+#include "recorder.h"
 #include "endian_swap.h"
 #include "triggers.h"
 #include "tseq.h"
+#include "client.h"
 
 /*
  * scoutfs manages internode item cache consistency using the kernel's
@@ -76,8 +79,11 @@ struct lock_info {
 	struct list_head lru_list;
 	unsigned long long lru_nr;
 	struct workqueue_struct *workq;
+	struct workqueue_struct *ahead_workq;
 	dlm_lockspace_t *lockspace;
 	atomic64_t next_refresh_gen;
+	atomic64_t cached_hits;
+	atomic64_t remote_invals;
 	struct dentry *tseq_dentry;
 	struct scoutfs_tseq_tree tseq_tree;
 };
@@ -94,12 +100,23 @@ static void scoutfs_lock_grace_work(struct work_struct *work);
  */
 static void invalidate_inode(struct super_block *sb, u64 ino)
 {
+	struct scoutfs_inode_info *si;
 	struct inode *inode;
 
 	inode = scoutfs_ilookup(sb, ino);
 	if (inode) {
-		if (S_ISREG(inode->i_mode))
+		if (S_ISREG(inode->i_mode)) {
 			truncate_inode_pages(inode->i_mapping, 0);
+			/*
+			 * Truncation discarded any delayed pages so
+			 * writeback can't map through the dying lock.
+			 */
+			si = SCOUTFS_I(inode);
+			mutex_lock(&si->alloc_mutex);
+			si->delalloc_lock = NULL;
+			si->delalloc_blocks = 0;
+			mutex_unlock(&si->alloc_mutex);
+		}
 		iput(inode);
 	}
 }
@@ -116,7 +133,11 @@ static int lock_invalidate(struct super_block *sb, struct scoutfs_lock *lock,
 	struct scoutfs_lock_coverage *cov;
 	struct scoutfs_lock_coverage *tmp;
 	u64 ino, last;
-	int ret;
+	int ret = 0;
+
+	scoutfs_rec(sb, SCOUTFS_REC_LOCK_INVALIDATE,
+		    le64_to_cpu(lock->name.first),
+		    ((u64)lock->name.zone << 16) | (prev << 8) | mode);
 
 	/* any transition from a mode allowed to dirty items has to write */
 	if (prev == DLM_LOCK_CW || prev == DLM_LOCK_EX) {
@@ -129,7 +150,14 @@ static int lock_invalidate(struct super_block *sb, struct scoutfs_lock *lock,
 		}
 	}
 
-	/* invalidate items that we could have but won't be able to use */
+	/*
+	 * Invalidate items that we could have but won't be able to use.
+	 * A down convert from EX to PR keeps the item cache and the
+	 * coverage on the lock.  The write above made the cached items
+	 * consistent with the segments and PR still lets us read them,
+	 * so readers after the down convert don't have to re-read
+	 * segments to rebuild the cache.
+	 */
 	if (prev == DLM_LOCK_CW ||
             (prev == DLM_LOCK_PR && mode != DLM_LOCK_EX) ||
             (prev == DLM_LOCK_EX && mode != DLM_LOCK_PR)) {
@@ -163,6 +191,8 @@ retry:
 					    ret);
 			ret = 0;
 		}
+	} else if (prev == DLM_LOCK_EX && mode == DLM_LOCK_PR) {
+		scoutfs_inc_counter(sb, lock_downconvert_keep_items);
 	}
 
 	return ret;
@@ -341,8 +371,12 @@ static void lock_process(struct lock_info *linfo, struct scoutfs_lock *lock)
 
 	/*
 	 * Try to down convert a lock in response to a bast once users
-	 * are done with it.  We may have to wait for a grace period
-	 * to expire after an unlock.
+	 * are done with it.  We may have to wait for a grace period to
+	 * expire after an unlock, but only for locks that are showing
+	 * local reuse.  A lock that's bounced between nodes without
+	 * satisfying repeated local requests gets handed over
+	 * immediately so that it doesn't add a grace delay to every
+	 * remote request that it blocks.
 	 */
 	if (lock->work_mode < 0 &&
 	    lock->granted_mode >= 0 &&
@@ -350,12 +384,17 @@ static void lock_process(struct lock_info *linfo, struct scoutfs_lock *lock)
 	    lock_counts_match(lock->bast_mode, lock->users) &&
 	    !lock->grace_pending) {
 
-		if (ktime_before(ktime_get(), lock->grace_deadline)) {
+		if (ktime_before(ktime_get(), lock->grace_deadline) &&
+		    lock->cached_hits >= lock->remote_basts) {
 			scoutfs_inc_counter(linfo->sb, lock_grace_enforced);
 			queue_delayed_work(linfo->workq, &lock->grace_work,
 					   GRACE_WORK_DELAY_JIFFIES);
 			lock->grace_pending = true;
 		} else {
+			if (ktime_before(ktime_get(), lock->grace_deadline))
+				scoutfs_inc_counter(linfo->sb,
+						    lock_grace_elided);
+
 			lock->work_prev_mode = lock->granted_mode;
 			lock->work_mode = lock->bast_mode;
 			lock->granted_mode = lock->bast_mode;
@@ -546,6 +585,12 @@ static void scoutfs_lock_ast(void *arg)
 		    !lock_mode_can_read(lock->work_prev_mode)) {
 			lock->refresh_gen =
 				atomic64_inc_return(&linfo->next_refresh_gen);
+			/*
+			 * The grant can let us read keys that another
+			 * node wrote, which our cached manifest root
+			 * can't see.
+			 */
+			scoutfs_client_invalidate_manifest_root(sb);
 		}
 		lock->granted_mode = lock->work_mode;
 
@@ -639,8 +684,12 @@ static void scoutfs_lock_bast(void *arg, int blocked_mode)
 	/* greater is safe, only try nl < all or pr < ex */
 	if (lock_mode_valid_and_greater(lock->granted_mode, bast_mode) ||
 	    lock_mode_valid_and_greater(lock->work_mode, bast_mode) ||
-	    lock_mode_valid_and_greater(lock->bast_mode, bast_mode))
+	    lock_mode_valid_and_greater(lock->bast_mode, bast_mode)) {
 		lock->bast_mode = bast_mode;
+		lock->remote_basts++;
+		lock->cached_hits >>= 1;
+		atomic64_inc(&linfo->remote_invals);
+	}
 
 	trace_scoutfs_lock_bast(sb, lock);
 	lock_process(linfo, lock);
@@ -789,21 +838,23 @@ static bool lock_wait(struct lock_info *linfo, struct scoutfs_lock *lock,
 }
 
 /*
- * Acquire a coherent lock on the given range of keys.  On success the
- * caller can use the given mode to interact with the item cache.  While
- * holding the lock the cache won't be invalidated and other conflicting
- * lock users will be serialized.  The item cache can be invalidated
- * once the lock is unlocked.
+ * Find or create the lock with the given name, register the caller as a
+ * waiter, and kick off any mode conversion that the waiter needs.  The
+ * caller isn't a user of the lock yet.  They either wait for their mode
+ * with lock_name_keys_wait() or stop waiting with
+ * lock_name_keys_cancel().  Callers can have a few of these requests in
+ * flight at once so that their lock conversion round trips overlap
+ * instead of being serialized by waiting for each in turn.
  */
-static int lock_name_keys(struct super_block *sb, int mode, int flags,
-			  struct scoutfs_lock_name *name,
-			  struct scoutfs_key *start, struct scoutfs_key *end,
-			  struct scoutfs_lock **ret_lock)
+static int lock_name_keys_request(struct super_block *sb, int mode, int flags,
+				  struct scoutfs_lock_name *name,
+				  struct scoutfs_key *start,
+				  struct scoutfs_key *end,
+				  struct scoutfs_lock **ret_lock)
 {
 	DECLARE_LOCK_INFO(sb, linfo);
 	struct scoutfs_lock *lock;
 	struct scoutfs_lock *ins;
-	int wait_ret;
 	int ret;
 
 	scoutfs_inc_counter(sb, lock_lock);
@@ -852,8 +903,36 @@ retry:
 	}
 
 	lock_inc_count(lock->waiters, mode);
+
+	/* feed reuse of granted modes back into the caching policy */
+	if (lock_modes_match(lock->granted_mode, mode)) {
+		lock->cached_hits++;
+		lock->shrink_deferred = false;
+		atomic64_inc(&linfo->cached_hits);
+		scoutfs_inc_counter(sb, lock_cached_hit);
+	}
+
+	lock_process(linfo, lock);
 	spin_unlock(&linfo->lock);
 
+	*ret_lock = lock;
+	ret = 0;
+out:
+	return ret;
+}
+
+/*
+ * Wait for a requested lock.  On success the caller is a user of the
+ * lock at their mode.  On error the caller's waiter registration has
+ * been dropped and they must not reference the lock again.
+ */
+static int lock_name_keys_wait(struct super_block *sb,
+			       struct scoutfs_lock *lock, int mode, int flags)
+{
+	DECLARE_LOCK_INFO(sb, linfo);
+	int wait_ret;
+	int ret;
+
 	ret = wait_event_interruptible(lock->waitq,
 				       lock_wait(linfo, lock, mode, flags,
 					         &wait_ret));
@@ -865,39 +944,84 @@ retry:
 		lock_dec_count(lock->waiters, mode);
 		lock_process(linfo, lock);
 		spin_unlock(&linfo->lock);
-	} else {
-		*ret_lock = lock;
 	}
-out:
+
 	return ret;
 }
 
-int scoutfs_lock_ino(struct super_block *sb, int mode, int flags, u64 ino,
-		     struct scoutfs_lock **ret_lock)
+/*
+ * Stop waiting for a lock that was requested but never waited on.
+ */
+static void lock_name_keys_cancel(struct super_block *sb,
+				  struct scoutfs_lock *lock, int mode)
 {
-	struct scoutfs_lock_name name;
-	struct scoutfs_key start;
-	struct scoutfs_key end;
+	DECLARE_LOCK_INFO(sb, linfo);
+
+	spin_lock(&linfo->lock);
+	lock_dec_count(lock->waiters, mode);
+	lock_process(linfo, lock);
+	spin_unlock(&linfo->lock);
+}
 
+/*
+ * Acquire a coherent lock on the given range of keys.  On success the
+ * caller can use the given mode to interact with the item cache.  While
+ * holding the lock the cache won't be invalidated and other conflicting
+ * lock users will be serialized.  The item cache can be invalidated
+ * once the lock is unlocked.
+ */
+static int lock_name_keys(struct super_block *sb, int mode, int flags,
+			  struct scoutfs_lock_name *name,
+			  struct scoutfs_key *start, struct scoutfs_key *end,
+			  struct scoutfs_lock **ret_lock)
+{
+	struct scoutfs_lock *lock;
+	int ret;
+
+	ret = lock_name_keys_request(sb, mode, flags, name, start, end,
+				     &lock) ?:
+	      lock_name_keys_wait(sb, lock, mode, flags);
+	if (ret == 0)
+		*ret_lock = lock;
+	else
+		*ret_lock = NULL;
+
+	return ret;
+}
+
+static void ino_lock_name_keys(u64 ino, struct scoutfs_lock_name *name,
+			       struct scoutfs_key *start,
+			       struct scoutfs_key *end)
+{
 	ino &= ~(u64)SCOUTFS_LOCK_INODE_GROUP_MASK;
 
-	name.scope = SCOUTFS_LOCK_SCOPE_FS_ITEMS;
-	name.zone = SCOUTFS_FS_ZONE;
-	name.type = SCOUTFS_INODE_TYPE;
-	name.first = cpu_to_le64(ino);
-	name.second = 0;
+	name->scope = SCOUTFS_LOCK_SCOPE_FS_ITEMS;
+	name->zone = SCOUTFS_FS_ZONE;
+	name->type = SCOUTFS_INODE_TYPE;
+	name->first = cpu_to_le64(ino);
+	name->second = 0;
 
-	start = (struct scoutfs_key) {
+	*start = (struct scoutfs_key) {
 		.sk_zone = SCOUTFS_FS_ZONE,
 		.ski_ino = cpu_to_le64(ino),
 		.sk_type = 0,
 	};
 
-	end = (struct scoutfs_key) {
+	*end = (struct scoutfs_key) {
 		.sk_zone = SCOUTFS_FS_ZONE,
 		.ski_ino = cpu_to_le64(ino + SCOUTFS_LOCK_INODE_GROUP_NR - 1),
 		.sk_type = U8_MAX,
 	};
+}
+
+int scoutfs_lock_ino(struct super_block *sb, int mode, int flags, u64 ino,
+		     struct scoutfs_lock **ret_lock)
+{
+	struct scoutfs_lock_name name;
+	struct scoutfs_key start;
+	struct scoutfs_key end;
+
+	ino_lock_name_keys(ino, &name, &start, &end);
 
 	return lock_name_keys(sb, mode, flags, &name, &start, &end, ret_lock);
 }
@@ -913,12 +1037,15 @@ int scoutfs_lock_ino(struct super_block *sb, int mode, int flags, u64 ino,
 int scoutfs_lock_inode(struct super_block *sb, int mode, int flags,
 		       struct inode *inode, struct scoutfs_lock **lock)
 {
+	ktime_t start = ktime_get();
 	int ret;
 
 	ret = scoutfs_lock_ino(sb, mode, flags, scoutfs_ino(inode), lock);
 	if (ret < 0)
 		goto out;
 
+	scoutfs_hist_record_since(sb, lock_inode_grant, start);
+
 	if (flags & SCOUTFS_LKF_REFRESH_INODE) {
 		ret = scoutfs_inode_refresh(inode, *lock, flags);
 		if (ret < 0) {
@@ -961,12 +1088,18 @@ static void swap_arg(void *A, void *B, int size)
 }
 
 /*
- * Lock all the inodes in inode number order.  The inode arguments can
- * be in any order and can be duplicated or null.  This relies on core
- * lock matching to efficiently handle duplicate lock attempts of the
- * same group.  Callers can try to use the lock range keys for all the
- * locks they attempt to acquire without knowing that they map to the
- * same groups.
+ * Lock all the inodes.  The inode arguments can be in any order and can
+ * be duplicated or null.  This relies on core lock matching to
+ * efficiently handle duplicate lock attempts of the same group.
+ * Callers can try to use the lock range keys for all the locks they
+ * attempt to acquire without knowing that they map to the same groups.
+ *
+ * All the lock requests are issued before waiting for any of them so
+ * that their conversion round trips overlap rather than stacking up a
+ * full synchronous round trip per inode.  We only become a user of
+ * each lock as we gather the grants in sorted inode order, and until
+ * then granted locks can still be revoked by remote basts, so the
+ * usual ordered conflict resolution is preserved.
  *
  * On error no locks are held and all pointers are set to null.  Lock
  * pointers for null inodes are always set to null.
@@ -982,6 +1115,13 @@ int scoutfs_lock_inodes(struct super_block *sb, int mode, int flags,
 	struct lock_inodes_arg args[] = {
 		{a, a_lock}, {b, b_lock}, {c, c_lock}, {d, D_lock},
 	};
+	struct scoutfs_lock *locks[ARRAY_SIZE(args)] = {NULL, };
+	struct scoutfs_lock_name name;
+	struct scoutfs_key start;
+	struct scoutfs_key end;
+	int started = 0;
+	int waited = 0;
+	int held = 0;
 	int ret;
 	int i;
 
@@ -999,20 +1139,113 @@ int scoutfs_lock_inodes(struct super_block *sb, int mode, int flags,
 	/* sort by having an inode then inode number */
 	sort(args, ARRAY_SIZE(args), sizeof(args[0]), cmp_arg, swap_arg);
 
-	/* lock unique inodes */
+	/* issue all the lock requests */
 	for (i = 0; i < ARRAY_SIZE(args) && args[i].inode; i++) {
-		ret = scoutfs_lock_inode(sb, mode, flags, args[i].inode,
-					 args[i].lockp);
+		ino_lock_name_keys(scoutfs_ino(args[i].inode), &name,
+				   &start, &end);
+		ret = lock_name_keys_request(sb, mode, flags, &name, &start,
+					     &end, &locks[i]);
 		if (ret)
-			break;
+			goto out;
+		started++;
 	}
 
-	/* unlock on error */
-	for (i = ARRAY_SIZE(args) - 1; ret < 0 && i >= 0; i--) {
-		if (args[i].lockp && *args[i].lockp) {
-			scoutfs_unlock(sb, *args[i].lockp, mode);
+	/* gather grants in sorted order, becoming a user of each */
+	for (i = 0; i < started; i++) {
+		ret = lock_name_keys_wait(sb, locks[i], mode, flags);
+		waited++;
+		if (ret)
+			goto out;
+		held++;
+
+		if (flags & SCOUTFS_LKF_REFRESH_INODE) {
+			ret = scoutfs_inode_refresh(args[i].inode, locks[i],
+						    flags);
+			if (ret)
+				goto out;
+		}
+
+		*args[i].lockp = locks[i];
+	}
+
+	ret = 0;
+out:
+	if (ret) {
+		for (i = 0; i < held; i++) {
+			scoutfs_unlock(sb, locks[i], mode);
 			*args[i].lockp = NULL;
 		}
+		for (i = waited; i < started; i++)
+			lock_name_keys_cancel(sb, locks[i], mode);
+	}
+
+	return ret;
+}
+
+/*
+ * Lock two inode numbers, issuing both lock requests before gathering
+ * the grants in sorted inode order.  Inode creation uses this because
+ * it only has an inode number, not a vfs inode, for the inode that
+ * it's creating.
+ */
+int scoutfs_lock_ino_pair(struct super_block *sb, int mode, int flags,
+			  u64 a_ino, struct scoutfs_lock **a_lock,
+			  u64 b_ino, struct scoutfs_lock **b_lock)
+{
+	struct scoutfs_lock **lockps[2];
+	struct scoutfs_lock *locks[2];
+	struct scoutfs_lock_name name;
+	struct scoutfs_key start;
+	struct scoutfs_key end;
+	u64 inos[2];
+	int started = 0;
+	int waited = 0;
+	int held = 0;
+	int ret;
+	int i;
+
+	if (a_ino <= b_ino) {
+		inos[0] = a_ino;
+		lockps[0] = a_lock;
+		inos[1] = b_ino;
+		lockps[1] = b_lock;
+	} else {
+		inos[0] = b_ino;
+		lockps[0] = b_lock;
+		inos[1] = a_ino;
+		lockps[1] = a_lock;
+	}
+
+	*a_lock = NULL;
+	*b_lock = NULL;
+
+	for (i = 0; i < ARRAY_SIZE(inos); i++) {
+		ino_lock_name_keys(inos[i], &name, &start, &end);
+		ret = lock_name_keys_request(sb, mode, flags, &name, &start,
+					     &end, &locks[i]);
+		if (ret)
+			goto out;
+		started++;
+	}
+
+	for (i = 0; i < started; i++) {
+		ret = lock_name_keys_wait(sb, locks[i], mode, flags);
+		waited++;
+		if (ret)
+			goto out;
+		held++;
+		*lockps[i] = locks[i];
+	}
+
+	ret = 0;
+out:
+	if (ret) {
+		for (i = 0; i < held; i++) {
+			scoutfs_unlock(sb, locks[i], mode);
+			*lockps[i] = NULL;
+		}
+		for (i = waited; i < started; i++)
+			lock_name_keys_cancel(sb, locks[i], mode);
 	}
 
 	return ret;
@@ -1129,6 +1362,182 @@ int scoutfs_lock_node_id(struct super_block *sb, int mode, int flags,
 	return lock_name_keys(sb, mode, flags, &name, &start, &end, lock);
 }
 
+struct lock_ahead_work {
+	struct work_struct work;
+	struct super_block *sb;
+	unsigned int nr;
+	u64 inos[0];
+};
+
+/*
+ * Acquire and immediately release a PR lock on each inode group that
+ * covers the caller's inodes.  Released locks stay granted until a bast
+ * or the shrinker tears them down, so when the scanning task gets to an
+ * inode its lock attempt matches the already granted mode and skips the
+ * dlm round trip.  We only warm each group once for runs of inodes in
+ * sorted batches.
+ *
+ * The work runs on an ordered queue so a flood of requests warms locks
+ * one at a time ahead of the scan instead of stampeding the dlm.  Lock
+ * attempts fail fast once locking is shut down.
+ */
+static void scoutfs_lock_ahead_work(struct work_struct *work)
+{
+	struct lock_ahead_work *law = container_of(work,
+						   struct lock_ahead_work,
+						   work);
+	struct super_block *sb = law->sb;
+	struct scoutfs_lock *lock;
+	u64 group = U64_MAX;
+	unsigned int i;
+	u64 start;
+	int ret;
+
+	for (i = 0; i < law->nr; i++) {
+		start = law->inos[i] & ~(u64)SCOUTFS_LOCK_INODE_GROUP_MASK;
+		if (start == group)
+			continue;
+		group = start;
+
+		ret = scoutfs_lock_ino(sb, DLM_LOCK_PR, 0, start, &lock);
+		if (ret == -ESHUTDOWN)
+			break;
+		if (ret == 0) {
+			scoutfs_inc_counter(sb, lock_ahead);
+			scoutfs_unlock(sb, lock, DLM_LOCK_PR);
+		}
+	}
+
+	kfree(law);
+}
+
+/*
+ * Asynchronously warm the inode group locks that will cover the given
+ * inodes.  The inos are copied so the caller's array can go away.  This
+ * only queues the work; the locks may or may not be granted by the time
+ * the caller gets to them and lock attempts that race with the warming
+ * wait on the same lock as usual.
+ */
+int scoutfs_lock_inos_ahead(struct super_block *sb, u64 *inos,
+			    unsigned int nr)
+{
+	DECLARE_LOCK_INFO(sb, linfo);
+	struct lock_ahead_work *law;
+
+	if (WARN_ON_ONCE(!linfo || linfo->lockspace == NULL))
+		return -ENOLCK;
+
+	if (linfo->shutdown)
+		return -ESHUTDOWN;
+
+	law = kmalloc(offsetof(struct lock_ahead_work, inos[nr]), GFP_NOFS);
+	if (!law)
+		return -ENOMEM;
+
+	INIT_WORK(&law->work, scoutfs_lock_ahead_work);
+	law->sb = sb;
+	law->nr = nr;
+	memcpy(law->inos, inos, nr * sizeof(inos[0]));
+
+	queue_work(linfo->ahead_workq, &law->work);
+
+	return 0;
+}
+
+struct warm_ranges_work {
+	struct work_struct work;
+	struct super_block *sb;
+	unsigned int nr;
+	struct scoutfs_key keys[0];
+};
+
+/*
+ * Acquire the lock that covers each key range and populate the item
+ * cache under it.  The ranges were typically dumped from the cached
+ * ranges of a previous mount so their start keys name the locks that
+ * covered them.  We can only name locks for the fs and index zones;
+ * ranges in other zones are quietly skipped.  Like lock ahead, the
+ * released locks stay granted so the warmed ranges survive until a
+ * bast or the shrinkers tear them down.
+ */
+static void scoutfs_lock_warm_ranges_work(struct work_struct *work)
+{
+	struct warm_ranges_work *wrw = container_of(work,
+						    struct warm_ranges_work,
+						    work);
+	struct super_block *sb = wrw->sb;
+	struct scoutfs_lock *lock;
+	struct scoutfs_key *start;
+	struct scoutfs_key *end;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i + 2 <= wrw->nr; i += 2) {
+		start = &wrw->keys[i];
+		end = &wrw->keys[i + 1];
+
+		if (scoutfs_key_compare(start, end) > 0)
+			continue;
+
+		if (start->sk_zone == SCOUTFS_FS_ZONE)
+			ret = scoutfs_lock_ino(sb, DLM_LOCK_PR, 0,
+					       le64_to_cpu(start->ski_ino),
+					       &lock);
+		else if (start->sk_zone == SCOUTFS_INODE_INDEX_ZONE)
+			ret = scoutfs_lock_inode_index(sb, DLM_LOCK_PR,
+					start->sk_type,
+					le64_to_cpu(start->skii_major),
+					le64_to_cpu(start->skii_ino), &lock);
+		else
+			continue;
+
+		if (ret == -ESHUTDOWN)
+			break;
+		if (ret)
+			continue;
+
+		ret = scoutfs_item_warm_range(sb, start, end, lock);
+		scoutfs_unlock(sb, lock, DLM_LOCK_PR);
+		if (ret == 0)
+			scoutfs_inc_counter(sb, item_cache_warm);
+	}
+
+	kfree(wrw);
+}
+
+/*
+ * Asynchronously populate the item cache for the given key ranges.
+ * Pairs of keys give the inclusive start and end of each range.  The
+ * keys are copied so the caller's array can go away.  This only queues
+ * the work on the ordered warming queue; it's purely a hint and the
+ * cache may or may not be warm by the time anyone looks.
+ */
+int scoutfs_lock_warm_ranges(struct super_block *sb, struct scoutfs_key *keys,
+			     unsigned int nr)
+{
+	DECLARE_LOCK_INFO(sb, linfo);
+	struct warm_ranges_work *wrw;
+
+	if (WARN_ON_ONCE(!linfo || linfo->lockspace == NULL))
+		return -ENOLCK;
+
+	if (linfo->shutdown)
+		return -ESHUTDOWN;
+
+	wrw = kmalloc(offsetof(struct warm_ranges_work, keys[nr]), GFP_NOFS);
+	if (!wrw)
+		return -ENOMEM;
+
+	INIT_WORK(&wrw->work, scoutfs_lock_warm_ranges_work);
+	wrw->sb = sb;
+	wrw->nr = nr;
+	memcpy(wrw->keys, keys, nr * sizeof(keys[0]));
+
+	queue_work(linfo->ahead_workq, &wrw->work);
+
+	return 0;
+}
+
 /*
  * As we unlock we start a grace period.  If a bast arrives before the
  * grace period we'll wait for another full grace period we downconvert
@@ -1239,6 +1648,21 @@ static int scoutfs_lock_shrink(struct shrinker *shrink,
 		if (nr-- == 0)
 			break;
 
+		/*
+		 * Uncontended locks that keep satisfying local requests
+		 * cost nothing to hold and save a conversion round trip
+		 * every time they're hit, so give them one more trip
+		 * around the lru before tearing them down.  Locks that
+		 * basts keep tearing down go first.
+		 */
+		if (!lock->shrink_deferred &&
+		    lock->cached_hits > lock->remote_basts) {
+			lock->shrink_deferred = true;
+			list_move_tail(&lock->lru_head, &linfo->lru_list);
+			scoutfs_inc_counter(sb, lock_shrink_deferred);
+			continue;
+		}
+
 		trace_scoutfs_lock_shrink(sb, lock);
 		scoutfs_inc_counter(sb, lock_shrink);
 
@@ -1271,16 +1695,36 @@ void scoutfs_free_unused_locks(struct super_block *sb, unsigned long nr)
 	linfo->shrinker.shrink(&linfo->shrinker, &sc);
 }
 
+/*
+ * Totals for sysfs so that the rate of lock reuse and remote
+ * invalidation can be watched.  The files can be visible before locking
+ * is set up and after it's torn down.
+ */
+u64 scoutfs_lock_cached_hits(struct super_block *sb)
+{
+	DECLARE_LOCK_INFO(sb, linfo);
+
+	return linfo ? atomic64_read(&linfo->cached_hits) : 0;
+}
+
+u64 scoutfs_lock_remote_invalidations(struct super_block *sb)
+{
+	DECLARE_LOCK_INFO(sb, linfo);
+
+	return linfo ? atomic64_read(&linfo->remote_invals) : 0;
+}
+
 static void lock_tseq_show(struct seq_file *m, struct scoutfs_tseq_entry *ent)
 {
 	struct scoutfs_lock *lock =
 		container_of(ent, struct scoutfs_lock, tseq_entry);
 
-	seq_printf(m, "name "LN_FMT" start "SK_FMT" end "SK_FMT" refresh_gen %llu error %d granted %d bast %d prev %d work %d waiters: pr %u ex %u cw %u users: pr %u ex %u cw %u dlmlksb: status %d lkid 0x%x flags 0x%x\n",
+	seq_printf(m, "name "LN_FMT" start "SK_FMT" end "SK_FMT" refresh_gen %llu error %d granted %d bast %d prev %d work %d hits %lu basts %lu waiters: pr %u ex %u cw %u users: pr %u ex %u cw %u dlmlksb: status %d lkid 0x%x flags 0x%x\n",
 			   LN_ARG(&lock->name), SK_ARG(&lock->start),
 			   SK_ARG(&lock->end), lock->refresh_gen, lock->error,
 			   lock->granted_mode, lock->bast_mode,
 			   lock->work_prev_mode, lock->work_mode,
+			   lock->cached_hits, lock->remote_basts,
 			   lock->waiters[DLM_LOCK_PR],
 			   lock->waiters[DLM_LOCK_EX],
 			   lock->waiters[DLM_LOCK_CW],
@@ -1345,6 +1789,10 @@ void scoutfs_lock_destroy(struct super_block *sb)
 	/* stop the shrinker from queueing work */
 	unregister_shrinker(&linfo->shrinker);
 
+	/* finish lock ahead work, its lock attempts fail after shutdown */
+	if (linfo->ahead_workq)
+		destroy_workqueue(linfo->ahead_workq);
+
 	/* make sure that no one's actively using locks */
 	spin_lock(&linfo->lock);
 	for (node = rb_first(&linfo->lock_tree); node; node = rb_next(node)) {
@@ -1432,6 +1880,8 @@ int scoutfs_lock_setup(struct super_block *sb)
 	register_shrinker(&linfo->shrinker);
 	INIT_LIST_HEAD(&linfo->lru_list);
 	atomic64_set(&linfo->next_refresh_gen, 0);
+	atomic64_set(&linfo->cached_hits, 0);
+	atomic64_set(&linfo->remote_invals, 0);
 	scoutfs_tseq_tree_init(&linfo->tseq_tree, lock_tseq_show);
 
 	sbi->lock_info = linfo;
@@ -1452,6 +1902,13 @@ int scoutfs_lock_setup(struct super_block *sb)
 		goto out;
 	}
 
+	linfo->ahead_workq = alloc_workqueue("scoutfs_lock_ahead",
+					     WQ_NON_REENTRANT | WQ_UNBOUND, 1);
+	if (!linfo->ahead_workq) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	snprintf(name, DLM_LOCKSPACE_LEN, "scoutfs_fsid_%llx",
 		 le64_to_cpu(sbi->super.hdr.fsid));
 
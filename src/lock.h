@@ -31,6 +31,16 @@ struct scoutfs_lock {
 	struct delayed_work grace_work;
 	bool grace_pending;
 
+	/*
+	 * Adaptive caching feedback: how often granted modes satisfied
+	 * local requests without a conversion and how often remote basts
+	 * tore the grant down.  Reuse decays as basts arrive so the
+	 * comparison tracks recent behaviour.
+	 */
+	unsigned long cached_hits;
+	unsigned long remote_basts;
+	bool shrink_deferred;
+
 	spinlock_t cov_list_lock;
 	struct list_head cov_list;
 
@@ -66,10 +76,17 @@ int scoutfs_lock_inodes(struct super_block *sb, int mode, int flags,
 			struct inode *b, struct scoutfs_lock **b_lock,
 			struct inode *c, struct scoutfs_lock **c_lock,
 			struct inode *d, struct scoutfs_lock **D_lock);
+int scoutfs_lock_ino_pair(struct super_block *sb, int mode, int flags,
+			  u64 a_ino, struct scoutfs_lock **a_lock,
+			  u64 b_ino, struct scoutfs_lock **b_lock);
 int scoutfs_lock_global(struct super_block *sb, int mode, int flags, int type,
 			struct scoutfs_lock **lock);
 int scoutfs_lock_node_id(struct super_block *sb, int mode, int flags,
 			 u64 node_id, struct scoutfs_lock **lock);
+int scoutfs_lock_inos_ahead(struct super_block *sb, u64 *inos,
+			    unsigned int nr);
+int scoutfs_lock_warm_ranges(struct super_block *sb, struct scoutfs_key *keys,
+			     unsigned int nr);
 void scoutfs_unlock(struct super_block *sb, struct scoutfs_lock *lock,
 		    int level);
 void scoutfs_unlock_flags(struct super_block *sb, struct scoutfs_lock *lock,
@@ -86,6 +103,9 @@ void scoutfs_lock_del_coverage(struct super_block *sb,
 
 void scoutfs_free_unused_locks(struct super_block *sb, unsigned long nr);
 
+u64 scoutfs_lock_cached_hits(struct super_block *sb);
+u64 scoutfs_lock_remote_invalidations(struct super_block *sb);
+
 int scoutfs_lock_setup(struct super_block *sb);
 void scoutfs_lock_shutdown(struct super_block *sb);
 void scoutfs_lock_destroy(struct super_block *sb);
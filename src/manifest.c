@@ -58,6 +58,9 @@ struct manifest {
 
 #define MANI_FLAG_LEVEL0_FULL (1 << 0)
 
+/* the number of candidate segments scored when choosing a compaction */
+#define COMPACT_NR_CANDIDATES 8
+
 #define DECLARE_MANIFEST(sb, name) \
 	struct manifest *name = SCOUTFS_SB(sb)->manifest
 
@@ -201,6 +204,86 @@ int scoutfs_manifest_add(struct super_block *sb,
 	return ret;
 }
 
+/*
+ * Add a set of manifest entries as one sorted batch of btree
+ * insertions.  Either all of the entries are added or none of them are:
+ * if the batch fails part way through we delete the entries that made
+ * it in before returning the error.  Failure of that unwind would leave
+ * the manifest half modified, which we can't recover from, so it's
+ * fatal like the other compaction commit unwind paths.
+ *
+ * This must be called with the manifest lock held.
+ */
+int scoutfs_manifest_add_batch(struct super_block *sb,
+			       struct scoutfs_manifest_entry *ments,
+			       unsigned int nr)
+{
+	DECLARE_MANIFEST(sb, mani);
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct scoutfs_super_block *super = &sbi->super;
+	struct scoutfs_manifest_btree_key *mkeys = NULL;
+	struct scoutfs_manifest_btree_val *mvals = NULL;
+	struct scoutfs_btree_op *ops = NULL;
+	unsigned int i;
+	int err;
+	int ret;
+
+	lockdep_assert_held(&mani->rwsem);
+
+	if (nr == 0)
+		return 0;
+
+	mkeys = kcalloc(nr, sizeof(mkeys[0]), GFP_NOFS);
+	mvals = kcalloc(nr, sizeof(mvals[0]), GFP_NOFS);
+	ops = kcalloc(nr, sizeof(ops[0]), GFP_NOFS);
+	if (!mkeys || !mvals || !ops) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		init_btree_key(&mkeys[i], ments[i].level, ments[i].seq,
+			       &ments[i].first);
+		init_btree_val(&mvals[i], ments[i].segno, &ments[i].last);
+
+		trace_scoutfs_manifest_add(sb, ments[i].level, ments[i].segno,
+					   ments[i].seq, &ments[i].first,
+					   &ments[i].last);
+
+		ops[i].key = &mkeys[i];
+		ops[i].key_len = sizeof(mkeys[i]);
+		ops[i].val = &mvals[i];
+		ops[i].val_len = sizeof(mvals[i]);
+		ops[i].del = false;
+	}
+
+	ret = scoutfs_btree_apply_batch(sb, &super->manifest.root, ops, nr);
+	if (ret < 0) {
+		for (i = 0; i < nr; i++) {
+			if (ops[i].ret == 0) {
+				err = scoutfs_btree_delete(sb,
+							&super->manifest.root,
+							ops[i].key,
+							ops[i].key_len);
+				BUG_ON(err);
+			}
+		}
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		mani->nr_levels = max_t(u8, mani->nr_levels,
+					ments[i].level + 1);
+		add_level_count(sb, ments[i].level, 1);
+	}
+
+out:
+	kfree(mkeys);
+	kfree(mvals);
+	kfree(ops);
+	return ret;
+}
+
 /*
  * This must be called with the manifest lock held.
  *
@@ -231,6 +314,83 @@ int scoutfs_manifest_del(struct super_block *sb,
 	return ret;
 }
 
+/*
+ * Delete a set of manifest entries as one sorted batch of btree
+ * deletions, with the same all or nothing behaviour as batched
+ * addition.  We build the values alongside the keys so that a partial
+ * batch can be unwound by re-inserting the deleted entries.
+ *
+ * This must be called with the manifest lock held.
+ */
+int scoutfs_manifest_del_batch(struct super_block *sb,
+			       struct scoutfs_manifest_entry *ments,
+			       unsigned int nr)
+{
+	DECLARE_MANIFEST(sb, mani);
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct scoutfs_super_block *super = &sbi->super;
+	struct scoutfs_manifest_btree_key *mkeys = NULL;
+	struct scoutfs_manifest_btree_val *mvals = NULL;
+	struct scoutfs_btree_op *ops = NULL;
+	unsigned int i;
+	int err;
+	int ret;
+
+	lockdep_assert_held(&mani->rwsem);
+
+	if (nr == 0)
+		return 0;
+
+	mkeys = kcalloc(nr, sizeof(mkeys[0]), GFP_NOFS);
+	mvals = kcalloc(nr, sizeof(mvals[0]), GFP_NOFS);
+	ops = kcalloc(nr, sizeof(ops[0]), GFP_NOFS);
+	if (!mkeys || !mvals || !ops) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		init_btree_key(&mkeys[i], ments[i].level, ments[i].seq,
+			       &ments[i].first);
+		init_btree_val(&mvals[i], ments[i].segno, &ments[i].last);
+
+		trace_scoutfs_manifest_delete(sb, ments[i].level,
+					      ments[i].segno, ments[i].seq,
+					      &ments[i].first, &ments[i].last);
+
+		ops[i].key = &mkeys[i];
+		ops[i].key_len = sizeof(mkeys[i]);
+		ops[i].val = &mvals[i];
+		ops[i].val_len = sizeof(mvals[i]);
+		ops[i].del = true;
+	}
+
+	ret = scoutfs_btree_apply_batch(sb, &super->manifest.root, ops, nr);
+	if (ret < 0) {
+		for (i = 0; i < nr; i++) {
+			if (ops[i].ret == 0) {
+				err = scoutfs_btree_insert(sb,
+							&super->manifest.root,
+							ops[i].key,
+							ops[i].key_len,
+							ops[i].val,
+							ops[i].val_len);
+				BUG_ON(err);
+			}
+		}
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++)
+		add_level_count(sb, ments[i].level, -1ULL);
+
+out:
+	kfree(mkeys);
+	kfree(mvals);
+	kfree(ops);
+	return ret;
+}
+
 /*
  * XXX This feels pretty gross, but it's a simple way to give compaction
  * atomic updates.  It'll go away once compactions go to the trouble of
@@ -521,6 +681,45 @@ static int cmp_ment_ref_level_seq(void *priv, struct list_head *A,
 	return a->level < b->level ? -1 : a->level > b->level ? 1 : 0;
 }
 
+/*
+ * Submit reads for the segments that intersect the key range just past
+ * a range that was populated.  Sequential iterators will soon ask for
+ * these keys and will find the segment reads already in flight or
+ * completed.  This is best effort, errors are ignored and the read
+ * path will resubmit and see them.
+ */
+static void readahead_next_segments(struct super_block *sb,
+				    struct scoutfs_btree_root *root,
+				    struct scoutfs_key *key,
+				    struct scoutfs_key *end)
+{
+	struct scoutfs_key seg_start = *key;
+	struct scoutfs_key seg_end = *end;
+	struct scoutfs_segment *seg;
+	struct manifest_ref *ref;
+	struct manifest_ref *tmp;
+	LIST_HEAD(ref_list);
+
+	if (get_nonzero_refs(sb, root, key, &seg_start, &seg_end, &ref_list) ||
+	    get_zero_refs(sb, root, &seg_start, &seg_end, &ref_list))
+		goto out;
+
+	list_sort(NULL, &ref_list, cmp_ment_ref_segno);
+
+	list_for_each_entry(ref, &ref_list, entry) {
+		seg = scoutfs_seg_submit_read(sb, ref->segno, false);
+		if (IS_ERR(seg))
+			break;
+		scoutfs_inc_counter(sb, manifest_readahead_segment);
+		scoutfs_seg_put(seg);
+	}
+out:
+	list_for_each_entry_safe(ref, tmp, &ref_list, entry) {
+		list_del_init(&ref->entry);
+		free_ref(sb, ref);
+	}
+}
+
 /*
  * The caller found a hole in the item cache that they'd like populated.
  * We can only trust items in the segments within their range (they hold
@@ -535,6 +734,11 @@ static int cmp_ment_ref_level_seq(void *priv, struct list_head *A,
  * negatively cache it.  Once we have the search range we get the level
  * zero segments that overlap.
  *
+ * Point lookup callers set 'point' to let us exclude segments whose
+ * bloom filters show that they can't contain the key.  Iterating
+ * callers can't because we'd shrink the cached range around the key
+ * and they'd call us for every missing key they pass over.
+ *
  * Once we have the segments we iterate over them and allocate the items
  * to insert into the cache.  We find the next item in each segment,
  * ignore deletion items, prefer more recent segments, and advance past
@@ -555,7 +759,7 @@ static int cmp_ment_ref_level_seq(void *priv, struct list_head *A,
 int scoutfs_manifest_read_items(struct super_block *sb,
 				struct scoutfs_key *key,
 				struct scoutfs_key *start,
-				struct scoutfs_key *end)
+				struct scoutfs_key *end, bool point)
 {
 	struct scoutfs_key item_key;
 	struct scoutfs_key found_key;
@@ -574,6 +778,7 @@ int scoutfs_manifest_read_items(struct super_block *sb,
 	u8 found_flags = 0;
 	u8 item_flags;
 	int found_ctr;
+	bool excluded;
 	bool found;
 	bool added;
 	int ret = 0;
@@ -608,6 +813,33 @@ retry_stale:
 	if (ret)
 		goto out;
 
+	/*
+	 * Point lookups can use the segment bloom filters to drop
+	 * segments that can't contain the key before reading them.  The
+	 * dropped segments could have contributed items around the key
+	 * so we have to shrink the cached range down to the key itself
+	 * when we exclude segments.  Bloom check failures just leave
+	 * the segment to the full read path.
+	 */
+	excluded = false;
+	if (point) {
+		list_for_each_entry_safe(ref, tmp, &ref_list, entry) {
+			if (scoutfs_seg_bloom_may_contain(sb, ref->segno,
+							  ref->seq, key) == 0) {
+				scoutfs_inc_counter(sb, seg_bloom_excluded);
+				list_del_init(&ref->entry);
+				free_ref(sb, ref);
+				excluded = true;
+			} else {
+				scoutfs_inc_counter(sb, seg_bloom_pass);
+			}
+		}
+	}
+	if (excluded) {
+		seg_start = *key;
+		seg_end = *key;
+	}
+
 	/* sort by segment to issue advancing reads */
 	list_sort(NULL, &ref_list, cmp_ment_ref_segno);
 
@@ -622,7 +854,7 @@ resubmit:
 						ref->seq, &ref->first,
 						&ref->last);
 
-		seg = scoutfs_seg_submit_read(sb, ref->segno);
+		seg = scoutfs_seg_submit_read(sb, ref->segno, false);
 		if (IS_ERR(seg)) {
 			ret = PTR_ERR(seg);
 			break;
@@ -756,6 +988,14 @@ resubmit:
 			scoutfs_inc_counter(sb, manifest_read_excluded_key);
 		ret = scoutfs_item_insert_batch(sb, &batch, &seg_start,
 						&batch_end);
+
+		/* start reads for the next range that iteration will need */
+		if (ret == 0 && !point &&
+		    scoutfs_key_compare(&batch_end, end) < 0) {
+			item_key = batch_end;
+			scoutfs_key_inc(&item_key);
+			readahead_next_segments(sb, &root, &item_key, end);
+		}
 	}
 out:
 	list_for_each_entry_safe(ref, tmp, &ref_list, entry) {
@@ -766,6 +1006,7 @@ out:
 	ret = handle_stale_btree(sb, &root, last_root_seq, ret);
 	if (ret == -EAGAIN) {
 		last_root_seq = root.ref.seq;
+		scoutfs_client_invalidate_manifest_root(sb);
 		goto retry_stale;
 	}
 
@@ -820,7 +1061,7 @@ retry_stale:
 	list_sort(NULL, &ref_list, cmp_ment_ref_segno);
 
 	list_for_each_entry(ref, &ref_list, entry) {
-		seg = scoutfs_seg_submit_read(sb, ref->segno);
+		seg = scoutfs_seg_submit_read(sb, ref->segno, false);
 		if (IS_ERR(seg)) {
 			ret = PTR_ERR(seg);
 			break;
@@ -881,6 +1122,7 @@ out:
 	ret = handle_stale_btree(sb, &root, last_root_seq, ret);
 	if (ret == -EAGAIN) {
 		last_root_seq = root.ref.seq;
+		scoutfs_client_invalidate_manifest_root(sb);
 		goto retry_stale;
 	}
 
@@ -1002,16 +1244,65 @@ static int add_entry_unless_busy(struct super_block *sb,
 	return 0;
 }
 
+/*
+ * Count the number of segments at the next lower level whose key
+ * ranges overlap the candidate entry, up to the fanout bound that
+ * limits a compaction.  The count is the dominant cost of compacting
+ * the candidate: all of its overlapping lower segments are read and
+ * rewritten to retire it.
+ */
+static int count_lower_overlap(struct super_block *sb,
+			       struct scoutfs_manifest_entry *ment,
+			       int level)
+{
+	struct scoutfs_super_block *super = &SCOUTFS_SB(sb)->super;
+	struct scoutfs_manifest_btree_key mkey;
+	struct scoutfs_manifest_entry over;
+	SCOUTFS_BTREE_ITEM_REF(iref);
+	SCOUTFS_BTREE_ITEM_REF(prev);
+	int nr = 0;
+	int ret;
+
+	init_btree_key(&mkey, level + 1, 0, &ment->first);
+	ret = btree_prev_overlap_or_next(sb, &super->manifest.root, &mkey,
+					 sizeof(mkey), &ment->first, NULL,
+					 level + 1, &iref);
+	while (ret == 0 && nr <= SCOUTFS_MANIFEST_FANOUT) {
+		init_ment_iref(&over, &iref);
+		if (over.level != level + 1 ||
+		    scoutfs_key_compare_ranges(&ment->first, &ment->last,
+					       &over.first, &over.last) != 0)
+			break;
+
+		nr++;
+		swap(prev, iref);
+		ret = scoutfs_btree_after(sb, &super->manifest.root,
+					  prev.key, prev.key_len, &iref);
+		scoutfs_btree_put_iref(&prev);
+	}
+	scoutfs_btree_put_iref(&iref);
+	scoutfs_btree_put_iref(&prev);
+
+	if (ret < 0 && ret != -ENOENT)
+		return ret;
+	return nr;
+}
+
 /*
  * Give the caller the segments that will be involved in the next
  * compaction.
  *
- * For now we have a simple candidate search.  We only initiate
- * compaction when a level has exceeded its exponentially increasing
- * limit on the number of segments.  Once we have a level we use keys at
- * each level to chose the next segment.  This results in a pattern
- * where clock hands sweep through each level.  The hands wrap much
- * faster on the higher levels.
+ * We only initiate compaction when a level has exceeded its
+ * exponentially increasing limit on the number of segments.  Once we
+ * have a level we use keys at each level to chose the next candidates.
+ * This results in a pattern where clock hands sweep through each
+ * level.  The hands wrap much faster on the higher levels.
+ *
+ * A window of candidates at the cursor is scored by the number of
+ * lower level segments each overlaps and the cheapest is chosen, so
+ * the write amplification of retiring an upper segment is the smallest
+ * the window offers.  Ties go to the earliest candidate so the hand
+ * still sweeps.
  *
  * We add all the segments to the compaction caller's data and let it do
  * its thing.  It'll allocate and free segments and update the manifest.
@@ -1043,6 +1334,9 @@ static int next_compact_req(struct super_block *sb, int level,
 	static struct scoutfs_key zeros;
 	bool wrapped;
 	bool sticky;
+	bool found;
+	int best;
+	int cand;
 	int ret;
 	int nr = 0;
 	int i;
@@ -1085,16 +1379,27 @@ static int next_compact_req(struct super_block *sb, int level,
 		}
 
 	} else {
-		/* find the next segment after the compaction at this level */
+		/*
+		 * Scan candidates from the cursor and keep the one
+		 * that overlaps the fewest lower segments.  A
+		 * candidate with no overlaps is moved down without
+		 * rewriting anything so it can't be beaten.  All the
+		 * candidates in the window can be busy, the first is
+		 * remembered so that the cursor still advances as the
+		 * caller retries.
+		 */
 		init_btree_key(&mkey, level, 0, &mani->compact_keys[level]);
 		wrapped = false;
+		found = false;
+		best = -1;
+		cand = 0;
 again:
 		ret = scoutfs_btree_next(sb, &super->manifest.root,
 					 &mkey, sizeof(mkey), &iref);
 		if (ret == 0) {
-			init_ment_iref(&ment, &iref);
+			init_ment_iref(&next, &iref);
 			scoutfs_btree_put_iref(&iref);
-			if (ment.level != level)
+			if (next.level != level)
 				ret = -ENOENT;
 		}
 		/* try again if we wrapped */
@@ -1103,6 +1408,35 @@ again:
 			wrapped = true;
 			goto again;
 		}
+		if (ret == 0) {
+			if (!found) {
+				found = true;
+				ment = next;
+			}
+
+			if (!scoutfs_spbm_test(&mani->segno_busy,
+					       next.segno)) {
+				ret = count_lower_overlap(sb, &next, level);
+				if (ret < 0)
+					goto out;
+				scoutfs_inc_counter(sb,
+						compact_candidate_scored);
+				if (best < 0 || ret < best) {
+					best = ret;
+					ment = next;
+				}
+			}
+
+			if (best != 0 && ++cand < COMPACT_NR_CANDIDATES) {
+				init_btree_key(&mkey, level, next.seq + 1,
+					       &next.first);
+				goto again;
+			}
+			ret = 0;
+		} else if (found) {
+			/* ran out of entries, work with what we saw */
+			ret = 0;
+		}
 	}
 
 	if (ret < 0) {
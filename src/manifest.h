@@ -27,6 +27,12 @@ int scoutfs_manifest_add(struct super_block *sb,
 			 struct scoutfs_manifest_entry *ment);
 int scoutfs_manifest_del(struct super_block *sb,
 			 struct scoutfs_manifest_entry *ment);
+int scoutfs_manifest_add_batch(struct super_block *sb,
+			       struct scoutfs_manifest_entry *ments,
+			       unsigned int nr);
+int scoutfs_manifest_del_batch(struct super_block *sb,
+			       struct scoutfs_manifest_entry *ments,
+			       unsigned int nr);
 
 int scoutfs_manifest_lock(struct super_block *sb);
 int scoutfs_manifest_unlock(struct super_block *sb);
@@ -34,7 +40,7 @@ int scoutfs_manifest_unlock(struct super_block *sb);
 int scoutfs_manifest_read_items(struct super_block *sb,
 				struct scoutfs_key *key,
 				struct scoutfs_key *start,
-				struct scoutfs_key *end);
+				struct scoutfs_key *end, bool point);
 int scoutfs_manifest_next_key(struct super_block *sb, struct scoutfs_key *key,
 			      struct scoutfs_key *next_key);
 
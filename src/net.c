@@ -20,9 +20,13 @@
 #include <net/sock.h>
 #include <net/tcp.h>
 #include <linux/log2.h>
+#include <linux/llist.h>
+#include <linux/math64.h>
 
 #include "format.h"
 #include "counters.h"
+#include "hist.h"
+#include "recorder.h"
 #include "inode.h"
 #include "btree.h"
 #include "manifest.h"
@@ -111,10 +115,15 @@ struct scoutfs_net_connection {
 	struct scoutfs_net_connection *listening_conn;
 	struct list_head accepted_list;
 
-	u64 next_send_id;
+	atomic64_t next_send_id;
+	struct llist_head submit_list;
 	struct list_head send_queue;
 	struct list_head resend_queue;
 
+	/* smoothed response round trip estimate, under the lock */
+	u64 srtt_ns;
+	u64 rttvar_ns;
+
 	struct workqueue_struct *workq;
 	struct work_struct listen_work;
 	struct work_struct connect_work;
@@ -135,7 +144,10 @@ enum {
 };
 
 /*
- * Messages to be sent are allocated and put on the send queue.
+ * Messages to be sent are allocated and first published on a lock-free
+ * submission list so that submitters don't serialize on the connection
+ * lock.  Everyone who walks the locked queues splices the submission
+ * list in first so that they can't miss a submitted message.
  *
  * Request messages are put on the resend queue until their response
  * messages is received and they can be freed.
@@ -145,13 +157,23 @@ enum {
  * message down the socket.  To free messages we mark them dead and have
  * the send worker free them while under the lock so that we don't have
  * to risk freeing messages from under the unlocked send worker.
+ *
+ * Small payloads are copied into the flexible data array after the
+ * header.  Large payloads can instead hand their allocated buffer over
+ * to the message, which sends it with a second gathered kvec and frees
+ * it with the message, avoiding copying the payload a second time.
  */
 struct message_send {
 	struct scoutfs_tseq_entry tseq_entry;
 	unsigned long dead:1;
+	unsigned long owns_data:1;
+	unsigned long resent:1;
+	struct llist_node llnode;
 	struct list_head head;
 	scoutfs_net_response_t resp_func;
 	void *resp_data;
+	void *data;
+	ktime_t submit_time;
 	struct scoutfs_net_header nh;
 };
 
@@ -186,6 +208,46 @@ static bool nh_is_request(struct scoutfs_net_header *nh)
 	return !nh_is_response(nh);
 }
 
+/*
+ * Move lock-free submissions onto the locked queues in submission
+ * order.  Sends on an established connection that's seen a valid
+ * greeting go straight to the send queue, everything else waits on the
+ * resend queue for the next valid greeting.
+ */
+static void splice_submitted(struct scoutfs_net_connection *conn)
+{
+	struct net_info *ninf = SCOUTFS_SB(conn->sb)->net_info;
+	struct message_send *msend;
+	struct llist_node *node;
+	struct llist_node *next;
+	struct llist_node *rev = NULL;
+
+	assert_spin_locked(&conn->lock);
+
+	/* the submission list is in lifo order, reverse it */
+	node = llist_del_all(&conn->submit_list);
+	while (node) {
+		next = node->next;
+		node->next = rev;
+		rev = node;
+		node = next;
+	}
+
+	while (rev) {
+		msend = llist_entry(rev, struct message_send, llnode);
+		rev = rev->next;
+
+		if (conn->established &&
+		    (conn->valid_greeting ||
+		     msend->nh.cmd == SCOUTFS_NET_CMD_GREETING))
+			list_add_tail(&msend->head, &conn->send_queue);
+		else
+			list_add_tail(&msend->head, &conn->resend_queue);
+
+		scoutfs_tseq_add(&ninf->msg_tseq_tree, &msend->tseq_entry);
+	}
+}
+
 static struct message_send *search_list(struct scoutfs_net_connection *conn,
 					struct list_head *list,
 					u8 cmd, u64 id)
@@ -212,6 +274,8 @@ static struct message_send *find_request(struct scoutfs_net_connection *conn,
 {
 	struct message_send *msend;
 
+	splice_submitted(conn);
+
 	msend = search_list(conn, &conn->resend_queue, cmd, id) ?:
 		search_list(conn, &conn->send_queue, cmd, id);
 	if (msend && msend->dead)
@@ -319,28 +383,33 @@ static void shutdown_conn(struct scoutfs_net_connection *conn)
 }
 
 /*
- * Allocate a message and put it on the send queue.
- *
- * A 0 id means that we'll assign the next id from the connection once
- * we hold the lock and is only valid for sending requests.
+ * Allocate a message and publish it on the lock-free submission list.
+ * The send worker splices submissions onto the locked queues, sending
+ * down the socket when the connection has passed the greeting and
+ * parking everything else on the resend queue until the next valid
+ * greeting.
  *
- * This can race with connections that are either starting up and
- * shutting down.  We only directly queue the send work if the
- * connection has passed the greeting and isn't being shut down.  At all
- * other times we add new sends to the resend queue.
+ * A 0 id means that we'll assign the next id from the connection and is
+ * only valid for sending requests.
  *
  * If a non-zero node_id is specified then the conn argument is a listening
  * connection and the connection to send the message down is found by
- * searching for the node_id in its accepted connections.
+ * searching for the node_id in its accepted connections.  The listening
+ * lock is held across publication so that the accepted connection can't
+ * be destroyed from under us.
+ *
+ * If own_data is set then ownership of the caller's allocated data
+ * buffer is transferred to the message instead of copying it.  The
+ * buffer is always freed, including when submission fails.
  */
 static int submit_send(struct super_block *sb,
 		       struct scoutfs_net_connection *conn, u64 node_id,
 		       u8 cmd, u8 flags, u64 id, u8 net_err,
-		       void *data, u16 data_len,
+		       void *data, u16 data_len, bool own_data,
 		       scoutfs_net_response_t resp_func, void *resp_data,
 		       u64 *id_ret)
 {
-	struct net_info *ninf = SCOUTFS_SB(sb)->net_info;
+	struct scoutfs_net_connection *listener = NULL;
 	struct scoutfs_net_connection *acc_conn;
 	struct message_send *msend;
 
@@ -350,30 +419,37 @@ static int submit_send(struct super_block *sb,
 	    WARN_ON_ONCE(data_len > SCOUTFS_NET_MAX_DATA_LEN) ||
 	    WARN_ON_ONCE(data_len && data == NULL) ||
 	    WARN_ON_ONCE(net_err && (!(flags & SCOUTFS_NET_FLAG_RESPONSE))) ||
-	    WARN_ON_ONCE(id == 0 && (flags & SCOUTFS_NET_FLAG_RESPONSE)))
+	    WARN_ON_ONCE(id == 0 && (flags & SCOUTFS_NET_FLAG_RESPONSE))) {
+		if (own_data)
+			kfree(data);
 		return -EINVAL;
+	}
 
 	msend = kmalloc(offsetof(struct message_send,
-				 nh.data[data_len]), GFP_NOFS);
-	if (!msend)
+				 nh.data[own_data ? 0 : data_len]), GFP_NOFS);
+	if (!msend) {
+		if (own_data)
+			kfree(data);
 		return -ENOMEM;
-
-	spin_lock_nested(&conn->lock, CONN_LOCK_LISTENER);
+	}
 
 	if (node_id != 0) {
-		list_for_each_entry(acc_conn, &conn->accepted_list,
+		listener = conn;
+		spin_lock_nested(&listener->lock, CONN_LOCK_LISTENER);
+
+		conn = NULL;
+		list_for_each_entry(acc_conn, &listener->accepted_list,
 				    accepted_head) {
 			if (acc_conn->node_id == node_id) {
-				spin_lock_nested(&acc_conn->lock,
-						 CONN_LOCK_ACCEPTED);
-				spin_unlock(&conn->lock);
 				conn = acc_conn;
-				node_id = 0;
 				break;
 			}
 		}
-		if (node_id != 0) {
-			spin_unlock(&conn->lock);
+		if (conn == NULL) {
+			spin_unlock(&listener->lock);
+			if (own_data)
+				kfree(data);
+			kfree(msend);
 			return -ENOTCONN;
 		}
 	}
@@ -381,31 +457,31 @@ static int submit_send(struct super_block *sb,
 	msend->resp_func = resp_func;
 	msend->resp_data = resp_data;
 	msend->dead = 0;
+	msend->owns_data = !!own_data;
+	msend->resent = 0;
+	msend->data = own_data ? data : NULL;
+	msend->submit_time = ktime_get();
 
 	if (id == 0)
-		id = conn->next_send_id++;
+		id = atomic64_inc_return(&conn->next_send_id) - 1;
 	msend->nh.id = cpu_to_le64(id);
 	msend->nh.cmd = cmd;
 	msend->nh.flags = flags;
 	msend->nh.error = net_err;
 	msend->nh.data_len = cpu_to_le16(data_len);
-	if (data_len)
+	if (data_len && !own_data)
 		memcpy(msend->nh.data, data, data_len);
 
-	if (conn->established &&
-	    (conn->valid_greeting || cmd == SCOUTFS_NET_CMD_GREETING)) {
-		list_add_tail(&msend->head, &conn->send_queue);
+	/* the send worker can free the message once it's visible */
+	llist_add(&msend->llnode, &conn->submit_list);
+	if (conn->established)
 		queue_work(conn->workq, &conn->send_work);
-	} else {
-		list_add_tail(&msend->head, &conn->resend_queue);
-	}
 
-	if (id_ret)
-		*id_ret = le64_to_cpu(msend->nh.id);
-
-	scoutfs_tseq_add(&ninf->msg_tseq_tree, &msend->tseq_entry);
+	if (listener)
+		spin_unlock(&listener->lock);
 
-	spin_unlock(&conn->lock);
+	if (id_ret)
+		*id_ret = id;
 
 	return 0;
 }
@@ -422,15 +498,46 @@ static int submit_send(struct super_block *sb,
  * Update the conn's node_id so that servers can send to specific
  * clients.
  */
+/*
+ * Resends that unblock commits and metadata progress go ahead of bulk
+ * payload transfers when a reconnected socket drains the resend queue,
+ * so a recovering server serves the messages nodes are waiting on
+ * before it chews through queued bulk work.
+ */
+static bool resend_high_priority(struct scoutfs_net_header *nh)
+{
+	switch (nh->cmd) {
+	case SCOUTFS_NET_CMD_ALLOC_INODES:
+	case SCOUTFS_NET_CMD_ALLOC_SEGNO:
+	case SCOUTFS_NET_CMD_ALLOC_SEGNOS:
+	case SCOUTFS_NET_CMD_RECORD_SEGMENT:
+	case SCOUTFS_NET_CMD_ADVANCE_SEQ:
+		return true;
+	default:
+		return false;
+	}
+}
+
 static void saw_valid_greeting(struct scoutfs_net_connection *conn, u64 node_id)
 {
 	struct super_block *sb = conn->sb;
+	struct message_send *msend;
+	struct message_send *tmp;
+	LIST_HEAD(bulk);
 
 	spin_lock(&conn->lock);
 
 	conn->valid_greeting = 1;
 	conn->node_id = node_id;
+	/* queue our greeting response before splicing resends behind it */
+	splice_submitted(conn);
+	/* critical resends first, bulk transfers behind them */
+	list_for_each_entry_safe(msend, tmp, &conn->resend_queue, head) {
+		if (!resend_high_priority(&msend->nh))
+			list_move_tail(&msend->head, &bulk);
+	}
 	list_splice_tail_init(&conn->resend_queue, &conn->send_queue);
+	list_splice_tail(&bulk, &conn->send_queue);
 	queue_work(conn->workq, &conn->send_work);
 
 	spin_unlock(&conn->lock);
@@ -464,6 +571,9 @@ static int process_request(struct scoutfs_net_connection *conn,
 		return -EINVAL;
 	}
 
+	scoutfs_rec(sb, SCOUTFS_REC_NET_REQUEST, mrecv->nh.cmd,
+		    le64_to_cpu(mrecv->nh.id));
+
 	ret = req_func(sb, conn, mrecv->nh.cmd, le64_to_cpu(mrecv->nh.id),
 		       mrecv->nh.data, le16_to_cpu(mrecv->nh.data_len));
 
@@ -481,6 +591,51 @@ static int process_request(struct scoutfs_net_connection *conn,
 	return ret;
 }
 
+/*
+ * Fold a request's measured round trip time into the connection's
+ * smoothed estimate with the usual TCP srtt/rttvar weights.  Requests
+ * that were resent over a new socket aren't sampled because their
+ * measurement would include the outage rather than the network.
+ */
+static void update_conn_rtt(struct scoutfs_net_connection *conn,
+			    struct message_send *msend)
+{
+	u64 rtt;
+	u64 diff;
+
+	assert_spin_locked(&conn->lock);
+
+	if (msend->resent)
+		return;
+
+	rtt = ktime_to_ns(ktime_sub(ktime_get(), msend->submit_time));
+
+	if (conn->srtt_ns == 0) {
+		conn->srtt_ns = rtt;
+		conn->rttvar_ns = rtt >> 1;
+	} else {
+		diff = max(rtt, conn->srtt_ns) - min(rtt, conn->srtt_ns);
+		conn->srtt_ns += ((s64)(rtt - conn->srtt_ns)) >> 3;
+		conn->rttvar_ns += ((s64)(diff - conn->rttvar_ns)) >> 2;
+	}
+}
+
+/*
+ * Give the caller a conservative retransmission-style timeout derived
+ * from the connection's smoothed round trip estimate, in msecs.
+ * Returns 0 before any responses have been sampled.
+ */
+unsigned long scoutfs_net_conn_rtt_ms(struct scoutfs_net_connection *conn)
+{
+	u64 rto_ns;
+
+	spin_lock(&conn->lock);
+	rto_ns = conn->srtt_ns + (conn->rttvar_ns << 2);
+	spin_unlock(&conn->lock);
+
+	return div_u64(rto_ns, NSEC_PER_MSEC);
+}
+
 /*
  * An incoming response finds the queued request and calls its response
  * function.  The response function for a given request will only be
@@ -501,6 +656,7 @@ static int process_response(struct scoutfs_net_connection *conn,
 
 	msend = find_request(conn, mrecv->nh.cmd, le64_to_cpu(mrecv->nh.id));
 	if (msend) {
+		update_conn_rtt(conn, msend);
 		resp_func = msend->resp_func;
 		resp_data = msend->resp_data;
 		complete_send(conn, msend);
@@ -670,26 +826,39 @@ static void scoutfs_net_recv_worker(struct work_struct *work)
 	trace_scoutfs_net_recv_work_exit(sb, 0, ret);
 }
 
-static int sendmsg_full(struct socket *sock, void *buf, unsigned len)
+/*
+ * Send a gathered batch of messages with single sendmsg calls.  The
+ * socket can accept partial amounts of the vector so we advance through
+ * it as bytes are sent.
+ */
+static int sendmsg_kvecs(struct socket *sock, struct kvec *kv,
+			 unsigned int nr, size_t len)
 {
 	struct msghdr msg;
-	struct kvec kv;
 	int ret;
 
 	while (len) {
 		memset(&msg, 0, sizeof(msg));
-		msg.msg_iov = (struct iovec *)&kv;
-		msg.msg_iovlen = 1;
+		msg.msg_iov = (struct iovec *)kv;
+		msg.msg_iovlen = nr;
 		msg.msg_flags = MSG_NOSIGNAL;
-		kv.iov_base = buf;
-		kv.iov_len = len;
 
-		ret = kernel_sendmsg(sock, &msg, &kv, 1, len);
+		ret = kernel_sendmsg(sock, &msg, kv, nr, len);
 		if (ret <= 0)
 			return -ECONNABORTED;
 
 		len -= ret;
-		buf += ret;
+		while (ret > 0) {
+			if (ret >= kv->iov_len) {
+				ret -= kv->iov_len;
+				kv++;
+				nr--;
+			} else {
+				kv->iov_base += ret;
+				kv->iov_len -= ret;
+				ret = 0;
+			}
+		}
 	}
 
 	return 0;
@@ -699,51 +868,93 @@ static void free_msend(struct net_info *ninf, struct message_send *msend)
 {
 	list_del_init(&msend->head);
 	scoutfs_tseq_del(&ninf->msg_tseq_tree, &msend->tseq_entry);
+	if (msend->owns_data)
+		kfree(msend->data);
 	kfree(msend);
 }
 
+/* bounds the stack footprint of a gathered send batch */
+#define SEND_BATCH_NR	16
+
 /*
  * Each connection has a single worker that sends queued messages down
  * the connection's socket.  The work is queued whenever a message is
- * put on the send queue.  The worker uses blocking sends so that we
- * don't have to worry about resuming partial sends or hooking into
- * data_ready.  Send errors shut down the connection.
+ * submitted.  The worker gathers batches of queued messages into one
+ * scatter-gather sendmsg so that a backlog of small messages doesn't
+ * pay a socket call each.  It uses blocking sends so that we don't have
+ * to worry about resuming partial sends or hooking into data_ready.
+ * Send errors shut down the connection.
  *
- * The worker is responsible for freeing messages so that other contexts
- * don't have to worry about freeing a message while we're blocked
- * sending it without the lock held.
+ * Messages stay on the send queue while they're being sent so that
+ * response processing can still find them, and only this worker frees
+ * them.  Other contexts mark messages dead and have the worker free
+ * them under the lock so that we don't have to risk freeing messages
+ * from under the unlocked send.
  */
 static void scoutfs_net_send_worker(struct work_struct *work)
 {
 	DEFINE_CONN_FROM_WORK(conn, work, send_work);
 	struct super_block *sb = conn->sb;
 	struct net_info *ninf = SCOUTFS_SB(sb)->net_info;
+	struct message_send *batch[SEND_BATCH_NR];
+	struct kvec kv[SEND_BATCH_NR * 2];
 	struct message_send *msend;
+	struct message_send *tmp;
+	unsigned int knr;
+	unsigned int nr;
+	unsigned int i;
+	u16 data_len;
+	size_t bytes;
 	int ret = 0;
-	int len;
 
 	trace_scoutfs_net_send_work_enter(sb, 0, 0);
 
 	spin_lock(&conn->lock);
 
-	while ((msend = list_first_entry_or_null(&conn->send_queue,
-						 struct message_send, head))) {
+	for (;;) {
+		splice_submitted(conn);
+
+		nr = 0;
+		knr = 0;
+		bytes = 0;
+		list_for_each_entry_safe(msend, tmp, &conn->send_queue, head) {
+			if (msend->dead) {
+				free_msend(ninf, msend);
+				continue;
+			}
 
-		if (msend->dead) {
-			free_msend(ninf, msend);
-			continue;
+			batch[nr] = msend;
+			data_len = le16_to_cpu(msend->nh.data_len);
+			if (msend->owns_data) {
+				/* gather the handed-off payload buffer */
+				kv[knr].iov_base = &msend->nh;
+				kv[knr].iov_len = nh_bytes(0);
+				bytes += kv[knr++].iov_len;
+				kv[knr].iov_base = msend->data;
+				kv[knr].iov_len = data_len;
+				bytes += kv[knr++].iov_len;
+			} else {
+				kv[knr].iov_base = &msend->nh;
+				kv[knr].iov_len = nh_bytes(data_len);
+				bytes += kv[knr++].iov_len;
+			}
+			if (++nr == ARRAY_SIZE(batch))
+				break;
 		}
 
-		spin_unlock(&conn->lock);
+		if (nr == 0)
+			break;
 
-		len = nh_bytes(le16_to_cpu(msend->nh.data_len));
+		spin_unlock(&conn->lock);
 
-		scoutfs_inc_counter(sb, net_send_messages);
-		scoutfs_add_counter(sb, net_send_bytes, len);
-		trace_scoutfs_net_send_message(sb, &conn->sockname,
-					       &conn->peername, &msend->nh);
+		scoutfs_add_counter(sb, net_send_messages, nr);
+		scoutfs_add_counter(sb, net_send_bytes, bytes);
+		for (i = 0; i < nr; i++)
+			trace_scoutfs_net_send_message(sb, &conn->sockname,
+						       &conn->peername,
+						       &batch[i]->nh);
 
-		ret = sendmsg_full(conn->sock, &msend->nh, len);
+		ret = sendmsg_kvecs(conn->sock, kv, knr, bytes);
 
 		spin_lock(&conn->lock);
 
@@ -751,10 +962,14 @@ static void scoutfs_net_send_worker(struct work_struct *work)
 			break;
 
 		/* active requests are resent, everything else is freed */
-		if (nh_is_request(&msend->nh) && !msend->dead)
-			list_move_tail(&msend->head, &conn->resend_queue);
-		else
-			msend->dead = 1;
+		for (i = 0; i < nr; i++) {
+			msend = batch[i];
+			if (nh_is_request(&msend->nh) && !msend->dead)
+				list_move_tail(&msend->head,
+					       &conn->resend_queue);
+			else
+				msend->dead = 1;
+		}
 	}
 
 	spin_unlock(&conn->lock);
@@ -778,6 +993,10 @@ static void destroy_conn(struct scoutfs_net_connection *conn)
 	WARN_ON_ONCE(conn->sock != NULL);
 	WARN_ON_ONCE(!list_empty(&conn->accepted_list));
 
+	spin_lock(&conn->lock);
+	splice_submitted(conn);
+	spin_unlock(&conn->lock);
+
 	/* free all messages, refactor and complete for forced unmount? */
 	list_splice_init(&conn->resend_queue, &conn->send_queue);
 	list_for_each_entry_safe(msend, tmp, &conn->send_queue, head) {
@@ -1067,11 +1286,14 @@ static void scoutfs_net_shutdown_worker(struct work_struct *work)
 	spin_lock(&conn->lock);
 
 	/* resend any pending requests, drop responses or greetings */
+	splice_submitted(conn);
 	list_splice_tail_init(&conn->send_queue, &conn->resend_queue);
 	list_for_each_entry_safe(msend, tmp, &conn->resend_queue, head) {
 		if (nh_is_response(&msend->nh) ||
 		    msend->nh.cmd == SCOUTFS_NET_CMD_GREETING)
 			free_msend(ninf, msend);
+		else
+			msend->resent = 1;
 	}
 
 	/* signal connect failure */
@@ -1140,7 +1362,8 @@ scoutfs_net_alloc_conn(struct super_block *sb,
 	conn->peername.sin_family = AF_INET;
 	INIT_LIST_HEAD(&conn->accepted_head);
 	INIT_LIST_HEAD(&conn->accepted_list);
-	conn->next_send_id = 1;
+	atomic64_set(&conn->next_send_id, 1);
+	init_llist_head(&conn->submit_list);
 	INIT_LIST_HEAD(&conn->send_queue);
 	INIT_LIST_HEAD(&conn->resend_queue);
 	INIT_WORK(&conn->listen_work, scoutfs_net_listen_worker);
@@ -1303,7 +1526,7 @@ int scoutfs_net_submit_request(struct super_block *sb,
 			       scoutfs_net_response_t resp_func,
 			       void *resp_data, u64 *id_ret)
 {
-	return submit_send(sb, conn, 0, cmd, 0, 0, 0, arg, arg_len,
+	return submit_send(sb, conn, 0, cmd, 0, 0, 0, arg, arg_len, false,
 			   resp_func, resp_data, id_ret);
 }
 
@@ -1319,7 +1542,7 @@ int scoutfs_net_submit_request_node(struct super_block *sb,
 				    void *resp_data, u64 *id_ret)
 {
 	return submit_send(sb, conn, node_id, cmd, 0, 0, 0, arg, arg_len,
-			   resp_func, resp_data, id_ret);
+			   false, resp_func, resp_data, id_ret);
 }
 
 /*
@@ -1342,7 +1565,29 @@ int scoutfs_net_response(struct super_block *sb,
 
 	return submit_send(sb, conn, 0, cmd, SCOUTFS_NET_FLAG_RESPONSE, id,
 			   net_err_from_host(sb, error), resp, resp_len,
-			   NULL, NULL, NULL);
+			   false, NULL, NULL, NULL);
+}
+
+/*
+ * Send a response, handing ownership of the caller's allocated payload
+ * buffer to the message instead of copying it.  The buffer is always
+ * freed, including when an error response drops the payload or
+ * submission fails, so callers just submit and forget it.
+ */
+int scoutfs_net_response_own(struct super_block *sb,
+			     struct scoutfs_net_connection *conn,
+			     u8 cmd, u64 id, int error, void *resp,
+			     u16 resp_len)
+{
+	if (error) {
+		kfree(resp);
+		resp = NULL;
+		resp_len = 0;
+	}
+
+	return submit_send(sb, conn, 0, cmd, SCOUTFS_NET_FLAG_RESPONSE, id,
+			   net_err_from_host(sb, error), resp, resp_len,
+			   resp != NULL, NULL, NULL, NULL);
 }
 
 /*
@@ -1362,33 +1607,94 @@ void scoutfs_net_cancel_request(struct super_block *sb,
 	spin_unlock(&conn->lock);
 }
 
-struct sync_request_completion {
-	struct completion comp;
-	void *resp;
-	unsigned int resp_len;
-	int error;
-};
+/*
+ * Give request processing the node_id that the connection's greeting
+ * assigned, 0 if the greeting hasn't been seen yet.
+ */
+u64 scoutfs_net_conn_node_id(struct scoutfs_net_connection *conn)
+{
+	return conn->node_id;
+}
 
-static int sync_response(struct super_block *sb,
-			 struct scoutfs_net_connection *conn,
-			 void *resp, unsigned int resp_len,
-			 int error, void *data)
+static int async_response(struct super_block *sb,
+			  struct scoutfs_net_connection *conn,
+			  void *resp, unsigned int resp_len,
+			  int error, void *data)
 {
-	struct sync_request_completion *sreq = data;
+	struct scoutfs_net_async_request *areq = data;
 
-	if (error == 0 && resp_len != sreq->resp_len)
+	if (error == 0 && resp_len != areq->resp_len)
 		error = -EMSGSIZE;
 
 	if (error)
-		sreq->error = error;
+		areq->error = error;
 	else if (resp_len)
-		memcpy(sreq->resp, resp, resp_len);
+		memcpy(areq->resp, resp, resp_len);
 
-	complete(&sreq->comp);
+	complete(&areq->comp);
 
 	return 0;
 }
 
+/*
+ * Submit a request whose response will be copied into the given buffer
+ * as the caller waits on the async request.  Submission errors are
+ * stored in the request and returned from the wait so that callers
+ * always follow submission with a wait, which they have to do anyway
+ * before the request struct and response buffer can leave scope.
+ */
+static void submit_async_request(struct super_block *sb,
+				 struct scoutfs_net_connection *conn,
+				 u8 cmd, void *arg, unsigned arg_len,
+				 bool own_arg, void *resp, size_t resp_len,
+				 struct scoutfs_net_async_request *areq)
+{
+	int ret;
+
+	init_completion(&areq->comp);
+	areq->conn = conn;
+	areq->cmd = cmd;
+	areq->resp = resp;
+	areq->resp_len = resp_len;
+	areq->error = 0;
+
+	ret = submit_send(sb, conn, 0, cmd, 0, 0, 0, arg, arg_len, own_arg,
+			  async_response, areq, &areq->id);
+	if (ret < 0) {
+		areq->error = ret;
+		complete(&areq->comp);
+	}
+}
+
+void scoutfs_net_submit_async_request(struct super_block *sb,
+				      struct scoutfs_net_connection *conn,
+				      u8 cmd, void *arg, unsigned arg_len,
+				      void *resp, size_t resp_len,
+				      struct scoutfs_net_async_request *areq)
+{
+	submit_async_request(sb, conn, cmd, arg, arg_len, false,
+			     resp, resp_len, areq);
+}
+
+/*
+ * Wait for an async request's response.  The wait is interruptible and
+ * can return -ERESTARTSYS after canceling the request, in which case
+ * the response function is never called.
+ */
+int scoutfs_net_async_request_wait(struct super_block *sb,
+				   struct scoutfs_net_async_request *areq)
+{
+	int ret;
+
+	ret = wait_for_completion_interruptible(&areq->comp);
+	if (ret == -ERESTARTSYS)
+		scoutfs_net_cancel_request(sb, areq->conn, areq->cmd, areq->id);
+	else
+		ret = areq->error;
+
+	return ret;
+}
+
 /*
  * Send a request and wait for a response to be copied into the given
  * buffer.  Errors returned can come from the remote request processing
@@ -1397,7 +1703,7 @@ static int sync_response(struct super_block *sb,
  * The wait for the response is interruptible and can return
  * -ERESTARTSYS if it is interrupted.
  *
- * -EOVERFLOW is returned if the response message's data_length doesn't
+ * -EMSGSIZE is returned if the response message's data_length doesn't
  * match the caller's resp_len buffer.
  */
 int scoutfs_net_sync_request(struct super_block *sb,
@@ -1405,23 +1711,40 @@ int scoutfs_net_sync_request(struct super_block *sb,
 			     u8 cmd, void *arg, unsigned arg_len,
 			     void *resp, size_t resp_len)
 {
-	struct sync_request_completion sreq;
+	struct scoutfs_net_async_request areq;
+	ktime_t start = ktime_get();
 	int ret;
-	u64 id;
 
-	init_completion(&sreq.comp);
-	sreq.resp = resp;
-	sreq.resp_len = resp_len;
-	sreq.error = 0;
+	scoutfs_net_submit_async_request(sb, conn, cmd, arg, arg_len,
+					 resp, resp_len, &areq);
+	ret = scoutfs_net_async_request_wait(sb, &areq);
+	if (ret == 0)
+		scoutfs_hist_record_since(sb, net_sync_request, start);
 
-	ret = scoutfs_net_submit_request(sb, conn, cmd, arg, arg_len,
-					 sync_response, &sreq, &id);
+	return ret;
+}
 
-	ret = wait_for_completion_interruptible(&sreq.comp);
-	if (ret == -ERESTARTSYS)
-		scoutfs_net_cancel_request(sb, conn, cmd, id);
-	else
-		ret = sreq.error;
+/*
+ * Like scoutfs_net_sync_request() but ownership of the caller's
+ * allocated argument buffer is handed to the message, which sends it
+ * gathered behind the header rather than copying it.  The buffer is
+ * always freed, even when submission fails, so it saves a copy of large
+ * request payloads without complicating the callers.
+ */
+int scoutfs_net_sync_request_own(struct super_block *sb,
+				 struct scoutfs_net_connection *conn,
+				 u8 cmd, void *arg, unsigned arg_len,
+				 void *resp, size_t resp_len)
+{
+	struct scoutfs_net_async_request areq;
+	ktime_t start = ktime_get();
+	int ret;
+
+	submit_async_request(sb, conn, cmd, arg, arg_len, true,
+			     resp, resp_len, &areq);
+	ret = scoutfs_net_async_request_wait(sb, &areq);
+	if (ret == 0)
+		scoutfs_hist_record_since(sb, net_sync_request, start);
 
 	return ret;
 }
@@ -1432,11 +1755,12 @@ static void net_tseq_show_conn(struct seq_file *m,
 	struct scoutfs_net_connection *conn =
 		container_of(ent, struct scoutfs_net_connection, tseq_entry);
 
-	seq_printf(m, "name "SIN_FMT" peer "SIN_FMT" vg %u est %u sd %u cto_ms %lu nsi %llu\n",
+	seq_printf(m, "name "SIN_FMT" peer "SIN_FMT" vg %u est %u sd %u cto_ms %lu nsi %llu srtt_us %llu\n",
 		   SIN_ARG(&conn->sockname), SIN_ARG(&conn->peername),
 		   conn->valid_greeting, conn->established,
 		   conn->shutting_down, conn->connect_timeout_ms,
-		   conn->next_send_id);
+		   (u64)atomic64_read(&conn->next_send_id),
+		   div_u64(conn->srtt_ns, NSEC_PER_USEC));
 }
 
 /*
@@ -2,6 +2,7 @@
 #define _SCOUTFS_NET_H_
 
 #include <linux/in.h>
+#include <linux/completion.h>
 
 #define SIN_FMT		"%pIS:%u"
 #define SIN_ARG(sin)	sin, be16_to_cpu((sin)->sin_port)
@@ -50,13 +51,46 @@ int scoutfs_net_submit_request_node(struct super_block *sb,
 void scoutfs_net_cancel_request(struct super_block *sb,
 				struct scoutfs_net_connection *conn,
 				u8 cmd, u64 id);
+u64 scoutfs_net_conn_node_id(struct scoutfs_net_connection *conn);
+unsigned long scoutfs_net_conn_rtt_ms(struct scoutfs_net_connection *conn);
+
+/*
+ * Tracks a submitted async request until its response is copied into
+ * the caller's buffer.  The caller provides the storage and must wait
+ * before the struct or the response buffer leave scope.
+ */
+struct scoutfs_net_async_request {
+	struct completion comp;
+	struct scoutfs_net_connection *conn;
+	u8 cmd;
+	u64 id;
+	void *resp;
+	unsigned int resp_len;
+	int error;
+};
+
+void scoutfs_net_submit_async_request(struct super_block *sb,
+				      struct scoutfs_net_connection *conn,
+				      u8 cmd, void *arg, unsigned arg_len,
+				      void *resp, size_t resp_len,
+				      struct scoutfs_net_async_request *areq);
+int scoutfs_net_async_request_wait(struct super_block *sb,
+				   struct scoutfs_net_async_request *areq);
 int scoutfs_net_sync_request(struct super_block *sb,
 			     struct scoutfs_net_connection *conn,
 			     u8 cmd, void *arg, unsigned arg_len,
 			     void *resp, size_t resp_len);
+int scoutfs_net_sync_request_own(struct super_block *sb,
+				 struct scoutfs_net_connection *conn,
+				 u8 cmd, void *arg, unsigned arg_len,
+				 void *resp, size_t resp_len);
 int scoutfs_net_response(struct super_block *sb,
 			 struct scoutfs_net_connection *conn,
 			 u8 cmd, u64 id, int error, void *resp, u16 resp_len);
+int scoutfs_net_response_own(struct super_block *sb,
+			     struct scoutfs_net_connection *conn,
+			     u8 cmd, u64 id, int error, void *resp,
+			     u16 resp_len);
 void scoutfs_net_shutdown(struct super_block *sb,
 			  struct scoutfs_net_connection *conn);
 void scoutfs_net_free_conn(struct super_block *sb,
@@ -29,6 +29,8 @@
 static const match_table_t tokens = {
 	{Opt_listen, "listen=%s"},
 	{Opt_cluster, "cluster=%s"},
+	{Opt_statfs_age_ms, "statfs_age_ms=%u"},
+	{Opt_commit_latency_ms, "commit_latency_ms=%u"},
 	{Opt_err, NULL}
 };
 
@@ -59,10 +61,13 @@ int scoutfs_parse_options(struct super_block *sb, char *options,
 	int token, len;
 	__be32 addr;
 	char *p;
+	int val;
 
 	/* Set defaults */
 	memset(parsed, 0, sizeof(*parsed));
 	strcpy(parsed->cluster_name, "scoutfs");
+	parsed->statfs_age_ms = SCOUTFS_STATFS_AGE_MS_DEFAULT;
+	parsed->commit_latency_ms = SCOUTFS_COMMIT_LATENCY_MS_DEFAULT;
 
 	while ((p = strsep(&options, ",")) != NULL) {
 		if (!*p)
@@ -86,6 +91,18 @@ int scoutfs_parse_options(struct super_block *sb, char *options,
 			match_strlcpy(parsed->cluster_name, args,
 				      MAX_CLUSTER_NAME_LEN);
 			break;
+		case Opt_statfs_age_ms:
+			/* 0 sends a request for every statfs call */
+			if (match_int(args, &val) || val < 0)
+				return -EINVAL;
+			parsed->statfs_age_ms = val;
+			break;
+		case Opt_commit_latency_ms:
+			/* 0 always fills segments, ignoring commit latency */
+			if (match_int(args, &val) || val < 0)
+				return -EINVAL;
+			parsed->commit_latency_ms = val;
+			break;
 		default:
 			scoutfs_err(sb, "Unknown or malformed option, \"%s\"\n",
 				    p);
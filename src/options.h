@@ -7,6 +7,8 @@
 enum {
 	Opt_listen = 0,
 	Opt_cluster,
+	Opt_statfs_age_ms,
+	Opt_commit_latency_ms,
 	/*
 	 * For debugging we can quickly create huge trees by limiting
 	 * the number of items in each block as though the blocks were tiny.
@@ -16,10 +18,19 @@ enum {
 };
 
 #define MAX_CLUSTER_NAME_LEN 17
+
+/* serve cached statfs results for up to a second by default */
+#define SCOUTFS_STATFS_AGE_MS_DEFAULT 1000
+
+/* size transactions to commit in about a second by default */
+#define SCOUTFS_COMMIT_LATENCY_MS_DEFAULT 1000
+
 struct mount_options
 {
 	struct scoutfs_inet_addr	listen_addr;
 	char				cluster_name[MAX_CLUSTER_NAME_LEN];
+	unsigned int			statfs_age_ms;
+	unsigned int			commit_latency_ms;
 };
 
 int scoutfs_parse_options(struct super_block *sb, char *options,
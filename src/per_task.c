@@ -19,11 +19,19 @@
 /*
  * There are times when we'd like to pass data from a caller to its
  * callee but we're bouncing through functions and callbacks that don't
- * provide per-task storage.  We add a trivial little locked list that
- * lets a caller store a pointer for callees.  The lists are put in the
- * scope of the sharing so the contention is rare and limited to real
- * concurrency -- imagine, for example, concurrent file reading on an
- * inode.
+ * provide per-task storage.  The lists are put in the scope of the
+ * sharing so the contention is rare and limited to real concurrency --
+ * imagine, for example, concurrent file reading on an inode.
+ *
+ * Lookup can only ever match the entry that the calling task itself
+ * added, so the fast path doesn't need locking at all.  Adding claims
+ * one of a few fixed slots with cmpxchg and lookup scans the slots for
+ * one owned by the current task.  A task reading its own slot is
+ * ordered by program order and a slot owned by another task can never
+ * match, so the scan doesn't need barriers.  The slots live in the
+ * struct, not on callers' stacks, so racing scans never dereference
+ * freed memory.  If all the slots are claimed by concurrent tasks we
+ * fall back to the original locked list of callers' entries.
  */
 
 /*
@@ -36,6 +44,20 @@ void *scoutfs_per_task_get(struct scoutfs_per_task *pt)
 	const struct task_struct *task = current;
 	struct scoutfs_per_task_entry *ent;
 	void *ret = NULL;
+	int i;
+
+	for (i = 0; i < SCOUTFS_PER_TASK_NR_SLOTS; i++) {
+		if (ACCESS_ONCE(pt->slots[i].task) == task)
+			return pt->slots[i].ptr;
+	}
+
+	/*
+	 * Only we could have added our entry to the list so an empty
+	 * list can't contain it, no matter how the check races with
+	 * other tasks adding theirs.
+	 */
+	if (list_empty(&pt->list))
+		return NULL;
 
 	spin_lock(&pt->lock);
 
@@ -54,8 +76,22 @@ void *scoutfs_per_task_get(struct scoutfs_per_task *pt)
 void scoutfs_per_task_add(struct scoutfs_per_task *pt,
 			  struct scoutfs_per_task_entry *ent, void *ptr)
 {
+	struct scoutfs_per_task_slot *slot;
+	int i;
+
 	ent->task = current;
 	ent->ptr = ptr;
+	ent->slot = NULL;
+
+	for (i = 0; i < SCOUTFS_PER_TASK_NR_SLOTS; i++) {
+		slot = &pt->slots[i];
+		if (ACCESS_ONCE(slot->task) == NULL &&
+		    cmpxchg(&slot->task, NULL, current) == NULL) {
+			slot->ptr = ptr;
+			ent->slot = slot;
+			return;
+		}
+	}
 
 	spin_lock(&pt->lock);
 	list_add(&ent->head, &pt->list);
@@ -66,8 +102,12 @@ void scoutfs_per_task_del(struct scoutfs_per_task *pt,
 			  struct scoutfs_per_task_entry *ent)
 {
 	BUG_ON(!list_empty(&ent->head) && ent->task != current);
+	BUG_ON(ent->slot && ent->slot->task != current);
 
-	if (!list_empty(&ent->head)) {
+	if (ent->slot) {
+		ACCESS_ONCE(ent->slot->task) = NULL;
+		ent->slot = NULL;
+	} else if (!list_empty(&ent->head)) {
 		spin_lock(&pt->lock);
 		list_del_init(&ent->head);
 		spin_unlock(&pt->lock);
@@ -76,6 +116,7 @@ void scoutfs_per_task_del(struct scoutfs_per_task *pt,
 
 void scoutfs_per_task_init(struct scoutfs_per_task *pt)
 {
+	memset(pt->slots, 0, sizeof(pt->slots));
 	spin_lock_init(&pt->lock);
 	INIT_LIST_HEAD(&pt->list);
 }
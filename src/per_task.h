@@ -1,12 +1,21 @@
 #ifndef _SCOUTFS_PER_TASK_H_
 #define _SCOUTFS_PER_TASK_H_
 
+#define SCOUTFS_PER_TASK_NR_SLOTS 4
+
+struct scoutfs_per_task_slot {
+	struct task_struct *task;
+	void *ptr;
+};
+
 struct scoutfs_per_task {
+	struct scoutfs_per_task_slot slots[SCOUTFS_PER_TASK_NR_SLOTS];
 	spinlock_t lock;
 	struct list_head list;
 };
 
 struct scoutfs_per_task_entry {
+	struct scoutfs_per_task_slot *slot;
 	struct list_head head;
 	struct task_struct *task;
 	void *ptr;
@@ -14,6 +23,7 @@ struct scoutfs_per_task_entry {
 
 #define SCOUTFS_DECLARE_PER_TASK_ENTRY(name)			\
 	struct scoutfs_per_task_entry name = {			\
+		.slot      = NULL,				\
 		.head      = LIST_HEAD_INIT((name).head),	\
 	}
 
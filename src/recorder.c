@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2019 Versity Software, Inc.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+
+#include "super.h"
+#include "recorder.h"
+
+/*
+ * The tseq files only show objects that are still alive and tracepoints
+ * have to be enabled before a problem happens.  This little flight
+ * recorder is always on.  Hot paths record compact fixed size events in
+ * per-cpu ring buffers that hold the last while of history.  When a
+ * node hiccups in production the rings can be dumped through a debugfs
+ * file after the fact.
+ *
+ * Recording only disables preemption and stores into the recording
+ * cpu's ring so it's cheap enough to leave enabled.  The dump walks the
+ * rings without excluding writers.  It can see torn entries that are
+ * being overwritten as it reads but that's fine for a debugging aid.
+ * Each cpu's entries are dumped in ring order, not time order, so the
+ * reader sorts the output by the timestamp column.
+ */
+
+#define REC_NR_ENTRIES	1024
+#define REC_POS_SHIFT	10
+#define REC_POS_CPU(pos) ((pos) >> REC_POS_SHIFT)
+#define REC_POS_IDX(pos) ((pos) & (REC_NR_ENTRIES - 1))
+
+struct scoutfs_rec_entry {
+	u64 ns;
+	u32 event;
+	u32 cpu;
+	u64 a;
+	u64 b;
+};
+
+struct scoutfs_rec_ring {
+	u64 head;
+	struct scoutfs_rec_entry ents[REC_NR_ENTRIES];
+} ____cacheline_aligned;
+
+struct scoutfs_recorder {
+	/* a ring for each possible cpu, too large for percpu alloc */
+	struct scoutfs_rec_ring *rings;
+	struct dentry *dentry;
+};
+
+static char *rec_event_names[] = {
+	[SCOUTFS_REC_COMPACT_START]	= "compact_start",
+	[SCOUTFS_REC_COMPACT_DONE]	= "compact_done",
+	[SCOUTFS_REC_LOCK_INVALIDATE]	= "lock_invalidate",
+	[SCOUTFS_REC_TRANS_COMMIT]	= "trans_commit",
+	[SCOUTFS_REC_NET_REQUEST]	= "net_request",
+};
+
+void scoutfs_rec(struct super_block *sb, enum scoutfs_rec_event event,
+		 u64 a, u64 b)
+{
+	struct scoutfs_recorder *rec = SCOUTFS_SB(sb)->recorder;
+	struct scoutfs_rec_ring *ring;
+	struct scoutfs_rec_entry *ent;
+
+	if (!rec)
+		return;
+
+	preempt_disable();
+
+	ring = &rec->rings[smp_processor_id()];
+	ent = &ring->ents[ring->head & (REC_NR_ENTRIES - 1)];
+
+	ent->ns = ktime_to_ns(ktime_get());
+	ent->event = event;
+	ent->cpu = smp_processor_id();
+	ent->a = a;
+	ent->b = b;
+
+	ring->head++;
+
+	preempt_enable();
+}
+
+/*
+ * Find the entry at pos, advancing pos past empty ring slots and
+ * impossible cpus.  Returns NULL once pos passes the last ring.
+ */
+static struct scoutfs_rec_entry *rec_pos_ent(struct scoutfs_recorder *rec,
+					     loff_t *pos)
+{
+	struct scoutfs_rec_ring *ring;
+	struct scoutfs_rec_entry *ent;
+	int cpu = REC_POS_CPU(*pos);
+	int idx = REC_POS_IDX(*pos);
+
+	while (cpu < nr_cpu_ids) {
+		if (!cpu_possible(cpu)) {
+			cpu++;
+			idx = 0;
+			continue;
+		}
+
+		ring = &rec->rings[cpu];
+		while (idx < REC_NR_ENTRIES) {
+			ent = &ring->ents[idx];
+			if (ent->ns != 0) {
+				*pos = ((loff_t)cpu << REC_POS_SHIFT) | idx;
+				return ent;
+			}
+			idx++;
+		}
+
+		cpu++;
+		idx = 0;
+	}
+
+	return NULL;
+}
+
+static void *scoutfs_rec_seq_start(struct seq_file *m, loff_t *pos)
+{
+	return rec_pos_ent(m->private, pos);
+}
+
+static void *scoutfs_rec_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	(*pos)++;
+	return rec_pos_ent(m->private, pos);
+}
+
+static void scoutfs_rec_seq_stop(struct seq_file *m, void *v)
+{
+}
+
+static int scoutfs_rec_seq_show(struct seq_file *m, void *v)
+{
+	struct scoutfs_rec_entry *ent = v;
+	char *name;
+
+	if (ent->event < SCOUTFS_REC_NR_EVENTS)
+		name = rec_event_names[ent->event];
+	else
+		name = "unknown";
+
+	seq_printf(m, "cpu %u ns %llu %s a %llu b %llu\n",
+		   ent->cpu, ent->ns, name, ent->a, ent->b);
+	return 0;
+}
+
+static const struct seq_operations scoutfs_rec_seq_ops = {
+	.start =	scoutfs_rec_seq_start,
+	.next =		scoutfs_rec_seq_next,
+	.stop =		scoutfs_rec_seq_stop,
+	.show =		scoutfs_rec_seq_show,
+};
+
+static int scoutfs_rec_open(struct inode *inode, struct file *file)
+{
+	struct seq_file *m;
+	int ret;
+
+	ret = seq_open(file, &scoutfs_rec_seq_ops);
+	if (ret == 0) {
+		m = file->private_data;
+		m->private = inode->i_private;
+	}
+	return ret;
+}
+
+static const struct file_operations scoutfs_rec_fops = {
+	.open =		scoutfs_rec_open,
+	.release =	seq_release,
+	.read =		seq_read,
+	.llseek =	seq_lseek,
+};
+
+int scoutfs_recorder_setup(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct scoutfs_recorder *rec;
+
+	rec = kzalloc(sizeof(struct scoutfs_recorder), GFP_KERNEL);
+	if (!rec)
+		return -ENOMEM;
+
+	rec->rings = vzalloc(nr_cpu_ids * sizeof(struct scoutfs_rec_ring));
+	if (!rec->rings) {
+		kfree(rec);
+		return -ENOMEM;
+	}
+
+	rec->dentry = debugfs_create_file("recorder", S_IFREG|S_IRUSR,
+					  sbi->debug_root, rec,
+					  &scoutfs_rec_fops);
+	if (!rec->dentry) {
+		vfree(rec->rings);
+		kfree(rec);
+		return -ENOMEM;
+	}
+
+	sbi->recorder = rec;
+	return 0;
+}
+
+void scoutfs_recorder_destroy(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct scoutfs_recorder *rec = sbi->recorder;
+
+	if (rec) {
+		debugfs_remove(rec->dentry);
+		vfree(rec->rings);
+		kfree(rec);
+		sbi->recorder = NULL;
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef _SCOUTFS_RECORDER_H_
+#define _SCOUTFS_RECORDER_H_
+
+#include "super.h"
+
+/*
+ * Hot paths record a few compact events in always-on percpu ring
+ * buffers so that the recent history is available after the fact
+ * without having enabled tracing in advance.
+ */
+enum scoutfs_rec_event {
+	SCOUTFS_REC_COMPACT_START = 0,
+	SCOUTFS_REC_COMPACT_DONE,
+	SCOUTFS_REC_LOCK_INVALIDATE,
+	SCOUTFS_REC_TRANS_COMMIT,
+	SCOUTFS_REC_NET_REQUEST,
+	SCOUTFS_REC_NR_EVENTS,
+};
+
+void scoutfs_rec(struct super_block *sb, enum scoutfs_rec_event event,
+		 u64 a, u64 b);
+int scoutfs_recorder_setup(struct super_block *sb);
+void scoutfs_recorder_destroy(struct super_block *sb);
+
+#endif
@@ -553,12 +553,12 @@ TRACE_EVENT(scoutfs_trans_write_func,
 TRACE_EVENT(scoutfs_release_trans,
 	TP_PROTO(struct super_block *sb, void *rsv, unsigned int rsv_holders,
 		 struct scoutfs_item_count *res,
-		 struct scoutfs_item_count *act, unsigned int tri_holders,
-		 unsigned int tri_writing, unsigned int tri_items,
-		 unsigned int tri_vals),
+		 struct scoutfs_item_count *act, int cpu_holders,
+		 unsigned int tri_writing, unsigned int stock_items,
+		 unsigned int stock_vals),
 
-	TP_ARGS(sb, rsv, rsv_holders, res, act, tri_holders, tri_writing,
-		tri_items, tri_vals),
+	TP_ARGS(sb, rsv, rsv_holders, res, act, cpu_holders, tri_writing,
+		stock_items, stock_vals),
 
 	TP_STRUCT__entry(
 		__field(__u64, fsid)
@@ -568,10 +568,10 @@ TRACE_EVENT(scoutfs_release_trans,
 		__field(int, res_vals)
 		__field(int, act_items)
 		__field(int, act_vals)
-		__field(unsigned int, tri_holders)
+		__field(int, cpu_holders)
 		__field(unsigned int, tri_writing)
-		__field(unsigned int, tri_items)
-		__field(unsigned int, tri_vals)
+		__field(unsigned int, stock_items)
+		__field(unsigned int, stock_vals)
 	),
 
 	TP_fast_assign(
@@ -582,30 +582,30 @@ TRACE_EVENT(scoutfs_release_trans,
 		__entry->res_vals = res->vals;
 		__entry->act_items = act->items;
 		__entry->act_vals = act->vals;
-		__entry->tri_holders = tri_holders;
+		__entry->cpu_holders = cpu_holders;
 		__entry->tri_writing = tri_writing;
-		__entry->tri_items = tri_items;
-		__entry->tri_vals = tri_vals;
+		__entry->stock_items = stock_items;
+		__entry->stock_vals = stock_vals;
 	),
 
 	TP_printk(FSID_FMT" rsv %p holders %u reserved %u.%u actual "
-		  "%d.%d, trans holders %u writing %u reserved "
+		  "%d.%d, trans cpu_holders %d writing %u stock "
 		  "%u.%u", __entry->fsid, __entry->rsv, __entry->rsv_holders,
 		  __entry->res_items, __entry->res_vals, __entry->act_items,
-		  __entry->act_vals, __entry->tri_holders, __entry->tri_writing,
-		  __entry->tri_items, __entry->tri_vals)
+		  __entry->act_vals, __entry->cpu_holders, __entry->tri_writing,
+		  __entry->stock_items, __entry->stock_vals)
 );
 
 TRACE_EVENT(scoutfs_trans_acquired_hold,
 	TP_PROTO(struct super_block *sb, const struct scoutfs_item_count *cnt,
 		 void *rsv, unsigned int rsv_holders,
 		 struct scoutfs_item_count *res,
-		 struct scoutfs_item_count *act, unsigned int tri_holders,
-		 unsigned int tri_writing, unsigned int tri_items,
-		 unsigned int tri_vals),
+		 struct scoutfs_item_count *act, int cpu_holders,
+		 unsigned int tri_writing, unsigned int stock_items,
+		 unsigned int stock_vals),
 
-	TP_ARGS(sb, cnt, rsv, rsv_holders, res, act, tri_holders, tri_writing,
-		tri_items, tri_vals),
+	TP_ARGS(sb, cnt, rsv, rsv_holders, res, act, cpu_holders, tri_writing,
+		stock_items, stock_vals),
 
 	TP_STRUCT__entry(
 		__field(__u64, fsid)
@@ -617,10 +617,10 @@ TRACE_EVENT(scoutfs_trans_acquired_hold,
 		__field(int, res_vals)
 		__field(int, act_items)
 		__field(int, act_vals)
-		__field(unsigned int, tri_holders)
+		__field(int, cpu_holders)
 		__field(unsigned int, tri_writing)
-		__field(unsigned int, tri_items)
-		__field(unsigned int, tri_vals)
+		__field(unsigned int, stock_items)
+		__field(unsigned int, stock_vals)
 	),
 
 	TP_fast_assign(
@@ -633,19 +633,19 @@ TRACE_EVENT(scoutfs_trans_acquired_hold,
 		__entry->res_vals = res->vals;
 		__entry->act_items = act->items;
 		__entry->act_vals = act->vals;
-		__entry->tri_holders = tri_holders;
+		__entry->cpu_holders = cpu_holders;
 		__entry->tri_writing = tri_writing;
-		__entry->tri_items = tri_items;
-		__entry->tri_vals = tri_vals;
+		__entry->stock_items = stock_items;
+		__entry->stock_vals = stock_vals;
 	),
 
 	TP_printk(FSID_FMT" cnt %u.%u, rsv %p holders %u reserved %u.%u "
-		  "actual %d.%d, trans holders %u writing %u reserved "
+		  "actual %d.%d, trans cpu_holders %d writing %u stock "
 		  "%u.%u", __entry->fsid, __entry->cnt_items,
 		  __entry->cnt_vals, __entry->rsv, __entry->rsv_holders,
 		  __entry->res_items, __entry->res_vals, __entry->act_items,
-		  __entry->act_vals, __entry->tri_holders, __entry->tri_writing,
-		  __entry->tri_items, __entry->tri_vals)
+		  __entry->act_vals, __entry->cpu_holders, __entry->tri_writing,
+		  __entry->stock_items, __entry->stock_vals)
 );
 
 TRACE_EVENT(scoutfs_trans_track_item,
@@ -15,7 +15,9 @@
 #include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/mm.h>
+#include <linux/workqueue.h>
 #include <linux/crc32c.h>
+#include <linux/blkdev.h>
 
 #include "super.h"
 #include "format.h"
@@ -26,6 +28,7 @@
 #include "manifest.h"
 #include "key.h"
 #include "counters.h"
+#include "hist.h"
 #include "triggers.h"
 #include "msg.h"
 #include "server.h"
@@ -48,9 +51,14 @@ struct segment_cache {
 	struct rb_root root;
 	wait_queue_head_t waitq;
 
+	struct workqueue_struct *crc_wq;
+
 	struct shrinker shrinker;
 	struct list_head lru_list;
 	unsigned long lru_nr;
+
+	/* rough ewma of read waits, updated racily without locking */
+	u64 read_wait_ewma_ns;
 };
 
 
@@ -59,8 +67,14 @@ enum {
 	SF_CALC_CRC_STARTED,
 	SF_CALC_CRC_DONE,
 	SF_INVALID_CRC,
+	SF_SCAN_ONCE,
 };
 
+#define SEG_BLOOM_PAGES \
+	((SCOUTFS_SEG_BLOOM_BLOCKS * SCOUTFS_BLOCK_SIZE) / PAGE_SIZE)
+
+static void seg_crc_work_fn(struct work_struct *work);
+
 static void *off_ptr(struct scoutfs_segment *seg, u32 off)
 {
 	unsigned int pg = off >> PAGE_SHIFT;
@@ -71,14 +85,21 @@ static void *off_ptr(struct scoutfs_segment *seg, u32 off)
 
 static struct scoutfs_segment *alloc_seg(struct super_block *sb, u64 segno)
 {
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_segment *seg;
 	struct page *page;
 	int i;
 
-	/* don't waste the tail of pages */
-	BUILD_BUG_ON(SCOUTFS_SEGMENT_SIZE % PAGE_SIZE);
+	/* bloom tests read the header without reading the whole segment */
+	BUILD_BUG_ON(sizeof(struct scoutfs_segment_block) >
+		     SCOUTFS_SEG_BLOOM_BLOCKS * SCOUTFS_BLOCK_SIZE);
+	/* the first chunk crc has to cover the smallest segment's header */
+	BUILD_BUG_ON(sizeof(struct scoutfs_segment_block) >
+		     (1 << (SCOUTFS_SEGMENT_SHIFT_MIN -
+			    SCOUTFS_SEG_NR_CHUNKS_SHIFT)));
 
-	seg = kzalloc(sizeof(struct scoutfs_segment), GFP_NOFS);
+	seg = kzalloc(offsetof(struct scoutfs_segment,
+			       pages[sbi->segment_pages]), GFP_NOFS);
 	if (!seg)
 		return seg;
 
@@ -88,7 +109,12 @@ static struct scoutfs_segment *alloc_seg(struct super_block *sb, u64 segno)
 	atomic_set(&seg->refcount, 1);
 	seg->segno = segno;
 
-	for (i = 0; i < SCOUTFS_SEGMENT_PAGES; i++) {
+	for (i = 0; i < SCOUTFS_SEG_NR_CHUNKS; i++) {
+		INIT_WORK(&seg->crc_works[i].work, seg_crc_work_fn);
+		seg->crc_works[i].seg = seg;
+	}
+
+	for (i = 0; i < sbi->segment_pages; i++) {
 		page = alloc_page(GFP_NOFS);
 		if (!page) {
 			scoutfs_seg_put(seg);
@@ -111,16 +137,19 @@ void scoutfs_seg_get(struct scoutfs_segment *seg)
 
 void scoutfs_seg_put(struct scoutfs_segment *seg)
 {
+	struct scoutfs_sb_info *sbi;
 	int i;
 
 	if (!IS_ERR_OR_NULL(seg) && atomic_dec_and_test(&seg->refcount)) {
+		sbi = SCOUTFS_SB(seg->sb);
 		trace_scoutfs_seg_free(seg);
 		scoutfs_inc_counter(seg->sb, seg_free);
 		WARN_ON_ONCE(!RB_EMPTY_NODE(&seg->node));
 		WARN_ON_ONCE(!list_empty(&seg->lru_entry));
-		for (i = 0; i < SCOUTFS_SEGMENT_PAGES; i++)
+		for (i = 0; i < sbi->segment_pages; i++)
 			if (seg->pages[i])
 				__free_page(seg->pages[i]);
+		kfree(seg->find_index);
 		kfree(seg);
 	}
 }
@@ -148,6 +177,12 @@ static struct scoutfs_segment *find_seg(struct rb_root *root, u64 segno)
 	return NULL;
 }
 
+/*
+ * Segments read for a single sequential pass, like compaction inputs,
+ * sit at the cold head of the LRU so that memory pressure reclaims them
+ * before the hot recently used segments at the tail.  They're only
+ * promoted to the tail once a normal lookup reuses them.
+ */
 static void lru_check(struct segment_cache *cac, struct scoutfs_segment *seg)
 {
 	if (RB_EMPTY_NODE(&seg->node)) {
@@ -157,26 +192,25 @@ static void lru_check(struct segment_cache *cac, struct scoutfs_segment *seg)
 		}
 	} else {
 		if (list_empty(&seg->lru_entry)) {
-			list_add_tail(&seg->lru_entry, &cac->lru_list);
+			if (test_bit(SF_SCAN_ONCE, &seg->flags))
+				list_add(&seg->lru_entry, &cac->lru_list);
+			else
+				list_add_tail(&seg->lru_entry,
+					      &cac->lru_list);
 			cac->lru_nr++;
-		} else {
+		} else if (!test_bit(SF_SCAN_ONCE, &seg->flags)) {
 			list_move_tail(&seg->lru_entry, &cac->lru_list);
 		}
 	}
 }
 
-static __le32 calc_seg_crc(struct scoutfs_segment *seg)
+static __le32 calc_crc_range(struct scoutfs_segment *seg, u32 off, u32 end)
 {
-	u32 total = scoutfs_seg_total_bytes(seg);
 	u32 crc = ~0;
-	u32 off;
 	u32 len;
 
-	off = offsetof(struct scoutfs_segment_block, _padding) +
-	       FIELD_SIZEOF(struct scoutfs_segment_block, _padding);
-
-	while (off < total) {
-		len = min(total - off,
+	while (off < end) {
+		len = min(end - off,
 			  SCOUTFS_BLOCK_SIZE - (off & SCOUTFS_BLOCK_MASK));
 		crc = crc32c(crc, off_ptr(seg, off), len);
 		off += len;
@@ -185,6 +219,131 @@ static __le32 calc_seg_crc(struct scoutfs_segment *seg)
 	return cpu_to_le32(crc);
 }
 
+/* the header crc covers the rest of the header after the padding */
+static __le32 calc_header_crc(struct scoutfs_segment *seg)
+{
+	u32 off = offsetof(struct scoutfs_segment_block, _padding) +
+		  FIELD_SIZEOF(struct scoutfs_segment_block, _padding);
+
+	return calc_crc_range(seg, off, sizeof(struct scoutfs_segment_block));
+}
+
+/* each chunk crc covers its chunk of the used bytes after the header */
+static __le32 calc_chunk_crc(struct scoutfs_segment *seg, int chunk)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(seg->sb);
+	u32 total = scoutfs_seg_total_bytes(seg);
+	u32 off = chunk << sbi->seg_chunk_shift;
+	u32 end = min(total, off + sbi->seg_chunk_size);
+
+	if (chunk == 0)
+		off = sizeof(struct scoutfs_segment_block);
+
+	return calc_crc_range(seg, off, end);
+}
+
+/* the number of chunks covering the used bytes of the segment */
+static int used_chunks(struct scoutfs_segment *seg)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(seg->sb);
+
+	return DIV_ROUND_UP(scoutfs_seg_total_bytes(seg),
+			    sbi->seg_chunk_size);
+}
+
+/* the number of blocks covering the used bytes of the segment */
+static int used_blocks(struct scoutfs_segment *seg)
+{
+	return DIV_ROUND_UP(scoutfs_seg_total_bytes(seg),
+			    SCOUTFS_BLOCK_SIZE);
+}
+
+/*
+ * Verify one chunk's crc.  The final chunk to finish marks calculation
+ * done and wakes any tasks waiting on the segment.
+ */
+static void verify_chunk_crc(struct scoutfs_segment *seg, int chunk)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(seg->sb);
+	struct segment_cache *cac = sbi->segment_cache;
+	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
+
+	if (sblk->chunk_crcs[chunk] != calc_chunk_crc(seg, chunk)) {
+		scoutfs_inc_counter(seg->sb, seg_csum_error);
+		set_bit(SF_INVALID_CRC, &seg->flags);
+	}
+
+	if (atomic_dec_and_test(&seg->crc_pending)) {
+		set_bit(SF_CALC_CRC_DONE, &seg->flags);
+		smp_mb__after_atomic();
+		wake_up(&cac->waitq);
+	}
+}
+
+static void seg_crc_work_fn(struct work_struct *work)
+{
+	struct seg_crc_work *cwork = container_of(work, struct seg_crc_work,
+						  work);
+	struct scoutfs_segment *seg = cwork->seg;
+
+	verify_chunk_crc(seg, cwork - seg->crc_works);
+	scoutfs_seg_put(seg);
+}
+
+/*
+ * Fill the caller's array with the bit positions that a key sets in a
+ * segment's bloom filter.  Two crcs of the key with different initial
+ * values are combined to generate each position.
+ */
+static void bloom_bit_nrs(struct scoutfs_key *key, u32 *nrs)
+{
+	u32 a = crc32c(~0, key, sizeof(struct scoutfs_key));
+	u32 b = crc32c(a, key, sizeof(struct scoutfs_key));
+	int i;
+
+	for (i = 0; i < SCOUTFS_SEG_BLOOM_NRS; i++) {
+		nrs[i] = a % SCOUTFS_SEG_BLOOM_BITS;
+		a += b;
+	}
+}
+
+/* the byte offset in the segment of the byte containing the bloom bit */
+static u32 bloom_byte_off(u32 nr)
+{
+	return offsetof(struct scoutfs_segment_block, bloom) + (nr >> 3);
+}
+
+static void bloom_set_key(struct scoutfs_segment *seg, struct scoutfs_key *key)
+{
+	u32 nrs[SCOUTFS_SEG_BLOOM_NRS];
+	int i;
+
+	bloom_bit_nrs(key, nrs);
+	for (i = 0; i < SCOUTFS_SEG_BLOOM_NRS; i++)
+		*(u8 *)off_ptr(seg, bloom_byte_off(nrs[i])) |=
+			1 << (nrs[i] & 7);
+}
+
+/* test the bloom bits in pages holding the start of a segment */
+static bool bloom_test_key(struct page **pages, struct scoutfs_key *key)
+{
+	u32 nrs[SCOUTFS_SEG_BLOOM_NRS];
+	u8 *byte;
+	u32 off;
+	int i;
+
+	bloom_bit_nrs(key, nrs);
+	for (i = 0; i < SCOUTFS_SEG_BLOOM_NRS; i++) {
+		off = bloom_byte_off(nrs[i]);
+		byte = page_address(pages[off >> PAGE_SHIFT]) +
+		       (off & ~PAGE_MASK);
+		if (!(*byte & (1 << (nrs[i] & 7))))
+			return false;
+	}
+
+	return true;
+}
+
 /*
  * This always inserts the segment into the rbtree.  If there's already
  * a segment at the given seg then it is removed and returned.  The
@@ -271,9 +430,9 @@ static void seg_end_io(struct super_block *sb, void *data, int err)
 	scoutfs_seg_put(seg);
 }
 
-static u64 segno_to_blkno(u64 blkno)
+static u64 segno_to_blkno(struct super_block *sb, u64 segno)
 {
-	return blkno << (SCOUTFS_SEGMENT_SHIFT - SCOUTFS_BLOCK_SHIFT);
+	return segno << SCOUTFS_SB(sb)->segment_block_shift;
 }
 
 int scoutfs_seg_alloc(struct super_block *sb, u64 segno,
@@ -285,6 +444,7 @@ int scoutfs_seg_alloc(struct super_block *sb, u64 segno,
 	struct scoutfs_segment *seg;
 	unsigned long flags;
 	int ret;
+	u32 i;
 
 	seg = alloc_seg(sb, segno);
 	if (!seg) {
@@ -295,9 +455,11 @@ int scoutfs_seg_alloc(struct super_block *sb, u64 segno,
 	/* reads shouldn't wait for this */
 	set_bit(SF_END_IO, &seg->flags);
 
-	/* zero the block header so the caller knows to initialize */
-	memset(page_address(seg->pages[0]), 0,
-	       sizeof(struct scoutfs_segment_block));
+	/* zero the multi-page block header so the caller knows to initialize */
+	for (i = 0; i < sizeof(struct scoutfs_segment_block); i += PAGE_SIZE)
+		memset(off_ptr(seg, i), 0,
+		       min_t(size_t, sizeof(struct scoutfs_segment_block) - i,
+			     PAGE_SIZE));
 
 	/* XXX always remove existing segs, is that necessary? */
 	spin_lock_irqsave(&cac->lock, flags);
@@ -320,9 +482,13 @@ out:
  * The bios submitted by this don't have page references themselves.  If
  * this succeeds then the caller must call _wait before putting their
  * seg ref.
+ *
+ * Callers reading for a single sequential pass set scan so the cache
+ * reclaims their segments first under memory pressure instead of
+ * pushing out the hot segments that the next item reads need.
  */
 struct scoutfs_segment *scoutfs_seg_submit_read(struct super_block *sb,
-						u64 segno)
+						u64 segno, bool scan)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct segment_cache *cac = sbi->segment_cache;
@@ -335,17 +501,27 @@ struct scoutfs_segment *scoutfs_seg_submit_read(struct super_block *sb,
 	spin_lock_irqsave(&cac->lock, flags);
 	seg = find_seg(&cac->root, segno);
 	if (seg) {
+		/* reuse by a normal lookup promotes scan-once segments */
+		if (!scan)
+			clear_bit(SF_SCAN_ONCE, &seg->flags);
 		lru_check(cac, seg);
 		atomic_inc(&seg->refcount);
 	}
 	spin_unlock_irqrestore(&cac->lock, flags);
-	if (seg)
+	if (seg) {
+		scoutfs_inc_counter(sb, seg_cache_hit);
 		return seg;
+	}
+
+	scoutfs_inc_counter(sb, seg_cache_miss);
 
 	seg = alloc_seg(sb, segno);
 	if (IS_ERR(seg))
 		return seg;
 
+	if (scan)
+		set_bit(SF_SCAN_ONCE, &seg->flags);
+
 	/* always drop existing segs, could compare seqs */
 	spin_lock_irqsave(&cac->lock, flags);
 	atomic_inc(&seg->refcount);
@@ -355,29 +531,120 @@ struct scoutfs_segment *scoutfs_seg_submit_read(struct super_block *sb,
 		scoutfs_seg_put(existing);
 
 	atomic_inc(&seg->refcount);
-	scoutfs_bio_submit(sb, READ, seg->pages, segno_to_blkno(seg->segno),
-			   SCOUTFS_SEGMENT_BLOCKS, seg_end_io, seg);
+	scoutfs_bio_submit(sb, READ, seg->pages,
+			   segno_to_blkno(sb, seg->segno),
+			   sbi->segment_blocks, seg_end_io, seg);
 
 	return seg;
 }
 
+static void write_segment_crcs(struct scoutfs_segment *seg)
+{
+	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
+	int nr = used_chunks(seg);
+	int i;
+
+	for (i = 0; i < nr; i++)
+		sblk->chunk_crcs[i] = calc_chunk_crc(seg, i);
+	sblk->crc = calc_header_crc(seg);
+}
+
 /*
  * The caller has ensured that the segment won't be modified while
  * it is in flight.
+ *
+ * Only the blocks covering the used bytes of the segment are written.
+ * Small transaction commits produce mostly empty level 0 segments and
+ * writing their unused tails would multiply their io many times over.
+ * Readers always read full segments but item walking and the chunk
+ * crcs only ever examine the used bytes, so whatever stale blocks are
+ * on disk after the trimmed write are never seen.
  */
 int scoutfs_seg_submit_write(struct super_block *sb,
 			     struct scoutfs_segment *seg,
 			     struct scoutfs_bio_completion *comp)
 {
-	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
+	int nr = used_blocks(seg);
 
 	trace_scoutfs_seg_submit_write(sb, seg->segno);
 
-	sblk->crc = calc_seg_crc(seg);
+	write_segment_crcs(seg);
 
+	scoutfs_add_counter(sb, seg_write_trim_blocks,
+			    SCOUTFS_SB(sb)->segment_blocks - nr);
 	scoutfs_bio_submit_comp(sb, WRITE, seg->pages,
-				segno_to_blkno(seg->segno),
-				SCOUTFS_SEGMENT_BLOCKS, comp);
+				segno_to_blkno(sb, seg->segno), nr, comp);
+
+	return 0;
+}
+
+/*
+ * Submit writes for a batch of segments, all tracked by the caller's
+ * single completion.
+ *
+ * The segments arrive in segno order so runs of physically contiguous
+ * segments are easy to find.  We submit each run as one larger IO by
+ * feeding the run's pages through one combined array, and we plug
+ * across the whole batch so the block layer can merge and sort what's
+ * left before it hits the device.  If we can't allocate the combined
+ * array then submitting a segment at a time is always safe.
+ *
+ * The caller has ensured that the segments won't be modified while
+ * they're in flight.
+ */
+int scoutfs_seg_submit_write_batch(struct super_block *sb,
+				   struct scoutfs_segment **segs,
+				   unsigned int nr,
+				   struct scoutfs_bio_completion *comp)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct page **pages;
+	struct blk_plug plug;
+	unsigned int run;
+	unsigned int i;
+	unsigned int s;
+
+	blk_start_plug(&plug);
+
+	for (i = 0; i < nr; i += run) {
+		for (run = 1; i + run < nr &&
+		     segs[i + run]->segno == segs[i + run - 1]->segno + 1;
+		     run++)
+			;
+
+		for (s = 0; s < run; s++) {
+			trace_scoutfs_seg_submit_write(sb, segs[i + s]->segno);
+			write_segment_crcs(segs[i + s]);
+		}
+
+		pages = NULL;
+		if (run > 1)
+			pages = kmalloc(run * sbi->segment_pages *
+					sizeof(struct page *), GFP_NOFS);
+		if (pages) {
+			for (s = 0; s < run; s++)
+				memcpy(&pages[s * sbi->segment_pages],
+				       segs[i + s]->pages,
+				       sbi->segment_pages *
+				       sizeof(struct page *));
+
+			/* submission only reads the array, bios hold pages */
+			scoutfs_bio_submit_comp(sb, WRITE, pages,
+						segno_to_blkno(sb, segs[i]->segno),
+						run * sbi->segment_blocks,
+						comp);
+			kfree(pages);
+			scoutfs_add_counter(sb, seg_write_merged, run);
+		} else {
+			for (s = 0; s < run; s++)
+				scoutfs_bio_submit_comp(sb, WRITE,
+						segs[i + s]->pages,
+						segno_to_blkno(sb, segs[i + s]->segno),
+						sbi->segment_blocks, comp);
+		}
+	}
+
+	blk_finish_plug(&plug);
 
 	return 0;
 }
@@ -402,29 +669,57 @@ int scoutfs_seg_wait(struct super_block *sb, struct scoutfs_segment *seg,
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct segment_cache *cac = sbi->segment_cache;
 	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
+	ktime_t start = ktime_get();
 	unsigned long flags;
 	bool erased;
 	int ret;
+	int nr;
+	int i;
 
 	ret = wait_event_interruptible(cac->waitq,
 				       test_bit(SF_END_IO, &seg->flags));
 	if (ret)
 		goto out;
 
+	scoutfs_hist_record_since(sb, seg_read_wait, start);
+
+	/*
+	 * Maintain a cheap congestion signal for background work
+	 * without adding a lock to the read path.  The racy lossy
+	 * update is fine for an advisory hint.
+	 */
+	cac->read_wait_ewma_ns +=
+		((s64)ktime_to_ns(ktime_sub(ktime_get(), start)) -
+		 (s64)cac->read_wait_ewma_ns) >> 3;
+
 	if (seg->err) {
 		ret = seg->err;
 		goto out;
 	}
 
-	/* calc crc in waiting task instead of end_io */
+	/*
+	 * Calc crcs in tasks instead of end_io.  The first waiter
+	 * checks the header crc and then kicks per-chunk crc works so
+	 * that verification of large segments is spread across cpus.
+	 * It verifies the first chunk itself rather than just waiting.
+	 */
 	if (!test_bit(SF_CALC_CRC_DONE, &seg->flags) &&
 	    !test_and_set_bit(SF_CALC_CRC_STARTED, &seg->flags)) {
-		if (sblk->crc != calc_seg_crc(seg)) {
+		if (sblk->crc != calc_header_crc(seg)) {
 			scoutfs_inc_counter(sb, seg_csum_error);
 			set_bit(SF_INVALID_CRC, &seg->flags);
+			set_bit(SF_CALC_CRC_DONE, &seg->flags);
+			wake_up(&cac->waitq);
+		} else {
+			nr = used_chunks(seg);
+			atomic_set(&seg->crc_pending, nr);
+			for (i = 1; i < nr; i++) {
+				atomic_inc(&seg->refcount);
+				queue_work(cac->crc_wq,
+					   &seg->crc_works[i].work);
+			}
+			verify_chunk_crc(seg, 0);
 		}
-		set_bit(SF_CALC_CRC_DONE, &seg->flags);
-		wake_up(&cac->waitq);
 	}
 
 	/* very rarely race waiting for calc to finish */
@@ -452,15 +747,129 @@ out:
 	return ret;
 }
 
-static u32 item_bytes(u8 nr_links, u16 val_len)
+/*
+ * Test whether a segment might contain an item with the given key
+ * without reading the entire segment.  If the segment is already cached
+ * we test its bloom filter in place, otherwise we read just the first
+ * blocks of the segment which contain the header and the bloom filter.
+ *
+ * Returns > 0 if the segment may contain the key, 0 if it definitely
+ * doesn't, and -errno on failure.  A header that doesn't match the
+ * caller's segno and seq can be a stale read racing with a segment
+ * write so we say the key may be present and leave resolving the race
+ * to the full segment read and its crc and seq validation.
+ */
+int scoutfs_seg_bloom_may_contain(struct super_block *sb, u64 segno, u64 seq,
+				  struct scoutfs_key *key)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct segment_cache *cac = sbi->segment_cache;
+	struct scoutfs_segment_block *sblk;
+	struct page *pages[SEG_BLOOM_PAGES];
+	struct scoutfs_segment *seg;
+	unsigned long flags;
+	int ret;
+	int i;
+
+	spin_lock_irqsave(&cac->lock, flags);
+	seg = find_seg(&cac->root, segno);
+	if (seg)
+		atomic_inc(&seg->refcount);
+	spin_unlock_irqrestore(&cac->lock, flags);
+
+	if (seg) {
+		/* only test completed reads, the full read path waits */
+		if (!test_bit(SF_END_IO, &seg->flags) || seg->err) {
+			ret = 1;
+		} else {
+			sblk = off_ptr(seg, 0);
+			if (le64_to_cpu(sblk->segno) != segno ||
+			    le64_to_cpu(sblk->seq) != seq)
+				ret = 1;
+			else
+				ret = !!bloom_test_key(seg->pages, key);
+		}
+		scoutfs_seg_put(seg);
+		return ret;
+	}
+
+	memset(pages, 0, sizeof(pages));
+	for (i = 0; i < SEG_BLOOM_PAGES; i++) {
+		pages[i] = alloc_page(GFP_NOFS);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	scoutfs_inc_counter(sb, seg_bloom_read);
+
+	ret = scoutfs_bio_read(sb, pages, segno_to_blkno(sb, segno),
+			       SCOUTFS_SEG_BLOOM_BLOCKS);
+	if (ret)
+		goto out;
+
+	sblk = page_address(pages[0]);
+	if (le64_to_cpu(sblk->segno) != segno ||
+	    le64_to_cpu(sblk->seq) != seq) {
+		scoutfs_inc_counter(sb, seg_bloom_stale);
+		ret = 1;
+	} else {
+		ret = !!bloom_test_key(pages, key);
+	}
+out:
+	for (i = 0; i < SEG_BLOOM_PAGES; i++)
+		if (pages[i])
+			__free_page(pages[i]);
+	return ret;
+}
+
+static u32 item_bytes(u8 nr_links, u8 key_pfx, u16 val_len)
 {
 	return offsetof(struct scoutfs_segment_item, skip_links[nr_links]) +
-		val_len;
+		sizeof(struct scoutfs_key) - key_pfx + val_len;
+}
+
+static inline void *item_key_ptr(struct scoutfs_segment_item *item)
+{
+	return (void *)item + offsetof(struct scoutfs_segment_item,
+				       skip_links[item->nr_links]);
 }
 
 static inline void *item_val_ptr(struct scoutfs_segment_item *item)
 {
-	return (void *)item + item_bytes(item->nr_links, 0);
+	return item_key_ptr(item) + sizeof(struct scoutfs_key) -
+	       item->key_pfx;
+}
+
+/*
+ * The first item in each block stores a full key.  Items never cross
+ * block boundaries so the first item in a block always starts at the
+ * block, except in the block that holds the end of the segment header.
+ */
+static u32 block_first_off(u32 off)
+{
+	return max_t(u32, off & ~(u32)SCOUTFS_BLOCK_MASK,
+		     sizeof(struct scoutfs_segment_block));
+}
+
+/*
+ * Decode an item's prefix compressed key.  The shared prefix bytes come
+ * from the full key of the first item in the block, the suffix bytes
+ * are stored with the item.
+ */
+static void get_item_key(struct scoutfs_segment *seg, u32 off,
+			 struct scoutfs_key *key)
+{
+	struct scoutfs_segment_item *item = off_ptr(seg, off);
+	struct scoutfs_segment_item *first;
+
+	if (item->key_pfx) {
+		first = off_ptr(seg, block_first_off(off));
+		memcpy(key, item_key_ptr(first), item->key_pfx);
+	}
+	memcpy((void *)key + item->key_pfx, item_key_ptr(item),
+	       sizeof(struct scoutfs_key) - item->key_pfx);
 }
 
 /* copy the item key into the caller's key and init their val to ref the val */
@@ -470,7 +879,7 @@ static void get_item_key_val(struct scoutfs_segment *seg, int off,
 	struct scoutfs_segment_item *item = off_ptr(seg, off);
 
 	if (key)
-		*key = item->key;
+		get_item_key(seg, off, key);
 
 	if (val)
 		kvec_init(val, item_val_ptr(item), le16_to_cpu(item->val_len));
@@ -546,19 +955,17 @@ static u8 skip_most_nr(u32 nr_items)
 }
 
 /*
- * Find offset of the first item in the segment whose key is greater
- * than or equal to the search key.  -ENOENT is returned if there's no
- * item that matches.
- *
- * This is a standard skip list search from the segment block through
- * the items.  Follow high less frequent links while the key is greater
- * than the items and descend down to lower more frequent links when the
- * search key is less.
+ * Fall back to a standard skip list search from the segment block
+ * through the items.  Follow high less frequent links while the key is
+ * greater than the items and descend down to lower more frequent links
+ * when the search key is less.  Each probe lands on an item somewhere
+ * in the segment so this eats a cache miss per probe.
  */
-int scoutfs_seg_find_off(struct scoutfs_segment *seg, struct scoutfs_key *key)
+static int find_off_skip(struct scoutfs_segment *seg, struct scoutfs_key *key)
 {
 	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
 	struct scoutfs_segment_item *item;
+	struct scoutfs_key item_key;
 	__le32 *links;
 	int cmp;
 	int ret;
@@ -573,8 +980,9 @@ int scoutfs_seg_find_off(struct scoutfs_segment *seg, struct scoutfs_key *key)
 
 		off = le32_to_cpu(links[i]);
 		item = off_ptr(seg, off);
+		get_item_key(seg, off, &item_key);
 
-		cmp = scoutfs_key_compare(key, &item->key);
+		cmp = scoutfs_key_compare(key, &item_key);
 		if (cmp == 0) {
 			ret = off;
 			break;
@@ -591,6 +999,123 @@ int scoutfs_seg_find_off(struct scoutfs_segment *seg, struct scoutfs_key *key)
 	return ret;
 }
 
+/*
+ * Searches first binary search a small contiguous index of the first
+ * item in each block and then walk the items in the found block, so the
+ * probes that used to miss all over a 1MB segment stay within a few kb.
+ */
+struct seg_find_entry {
+	struct scoutfs_key key;
+	u32 off;
+};
+
+struct seg_find_index {
+	unsigned int nr;
+	struct seg_find_entry entries[0];
+};
+
+/*
+ * Get the segment's block index, building it on first use.  Segments
+ * are immutable by the time they're searched, the items and links were
+ * fully written before the segment was visible in the manifest, so
+ * racing builders construct identical indices and cmpxchg resolves
+ * which one is installed.  Returns null if the allocation fails and the
+ * caller falls back to the skip list search.
+ */
+static struct seg_find_index *get_find_index(struct scoutfs_segment *seg)
+{
+	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
+	struct scoutfs_segment_item *item;
+	struct seg_find_index *ind;
+	u32 last = le32_to_cpu(sblk->last_item_off);
+	u32 prev_blk = U32_MAX;
+	u32 off;
+
+	ind = ACCESS_ONCE(seg->find_index);
+	if (ind)
+		return ind;
+
+	ind = kmalloc(offsetof(struct seg_find_index,
+			       entries[SCOUTFS_SB(seg->sb)->segment_blocks]),
+		      GFP_NOFS);
+	if (!ind)
+		return NULL;
+
+	ind->nr = 0;
+	for (off = le32_to_cpu(sblk->skip_links[0]); off && off <= last; ) {
+		item = off_ptr(seg, off);
+		if ((off >> SCOUTFS_BLOCK_SHIFT) != prev_blk) {
+			prev_blk = off >> SCOUTFS_BLOCK_SHIFT;
+			get_item_key(seg, off, &ind->entries[ind->nr].key);
+			ind->entries[ind->nr].off = off;
+			ind->nr++;
+		}
+		off = le32_to_cpu(item->skip_links[0]);
+	}
+
+	scoutfs_inc_counter(seg->sb, seg_find_index_build);
+
+	if (cmpxchg(&seg->find_index, NULL, ind) != NULL) {
+		kfree(ind);
+		ind = seg->find_index;
+	}
+
+	return ind;
+}
+
+/*
+ * Find offset of the first item in the segment whose key is greater
+ * than or equal to the search key.  -ENOENT is returned if there's no
+ * item that matches.
+ *
+ * We binary search the block index for the last block whose first item
+ * is less than or equal to the search key and then walk the block's
+ * items through their lowest skip links, crossing at most into the
+ * start of the next block.
+ */
+int scoutfs_seg_find_off(struct scoutfs_segment *seg, struct scoutfs_key *key)
+{
+	struct scoutfs_segment_item *item;
+	struct scoutfs_key item_key;
+	struct seg_find_index *ind;
+	unsigned int left;
+	unsigned int right;
+	unsigned int mid;
+	u32 off;
+
+	ind = get_find_index(seg);
+	if (!ind)
+		return find_off_skip(seg, key);
+
+	if (ind->nr == 0)
+		return -ENOENT;
+
+	/* find the first block whose first item is greater than the key */
+	left = 0;
+	right = ind->nr;
+	while (left < right) {
+		mid = (left + right) / 2;
+		if (scoutfs_key_compare(&ind->entries[mid].key, key) > 0)
+			right = mid;
+		else
+			left = mid + 1;
+	}
+
+	/* the key precedes all the items, the first item is the answer */
+	if (left == 0)
+		return ind->entries[0].off;
+
+	for (off = ind->entries[left - 1].off; off;
+	     off = le32_to_cpu(item->skip_links[0])) {
+		item = off_ptr(seg, off);
+		get_item_key(seg, off, &item_key);
+		if (scoutfs_key_compare(&item_key, key) >= 0)
+			return off;
+	}
+
+	return -ENOENT;
+}
+
 /*
  * Return the offset of the next item after the current item.  The input offset
  * must be a valid offset from _find_off().
@@ -634,15 +1159,17 @@ u32 scoutfs_seg_total_bytes(struct scoutfs_segment *seg)
  * than two links per item.  We assume the worst case items have the
  * max number of links.
  */
-bool scoutfs_seg_fits_single(u32 nr_items, u32 val_bytes)
+bool scoutfs_seg_fits_single(struct super_block *sb, u32 nr_items,
+			     u32 val_bytes)
 {
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	u32 header = sizeof(struct scoutfs_segment_block);
-	u32 items = nr_items * item_bytes(2, 0);
-	u32 item_pad = item_bytes(skip_most_nr(nr_items),
+	u32 items = nr_items * item_bytes(2, 0, 0);
+	u32 item_pad = item_bytes(skip_most_nr(nr_items), 0,
 				  SCOUTFS_MAX_VAL_SIZE) - 1;
-	u32 padding = (SCOUTFS_SEGMENT_SIZE / SCOUTFS_BLOCK_SIZE) * item_pad;
+	u32 padding = sbi->segment_blocks * item_pad;
 
-	return (header + items + val_bytes + padding) <= SCOUTFS_SEGMENT_SIZE;
+	return (header + items + val_bytes + padding) <= sbi->segment_size;
 }
 
 static u32 align_item_off(struct scoutfs_segment *seg, u32 item_off, u32 bytes)
@@ -657,6 +1184,32 @@ static u32 align_item_off(struct scoutfs_segment *seg, u32 item_off, u32 bytes)
 	return item_off;
 }
 
+/*
+ * Count the leading key bytes that an appended key shares with the full
+ * key stored by the first item in the block that the append offset
+ * falls in.  An append at the start of a block becomes the block's
+ * first item and stores its whole key.
+ */
+static u8 append_key_pfx(struct scoutfs_segment *seg, u32 off,
+			 struct scoutfs_key *key)
+{
+	struct scoutfs_segment_item *first;
+	u8 *a = (u8 *)key;
+	u8 *b;
+	u8 i;
+
+	if (off == block_first_off(off))
+		return 0;
+
+	first = off_ptr(seg, block_first_off(off));
+	b = item_key_ptr(first);
+
+	for (i = 0; i < sizeof(struct scoutfs_key) && a[i] == b[i]; i++)
+		;
+
+	return i;
+}
+
 
 /*
  * Append an item to the segment.  The caller always appends items that
@@ -671,10 +1224,12 @@ bool scoutfs_seg_append_item(struct super_block *sb, struct scoutfs_segment *seg
 	struct scoutfs_super_block *super = &sbi->super;
 	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
 	struct scoutfs_segment_item *item;
+	struct scoutfs_key prev_key;
 	struct kvec item_val;
 	u8 nr_links;
 	u32 val_len;
 	u32 bytes;
+	u8 pfx;
 	u32 off;
 	int i;
 
@@ -705,17 +1260,23 @@ bool scoutfs_seg_append_item(struct super_block *sb, struct scoutfs_segment *seg
 	 */
 	off = le32_to_cpu(sblk->last_item_off);
 	if (off) {
-		item = off_ptr(seg, off);
-		scoutfs_bug_on(sb, scoutfs_key_compare(key, &item->key) <= 0,
-			       "key "SK_FMT" item->key "SK_FMT,
-			       SK_ARG(key), SK_ARG(&item->key));
+		get_item_key(seg, off, &prev_key);
+		scoutfs_bug_on(sb, scoutfs_key_compare(key, &prev_key) <= 0,
+			       "key "SK_FMT" prev_key "SK_FMT,
+			       SK_ARG(key), SK_ARG(&prev_key));
 	}
 
+	/* sharing the block's key prefix, unless we're pushed to a new block */
 	nr_links = skip_next_nr(le32_to_cpu(sblk->nr_items));
-	bytes = item_bytes(nr_links, val_len);
+	pfx = append_key_pfx(seg, le32_to_cpu(sblk->total_bytes), key);
+	bytes = item_bytes(nr_links, pfx, val_len);
 	off = align_item_off(seg, le32_to_cpu(sblk->total_bytes), bytes);
+	if (off != le32_to_cpu(sblk->total_bytes)) {
+		pfx = 0;
+		bytes = item_bytes(nr_links, 0, val_len);
+	}
 
-	if ((off + bytes) > SCOUTFS_SEGMENT_SIZE)
+	if ((off + bytes) > sbi->segment_size)
 		return false;
 
 	sblk->last_item_off = cpu_to_le32(off);
@@ -723,9 +1284,9 @@ bool scoutfs_seg_append_item(struct super_block *sb, struct scoutfs_segment *seg
 	le32_add_cpu(&sblk->nr_items, 1);
 
 	item = off_ptr(seg, off);
-	item->key = *key;
 	item->val_len = cpu_to_le16(val_len);
 	item->flags = flags;
+	item->key_pfx = pfx;
 
 	/* point the previous skip links at our appended item */
 	item->nr_links = nr_links;
@@ -735,10 +1296,16 @@ bool scoutfs_seg_append_item(struct super_block *sb, struct scoutfs_segment *seg
 		links[i] = &item->skip_links[i];
 	}
 
+	memcpy(item_key_ptr(item), (u8 *)key + pfx,
+	       sizeof(struct scoutfs_key) - pfx);
+
 	get_item_key_val(seg, off, NULL, &item_val);
 	if (val_len)
 		memcpy(item_val.iov_base, val->iov_base, val_len);
 
+	/* deletion items set bloom bits too so that readers merge them */
+	bloom_set_key(seg, key);
+
 	return true;
 }
 
@@ -780,6 +1347,7 @@ static int seg_lru_shrink(struct shrinker *shrink, struct shrink_control *sc)
 	struct segment_cache *cac = container_of(shrink, struct segment_cache,
 						 shrinker);
 	struct super_block *sb = cac->sb;
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_segment *seg;
 	struct scoutfs_segment *tmp;
 	unsigned long flags;
@@ -787,7 +1355,7 @@ static int seg_lru_shrink(struct shrinker *shrink, struct shrink_control *sc)
 	LIST_HEAD(list);
 	int ret;
 
-	nr = DIV_ROUND_UP(sc->nr_to_scan, SCOUTFS_SEGMENT_PAGES);
+	nr = DIV_ROUND_UP(sc->nr_to_scan, sbi->segment_pages);
 	if (!nr)
 		goto out;
 
@@ -816,12 +1384,26 @@ static int seg_lru_shrink(struct shrinker *shrink, struct shrink_control *sc)
 	}
 
 out:
-	ret = min_t(unsigned long, cac->lru_nr * SCOUTFS_SEGMENT_PAGES,
+	ret = min_t(unsigned long, cac->lru_nr * sbi->segment_pages,
 		    INT_MAX);
 	trace_scoutfs_seg_shrink_exit(sb, sc->nr_to_scan, ret);
 	return ret;
 }
 
+/*
+ * Give background work a rough idea of how long recent segment reads
+ * have been waiting.  The ewma is updated racily by waiters so the
+ * returned value can be a little stale or torn, which is fine for a
+ * congestion hint.
+ */
+u64 scoutfs_seg_read_wait_ewma(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct segment_cache *cac = sbi->segment_cache;
+
+	return cac->read_wait_ewma_ns;
+}
+
 int scoutfs_seg_setup(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
@@ -837,6 +1419,13 @@ int scoutfs_seg_setup(struct super_block *sb)
 	cac->root = RB_ROOT;
 	init_waitqueue_head(&cac->waitq);
 
+	cac->crc_wq = alloc_workqueue("scoutfs_seg_crc", WQ_UNBOUND, 0);
+	if (!cac->crc_wq) {
+		kfree(cac);
+		sbi->segment_cache = NULL;
+		return -ENOMEM;
+	}
+
 	cac->shrinker.shrink = seg_lru_shrink;
 	cac->shrinker.seeks = DEFAULT_SEEKS;
 	register_shrinker(&cac->shrinker);
@@ -856,6 +1445,9 @@ void scoutfs_seg_destroy(struct super_block *sb)
 		if (cac->shrinker.shrink == seg_lru_shrink)
 			unregister_shrinker(&cac->shrinker);
 
+		if (cac->crc_wq)
+			destroy_workqueue(cac->crc_wq);
+
 		for (node = rb_first(&cac->root); node; ) {
 			seg = container_of(node, struct scoutfs_segment, node);
 			node = rb_next(node);
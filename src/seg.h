@@ -6,6 +6,15 @@ struct scoutfs_key;
 struct scoutfs_manifest_entry;
 struct kvec;
 
+struct scoutfs_segment;
+struct seg_find_index;
+
+/* per-chunk crc verification work queued on the crc workqueue */
+struct seg_crc_work {
+	struct work_struct work;
+	struct scoutfs_segment *seg;
+};
+
 /* this is only visible for trace events */
 struct scoutfs_segment {
 	struct super_block *sb;
@@ -15,13 +24,21 @@ struct scoutfs_segment {
 	u64 segno;
 	unsigned long flags;
 	int err;
-	struct page *pages[SCOUTFS_SEGMENT_PAGES];
+	atomic_t crc_pending;
+	/* in-memory block index built on first search, see seg_find_index */
+	struct seg_find_index *find_index;
+	struct seg_crc_work crc_works[SCOUTFS_SEG_NR_CHUNKS];
+	/* sized by the volume's segment size at allocation */
+	struct page *pages[0];
 };
 
 struct scoutfs_segment *scoutfs_seg_submit_read(struct super_block *sb,
-						u64 segno);
+						u64 segno, bool scan);
+int scoutfs_seg_bloom_may_contain(struct super_block *sb, u64 segno, u64 seq,
+				  struct scoutfs_key *key);
 int scoutfs_seg_wait(struct super_block *sb, struct scoutfs_segment *seg,
 		     u64 segno, u64 seq);
+u64 scoutfs_seg_read_wait_ewma(struct super_block *sb);
 
 int scoutfs_seg_find_off(struct scoutfs_segment *seg, struct scoutfs_key *key);
 int scoutfs_seg_next_off(struct scoutfs_segment *seg, int off);
@@ -34,7 +51,8 @@ void scoutfs_seg_put(struct scoutfs_segment *seg);
 
 int scoutfs_seg_alloc(struct super_block *sb, u64 segno,
 		      struct scoutfs_segment **seg_ret);
-bool scoutfs_seg_fits_single(u32 nr_items, u32 val_bytes);
+bool scoutfs_seg_fits_single(struct super_block *sb, u32 nr_items,
+			     u32 val_bytes);
 bool scoutfs_seg_append_item(struct super_block *sb, struct scoutfs_segment *seg,
 			     struct scoutfs_key *key, struct kvec *val,
 			     u8 flags, __le32 **links);
@@ -44,6 +62,10 @@ void scoutfs_seg_init_ment(struct scoutfs_manifest_entry *ment, int level,
 int scoutfs_seg_submit_write(struct super_block *sb,
 			     struct scoutfs_segment *seg,
 			     struct scoutfs_bio_completion *comp);
+int scoutfs_seg_submit_write_batch(struct super_block *sb,
+				   struct scoutfs_segment **segs,
+				   unsigned int nr,
+				   struct scoutfs_bio_completion *comp);
 
 int scoutfs_seg_setup(struct super_block *sb);
 void scoutfs_seg_destroy(struct super_block *sb);
@@ -32,6 +32,7 @@
 #include "msg.h"
 #include "server.h"
 #include "net.h"
+#include "spbm.h"
 #include "endian_swap.h"
 
 /*
@@ -50,6 +51,12 @@
  * mount will have less trouble.
  */
 
+/* one cached free extent per power of two length */
+struct alloc_bucket {
+	u64 start;
+	u64 len;
+};
+
 struct server_info {
 	struct super_block *sb;
 	spinlock_t lock;
@@ -77,6 +84,8 @@ struct server_info {
 	/* server tracks pending frees to be applied during commit */
 	struct rw_semaphore alloc_rwsem;
 	struct list_head pending_frees;
+	struct alloc_bucket alloc_buckets[64];
+	struct scoutfs_spbm segno_bitmap;
 
 	struct list_head clients;
 	unsigned long nr_clients;
@@ -86,6 +95,14 @@ struct server_info {
 	unsigned long nr_compacts;
 	struct list_head compacts;
 	struct work_struct compact_work;
+
+	/* track segnos granted to nodes until they're recorded */
+	struct list_head segno_grants;
+
+	/* per-directory inode number regions cluster inodes in key space */
+	struct rb_root ino_regions;
+	struct list_head ino_region_lru;
+	unsigned long nr_ino_regions;
 };
 
 #define DECLARE_SERVER_INFO(sb, name) \
@@ -106,6 +123,16 @@ struct commit_waiter {
 	int ret;
 };
 
+/*
+ * A segno that was granted to a node but hasn't yet been recorded in
+ * the manifest or freed back to us.  Tracked under the server lock.
+ */
+struct segno_grant {
+	struct list_head head;
+	u64 node_id;
+	u64 segno;
+};
+
 static void init_extent_btree_key(struct scoutfs_extent_btree_key *ebk,
 				  u8 type, u64 major, u64 minor)
 {
@@ -139,6 +166,101 @@ static int init_extent_from_btree_key(struct scoutfs_extent *ext, u8 type,
 	return scoutfs_extent_init(ext, ebk->type, 0, start, len, 0, 0);
 }
 
+/*
+ * The server keeps an in-memory size-bucketed index over the
+ * persistent free extents.  Each bucket caches one free extent whose
+ * length's highest set bit matches the bucket.  The hints are updated
+ * as extent btree io inserts and deletes free extents, and the server
+ * is the only mutator of the alloc btree, so a cached extent is always
+ * present in the btree.  Allocation scans the handful of buckets that
+ * can satisfy a request instead of descending the by-length index, and
+ * falls back to the btree search when the buckets miss.  The buckets
+ * are protected by the alloc_rwsem that covers all extent operations.
+ */
+static void bucket_update(struct server_info *server, u64 start, u64 len)
+{
+	struct alloc_bucket *b = &server->alloc_buckets[fls64(len) - 1];
+
+	/* prefer caching the largest extent in the bucket */
+	if (b->len < len) {
+		b->start = start;
+		b->len = len;
+	}
+}
+
+static void bucket_invalidate(struct server_info *server, u64 start, u64 len)
+{
+	struct alloc_bucket *b = &server->alloc_buckets[fls64(len) - 1];
+
+	if (b->start == start && b->len == len)
+		b->len = 0;
+}
+
+/*
+ * Find a cached free extent that covers the requested length.  We
+ * start with the bucket whose extents might barely fit and walk up
+ * through buckets of larger extents, giving a best-ish fit that
+ * mirrors the old smallest-extent search of the by-length index.
+ */
+static bool bucket_lookup(struct server_info *server, u64 blocks,
+			  struct scoutfs_extent *ext)
+{
+	struct alloc_bucket *b;
+	int i;
+
+	if (blocks == 0)
+		return false;
+
+	for (i = fls64(blocks) - 1; i < ARRAY_SIZE(server->alloc_buckets);
+	     i++) {
+		b = &server->alloc_buckets[i];
+		if (b->len >= blocks) {
+			scoutfs_extent_init(ext,
+					    SCOUTFS_FREE_EXTENT_BLOCKS_TYPE, 0,
+					    b->start, b->len, 0, 0);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * The server also keeps an in-memory bitmap of the segnos whose
+ * segments are entirely covered by free extents.  The sparse bitmap's
+ * rbtree of bitmap chunks gives a cheap search for the next free segno
+ * after the allocation cursor instead of sweeping the extent btree
+ * from the cursor for every segment allocation.  Bits are updated as
+ * extent btree io inserts and deletes free extents and are rebuilt
+ * from the persistent extents when the server starts.  Setting a bit
+ * can fail to allocate; a missing bit only costs falling back to the
+ * btree sweep.  The bitmap is protected by the alloc_rwsem.
+ */
+static void segno_bitmap_set(struct server_info *server, u64 start, u64 len)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(server->sb);
+	u64 blkno = ALIGN(start, sbi->segment_blocks);
+
+	while (blkno + sbi->segment_blocks <= start + len) {
+		if (scoutfs_spbm_set(&server->segno_bitmap,
+				     blkno >> sbi->segment_block_shift))
+			break;
+		blkno += sbi->segment_blocks;
+	}
+}
+
+static void segno_bitmap_clear(struct server_info *server, u64 start, u64 len)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(server->sb);
+	u64 blkno = start & ~((u64)sbi->segment_blocks - 1);
+
+	while (blkno < start + len) {
+		scoutfs_spbm_clear(&server->segno_bitmap,
+				   blkno >> sbi->segment_block_shift);
+		blkno += sbi->segment_blocks;
+	}
+}
+
 /*
  * This is called by the extent core on behalf of the server who holds
  * the appropriate locks to protect the many btree items that can be
@@ -146,12 +268,14 @@ static int init_extent_from_btree_key(struct scoutfs_extent *ext, u8 type,
  *
  * The free_blocks count in the super tracks the number of blocks in
  * the primary extent index.  We update it here instead of expecting
- * callers to remember.
+ * callers to remember.  The size bucket hints are similarly updated
+ * here so that they track every free extent mutation.
  */
 static int server_extent_io(struct super_block *sb, int op,
 			    struct scoutfs_extent *ext, void *data)
 {
 	struct scoutfs_super_block *super = &SCOUTFS_SB(sb)->super;
+	DECLARE_SERVER_INFO(sb, server);
 	struct scoutfs_extent_btree_key ebk;
 	SCOUTFS_BTREE_ITEM_REF(iref);
 	bool mirror = false;
@@ -220,10 +344,15 @@ static int server_extent_io(struct super_block *sb, int op,
 	}
 
 	if (ret == 0 && ext->type == SCOUTFS_FREE_EXTENT_BLKNO_TYPE) {
-		if (op == SEI_INSERT)
+		if (op == SEI_INSERT) {
 			le64_add_cpu(&super->free_blocks, ext->len);
-		else if (op == SEI_DELETE)
+			bucket_update(server, ext->start, ext->len);
+			segno_bitmap_set(server, ext->start, ext->len);
+		} else if (op == SEI_DELETE) {
 			le64_add_cpu(&super->free_blocks, -ext->len);
+			bucket_invalidate(server, ext->start, ext->len);
+			segno_bitmap_clear(server, ext->start, ext->len);
+		}
 	}
 
 	return ret;
@@ -232,7 +361,8 @@ static int server_extent_io(struct super_block *sb, int op,
 /*
  * Allocate an extent of the given length in the first smallest free
  * extent that contains it.  We allocate in multiples of segment blocks
- * and expose that to callers today.
+ * and expose that to callers today.  The size buckets usually find a
+ * fitting extent without searching the by-length index at all.
  *
  * This doesn't have the cursor that segment allocation does.  It's
  * possible that a recently freed segment can merge to form a larger
@@ -244,6 +374,7 @@ static int alloc_extent(struct super_block *sb, u64 blocks,
 {
 	struct server_info *server = SCOUTFS_SB(sb)->server_info;
 	struct scoutfs_extent ext;
+	bool bucketed;
 	int ret;
 
 	*start = 0;
@@ -251,20 +382,27 @@ static int alloc_extent(struct super_block *sb, u64 blocks,
 
 	down_write(&server->alloc_rwsem);
 
-	if (blocks & (SCOUTFS_SEGMENT_BLOCKS - 1)) {
+	if (blocks & (SCOUTFS_SB(sb)->segment_blocks - 1)) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	scoutfs_extent_init(&ext, SCOUTFS_FREE_EXTENT_BLOCKS_TYPE, 0,
-			    0, blocks, 0, 0);
-	ret = scoutfs_extent_next(sb, server_extent_io, &ext, NULL);
-	if (ret == -ENOENT)
-		ret = scoutfs_extent_prev(sb, server_extent_io, &ext, NULL);
-	if (ret) {
+retry:
+	bucketed = bucket_lookup(server, blocks, &ext);
+	if (bucketed) {
+		scoutfs_inc_counter(sb, server_alloc_bucket_hit);
+	} else {
+		scoutfs_extent_init(&ext, SCOUTFS_FREE_EXTENT_BLOCKS_TYPE, 0,
+				    0, blocks, 0, 0);
+		ret = scoutfs_extent_next(sb, server_extent_io, &ext, NULL);
 		if (ret == -ENOENT)
-			ret = -ENOSPC;
-		goto out;
+			ret = scoutfs_extent_prev(sb, server_extent_io, &ext,
+						  NULL);
+		if (ret) {
+			if (ret == -ENOENT)
+				ret = -ENOSPC;
+			goto out;
+		}
 	}
 
 	trace_scoutfs_server_alloc_extent_next(sb, &ext);
@@ -273,8 +411,21 @@ static int alloc_extent(struct super_block *sb, u64 blocks,
 	ext.len = min(blocks, ext.len);
 
 	ret = scoutfs_extent_remove(sb, server_extent_io, &ext, NULL);
-	if (ret)
+	if (ret) {
+		/*
+		 * A cached extent should always be present in the
+		 * btree.  If it somehow isn't then we throw away the
+		 * hints and fall back to searching rather than
+		 * returning a spurious failure.
+		 */
+		if (bucketed && ret == -ENOENT) {
+			WARN_ON_ONCE(1);
+			memset(server->alloc_buckets, 0,
+			       sizeof(server->alloc_buckets));
+			goto retry;
+		}
 		goto out;
+	}
 
 	trace_scoutfs_server_alloc_extent_allocated(sb, &ext);
 
@@ -405,10 +556,94 @@ static int free_extent(struct super_block *sb, u64 start, u64 len)
  */
 static int free_segno(struct super_block *sb, u64 segno)
 {
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+
 	scoutfs_inc_counter(sb, server_free_segno);
 	trace_scoutfs_free_segno(sb, segno);
-	return free_extent(sb, segno << SCOUTFS_SEGMENT_BLOCK_SHIFT,
-			   SCOUTFS_SEGMENT_BLOCKS);
+	return free_extent(sb, segno << sbi->segment_block_shift,
+			   sbi->segment_blocks);
+}
+
+/*
+ * Build the free segno bitmap from the persistent free extents.  This
+ * runs as the server starts, before it processes requests, because
+ * another server could have changed the extents since we last had
+ * bits.
+ */
+static int build_segno_bitmap(struct super_block *sb)
+{
+	struct server_info *server = SCOUTFS_SB(sb)->server_info;
+	struct scoutfs_extent ext;
+	u64 start = 0;
+	int ret;
+
+	down_write(&server->alloc_rwsem);
+
+	scoutfs_spbm_destroy(&server->segno_bitmap);
+	scoutfs_spbm_init(&server->segno_bitmap);
+
+	for (;;) {
+		scoutfs_extent_init(&ext, SCOUTFS_FREE_EXTENT_BLKNO_TYPE, 0,
+				    start, 1, 0, 0);
+		ret = scoutfs_extent_next(sb, server_extent_io, &ext, NULL);
+		if (ret) {
+			if (ret == -ENOENT)
+				ret = 0;
+			break;
+		}
+
+		segno_bitmap_set(server, ext.start, ext.len);
+
+		start = ext.start + ext.len;
+		if (start == 0)
+			break;
+	}
+
+	up_write(&server->alloc_rwsem);
+
+	return ret;
+}
+
+/*
+ * Find the first set bit in the free segno bitmap at or after the
+ * given segno, wrapping to the front once, and remove its segment's
+ * extent from the persistent index.  Returns -ENOENT if no set bits
+ * found a free segment.
+ */
+static int segno_bitmap_remove(struct super_block *sb, u64 from,
+			       struct scoutfs_extent *ext)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct server_info *server = sbi->server_info;
+	bool wrapped = false;
+	u64 bit;
+	int ret;
+
+	for (;;) {
+		ret = scoutfs_spbm_next_set(&server->segno_bitmap, from, &bit);
+		if (ret == -ENOENT && from && !wrapped) {
+			wrapped = true;
+			from = 0;
+			continue;
+		}
+		if (ret)
+			break;
+
+		scoutfs_extent_init(ext, SCOUTFS_FREE_EXTENT_BLKNO_TYPE, 0,
+				    bit << sbi->segment_block_shift,
+				    sbi->segment_blocks, 0, 0);
+		ret = scoutfs_extent_remove(sb, server_extent_io, ext, NULL);
+		if (ret != -ENOENT)
+			break;
+
+		/* set bits should always cover free extents */
+		WARN_ON_ONCE(1);
+		scoutfs_inc_counter(sb, server_segno_bitmap_stale);
+		scoutfs_spbm_clear(&server->segno_bitmap, bit);
+		from = bit + 1;
+	}
+
+	return ret;
 }
 
 /*
@@ -417,25 +652,33 @@ static int free_segno(struct super_block *sb, u64 segno)
  * we address segments with aligned segment numbers instead of block
  * offsets.
  *
- * We can use a simple cursor sweep of the index by start because all
- * server extents are multiples of the segment size.  Sweeping through
- * the volume tries to spread out new segment writes and make it more
- * rare to write to a recently freed segment which can cause a client to
- * have to re-read the manifest.
+ * A cursor sweeps through the volume to try to spread out new segment
+ * writes and make it more rare to write to a recently freed segment
+ * which can cause a client to have to re-read the manifest.  The free
+ * segno bitmap finds the first free segno after the cursor without
+ * searching the btree; we only fall back to sweeping the extent items
+ * if bits were dropped by allocation failures.
  */
-static int alloc_segno(struct super_block *sb, u64 *segno)
+static int __alloc_segno(struct super_block *sb, u64 *segno)
 {
-	struct server_info *server = SCOUTFS_SB(sb)->server_info;
-	struct scoutfs_super_block *super = &SCOUTFS_SB(sb)->super;
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct scoutfs_super_block *super = &sbi->super;
 	struct scoutfs_extent ext;
 	u64 curs;
 	int ret;
 
-	down_write(&server->alloc_rwsem);
-
-	curs = ALIGN(le64_to_cpu(super->alloc_cursor), SCOUTFS_SEGMENT_BLOCKS);
+	curs = ALIGN(le64_to_cpu(super->alloc_cursor), sbi->segment_blocks);
 	*segno = 0;
 
+	ret = segno_bitmap_remove(sb, curs >> sbi->segment_block_shift,
+				  &ext);
+	if (ret == 0) {
+		scoutfs_inc_counter(sb, server_segno_bitmap_hit);
+		goto found;
+	}
+	if (ret != -ENOENT)
+		goto out;
+
 	do {
 		scoutfs_extent_init(&ext, SCOUTFS_FREE_EXTENT_BLKNO_TYPE, 0,
 				    curs, 1, 0, 0);
@@ -452,25 +695,84 @@ static int alloc_segno(struct super_block *sb, u64 *segno)
 	/* use cursor if within extent, otherwise start of next extent */
 	if (ext.start < curs)
 		ext.start = curs;
-	ext.len = SCOUTFS_SEGMENT_BLOCKS;
+	ext.len = sbi->segment_blocks;
 
 	ret = scoutfs_extent_remove(sb, server_extent_io, &ext, NULL);
 	if (ret)
 		goto out;
 
+found:
 	super->alloc_cursor = cpu_to_le64(ext.start + ext.len);
 
-	*segno = ext.start >> SCOUTFS_SEGMENT_BLOCK_SHIFT;
+	*segno = ext.start >> sbi->segment_block_shift;
 
 	trace_scoutfs_server_alloc_segno_allocated(sb, &ext);
 	trace_scoutfs_alloc_segno(sb, *segno);
 	scoutfs_inc_counter(sb, server_alloc_segno);
 
 out:
+	return ret;
+}
+
+static int alloc_segno(struct super_block *sb, u64 *segno)
+{
+	struct server_info *server = SCOUTFS_SB(sb)->server_info;
+	int ret;
+
+	down_write(&server->alloc_rwsem);
+	ret = __alloc_segno(sb, segno);
 	up_write(&server->alloc_rwsem);
+
 	return ret;
 }
 
+/*
+ * A node used a granted segno, either by recording a segment in the
+ * manifest or by freeing it back to us, so it's no longer ours to
+ * reclaim.  Grants are forgotten in lots of paths that didn't come from
+ * grants so missing segnos are perfectly normal.
+ */
+static void forget_segno_grant(struct super_block *sb, u64 segno)
+{
+	DECLARE_SERVER_INFO(sb, server);
+	struct segno_grant *sg;
+
+	spin_lock(&server->lock);
+	list_for_each_entry(sg, &server->segno_grants, head) {
+		if (sg->segno == segno) {
+			list_del_init(&sg->head);
+			kfree(sg);
+			break;
+		}
+	}
+	spin_unlock(&server->lock);
+}
+
+/*
+ * Nodes return unused granted segnos at unmount by freeing their
+ * extents, forget any grants that the freed extent covers.
+ */
+static void forget_segno_grants_in_extent(struct super_block *sb,
+					  u64 start, u64 len)
+{
+	DECLARE_SERVER_INFO(sb, server);
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct segno_grant *sg;
+	struct segno_grant *pos;
+	u64 blkno;
+
+	spin_lock(&server->lock);
+	list_for_each_entry_safe(sg, pos, &server->segno_grants, head) {
+		blkno = sg->segno << sbi->segment_block_shift;
+		if (blkno >= start &&
+		    blkno + sbi->segment_blocks <= start + len) {
+			list_del_init(&sg->head);
+			kfree(sg);
+		}
+	}
+	spin_unlock(&server->lock);
+}
+
 /*
  * "allocating" a segno removes an unknown segment from the allocator
  * and returns it, "removing" a segno removes a specific segno from the
@@ -478,15 +780,16 @@ out:
  */
 static int remove_segno(struct super_block *sb, u64 segno)
 {
-	struct server_info *server = SCOUTFS_SB(sb)->server_info;
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct server_info *server = sbi->server_info;
 	struct scoutfs_extent ext;
 	int ret;
 
 	trace_scoutfs_remove_segno(sb, segno);
 
 	scoutfs_extent_init(&ext, SCOUTFS_FREE_EXTENT_BLKNO_TYPE, 0,
-			    segno << SCOUTFS_SEGMENT_BLOCK_SHIFT,
-			    SCOUTFS_SEGMENT_BLOCKS, 0, 0);
+			    segno << sbi->segment_block_shift,
+			    sbi->segment_blocks, 0, 0);
 
 	down_write(&server->alloc_rwsem);
 	ret = scoutfs_extent_remove(sb, server_extent_io, &ext, NULL);
@@ -579,6 +882,7 @@ static void scoutfs_server_commit_func(struct work_struct *work)
 	struct commit_waiter *cw;
 	struct commit_waiter *pos;
 	struct llist_node *node;
+	u64 nr = 0;
 	int ret;
 
 	trace_scoutfs_server_commit_work_enter(sb, 0, 0);
@@ -593,6 +897,7 @@ static void scoutfs_server_commit_func(struct work_struct *work)
 	}
 
 	if (!scoutfs_btree_has_dirty(sb)) {
+		scoutfs_inc_counter(sb, server_commit_empty);
 		ret = 0;
 		goto out;
 	}
@@ -616,6 +921,7 @@ static void scoutfs_server_commit_func(struct work_struct *work)
 	write_seqcount_end(&server->stable_seqcount);
 
 	scoutfs_advance_dirty_super(sb);
+	scoutfs_inc_counter(sb, server_commit_writes);
 	ret = 0;
 
 out:
@@ -625,7 +931,9 @@ out:
 	llist_for_each_entry_safe(cw, pos, node, node) {
 		cw->ret = ret;
 		complete(&cw->comp);
+		nr++;
 	}
+	scoutfs_add_counter(sb, server_commit_waiters, nr);
 
 	up_write(&server->commit_rwsem);
 	trace_scoutfs_server_commit_work_exit(sb, 0, ret);
@@ -651,6 +959,73 @@ void scoutfs_init_ment_from_net(struct scoutfs_manifest_entry *ment,
 	ment->last = net_ment->last;
 }
 
+/*
+ * Inode numbers are granted from per-directory regions so that one
+ * directory's inodes cluster in key space no matter which nodes create
+ * them.  A region is wholly reserved from next_ino when it's carved,
+ * so the region map only lives in server memory: a restarted server
+ * abandons partially used regions and carves fresh ones instead of
+ * ever re-granting numbers.  Regions the directory fills are replaced
+ * the same way.  The map is bounded by dropping the least recently
+ * used region, abandoning its remainder.
+ */
+#define INODE_REGION_SHIFT	20
+#define INODE_REGION_NR		(1ULL << INODE_REGION_SHIFT)
+#define INODE_REGION_MAX_CACHED	1024
+
+struct inode_region {
+	struct rb_node node;
+	struct list_head lru_head;
+	u64 dir_ino;
+	u64 next;
+	u64 last;
+};
+
+/* callers hold next_ino_lock */
+static struct inode_region *find_ino_region(struct server_info *server,
+					    u64 dir_ino)
+{
+	struct rb_node *node = server->ino_regions.rb_node;
+	struct inode_region *rgn;
+
+	while (node) {
+		rgn = container_of(node, struct inode_region, node);
+
+		if (dir_ino < rgn->dir_ino)
+			node = node->rb_left;
+		else if (dir_ino > rgn->dir_ino)
+			node = node->rb_right;
+		else
+			return rgn;
+	}
+
+	return NULL;
+}
+
+/* callers hold next_ino_lock */
+static void insert_ino_region(struct server_info *server,
+			      struct inode_region *ins)
+{
+	struct rb_node **node = &server->ino_regions.rb_node;
+	struct rb_node *parent = NULL;
+	struct inode_region *rgn;
+
+	while (*node) {
+		parent = *node;
+		rgn = container_of(*node, struct inode_region, node);
+
+		if (ins->dir_ino < rgn->dir_ino)
+			node = &(*node)->rb_left;
+		else
+			node = &(*node)->rb_right;
+	}
+
+	rb_link_node(&ins->node, parent, node);
+	rb_insert_color(&ins->node, &server->ino_regions);
+	list_add(&ins->lru_head, &server->ino_region_lru);
+	server->nr_ino_regions++;
+}
+
 static int server_alloc_inodes(struct super_block *sb,
 			       struct scoutfs_net_connection *conn,
 			       u8 cmd, u64 id, void *arg, u16 arg_len)
@@ -659,30 +1034,76 @@ static int server_alloc_inodes(struct super_block *sb,
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_super_block *super = &sbi->super;
 	struct scoutfs_net_inode_alloc ial = { 0, };
+	struct scoutfs_net_inode_alloc_args args;
+	struct inode_region *alloced;
+	struct inode_region *drop = NULL;
+	struct inode_region *rgn;
 	struct commit_waiter cw;
-	__le64 lecount;
-	u64 ino;
-	u64 nr;
+	u64 start;
+	u64 ino = ~0ULL;
+	u64 nr = 0;
 	int ret;
 
-	if (arg_len != sizeof(lecount)) {
+	if (arg_len != sizeof(args)) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	memcpy(&lecount, arg, arg_len);
+	memcpy(&args, arg, arg_len);
+
+	/* allocate outside the lock, freed if an existing region serves */
+	alloced = kzalloc(sizeof(struct inode_region), GFP_NOFS);
+	if (!alloced) {
+		ret = -ENOMEM;
+		goto out;
+	}
 
 	down_read(&server->commit_rwsem);
 
 	spin_lock(&sbi->next_ino_lock);
-	ino = le64_to_cpu(super->next_ino);
-	nr = min(le64_to_cpu(lecount), U64_MAX - ino);
-	le64_add_cpu(&super->next_ino, nr);
+
+	rgn = find_ino_region(server, le64_to_cpu(args.dir_ino));
+	if (!rgn || rgn->next > rgn->last) {
+		start = ALIGN(le64_to_cpu(super->next_ino), INODE_REGION_NR);
+		if (start <= U64_MAX - INODE_REGION_NR) {
+			super->next_ino = cpu_to_le64(start + INODE_REGION_NR);
+			if (!rgn) {
+				rgn = alloced;
+				alloced = NULL;
+				rgn->dir_ino = le64_to_cpu(args.dir_ino);
+				insert_ino_region(server, rgn);
+			}
+			rgn->next = start;
+			rgn->last = start + INODE_REGION_NR - 1;
+		} else {
+			/* out of inodes, nr == 0 tells the client */
+			rgn = NULL;
+		}
+	}
+
+	if (rgn) {
+		nr = min(le64_to_cpu(args.count), rgn->last - rgn->next + 1);
+		ino = rgn->next;
+		rgn->next += nr;
+		list_move(&rgn->lru_head, &server->ino_region_lru);
+	}
+
+	if (server->nr_ino_regions > INODE_REGION_MAX_CACHED) {
+		drop = list_last_entry(&server->ino_region_lru,
+				       struct inode_region, lru_head);
+		rb_erase(&drop->node, &server->ino_regions);
+		list_del(&drop->lru_head);
+		server->nr_ino_regions--;
+	}
+
 	spin_unlock(&sbi->next_ino_lock);
 
 	queue_commit_work(server, &cw);
 	up_read(&server->commit_rwsem);
 
+	kfree(drop);
+	kfree(alloced);
+
 	ial.ino = cpu_to_le64(ino);
 	ial.nr = cpu_to_le64(nr);
 
@@ -763,6 +1184,9 @@ static int server_free_extents(struct super_block *sb,
 				  le64_to_cpu(nexl->extents[i].len));
 		if (ret)
 			break;
+		forget_segno_grants_in_extent(sb,
+					le64_to_cpu(nexl->extents[i].start),
+					le64_to_cpu(nexl->extents[i].len));
 	}
 
 	if (i > 0)
@@ -814,6 +1238,92 @@ out:
 				    &lesegno, sizeof(lesegno));
 }
 
+/*
+ * Grant a node a batch of segnos to pool so that its steady state
+ * commits don't pay a round trip per segment.  The grants are tracked
+ * by node until the node records a segment in the manifest or frees the
+ * segment back to us.
+ *
+ * XXX like compaction segnos, tracked grants of a node that dies can't
+ * be returned to the allocator until we have recovery with fencing that
+ * ensures the node can't write to them anymore.
+ *
+ * We can return fewer segnos than were asked for, nr == 0 tells the
+ * node that we're out of space.
+ */
+static int server_alloc_segnos(struct super_block *sb,
+			       struct scoutfs_net_connection *conn,
+			       u8 cmd, u64 id, void *arg, u16 arg_len)
+{
+	DECLARE_SERVER_INFO(sb, server);
+	u64 node_id = scoutfs_net_conn_node_id(conn);
+	struct scoutfs_net_segnos *ns = NULL;
+	struct segno_grant *sg;
+	struct commit_waiter cw;
+	__le64 lecount;
+	u64 segno;
+	u64 count;
+	u64 nr = 0;
+	int ret = 0;
+
+	if (arg_len != sizeof(lecount)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	memcpy(&lecount, arg, arg_len);
+	count = clamp_t(u64, le64_to_cpu(lecount), 1,
+			SCOUTFS_NET_SEGNOS_MAX_NR);
+
+	ns = kmalloc(SCOUTFS_NET_SEGNOS_BYTES(count), GFP_NOFS);
+	if (!ns) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	down_read(&server->commit_rwsem);
+	down_write(&server->alloc_rwsem);
+
+	while (nr < count) {
+		sg = kmalloc(sizeof(struct segno_grant), GFP_NOFS);
+		if (!sg) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		ret = __alloc_segno(sb, &segno);
+		if (ret < 0) {
+			kfree(sg);
+			break;
+		}
+
+		sg->node_id = node_id;
+		sg->segno = segno;
+		spin_lock(&server->lock);
+		list_add_tail(&sg->head, &server->segno_grants);
+		spin_unlock(&server->lock);
+
+		ns->segnos[nr++] = cpu_to_le64(segno);
+	}
+
+	up_write(&server->alloc_rwsem);
+	if (nr > 0)
+		queue_commit_work(server, &cw);
+	up_read(&server->commit_rwsem);
+
+	/* a partial grant is a success, running dry is nr == 0 */
+	if (nr > 0)
+		ret = wait_for_commit(&cw);
+	else if (ret == -ENOSPC)
+		ret = 0;
+
+	ns->nr = cpu_to_le64(nr);
+out:
+	/* the response takes ownership of the segno array and frees it */
+	return scoutfs_net_response_own(sb, conn, cmd, id, ret, ns,
+					ns ? SCOUTFS_NET_SEGNOS_BYTES(nr) : 0);
+}
+
 static int server_record_segment(struct super_block *sb,
 				 struct scoutfs_net_connection *conn,
 				 u8 cmd, u64 id, void *arg, u16 arg_len)
@@ -854,8 +1364,10 @@ retry:
 
 	if (ret == 0) {
 		ret = wait_for_commit(&cw);
-		if (ret == 0)
+		if (ret == 0) {
+			forget_segno_grant(sb, le64_to_cpu(net_ment->segno));
 			try_queue_compact(server);
+		}
 	}
 
 out:
@@ -1225,6 +1737,32 @@ static void forget_client_compacts(struct super_block *sb,
 	}
 }
 
+/*
+ * When a client disconnects we forget the segnos that we granted it
+ * but that it never recorded or freed.
+ *
+ * XXX as with compaction segnos above, we can't return them to the
+ * allocator because the node could still be writing to them.  Until we
+ * have recovery procedures with fencing the grants of a dead node are
+ * leaked just like its other in-flight segment writes.
+ */
+static void forget_client_segno_grants(struct super_block *sb,
+				       struct server_client_info *sci)
+{
+	struct server_info *server = SCOUTFS_SB(sb)->server_info;
+	struct segno_grant *sg;
+	struct segno_grant *pos;
+
+	spin_lock(&server->lock);
+	list_for_each_entry_safe(sg, pos, &server->segno_grants, head) {
+		if (sg->node_id == sci->node_id) {
+			list_del_init(&sg->head);
+			kfree(sg);
+		}
+	}
+	spin_unlock(&server->lock);
+}
+
 static int segno_in_ents(__le64 segno, struct scoutfs_net_manifest_entry *ents,
 			 unsigned int nr)
 {
@@ -1283,18 +1821,23 @@ static int alloc_segnos(struct super_block *sb, __le64 * __packed segnos,
 		       unsigned int nr)
 
 {
+	struct server_info *server = SCOUTFS_SB(sb)->server_info;
 	u64 segno;
 	int ret = 0;
 	int i;
 
+	/* hold the alloc lock across the batch instead of per segno */
+	down_write(&server->alloc_rwsem);
 	for (i = 0; i < nr; i++) {
-		ret = alloc_segno(sb, &segno);
-		if (ret < 0) {
-			free_segnos(sb, segnos, i, NULL, 0, false);
+		ret = __alloc_segno(sb, &segno);
+		if (ret < 0)
 			break;
-		}
 		segnos[i] = cpu_to_le64(segno);
 	}
+	up_write(&server->alloc_rwsem);
+
+	if (ret < 0)
+		free_segnos(sb, segnos, i, NULL, 0, false);
 
 	return ret;
 }
@@ -1386,58 +1929,62 @@ static int remove_entry_segnos(struct super_block *sb,
 	return ret;
 }
 
-static int del_manifest_entries(struct super_block *sb,
-				struct scoutfs_net_manifest_entry *ents,
-				unsigned int nr, bool cleanup);
-
-static int add_manifest_entries(struct super_block *sb,
-				struct scoutfs_net_manifest_entry *ents,
-				unsigned int nr, bool cleanup)
+/*
+ * Build a native entry array from the populated head of a net entry
+ * array and apply it as one all or nothing manifest batch.  The batched
+ * calls unwind their partial progress themselves so a failure here
+ * leaves the manifest as it was.
+ */
+static int apply_manifest_entries(struct super_block *sb,
+				  struct scoutfs_net_manifest_entry *ents,
+				  unsigned int nr, bool cleanup, bool del)
 {
-	struct scoutfs_manifest_entry ment;
+	struct scoutfs_manifest_entry *ments;
+	unsigned int used = 0;
 	int ret = 0;
 	int i;
 
 	for (i = 0; i < nr; i++) {
 		if (ents[i].segno == 0)
 			break;
+		used++;
+	}
 
-		scoutfs_init_ment_from_net(&ment, &ents[i]);
-
-		ret = scoutfs_manifest_add(sb, &ment);
-		BUG_ON(ret < 0 && !cleanup);
-		if (ret < 0) {
-			del_manifest_entries(sb, ents, i, false);
-			break;
+	if (used) {
+		ments = kcalloc(used, sizeof(ments[0]), GFP_NOFS);
+		if (ments) {
+			for (i = 0; i < used; i++)
+				scoutfs_init_ment_from_net(&ments[i], &ents[i]);
+
+			if (del)
+				ret = scoutfs_manifest_del_batch(sb, ments,
+								 used);
+			else
+				ret = scoutfs_manifest_add_batch(sb, ments,
+								 used);
+			kfree(ments);
+		} else {
+			ret = -ENOMEM;
 		}
 	}
 
+	BUG_ON(ret < 0 && !cleanup);
+
 	return ret;
 }
 
-static int del_manifest_entries(struct super_block *sb,
+static int add_manifest_entries(struct super_block *sb,
 				struct scoutfs_net_manifest_entry *ents,
 				unsigned int nr, bool cleanup)
 {
-	struct scoutfs_manifest_entry ment;
-	int ret = 0;
-	int i;
-
-	for (i = 0; i < nr; i++) {
-		if (ents[i].segno == 0)
-			break;
-
-		scoutfs_init_ment_from_net(&ment, &ents[i]);
-
-		ret = scoutfs_manifest_del(sb, &ment);
-		BUG_ON(ret < 0 && !cleanup);
-		if (ret < 0) {
-			add_manifest_entries(sb, ents, i, false);
-			break;
-		}
-	}
+	return apply_manifest_entries(sb, ents, nr, cleanup, false);
+}
 
-	return ret;
+static int del_manifest_entries(struct super_block *sb,
+				struct scoutfs_net_manifest_entry *ents,
+				unsigned int nr, bool cleanup)
+{
+	return apply_manifest_entries(sb, ents, nr, cleanup, true);
 }
 
 /*
@@ -1707,6 +2254,7 @@ static scoutfs_net_request_t server_req_funcs[] = {
 	[SCOUTFS_NET_CMD_ALLOC_EXTENT]		= server_alloc_extent,
 	[SCOUTFS_NET_CMD_FREE_EXTENTS]		= server_free_extents,
 	[SCOUTFS_NET_CMD_ALLOC_SEGNO]		= server_alloc_segno,
+	[SCOUTFS_NET_CMD_ALLOC_SEGNOS]		= server_alloc_segnos,
 	[SCOUTFS_NET_CMD_RECORD_SEGMENT]	= server_record_segment,
 	[SCOUTFS_NET_CMD_ADVANCE_SEQ]		= server_advance_seq,
 	[SCOUTFS_NET_CMD_GET_LAST_SEQ]		= server_get_last_seq,
@@ -1750,6 +2298,7 @@ static void server_notify_down(struct super_block *sb,
 		spin_unlock(&server->lock);
 
 		forget_client_compacts(sb, sci);
+		forget_client_segno_grants(sb, sci);
 		try_queue_compact(server);
 	} else {
 		shutdown_server(server);
@@ -1775,6 +2324,8 @@ static void scoutfs_server_worker(struct work_struct *work)
 	struct scoutfs_lock *lock = NULL;
 	struct pending_seq *ps;
 	struct pending_seq *ps_tmp;
+	struct segno_grant *sg;
+	struct segno_grant *sg_tmp;
 	DECLARE_WAIT_QUEUE_HEAD(waitq);
 	struct sockaddr_in sin;
 	LIST_HEAD(conn_list);
@@ -1826,7 +2377,8 @@ static void scoutfs_server_worker(struct work_struct *work)
 
 	/* start up the server subsystems before accepting */
 	ret = scoutfs_btree_setup(sb) ?:
-	      scoutfs_manifest_setup(sb);
+	      scoutfs_manifest_setup(sb) ?:
+	      build_segno_bitmap(sb);
 	if (ret)
 		goto shutdown;
 
@@ -1857,11 +2409,19 @@ shutdown:
 	scoutfs_manifest_destroy(sb);
 	scoutfs_btree_destroy(sb);
 
+	/* drop the bitmap, it's rebuilt if we become the server again */
+	scoutfs_spbm_destroy(&server->segno_bitmap);
+	scoutfs_spbm_init(&server->segno_bitmap);
+
 	/* XXX these should be persistent and reclaimed during recovery */
 	list_for_each_entry_safe(ps, ps_tmp, &server->pending_seqs, head) {
 		list_del_init(&ps->head);
 		kfree(ps);
 	}
+	list_for_each_entry_safe(sg, sg_tmp, &server->segno_grants, head) {
+		list_del_init(&sg->head);
+		kfree(sg);
+	}
 
 	write_server_addr(sb, &zeros);
 
@@ -1898,10 +2458,15 @@ int scoutfs_server_setup(struct super_block *sb)
 	INIT_LIST_HEAD(&server->pending_seqs);
 	init_rwsem(&server->alloc_rwsem);
 	INIT_LIST_HEAD(&server->pending_frees);
+	scoutfs_spbm_init(&server->segno_bitmap);
 	INIT_LIST_HEAD(&server->clients);
-	server->compacts_per_client = 2;
+	/* clients process compactions concurrently in their worker pool */
+	server->compacts_per_client = 4;
 	INIT_LIST_HEAD(&server->compacts);
 	INIT_WORK(&server->compact_work, scoutfs_server_compact_worker);
+	INIT_LIST_HEAD(&server->segno_grants);
+	server->ino_regions = RB_ROOT;
+	INIT_LIST_HEAD(&server->ino_region_lru);
 
 	server->wq = alloc_workqueue("scoutfs_server",
 				     WQ_UNBOUND | WQ_NON_REENTRANT, 0);
@@ -1916,6 +2481,20 @@ int scoutfs_server_setup(struct super_block *sb)
 	return 0;
 }
 
+/* the server has shut down, no request processing uses the regions */
+static void free_ino_regions(struct server_info *server)
+{
+	struct inode_region *rgn;
+	struct inode_region *tmp;
+
+	list_for_each_entry_safe(rgn, tmp, &server->ino_region_lru, lru_head) {
+		list_del(&rgn->lru_head);
+		kfree(rgn);
+	}
+	server->ino_regions = RB_ROOT;
+	server->nr_ino_regions = 0;
+}
+
 void scoutfs_server_destroy(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
@@ -1932,6 +2511,8 @@ void scoutfs_server_destroy(struct super_block *sb)
 		trace_scoutfs_server_workqueue_destroy(sb, 0, 0);
 		destroy_workqueue(server->wq);
 
+		scoutfs_spbm_destroy(&server->segno_bitmap);
+		free_ino_regions(server);
 		kfree(server);
 		sbi->server_info = NULL;
 	}
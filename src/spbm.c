@@ -121,6 +121,50 @@ int scoutfs_spbm_test(struct scoutfs_spbm *spbm, u64 bit)
 	return 0;
 }
 
+/*
+ * Find the first set bit at or after the caller's starting bit.
+ * Returns 0 and sets the caller's bit or returns -ENOENT if no bits
+ * are set past the start.  Nodes with no bits set are freed as bits
+ * are cleared so the search visits very few nodes.
+ */
+int scoutfs_spbm_next_set(struct scoutfs_spbm *spbm, u64 from, u64 *bit)
+{
+	struct rb_node *node = spbm->root.rb_node;
+	struct spbm_node *found = NULL;
+	struct spbm_node *sn;
+	u64 index;
+	int nr;
+
+	calc_index_nr(&index, &nr, from);
+
+	/* find the first node at or after the starting index */
+	while (node) {
+		sn = container_of(node, struct spbm_node, node);
+
+		if (index <= sn->index) {
+			found = sn;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	while (found) {
+		nr = find_next_bit(found->bits, SPBM_BITS,
+				   found->index == index ? nr : 0);
+		if (nr < SPBM_BITS) {
+			*bit = (found->index << SPBM_SHIFT) + nr;
+			return 0;
+		}
+
+		node = rb_next(&found->node);
+		found = node ? container_of(node, struct spbm_node, node) :
+			NULL;
+	}
+
+	return -ENOENT;
+}
+
 static void free_node(struct scoutfs_spbm *spbm, struct spbm_node *sn)
 {
 	rb_erase(&sn->node, &spbm->root);
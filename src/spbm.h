@@ -11,5 +11,6 @@ void scoutfs_spbm_destroy(struct scoutfs_spbm *spbm);
 int scoutfs_spbm_set(struct scoutfs_spbm *spbm, u64 bit);
 int scoutfs_spbm_test(struct scoutfs_spbm *spbm, u64 bit);
 void scoutfs_spbm_clear(struct scoutfs_spbm *spbm, u64 bit);
+int scoutfs_spbm_next_set(struct scoutfs_spbm *spbm, u64 from, u64 *bit);
 
 #endif
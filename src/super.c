@@ -29,6 +29,9 @@
 #include "dir.h"
 #include "msg.h"
 #include "counters.h"
+#include "hist.h"
+#include "recorder.h"
+#include "bench.h"
 #include "triggers.h"
 #include "trans.h"
 #include "item.h"
@@ -48,10 +51,10 @@
 static struct dentry *scoutfs_debugfs_root;
 
 /*
- * Ask the server for the current statfs fields.  The message is very
- * cheap so we're not worrying about spinning in statfs flooding the
- * server with requests.  We can add a cache and stale results if that
- * becomes a problem.
+ * Ask the client for the current statfs fields.  It caches results
+ * from the server and bounds their age with the statfs_age_ms mount
+ * option so monitoring that spins in statfs doesn't flood the server
+ * with requests.
  *
  * We fake the number of free inodes value by assuming that we can fill
  * free blocks with a certain number of inodes.  We then the number of
@@ -121,6 +124,10 @@ static void scoutfs_put_super(struct super_block *sb)
 
 	sbi->shutdown = true;
 
+	/* stop orphan workers while the locks and transactions they use live */
+	scoutfs_inode_stop_orphan_scan(sb);
+
+	scoutfs_bench_destroy(sb);
 	scoutfs_data_destroy(sb);
 
 	scoutfs_unlock(sb, sbi->node_id_lock, DLM_LOCK_EX);
@@ -129,18 +136,22 @@ static void scoutfs_put_super(struct super_block *sb)
 	scoutfs_shutdown_trans(sb);
 	scoutfs_client_destroy(sb);
 	scoutfs_inode_destroy(sb);
+	scoutfs_dir_destroy(sb);
 
 	/* the server locks the listen address and compacts */
 	scoutfs_lock_shutdown(sb);
 	scoutfs_server_destroy(sb);
 	scoutfs_net_destroy(sb);
 	scoutfs_seg_destroy(sb);
+	scoutfs_compact_destroy(sb);
 	scoutfs_lock_destroy(sb);
 
 	scoutfs_item_destroy(sb);
 	scoutfs_destroy_triggers(sb);
 	scoutfs_options_destroy(sb);
+	scoutfs_recorder_destroy(sb);
 	debugfs_remove(sbi->debug_root);
+	scoutfs_destroy_hists(sb);
 	scoutfs_destroy_counters(sb);
 	scoutfs_destroy_sysfs(sb);
 	kfree(sbi);
@@ -209,9 +220,11 @@ int scoutfs_write_dirty_super(struct super_block *sb)
 int scoutfs_read_super(struct super_block *sb,
 		       struct scoutfs_super_block *super_res)
 {
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_super_block *super;
 	struct page *page;
 	__le32 calc;
+	u64 shift;
 	int ret;
 
 	page = alloc_page(GFP_KERNEL);
@@ -256,6 +269,29 @@ int scoutfs_read_super(struct super_block *sb,
 		goto out;
 	}
 
+	shift = le64_to_cpu(super->segment_shift);
+	if (shift < SCOUTFS_SEGMENT_SHIFT_MIN ||
+	    shift > SCOUTFS_SEGMENT_SHIFT_MAX ||
+	    ((1ULL << shift) % PAGE_SIZE)) {
+		scoutfs_err(sb, "super block has invalid segment shift %llu, supported range is %u through %u",
+			    shift, SCOUTFS_SEGMENT_SHIFT_MIN,
+			    SCOUTFS_SEGMENT_SHIFT_MAX);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/*
+	 * Every reader of the super derives the same geometry so it's
+	 * safe to (re)assign the cached values each time it's read.
+	 */
+	sbi->segment_shift = shift;
+	sbi->segment_size = 1 << shift;
+	sbi->segment_pages = sbi->segment_size / PAGE_SIZE;
+	sbi->segment_blocks = sbi->segment_size / SCOUTFS_BLOCK_SIZE;
+	sbi->segment_block_shift = shift - SCOUTFS_BLOCK_SHIFT;
+	sbi->seg_chunk_shift = shift - SCOUTFS_SEG_NR_CHUNKS_SHIFT;
+	sbi->seg_chunk_size = 1 << sbi->seg_chunk_shift;
+
 	*super_res = *super;
 	ret = 0;
 out:
@@ -319,19 +355,31 @@ static int scoutfs_fill_super(struct super_block *sb, void *data, int silent)
 
 	ret = scoutfs_setup_sysfs(sb) ?:
 	      scoutfs_setup_counters(sb) ?:
+	      scoutfs_setup_hists(sb) ?:
 	      scoutfs_read_super(sb, &SCOUTFS_SB(sb)->super) ?:
 	      scoutfs_debugfs_setup(sb) ?:
+	      scoutfs_recorder_setup(sb) ?:
 	      scoutfs_options_setup(sb) ?:
 	      scoutfs_setup_triggers(sb) ?:
 	      scoutfs_seg_setup(sb) ?:
+	      scoutfs_compact_setup(sb) ?:
 	      scoutfs_item_setup(sb) ?:
 	      scoutfs_inode_setup(sb) ?:
+	      scoutfs_dir_setup(sb) ?:
 	      scoutfs_data_setup(sb) ?:
+	      scoutfs_bench_setup(sb) ?:
 	      scoutfs_setup_trans(sb) ?:
-	      scoutfs_lock_setup(sb) ?:
 	      scoutfs_net_setup(sb) ?:
-	      scoutfs_server_setup(sb) ?:
+	      /*
+	       * The client starts connecting asynchronously the moment
+	       * it's set up so its greeting exchange overlaps the slow
+	       * lockspace join instead of waiting behind it.  The
+	       * server has to follow the lockspace because its work
+	       * acquires the global server lock as it starts up.
+	       */
 	      scoutfs_client_setup(sb) ?:
+	      scoutfs_lock_setup(sb) ?:
+	      scoutfs_server_setup(sb) ?:
 	      scoutfs_client_wait_node_id(sb) ?:
 	      scoutfs_lock_node_id(sb, DLM_LOCK_EX, 0, sbi->node_id,
 				   &sbi->node_id_lock);
@@ -355,7 +403,7 @@ static int scoutfs_fill_super(struct super_block *sb, void *data, int silent)
 		goto out;
 
 	scoutfs_trans_restart_sync_deadline(sb);
-//	scoutfs_scan_orphans(sb);
+	scoutfs_inode_start_orphan_scan(sb);
 	ret = 0;
 out:
 	/* on error, generic_shutdown_super calls put_super if s_root */
@@ -394,6 +442,7 @@ MODULE_ALIAS_FS("scoutfs");
 static void teardown_module(void)
 {
 	debugfs_remove(scoutfs_debugfs_root);
+	scoutfs_item_exit();
 	scoutfs_dir_exit();
 	scoutfs_inode_exit();
 	scoutfs_sysfs_exit();
@@ -413,6 +462,7 @@ static int __init scoutfs_module_init(void)
 		".previous\n");
 
 	scoutfs_init_counters();
+	scoutfs_init_hists();
 
 	ret = scoutfs_sysfs_init();
 	if (ret)
@@ -425,6 +475,7 @@ static int __init scoutfs_module_init(void)
 	}
 	ret = scoutfs_inode_init() ?:
 	      scoutfs_dir_init() ?:
+	      scoutfs_item_init() ?:
 	      register_filesystem(&scoutfs_fs_type);
 out:
 	if (ret)
@@ -8,6 +8,8 @@
 #include "options.h"
 
 struct scoutfs_counters;
+struct scoutfs_hists;
+struct scoutfs_recorder;
 struct scoutfs_triggers;
 struct item_cache;
 struct manifest;
@@ -23,6 +25,7 @@ struct btree_info;
 struct sysfs_info;
 struct options_sb_info;
 struct net_info;
+struct bench_info;
 
 struct scoutfs_sb_info {
 	struct super_block *sb;
@@ -31,6 +34,15 @@ struct scoutfs_sb_info {
 	u64 node_id;
 	struct scoutfs_lock *node_id_lock;
 
+	/* segment geometry derived from the super's shift, read-only */
+	u32 segment_shift;
+	u32 segment_size;
+	u32 segment_pages;
+	u32 segment_blocks;
+	u32 segment_block_shift;
+	u32 seg_chunk_shift;
+	u32 seg_chunk_size;
+
 	struct scoutfs_super_block super;
 
 	spinlock_t next_ino_lock;
@@ -42,6 +54,7 @@ struct scoutfs_sb_info {
 	struct compact_info *compact_info;
 	struct data_info *data_info;
 	struct inode_sb_info *inode_sb_info;
+	struct dir_info *dir_info;
 	struct btree_info *btree_info;
 	struct net_info *net_info;
 
@@ -50,6 +63,7 @@ struct scoutfs_sb_info {
 
 	spinlock_t trans_write_lock;
 	u64 trans_write_count;
+	u64 trans_committed_seq;
 	u64 trans_seq;
 	int trans_write_ret;
 	struct delayed_work trans_write_work;
@@ -64,12 +78,15 @@ struct scoutfs_sb_info {
 	struct sysfs_info *sfsinfo;
 
 	struct scoutfs_counters *counters;
+	struct scoutfs_hists *hists;
 	struct scoutfs_triggers *triggers;
 
 	struct mount_options opts;
 	struct options_sb_info *options;
 
 	struct dentry *debug_root;
+	struct scoutfs_recorder *recorder;
+	struct bench_info *bench_info;
 
 	bool shutdown;
 
@@ -16,6 +16,7 @@
 
 #include "super.h"
 #include "sysfs.h"
+#include "lock.h"
 
 static struct kset *scoutfs_kset;
 
@@ -47,6 +48,26 @@ static ssize_t fsid_show(struct kobject *kobj, struct attribute *attr,
 }
 ATTR_FUNCS_RO(fsid);
 
+static ssize_t lock_cached_hits_show(struct kobject *kobj,
+				     struct attribute *attr, char *buf)
+{
+	struct super_block *sb = KOBJ_TO_SB(kobj, sb_id_kobj);
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n",
+			scoutfs_lock_cached_hits(sb));
+}
+ATTR_FUNCS_RO(lock_cached_hits);
+
+static ssize_t lock_remote_invalidations_show(struct kobject *kobj,
+					      struct attribute *attr, char *buf)
+{
+	struct super_block *sb = KOBJ_TO_SB(kobj, sb_id_kobj);
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n",
+			scoutfs_lock_remote_invalidations(sb));
+}
+ATTR_FUNCS_RO(lock_remote_invalidations);
+
 /*
  * ops are defined per type, not per attribute.  To have attributes with
  * different types that want different funcs we wrap them with a struct
@@ -82,6 +103,8 @@ static ssize_t attr_funcs_show(struct kobject *kobj, struct attribute *attr,
 
 static struct attribute *sb_id_attrs[] = {
 	&fsid_attr_funcs.attr,
+	&lock_cached_hits_attr_funcs.attr,
+	&lock_remote_invalidations_attr_funcs.attr,
 	NULL,
 };
 KTYPE(sb_id);
@@ -17,6 +17,8 @@
 #include <linux/atomic.h>
 #include <linux/writeback.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/math64.h>
 
 #include "super.h"
 #include "trans.h"
@@ -26,6 +28,8 @@
 #include "manifest.h"
 #include "seg.h"
 #include "counters.h"
+#include "hist.h"
+#include "recorder.h"
 #include "client.h"
 #include "inode.h"
 #include "scoutfs_trace.h"
@@ -51,33 +55,151 @@
  * very long time.
  */
 
-/* sync dirty data at least this often */
+/* sync dirty data at least this often by default */
 #define TRANS_SYNC_DELAY (HZ * 10)
+/* the feedback controller never stretches the sync deadline past this */
+#define TRANS_SYNC_DELAY_MAX (HZ * 60)
 
 /*
+ * Each cpu takes reservation budget from the shared pool in chunks so
+ * that the hold fast path doesn't bounce a shared cache line.  The
+ * chunks are sized to cover a handful of typical operations.
+ */
+#define TRANS_STOCK_ITEMS	64
+#define TRANS_STOCK_VALS	8192
+
+/* the soft budget never shrinks below a stock chunk or grows past this */
+#define TRANS_BUDGET_MAX	(INT_MAX / 2)
+
+struct trans_stock {
+	unsigned items;
+	unsigned vals;
+};
+
+/*
+ * Holders and the reservation budget are the hottest shared state in
+ * the fs so they're tracked per-cpu.  The per-cpu holder counts only
+ * have a meaningful total; a task can hold on one cpu and release on
+ * another so an individual cpu's count can go negative.  The writing
+ * flag gates new holds while the write func sums the counts waiting
+ * for them to drain.  The shared reserved_ counts include the budget
+ * sitting in each cpu's stock so the fits check at refill time is
+ * always conservative.
+ *
  * XXX move the rest of the super trans_ fields here.
  */
 struct trans_info {
 	spinlock_t lock;
 	unsigned reserved_items;
 	unsigned reserved_vals;
-	unsigned holders;
+	int __percpu *holders;
+	struct trans_stock __percpu *stock;
 	bool writing;
+	wait_queue_head_t drain_wq;
+	/*
+	 * The soft budget caps a commit's reservations below the hard
+	 * single segment limit and the sync deadline bounds how long an
+	 * underfull commit can accumulate.  A feedback controller in
+	 * the write func adapts both from measured commit latency and
+	 * segment fill, under lock.
+	 */
+	unsigned budget_items;
+	unsigned budget_vals;
+	unsigned long sync_delay;
+	/*
+	 * Commits are identified by an increasing seq so that sync
+	 * waiters can wait for the specific commit that covers their
+	 * dirty items.  commit_seq identifies the commit that holders
+	 * are currently dirtying into.  It's advanced by the write
+	 * func once it has snapshotted the dirty items into its
+	 * segment and lets new holders accumulate the next commit
+	 * while it writes.
+	 */
+	u64 commit_seq;
 };
 
 #define DECLARE_TRANS_INFO(sb, name) \
 	struct trans_info *name = SCOUTFS_SB(sb)->trans_info
 
+/*
+ * Stop new holds and test if existing holds have drained.  Setting the
+ * writing flag before summing pairs with the barrier between a
+ * holder's increment and its test of the flag: either we see their
+ * hold in the sum or they see the flag and back off.
+ */
 static bool drained_holders(struct trans_info *tri)
 {
-	bool drained;
+	long sum = 0;
+	int cpu;
 
-	spin_lock(&tri->lock);
 	tri->writing = true;
-	drained = tri->holders == 0;
-	spin_unlock(&tri->lock);
+	smp_mb();
+
+	for_each_possible_cpu(cpu)
+		sum += *per_cpu_ptr(tri->holders, cpu);
 
-	return drained;
+	return sum == 0;
+}
+
+/*
+ * Adapt the transaction size and sync deadline to the commit we just
+ * measured.
+ *
+ * The hard reservation limit is a full segment, but a full segment of
+ * dirty items and the file data that comes with them can take seconds
+ * to commit and fsyncers wait out the whole commit.  When a commit
+ * takes longer than the target latency we shrink the soft budget
+ * proportionally towards the reservations that built it; commits with
+ * plenty of headroom grow it back in small steps so we return to full
+ * level 0 segments whenever the device keeps up.  The reservation
+ * counts include budget stranded in cpu stocks so shrinking is a
+ * little conservative.
+ *
+ * The sync deadline bounds the other extreme.  When it expires before
+ * half a segment accumulates we're writing sparse level 0 segments
+ * that compaction has to clean up, so we stretch the deadline to let
+ * them fill.  Commits forced by size relax it back towards the
+ * default.
+ */
+static void adapt_trans_feedback(struct super_block *sb, unsigned used_items,
+				 unsigned used_vals, u32 seg_bytes,
+				 u64 dur_ns, bool expired)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	DECLARE_TRANS_INFO(sb, tri);
+	unsigned int target = sbi->opts.commit_latency_ms;
+	u64 dur_ms = div_u64(dur_ns, NSEC_PER_MSEC);
+
+	if (!target)
+		return;
+
+	spin_lock(&tri->lock);
+
+	if (dur_ms > target) {
+		tri->budget_items = max_t(u64, TRANS_STOCK_ITEMS,
+				div64_u64((u64)used_items * target, dur_ms));
+		tri->budget_vals = max_t(u64, TRANS_STOCK_VALS,
+				div64_u64((u64)used_vals * target, dur_ms));
+		scoutfs_inc_counter(sb, trans_budget_shrink);
+	} else if (dur_ms <= target / 2 &&
+		   tri->budget_items < TRANS_BUDGET_MAX) {
+		tri->budget_items += tri->budget_items / 8 + 1;
+		tri->budget_vals += tri->budget_vals / 8 + 1;
+		scoutfs_inc_counter(sb, trans_budget_grow);
+	}
+
+	if (expired && seg_bytes < sbi->segment_size / 2) {
+		tri->sync_delay = min_t(unsigned long,
+					tri->sync_delay + tri->sync_delay / 2,
+					TRANS_SYNC_DELAY_MAX);
+		scoutfs_inc_counter(sb, trans_sync_delay_grow);
+	} else if (!expired && tri->sync_delay > TRANS_SYNC_DELAY) {
+		tri->sync_delay = max_t(unsigned long, TRANS_SYNC_DELAY,
+					tri->sync_delay - tri->sync_delay / 4);
+		scoutfs_inc_counter(sb, trans_sync_delay_shrink);
+	}
+
+	spin_unlock(&tri->lock);
 }
 
 /*
@@ -101,6 +223,13 @@ static bool drained_holders(struct trans_info *tri)
  * then we write all our dirty metadata blocks, and only when those succeed
  * do we write the new super that references all of these newly written blocks.
  *
+ * Commits are pipelined.  We only exclude holders while we kick off
+ * data writeback and snapshot the dirty items into our segment.  Once
+ * the item cache is clean we advance the commit seq and let holders
+ * start dirtying the next commit while we wait on the IO and record
+ * the segment with the server.  The single threaded workqueue ensures
+ * that commits themselves are still written one at a time in order.
+ *
  * If there are write errors then blocks are kept dirty in memory and will
  * be written again at the next sync.
  */
@@ -112,35 +241,124 @@ void scoutfs_trans_write_func(struct work_struct *work)
 	DECLARE_TRANS_INFO(sb, tri);
 	struct scoutfs_bio_completion comp;
 	struct scoutfs_segment *seg = NULL;
+	struct scoutfs_client_async_segno aseg;
+	struct scoutfs_client_async_seq aseq;
+	struct trans_stock *stock;
+	bool expired = sbi->trans_deadline_expired;
+	bool advance;
+	unsigned used_items;
+	unsigned used_vals;
+	ktime_t start;
+	u64 commit_seq;
+	u64 next_seq;
+	u64 dur_ns;
 	u64 segno;
+	int cpu;
+	int err;
 	int ret = 0;
 
 	scoutfs_bio_init_comp(&comp);
 	sbi->trans_task = current;
 
-	wait_event(sbi->trans_hold_wq, drained_holders(tri));
+	wait_event(tri->drain_wq, drained_holders(tri));
+
+	/*
+	 * With the holders drained all the reservations have been
+	 * returned and the shared pool only counts the budget stranded
+	 * in per-cpu stocks.  Reclaim it so the next commit starts with
+	 * the full segment.
+	 */
+	for_each_possible_cpu(cpu) {
+		stock = per_cpu_ptr(tri->stock, cpu);
+		stock->items = 0;
+		stock->vals = 0;
+	}
+	spin_lock(&tri->lock);
+	used_items = tri->reserved_items;
+	used_vals = tri->reserved_vals;
+	tri->reserved_items = 0;
+	tri->reserved_vals = 0;
+	spin_unlock(&tri->lock);
 
 	trace_scoutfs_trans_write_func(sb, scoutfs_item_has_dirty(sb));
 
+	start = ktime_get();
+
+	/*
+	 * We advance the seq when we're writing a commit, and otherwise
+	 * only at the sync deadline interval.  That keeps idle mounts
+	 * from pinning a seq and stopping readers of the seq indices
+	 * without sending a message for every sync syscall.  The round
+	 * trip overlaps with kicking off data writeback and
+	 * snapshotting the dirty items, but the advanced seq has to be
+	 * published before the next commit's holders are released so
+	 * they can never stamp seq index items with a seq that the
+	 * server has already been told is complete.
+	 */
+	advance = scoutfs_item_has_dirty(sb) || expired;
+	if (advance)
+		scoutfs_client_submit_advance_seq(sb, sbi->trans_seq, &aseq);
 
 	if (scoutfs_item_has_dirty(sb)) {
-		if (sbi->trans_deadline_expired)
+		if (expired)
 			scoutfs_inc_counter(sb, trans_commit_timer);
 		/*
 		 * XXX only straight pass through, we're not worrying
 		 * about leaking segnos nor duplicate manifest entries
 		 * on crashes between us and the server.
+		 *
+		 * The segno allocation round trip overlaps with kicking
+		 * off data writeback.  We always wait for the response
+		 * before the async struct leaves scope.
 		 */
-		ret = scoutfs_inode_walk_writeback(sb, true) ?:
-		      scoutfs_client_alloc_segno(sb, &segno) ?:
-		      scoutfs_seg_alloc(sb, segno, &seg) ?:
-		      scoutfs_item_dirty_seg(sb, seg) ?:
-		      scoutfs_seg_submit_write(sb, seg, &comp) ?:
+		scoutfs_client_submit_alloc_segno(sb, &aseg);
+		ret = scoutfs_inode_walk_writeback(sb, true);
+		err = scoutfs_client_alloc_segno_wait(sb, &aseg, &segno);
+		if (ret == 0)
+			ret = err;
+		if (ret == 0)
+			ret = scoutfs_seg_alloc(sb, segno, &seg) ?:
+			      scoutfs_item_dirty_seg(sb, seg);
+	}
+
+	if (advance) {
+		next_seq = sbi->trans_seq;
+		err = scoutfs_client_advance_seq_wait(sb, &aseq, &next_seq);
+		if (ret == 0)
+			ret = err;
+		if (err)
+			advance = false;
+	}
+
+	/*
+	 * The dirty items, if any, are snapshotted into our segment and
+	 * the item cache is clean.  Let holders accumulate the next
+	 * commit while we write this one out.  The advanced seq is
+	 * stored before the gate opens, with the wmb pairing with the
+	 * rmb in scoutfs_trans_sample_seq, so released holders sample
+	 * the seq they'll commit under.
+	 */
+	spin_lock(&tri->lock);
+	commit_seq = tri->commit_seq;
+	if (ret == 0)
+		tri->commit_seq++;
+	if (advance) {
+		sbi->trans_seq = next_seq;
+		smp_wmb();
+	}
+	tri->writing = false;
+	spin_unlock(&tri->lock);
+	sbi->trans_task = NULL;
+	wake_up(&sbi->trans_hold_wq);
+
+	if (ret)
+		goto out;
+
+	if (seg) {
+		ret = scoutfs_seg_submit_write(sb, seg, &comp) ?:
 		      scoutfs_inode_walk_writeback(sb, false) ?:
 		      scoutfs_bio_wait_comp(sb, &comp) ?:
-		      scoutfs_client_record_segment(sb, seg, 0) ?:
-		      scoutfs_client_advance_seq(sb, &sbi->trans_seq);
-		scoutfs_seg_put(seg);
+		      scoutfs_client_record_segment(sb, seg, 0);
 		if (ret)
 			goto out;
 
@@ -148,51 +366,56 @@ void scoutfs_trans_write_func(struct work_struct *work)
 		scoutfs_add_counter(sb, trans_level0_seg_write_bytes,
 				    scoutfs_seg_total_bytes(seg));
 
-	} else if (sbi->trans_deadline_expired) {
-		/*
-		 * If we're not writing data then we only advance the
-		 * seq at the sync deadline interval.  This keeps idle
-		 * mounts from pinning a seq and stopping readers of the
-		 * seq indices but doesn't send a message for every sync
-		 * syscall.
-		 */
-		ret = scoutfs_client_advance_seq(sb, &sbi->trans_seq);
+		dur_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		scoutfs_hist_record(&sbi->hists->trans_commit, dur_ns);
+		adapt_trans_feedback(sb, used_items, used_vals,
+				     scoutfs_seg_total_bytes(seg), dur_ns,
+				     expired);
 	}
 
 out:
 	/* XXX this all needs serious work for dealing with errors */
 	WARN_ON_ONCE(ret);
 
+	scoutfs_seg_put(seg);
+
+	scoutfs_rec(sb, SCOUTFS_REC_TRANS_COMMIT, commit_seq, ret);
+
 	spin_lock(&sbi->trans_write_lock);
 	sbi->trans_write_count++;
 	sbi->trans_write_ret = ret;
+	if (ret == 0)
+		sbi->trans_committed_seq = commit_seq;
 	spin_unlock(&sbi->trans_write_lock);
 	wake_up(&sbi->trans_write_wq);
 
-	spin_lock(&tri->lock);
-	tri->writing = false;
-	spin_unlock(&tri->lock);
-
-	wake_up(&sbi->trans_hold_wq);
-
-	sbi->trans_task = NULL;
-
 	scoutfs_trans_restart_sync_deadline(sb);
 }
 
 struct write_attempt {
+	u64 seq;
 	u64 count;
 	int ret;
 };
 
-/* this is called as a wait_event() condition so it can't change task state */
+/*
+ * A waiter is finished once the commit that covers their dirty items
+ * has been written, or once any write attempt after theirs fails.
+ * Commits pipeline behind the one being written so a successful
+ * attempt can complete without covering a waiter's later commit.
+ *
+ * this is called as a wait_event() condition so it can't change task state
+ */
 static int write_attempted(struct scoutfs_sb_info *sbi,
 			   struct write_attempt *attempt)
 {
 	int done = 1;
 
 	spin_lock(&sbi->trans_write_lock);
-	if (sbi->trans_write_count > attempt->count)
+	if (sbi->trans_committed_seq >= attempt->seq)
+		attempt->ret = 0;
+	else if (sbi->trans_write_count > attempt->count &&
+		 sbi->trans_write_ret < 0)
 		attempt->ret = sbi->trans_write_ret;
 	else
 		done = 0;
@@ -213,16 +436,16 @@ static void queue_trans_work(struct scoutfs_sb_info *sbi)
 }
 
 /*
- * Wait for a trans commit to finish and return its error code.  There
- * can already be one in flight that we end up waiting for the
- * completion of.  This is safe because dirtying and trans commits are
- * serialized.  There's no way that there could have been dirty data
- * before the caller got here that wouldn't be covered by a commit
- * that's in flight. 
+ * Wait for a trans commit to finish and return its error code.  Any
+ * items the caller dirtied were dirtied into the commit seq we sample
+ * here at the latest, so waiting for that commit to be written covers
+ * them.  Waiters naturally group onto their covering commit: everyone
+ * who dirtied into a given commit waits for its one write.
  */
 int scoutfs_trans_sync(struct super_block *sb, int wait)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	DECLARE_TRANS_INFO(sb, tri);
 	struct write_attempt attempt;
 	int ret;
 
@@ -232,6 +455,10 @@ int scoutfs_trans_sync(struct super_block *sb, int wait)
 		return 0;
 	}
 
+	spin_lock(&tri->lock);
+	attempt.seq = tri->commit_seq;
+	spin_unlock(&tri->lock);
+
 	spin_lock(&sbi->trans_write_lock);
 	attempt.count = sbi->trans_write_count;
 	spin_unlock(&sbi->trans_write_lock);
@@ -258,10 +485,11 @@ int scoutfs_file_fsync(struct file *file, loff_t start, loff_t end,
 void scoutfs_trans_restart_sync_deadline(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	DECLARE_TRANS_INFO(sb, tri);
 
 	sbi->trans_deadline_expired = true;
 	mod_delayed_work(sbi->trans_write_workq, &sbi->trans_write_work,
-			 TRANS_SYNC_DELAY);
+			 ACCESS_ONCE(tri->sync_delay));
 }
 
 /*
@@ -280,11 +508,80 @@ struct scoutfs_reservation {
 	struct scoutfs_item_count actual;
 };
 
+/*
+ * Reserve budget for a hold's item count, preferring the local cpu's
+ * stock so the fast path doesn't touch shared cache lines.  When the
+ * stock runs dry we refill it in a chunk from the shared pool, where
+ * the precise fits check against the single segment lives.  As the
+ * segment fills we degrade to taking just the count so stragglers can
+ * still squeeze in before the commit is forced.
+ */
+static bool reserved_budget(struct super_block *sb, struct trans_info *tri,
+			    const struct scoutfs_item_count *cnt)
+{
+	struct trans_stock *stock;
+	bool refill = false;
+	bool ok = false;
+	unsigned items;
+	unsigned vals;
+
+	stock = get_cpu_ptr(tri->stock);
+	if (stock->items >= cnt->items && stock->vals >= cnt->vals) {
+		stock->items -= cnt->items;
+		stock->vals -= cnt->vals;
+		ok = true;
+	}
+	put_cpu_ptr(tri->stock);
+	if (ok)
+		return true;
+
+	spin_lock(&tri->lock);
+	/*
+	 * The soft budget forces the commit early when the device
+	 * can't write a full segment within the target latency.  It's
+	 * tested before adding our count so the first hold of an empty
+	 * commit always gets through no matter how far it has shrunk.
+	 */
+	if (tri->reserved_items >= tri->budget_items ||
+	    tri->reserved_vals >= tri->budget_vals) {
+		spin_unlock(&tri->lock);
+		scoutfs_inc_counter(sb, trans_commit_budget);
+		return false;
+	}
+	items = tri->reserved_items + cnt->items;
+	vals = tri->reserved_vals + cnt->vals;
+	if (scoutfs_item_dirty_fits_single(sb, items + TRANS_STOCK_ITEMS,
+					   vals + TRANS_STOCK_VALS)) {
+		tri->reserved_items = items + TRANS_STOCK_ITEMS;
+		tri->reserved_vals = vals + TRANS_STOCK_VALS;
+		refill = true;
+		ok = true;
+	} else if (scoutfs_item_dirty_fits_single(sb, items, vals)) {
+		tri->reserved_items = items;
+		tri->reserved_vals = vals;
+		ok = true;
+	}
+	spin_unlock(&tri->lock);
+
+	if (refill) {
+		stock = get_cpu_ptr(tri->stock);
+		stock->items += TRANS_STOCK_ITEMS;
+		stock->vals += TRANS_STOCK_VALS;
+		put_cpu_ptr(tri->stock);
+	}
+
+	return ok;
+}
+
 /*
  * Try to hold the transaction.  If a caller already holds the trans then
  * we piggy back on their hold.  We wait if the writer is trying to
  * write out the transation.  And if our items won't fit then we kick off
  * a write.
+ *
+ * The uncontended path only touches this cpu's holder count and stock.
+ * A hold that loses the race with a writer backs out and wakes the
+ * drain waitqueue in case the writer sampled its transient hold.
  */
 static bool acquired_hold(struct super_block *sb,
 			  struct scoutfs_reservation *rsv,
@@ -292,53 +589,46 @@ static bool acquired_hold(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	DECLARE_TRANS_INFO(sb, tri);
-	bool acquired = false;
-	unsigned items;
-	unsigned vals;
-	bool fits;
-
-	spin_lock(&tri->lock);
 
 	trace_scoutfs_trans_acquired_hold(sb, cnt, rsv, rsv->holders,
 					  &rsv->reserved, &rsv->actual,
-					  tri->holders, tri->writing,
-					  tri->reserved_items,
-					  tri->reserved_vals);
+					  this_cpu_read(*tri->holders),
+					  tri->writing,
+					  this_cpu_read(tri->stock->items),
+					  this_cpu_read(tri->stock->vals));
 
 	/* use a caller's existing reservation */
-	if (rsv->holders)
-		goto hold;
+	if (rsv->holders) {
+		rsv->holders++;
+		this_cpu_inc(*tri->holders);
+		return true;
+	}
+
+	this_cpu_inc(*tri->holders);
+	/* our hold has to be visible before we test the drain gate */
+	smp_mb();
 
 	/* wait until the writing thread is finished */
 	if (tri->writing)
-		goto out;
+		goto undo;
 
 	/* see if we can reserve space for our item count */
-	items = tri->reserved_items + cnt->items;
-	vals = tri->reserved_vals + cnt->vals;
-	fits = scoutfs_item_dirty_fits_single(sb, items, vals);
-	if (!fits) {
+	if (!reserved_budget(sb, tri, cnt)) {
 		scoutfs_inc_counter(sb, trans_commit_full);
 		queue_trans_work(sbi);
-		goto out;
+		goto undo;
 	}
 
-	tri->reserved_items = items;
-	tri->reserved_vals = vals;
-
 	rsv->reserved.items = cnt->items;
 	rsv->reserved.vals = cnt->vals;
-
-hold:
-	rsv->holders++;
-	tri->holders++;
-	acquired = true;
-
-out:
-
-	spin_unlock(&tri->lock);
-
-	return acquired;
+	rsv->holders = 1;
+	return true;
+
+undo:
+	this_cpu_dec(*tri->holders);
+	smp_mb();
+	wake_up(&tri->drain_wq);
+	return false;
 }
 
 int scoutfs_hold_trans(struct super_block *sb,
@@ -346,6 +636,7 @@ int scoutfs_hold_trans(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_reservation *rsv;
+	ktime_t start = ktime_get();
 	int ret;
 
 	/*
@@ -353,7 +644,7 @@ int scoutfs_hold_trans(struct super_block *sb,
 	 * can't fit in segments by themselves.
 	 */
 	if (WARN_ON_ONCE(cnt.items <= 0 || cnt.vals < 0) ||
-	    WARN_ON_ONCE(!scoutfs_seg_fits_single(cnt.items, cnt.vals)))
+	    WARN_ON_ONCE(!scoutfs_seg_fits_single(sb, cnt.items, cnt.vals)))
 		return -EINVAL;
 
 	if (current == sbi->trans_task)
@@ -377,6 +668,8 @@ int scoutfs_hold_trans(struct super_block *sb,
 		current->journal_info = NULL;
 		kfree(rsv);
 	}
+	if (ret == 0)
+		scoutfs_hist_record_since(sb, trans_hold, start);
 	return ret;
 }
 
@@ -392,6 +685,19 @@ bool scoutfs_trans_held(void)
 	return rsv && rsv->magic == SCOUTFS_RESERVATION_MAGIC;
 }
 
+/*
+ * Sample the seq of the transaction that the calling holder is
+ * dirtying into.  The write func only advances the seq while holders
+ * are drained and stores it before opening the gate that admits them;
+ * the rmb pairs with its wmb so a holder that got through the gate
+ * can't read a stale seq.
+ */
+u64 scoutfs_trans_sample_seq(struct super_block *sb)
+{
+	smp_rmb();
+	return SCOUTFS_SB(sb)->trans_seq;
+}
+
 /*
  * Record a transaction holder's individual contribution to the dirty
  * items in the current transaction.  We're making sure that the
@@ -424,6 +730,39 @@ void scoutfs_trans_track_item(struct super_block *sb, signed items,
 	WARN_ON_ONCE(rsv->actual.vals > rsv->reserved.vals);
 }
 
+/*
+ * Return a dropped reservation's budget to the local cpu's stock,
+ * capping the stock and giving the excess back to the shared pool so
+ * that budget doesn't accumulate on one cpu.
+ */
+static void released_budget(struct trans_info *tri,
+			    const struct scoutfs_item_count *res)
+{
+	struct trans_stock *stock;
+	unsigned items = 0;
+	unsigned vals = 0;
+
+	stock = get_cpu_ptr(tri->stock);
+	stock->items += res->items;
+	stock->vals += res->vals;
+	if (stock->items > 2 * TRANS_STOCK_ITEMS) {
+		items = stock->items - TRANS_STOCK_ITEMS;
+		stock->items = TRANS_STOCK_ITEMS;
+	}
+	if (stock->vals > 2 * TRANS_STOCK_VALS) {
+		vals = stock->vals - TRANS_STOCK_VALS;
+		stock->vals = TRANS_STOCK_VALS;
+	}
+	put_cpu_ptr(tri->stock);
+
+	if (items || vals) {
+		spin_lock(&tri->lock);
+		tri->reserved_items -= items;
+		tri->reserved_vals -= vals;
+		spin_unlock(&tri->lock);
+	}
+}
+
 /*
  * As we drop the last hold in the reservation we try and wake other
  * hold attempts that were waiting for space.  As we drop the last trans
@@ -443,28 +782,33 @@ void scoutfs_release_trans(struct super_block *sb)
 	rsv = current->journal_info;
 	BUG_ON(!rsv || rsv->magic != SCOUTFS_RESERVATION_MAGIC);
 
-	spin_lock(&tri->lock);
-
 	trace_scoutfs_release_trans(sb, rsv, rsv->holders, &rsv->reserved,
-				    &rsv->actual, tri->holders, tri->writing,
-				    tri->reserved_items, tri->reserved_vals);
+				    &rsv->actual, this_cpu_read(*tri->holders),
+				    tri->writing,
+				    this_cpu_read(tri->stock->items),
+				    this_cpu_read(tri->stock->vals));
 
 	BUG_ON(rsv->holders <= 0);
-	BUG_ON(tri->holders <= 0);
 
 	if (--rsv->holders == 0) {
-		tri->reserved_items -= rsv->reserved.items;
-		tri->reserved_vals -= rsv->reserved.vals;
+		released_budget(tri, &rsv->reserved);
 		current->journal_info = NULL;
 		kfree(rsv);
 		wake = true;
 	}
 
-	if (--tri->holders == 0)
-		wake = true;
-
-	spin_unlock(&tri->lock);
+	/*
+	 * The budget release has to be visible before our hold drops so
+	 * a writer that sees the drained count can safely reclaim the
+	 * stocks, and the drop has to be visible before we test for a
+	 * draining writer to wake.
+	 */
+	smp_mb();
+	this_cpu_dec(*tri->holders);
+	smp_mb();
 
+	if (tri->writing)
+		wake_up(&tri->drain_wq);
 	if (wake)
 		wake_up(&sbi->trans_hold_wq);
 }
@@ -479,10 +823,25 @@ int scoutfs_setup_trans(struct super_block *sb)
 		return -ENOMEM;
 
 	spin_lock_init(&tri->lock);
-
+	init_waitqueue_head(&tri->drain_wq);
+	/* start ahead of the initial committed seq of 0 */
+	tri->commit_seq = 1;
+	/* the budget starts unlimited and the controller shrinks it */
+	tri->budget_items = TRANS_BUDGET_MAX;
+	tri->budget_vals = TRANS_BUDGET_MAX;
+	tri->sync_delay = TRANS_SYNC_DELAY;
+
+	tri->holders = alloc_percpu(int);
+	tri->stock = alloc_percpu(struct trans_stock);
 	sbi->trans_write_workq = alloc_workqueue("scoutfs_trans",
 						 WQ_UNBOUND, 1);
-	if (!sbi->trans_write_workq) {
+	if (!tri->holders || !tri->stock || !sbi->trans_write_workq) {
+		if (sbi->trans_write_workq) {
+			destroy_workqueue(sbi->trans_write_workq);
+			sbi->trans_write_workq = NULL;
+		}
+		free_percpu(tri->stock);
+		free_percpu(tri->holders);
 		kfree(tri);
 		return -ENOMEM;
 	}
@@ -508,6 +867,8 @@ void scoutfs_shutdown_trans(struct super_block *sb)
 			/* trans work schedules after shutdown see null */
 			sbi->trans_write_workq = NULL;
 		}
+		free_percpu(tri->stock);
+		free_percpu(tri->holders);
 		kfree(tri);
 		sbi->trans_info = NULL;
 	}
@@ -17,6 +17,7 @@
 #include <linux/crc32c.h>
 
 #include "format.h"
+#include "counters.h"
 #include "inode.h"
 #include "key.h"
 #include "super.h"
@@ -40,6 +41,11 @@
  * items to make sure that we don't let readers race and see an
  * inconsistent mix of the items that make up xattrs.
  *
+ * A few small recently read xattrs are cached per inode so that
+ * scanners that read the same attributes from every file hit memory.
+ * Cached copies are only valid while the cluster lock that covered the
+ * read is still granted, like the inode fields themselves.
+ *
  * XXX
  *  - add acl support and call generic xattr->handlers for SYSTEM
  */
@@ -89,6 +95,206 @@ static int unknown_prefix(const char *name)
 	       strncmp(name, XATTR_SECURITY_PREFIX, XATTR_SECURITY_PREFIX_LEN);
 }
 
+/* small xattrs, like everyone's policy tags, are worth a copy per inode */
+#define XATTR_CACHE_MAX_BYTES 1024
+
+/*
+ * Try to satisfy getxattr from the inode's cache of recently read
+ * xattrs.  A hit returns what getxattr would: the value length, copying
+ * it when the caller's buffer is large enough, or -ERANGE when it
+ * isn't.  -ENOENT is returned on a miss, saying nothing about whether
+ * the xattr exists.
+ */
+static int cached_xattr_lookup(struct inode *inode, struct scoutfs_lock *lock,
+			       const char *name, unsigned int name_len,
+			       void *buffer, size_t size)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	struct scoutfs_xattr *xat;
+	int ret = -ENOENT;
+	int i;
+
+	spin_lock(&si->xattr_cache_lock);
+
+	if (si->xattr_cache_gen != lock->refresh_gen)
+		goto out;
+
+	for (i = 0; i < SCOUTFS_XATTR_CACHE_NR; i++) {
+		xat = si->xattr_cache[i];
+		if (!xat || !xattr_names_equal(name, name_len,
+					       xat->name, xat->name_len))
+			continue;
+
+		if (size == 0) {
+			ret = le16_to_cpu(xat->val_len);
+		} else if (size < le16_to_cpu(xat->val_len)) {
+			ret = -ERANGE;
+		} else {
+			ret = le16_to_cpu(xat->val_len);
+			memcpy(buffer, &xat->name[xat->name_len], ret);
+		}
+		break;
+	}
+out:
+	spin_unlock(&si->xattr_cache_lock);
+
+	if (ret >= 0)
+		scoutfs_inc_counter(inode->i_sb, xattr_cache_hit);
+	return ret;
+}
+
+/*
+ * Stash a copy of a fully read xattr in the inode's cache.  The caller
+ * still holds the covering lock whose refresh_gen validates the
+ * entries.  An entry with a matching name or an empty slot is replaced,
+ * otherwise slots are recycled in rotation.  Allocation failure just
+ * means we don't cache.
+ */
+static void cache_xattr(struct inode *inode, struct scoutfs_lock *lock,
+			struct scoutfs_xattr *xat)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	struct scoutfs_xattr *stale[SCOUTFS_XATTR_CACHE_NR] = {NULL,};
+	struct scoutfs_xattr *old;
+	struct scoutfs_xattr *dup;
+	unsigned int bytes = xattr_full_bytes(xat);
+	int slot = -1;
+	int i;
+
+	if (bytes > XATTR_CACHE_MAX_BYTES)
+		return;
+
+	dup = kmalloc(bytes, GFP_NOFS);
+	if (!dup)
+		return;
+	memcpy(dup, xat, bytes);
+
+	spin_lock(&si->xattr_cache_lock);
+
+	if (si->xattr_cache_gen != lock->refresh_gen) {
+		memcpy(stale, si->xattr_cache, sizeof(stale));
+		memset(si->xattr_cache, 0, sizeof(si->xattr_cache));
+		si->xattr_cache_next = 0;
+		si->xattr_cache_gen = lock->refresh_gen;
+	}
+
+	for (i = 0; i < SCOUTFS_XATTR_CACHE_NR; i++) {
+		old = si->xattr_cache[i];
+		if (!old) {
+			if (slot < 0)
+				slot = i;
+		} else if (xattr_names_equal(dup->name, dup->name_len,
+					     old->name, old->name_len)) {
+			slot = i;
+			break;
+		}
+	}
+	if (slot < 0)
+		slot = si->xattr_cache_next++ % SCOUTFS_XATTR_CACHE_NR;
+
+	old = si->xattr_cache[slot];
+	si->xattr_cache[slot] = dup;
+
+	spin_unlock(&si->xattr_cache_lock);
+
+	kfree(old);
+	for (i = 0; i < SCOUTFS_XATTR_CACHE_NR; i++)
+		kfree(stale[i]);
+}
+
+/*
+ * Drop all of an inode's cached xattrs, after local modification and as
+ * the inode is destroyed.
+ */
+void scoutfs_xattr_invalidate_cache(struct scoutfs_inode_info *si)
+{
+	struct scoutfs_xattr *stale[SCOUTFS_XATTR_CACHE_NR];
+	int i;
+
+	spin_lock(&si->xattr_cache_lock);
+	memcpy(stale, si->xattr_cache, sizeof(stale));
+	memset(si->xattr_cache, 0, sizeof(si->xattr_cache));
+	si->xattr_cache_gen = 0;
+	spin_unlock(&si->xattr_cache_lock);
+
+	for (i = 0; i < SCOUTFS_XATTR_CACHE_NR; i++)
+		kfree(stale[i]);
+}
+
+/*
+ * Copy the value bytes from the parts after the first of a found xattr
+ * into the caller's buffer.  The first part's header told us how many
+ * parts to expect so missing or misnumbered parts are corruption.
+ * Parts are copied with batched item copies so that a large value costs
+ * an item cache traversal per batch buffer instead of a locked search
+ * per part.  Returns the number of value bytes copied, which can be
+ * limited by the caller's buffer.
+ */
+static int copy_xattr_parts(struct super_block *sb, struct scoutfs_key *key,
+			    u8 last_part, void *dst, unsigned int bytes,
+			    struct scoutfs_lock *lock)
+{
+	struct scoutfs_item_batch_entry *ent;
+	struct scoutfs_key last;
+	struct scoutfs_key pos;
+	unsigned int batch_bytes;
+	unsigned int total = 0;
+	unsigned int cnt;
+	void *buf;
+	u8 part = 1;
+	int nr;
+	int i;
+	int ret;
+
+	last = *key;
+	last.skx_part = last_part;
+
+	batch_bytes = min_t(unsigned int, PAGE_SIZE, (unsigned int)last_part *
+			    scoutfs_item_batch_entry_bytes(
+					SCOUTFS_XATTR_MAX_PART_SIZE));
+	buf = kmalloc(batch_bytes, GFP_NOFS);
+	if (!buf)
+		return -ENOMEM;
+
+	while (part <= last_part && total < bytes) {
+		pos = *key;
+		pos.skx_part = part;
+
+		ret = scoutfs_item_next_batch(sb, &pos, &last, buf,
+					      batch_bytes, lock);
+		if (ret < 0) {
+			/* XXX corruption, ran out of parts */
+			if (ret == -ENOENT)
+				ret = -EIO;
+			goto out;
+		}
+
+		nr = ret;
+		ent = buf;
+		for (i = 0; i < nr && total < bytes; i++) {
+			pos = *key;
+			pos.skx_part = part;
+
+			/* XXX corruption, parts out of sequence */
+			if (scoutfs_key_compare(&ent->key, &pos) != 0) {
+				ret = -EIO;
+				goto out;
+			}
+
+			cnt = min_t(unsigned int, ent->val_len, bytes - total);
+			memcpy(dst + total, ent->val, cnt);
+			total += cnt;
+			part++;
+			ent = scoutfs_item_batch_entry_next(ent);
+		}
+	}
+
+	ret = total;
+out:
+	kfree(buf);
+	return ret;
+}
+
 /*
  * Find the next xattr and copy the key, xattr header, and as much of
  * the name and value into the callers buffer as we can.  Returns the
@@ -116,7 +322,6 @@ static int get_next_xattr(struct inode *inode, struct scoutfs_key *key,
 	struct kvec val;
 	u8 last_part;
 	int total;
-	u8 part;
 	int ret;
 
 	/* need to be able to see the name we're looking for */
@@ -131,24 +336,19 @@ static int get_next_xattr(struct inode *inode, struct scoutfs_key *key,
 	init_xattr_key(&last, scoutfs_ino(inode), U32_MAX, U64_MAX);
 
 	last_part = 0;
-	part = 0;
 	total = 0;
 
 	for (;;) {
-		key->skx_part = part;
-		kvec_init(&val, (void *)xat + total, bytes - total);
+		key->skx_part = 0;
+		kvec_init(&val, xat, bytes);
 		ret = scoutfs_item_next(sb, key, &last, &val, lock);
-		if (ret < 0) {
-			/* XXX corruption, ran out of parts */
-			if (ret == -ENOENT && part > 0)
-				ret = -EIO;
+		if (ret < 0)
 			break;
-		}
 
 		trace_scoutfs_xattr_get_next_key(sb, key);
 
-		/* XXX corruption */
-		if (key->skx_part != part) {
+		/* XXX corruption, xattrs always start with a first part */
+		if (key->skx_part != 0) {
 			ret = -EIO;
 			break;
 		}
@@ -158,18 +358,17 @@ static int get_next_xattr(struct inode *inode, struct scoutfs_key *key,
 		 * the first part and if the next xattr name fits in our
 		 * buffer then the item must have included it.
 		 */
-		if (part == 0 &&
-		    (ret < sizeof(struct scoutfs_xattr) ||
-		     (xat->name_len <= name_len &&
-		      ret < offsetof(struct scoutfs_xattr,
-				     name[xat->name_len])) ||
-		     xat->name_len > SCOUTFS_XATTR_MAX_NAME_LEN ||
-		     le16_to_cpu(xat->val_len) > SCOUTFS_XATTR_MAX_VAL_LEN)) {
+		if (ret < sizeof(struct scoutfs_xattr) ||
+		    (xat->name_len <= name_len &&
+		     ret < offsetof(struct scoutfs_xattr,
+				    name[xat->name_len])) ||
+		    xat->name_len > SCOUTFS_XATTR_MAX_NAME_LEN ||
+		    le16_to_cpu(xat->val_len) > SCOUTFS_XATTR_MAX_VAL_LEN) {
 			ret = -EIO;
 			break;
 		}
 
-		if (part == 0 && name_len) {
+		if (name_len) {
 			/* ran out of names that could match */
 			if (le64_to_cpu(key->skx_name_hash) != name_hash) {
 				ret = -ENOENT;
@@ -179,7 +378,6 @@ static int get_next_xattr(struct inode *inode, struct scoutfs_key *key,
 			/* keep looking for our name */
 			if (!xattr_names_equal(name, name_len,
 					       xat->name, xat->name_len)) {
-				part = 0;
 				le64_add_cpu(&key->skx_id, 1);
 				continue;
 			}
@@ -188,13 +386,21 @@ static int get_next_xattr(struct inode *inode, struct scoutfs_key *key,
 			last_part = xattr_nr_parts(xat) - 1;
 		}
 
-		total += ret;
-		if (total == bytes || part == last_part) {
-			/* copied as much as we could */
-			ret = total;
-			break;
+		total = ret;
+
+		/* batch the remaining parts into the rest of the buffer */
+		if (total < bytes && last_part > 0) {
+			ret = copy_xattr_parts(sb, key, last_part,
+					       (void *)xat + total,
+					       bytes - total, lock);
+			if (ret < 0)
+				break;
+			total += ret;
 		}
-		part++;
+
+		/* copied as much as we could */
+		ret = total;
+		break;
 	}
 
 	return ret;
@@ -295,11 +501,21 @@ ssize_t scoutfs_getxattr(struct dentry *dentry, const char *name, void *buffer,
 	if (ret)
 		goto out;
 
+	ret = cached_xattr_lookup(inode, lck, name, name_len, buffer, size);
+	if (ret != -ENOENT) {
+		scoutfs_unlock(sb, lck, DLM_LOCK_PR);
+		goto out;
+	}
+
 	down_read(&si->xattr_rwsem);
 
 	ret = get_next_xattr(inode, &key, xat, bytes,
 			     name, name_len, 0, 0, lck);
 
+	/* cache fully copied xattrs while we still hold the lock */
+	if (ret >= 0 && ret >= xattr_full_bytes(xat))
+		cache_xattr(inode, lck, xat);
+
 	up_read(&si->xattr_rwsem);
 	scoutfs_unlock(sb, lck, DLM_LOCK_PR);
 
@@ -462,6 +678,7 @@ retry:
 	ret = 0;
 
 release:
+	scoutfs_xattr_invalidate_cache(si);
 	scoutfs_release_trans(sb);
 	scoutfs_inode_index_unlock(sb, &ind_locks);
 unlock:
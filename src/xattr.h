@@ -1,6 +1,8 @@
 #ifndef _SCOUTFS_XATTR_H_
 #define _SCOUTFS_XATTR_H_
 
+struct scoutfs_inode_info;
+
 ssize_t scoutfs_getxattr(struct dentry *dentry, const char *name, void *buffer,
 			 size_t size);
 int scoutfs_setxattr(struct dentry *dentry, const char *name,
@@ -10,5 +12,6 @@ ssize_t scoutfs_listxattr(struct dentry *dentry, char *buffer, size_t size);
 
 int scoutfs_xattr_drop(struct super_block *sb, u64 ino,
 		       struct scoutfs_lock *lock);
+void scoutfs_xattr_invalidate_cache(struct scoutfs_inode_info *si);
 
 #endif